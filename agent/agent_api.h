@@ -0,0 +1,67 @@
+#ifndef NESEMU_AGENT_AGENT_API_H_
+#define NESEMU_AGENT_AGENT_API_H_
+
+/* C ABI of agent plugins
+  An agent is a shared library exporting NES_AGENT_ENTRY, a NesAgentGetApi
+  that returns its table of functions for the ABI version the host asks
+  for, or NULL if it does not speak it. The host (agent/agent_host.h) calls
+  act() once per decision point with the whole batch of consoles, never
+  per frame in between, per instruction or per memory access. Everything
+  passed in is owned by the host and only valid during the call.
+
+  Only C types cross the boundary, so agents can be built by any compiler
+  or language with a C FFI. Fields are only ever added at the end of a
+  struct, with the size of NesAgentApi telling the host which ones a
+  plugin was built with; anything else is a new ABI version.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_AGENT_ABI_VERSION 1
+#define NES_AGENT_ENTRY "nes_agent_get_api"
+
+/* What an agent is made for */
+typedef struct NesAgentInfo {
+  uint32_t abi_version;
+  int32_t count;             /* consoles in a batch */
+  int32_t output_mode;       /* OUTPUT_* of ppu/ppu.h */
+  int32_t width;             /* observation pixels */
+  int32_t height;
+  uint32_t observation_size; /* bytes per console, width * height */
+  uint32_t ram_size;         /* bytes of CPU RAM per console, 0x800 */
+  int32_t interval;          /* frames between decisions */
+  int32_t repeat;            /* frames an action is held, 1 - interval */
+} NesAgentInfo;
+
+/* The consoles at a decision point */
+typedef struct NesAgentBatch {
+  int32_t count;
+  uint64_t decision;           /* decisions taken before this one */
+  const uint8_t* observations; /* count * observation_size bytes */
+  const uint8_t* const* rams;  /* count pointers to ram_size bytes */
+  const float* rewards;        /* over the last interval */
+  const uint8_t* dones;        /* the episode ended and the console reset */
+} NesAgentBatch;
+
+typedef struct NesAgentApi {
+  uint32_t abi_version; /* NES_AGENT_ABI_VERSION */
+  uint32_t size;        /* sizeof(NesAgentApi) */
+  /* NULL on failure; args is the host's plugin argument string */
+  void* (*create)(const NesAgentInfo* info, const char* args);
+  void (*destroy)(void* agent);
+  /* Writes count pad 1 button masks (BUTTON_* of controller.h) into
+    actions. Nonzero ends the run. */
+  int (*act)(void* agent, const NesAgentBatch* batch, uint8_t* actions);
+} NesAgentApi;
+
+typedef const NesAgentApi* (*NesAgentGetApi)(uint32_t abi_version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NESEMU_AGENT_AGENT_API_H_ */
@@ -0,0 +1,68 @@
+#include "agent_host.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int CALLS = 10000000;
+static const int FRAMES = 1200;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return elapsed.count();
+}
+
+// ns per decision of the empty agent, host and call only
+static double run_calls(AgentHost& host) {
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < CALLS; i++) {
+    host.decide();
+  }
+  return seconds_since(start) * 1e9 / CALLS;
+}
+
+// us per frame of one console, stepped by hand or by the empty agent
+static double run_frames(const std::vector<uint8_t>& image, bool hosted) {
+  VecEnv env;
+  env.init(&image[0], image.size(), 1);
+  AgentHost host;
+  std::vector<uint8_t> observation(env.get_observation_size());
+  uint8_t action = 0, done;
+  float reward;
+  if (hosted && host.load("./empty_agent.so", &env)) {
+    return 0;
+  }
+  env.reset(&observation[0]);
+  Clock::time_point start = Clock::now();
+  if (hosted) {
+    host.run(FRAMES);
+  } else {
+    for (int frame = 0; frame < FRAMES; frame++) {
+      env.step(&action, &observation[0], &reward, &done);
+    }
+  }
+  return seconds_since(start) * 1e6 / FRAMES;
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  env.init(&image[0], image.size(), 1);
+  AgentHost host;
+  if (host.load("./empty_agent.so", &env)) {
+    printf("cannot load ./empty_agent.so\n");
+    return 1;
+  }
+  printf("empty agent, 1 console, a decision every frame\n");
+  printf("  host and call   %8.2f ns per decision\n", run_calls(host));
+  double plain = run_frames(image, false);
+  double hosted = run_frames(image, true);
+  printf("  stepped by hand %8.2f us per frame\n", plain);
+  printf("  stepped by host %8.2f us per frame\n", hosted);
+  return 0;
+}
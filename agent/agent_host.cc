@@ -0,0 +1,155 @@
+#include "agent_host.h"
+
+#include <cstring>
+#include <dlfcn.h>
+
+namespace nesemu {
+
+AgentHost::AgentHost() {
+  interval = 1;
+  repeat = 0;
+  library = NULL;
+  api = NULL;
+  agent = NULL;
+  env = NULL;
+  decisions = 0;
+  memset(&batch, 0, sizeof batch);
+}
+
+AgentHost::~AgentHost() {
+  unload();
+}
+
+int AgentHost::set_interval(int frames) {
+  if (frames < 1 || frames > VecEnv::MAX_REPEAT) {
+    return 1;
+  }
+  interval = frames;
+  return 0;
+}
+
+int AgentHost::get_interval() const {
+  return interval;
+}
+
+int AgentHost::set_repeat(int frames) {
+  if (frames < 0 || frames > VecEnv::MAX_REPEAT) {
+    return 1;
+  }
+  repeat = frames;
+  return 0;
+}
+
+int AgentHost::get_repeat() const {
+  return repeat;
+}
+
+int AgentHost::load(const std::string& path, VecEnv* env,
+                    const std::string& args) {
+  unload();
+  if (!env || env->get_count() < 1 || repeat > interval) {
+    return 1;
+  }
+  library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    return 1;
+  }
+  NesAgentGetApi get_api = reinterpret_cast<NesAgentGetApi>(
+      dlsym(library, NES_AGENT_ENTRY));
+  api = get_api ? get_api(NES_AGENT_ABI_VERSION) : NULL;
+  if (!api || api->abi_version != NES_AGENT_ABI_VERSION ||
+      api->size < sizeof(NesAgentApi) || !api->create || !api->destroy ||
+      !api->act) {
+    unload();
+    return 1;
+  }
+  int count = env->get_count();
+  NesAgentInfo info;
+  memset(&info, 0, sizeof info);
+  info.abi_version = NES_AGENT_ABI_VERSION;
+  info.count = count;
+  info.output_mode = env->get_output_mode();
+  info.width = env->get_output_width();
+  info.height = env->get_output_height();
+  info.observation_size = uint32_t(env->get_observation_size());
+  info.ram_size = 0x800;
+  info.interval = interval;
+  info.repeat = repeat ? repeat : interval;
+  agent = api->create(&info, args.c_str());
+  if (!agent) {
+    unload();
+    return 1;
+  }
+  this->env = env;
+  env->set_action_repeat(interval);
+  env->set_action_hold(repeat == interval ? 0 : repeat);
+  observations.assign(count * env->get_observation_size(), 0);
+  rams.resize(count);
+  for (int i = 0; i < count; i++) {
+    rams[i] = env->get_console(i).get_ram();
+  }
+  rewards.assign(count, 0.0f);
+  dones.assign(count, 0);
+  actions.assign(count, 0);
+  batch.count = count;
+  batch.decision = 0;
+  batch.observations = &observations[0];
+  batch.rams = &rams[0];
+  batch.rewards = &rewards[0];
+  batch.dones = &dones[0];
+  decisions = 0;
+  env->reset(&observations[0]);
+  return 0;
+}
+
+void AgentHost::unload() {
+  if (agent) {
+    api->destroy(agent);
+    agent = NULL;
+  }
+  api = NULL;
+  if (library) {
+    dlclose(library);
+    library = NULL;
+  }
+  env = NULL;
+}
+
+int AgentHost::run(uint64_t decisions) {
+  if (!agent) {
+    return 1;
+  }
+  for (uint64_t i = 0; i < decisions; i++) {
+    if (decide()) {
+      return 1;
+    }
+    env->step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+  }
+  return 0;
+}
+
+int AgentHost::decide() {
+  if (!agent) {
+    return 1;
+  }
+  batch.decision = decisions;
+  if (api->act(agent, &batch, &actions[0])) {
+    return 1;
+  }
+  decisions++;
+  return 0;
+}
+
+uint64_t AgentHost::get_decisions() const {
+  return decisions;
+}
+
+const uint8_t* AgentHost::get_observations() const {
+  return observations.empty() ? NULL : &observations[0];
+}
+
+const uint8_t* AgentHost::get_actions() const {
+  return actions.empty() ? NULL : &actions[0];
+}
+
+} // namespace nesemu
@@ -0,0 +1,80 @@
+#ifndef NESEMU_AGENT_AGENT_HOST_H_
+#define NESEMU_AGENT_AGENT_HOST_H_
+
+#include "agent_api.h"
+#include "env/vec_env.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nesemu {
+
+/* Runs an agent plugin on a VecEnv
+  The plugin (see agent_api.h) is loaded with dlopen and called once per
+  decision point with every console of the batch: pointers to their
+  observations and RAM, and the rewards and done flags since the last
+  decision. Its actions are held for repeat frames and released until the
+  next decision, interval frames on; the env runs the frames in between
+  without the agent and renders only the last.
+
+  The batch is set up once, when the plugin is loaded, and a decision only
+  fills in its number before calling act(), so an agent that does nothing
+  costs an indirect call per decision.
+*/
+class AgentHost {
+  public:
+    AgentHost();
+    ~AgentHost();
+
+    /* Decision points, set before load() */
+    // frames between decisions, 1 - VecEnv::MAX_REPEAT
+    int set_interval(int frames);
+    int get_interval() const;
+    // frames an action is held, 1 - interval, 0 for the whole interval
+    int set_repeat(int frames);
+    int get_repeat() const;
+
+    // Loads the plugin at path, makes its agent for env with args, and
+    // resets env. env must be initialized and outlive the agent. Returns 1
+    // when the plugin is missing, speaks another ABI version or fails to
+    // make its agent.
+    int load(const std::string& path, VecEnv* env,
+             const std::string& args = std::string());
+    void unload(); // destroys the agent and closes the plugin
+
+    // Takes decisions decisions, stepping the env after each. Returns 1
+    // when nothing is loaded or the agent ended the run.
+    int run(uint64_t decisions);
+    // Asks the agent once, without stepping, into get_actions(). Returns 1
+    // when the agent ends the run.
+    int decide();
+
+    uint64_t get_decisions() const;
+    const uint8_t* get_observations() const;
+    const uint8_t* get_actions() const;
+
+  private:
+    AgentHost(const AgentHost&);
+    AgentHost& operator=(const AgentHost&);
+
+    int interval;
+    int repeat;
+    void* library;
+    const NesAgentApi* api;
+    void* agent;
+    VecEnv* env;
+    uint64_t decisions;
+
+    /* The batch and the env's arrays it points to */
+    NesAgentBatch batch;
+    std::vector<uint8_t> observations;
+    std::vector<const uint8_t*> rams;
+    std::vector<float> rewards;
+    std::vector<uint8_t> dones;
+    std::vector<uint8_t> actions;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_AGENT_AGENT_HOST_H_
@@ -0,0 +1,80 @@
+#include "agent_host.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+namespace nesemu {
+
+static const char* TEST_AGENT = "./test_agent.so";
+
+TEST (AgentHostTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  AgentHost host;
+  EXPECT_EQ(host.load(TEST_AGENT, &env), 1); // not initialized
+  ASSERT_EQ(env.init(&image[0], image.size(), 2), 0);
+  EXPECT_EQ(host.set_interval(0), 1);
+  EXPECT_EQ(host.set_interval(VecEnv::MAX_REPEAT + 1), 1);
+  EXPECT_EQ(host.set_repeat(2), 0);
+  EXPECT_EQ(host.load(TEST_AGENT, &env), 1); // held past the interval
+  EXPECT_EQ(host.set_interval(2), 0);
+  EXPECT_EQ(host.load("./missing_agent.so", &env), 1);
+  EXPECT_EQ(host.load(TEST_AGENT, &env, "fail"), 1);
+  EXPECT_EQ(host.run(1), 1);
+  EXPECT_EQ(host.decide(), 1);
+  EXPECT_EQ(host.load(TEST_AGENT, &env), 0);
+  EXPECT_EQ(host.run(1), 0);
+}
+
+// the agent's actions play out as they would stepped by hand
+TEST (AgentHostTest, DecisionPoints) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 3;
+  VecEnv hosted, local;
+  ASSERT_EQ(hosted.init(&image[0], image.size(), count), 0);
+  ASSERT_EQ(local.init(&image[0], image.size(), count), 0);
+  AgentHost host;
+  ASSERT_EQ(host.set_interval(4), 0);
+  ASSERT_EQ(host.set_repeat(1), 0);
+  ASSERT_EQ(host.load(TEST_AGENT, &hosted), 0);
+  EXPECT_EQ(hosted.get_action_repeat(), 4);
+  EXPECT_EQ(hosted.get_action_hold(), 1);
+
+  size_t size = local.get_observation_size();
+  std::vector<uint8_t> observations(count * size), actions(count);
+  std::vector<uint8_t> dones(count);
+  std::vector<float> rewards(count);
+  local.set_action_repeat(4);
+  local.set_action_hold(1);
+  local.reset(&observations[0]);
+  EXPECT_TRUE(std::equal(observations.begin(), observations.end(),
+                         host.get_observations()));
+  for (int decision = 0; decision < 10; decision++) {
+    ASSERT_EQ(host.run(1), 0);
+    actions.assign(count, decision % 2 ? 0 : BUTTON_A);
+    EXPECT_TRUE(std::equal(actions.begin(), actions.end(),
+                           host.get_actions()));
+    local.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    ASSERT_TRUE(std::equal(observations.begin(), observations.end(),
+                           host.get_observations()))
+        << "decision " << decision;
+    EXPECT_EQ(hosted.get_console(0).get_frame_count(),
+              local.get_console(0).get_frame_count());
+  }
+  EXPECT_EQ(host.get_decisions(), 10u);
+}
+
+TEST (AgentHostTest, AgentEndsRun) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  ASSERT_EQ(env.init(&image[0], image.size(), 1), 0);
+  AgentHost host;
+  ASSERT_EQ(host.load(TEST_AGENT, &env, "stop 5"), 0);
+  EXPECT_EQ(host.run(10), 1);
+  EXPECT_EQ(host.get_decisions(), 5u);
+  EXPECT_EQ(env.get_action_repeat(), 1);
+  EXPECT_EQ(env.get_action_hold(), 0);
+}
+
+} // namespace nesemu
@@ -0,0 +1,27 @@
+#include "agent_api.h"
+
+#include <cstring>
+
+/* An agent that presses nothing, for measuring the host */
+
+static void* create(const NesAgentInfo* /* info */, const char* /* args */) {
+  static int agent;
+  return &agent;
+}
+
+static void destroy(void* /* agent */) {
+}
+
+static int act(void* /* agent */, const NesAgentBatch* batch,
+               uint8_t* actions) {
+  memset(actions, 0, batch->count);
+  return 0;
+}
+
+static const NesAgentApi API = {
+  NES_AGENT_ABI_VERSION, sizeof(NesAgentApi), create, destroy, act
+};
+
+extern "C" const NesAgentApi* nes_agent_get_api(uint32_t abi_version) {
+  return abi_version == NES_AGENT_ABI_VERSION ? &API : NULL;
+}
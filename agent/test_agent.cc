@@ -0,0 +1,62 @@
+#include "agent_api.h"
+
+#include "controller/controller.h"
+#include <cstdlib>
+#include <cstring>
+
+/* An agent for the host's tests
+  Presses A on even decisions. args "fail" makes no agent, "stop N" ends
+  the run at decision N. It checks the batch on every call and ends the
+  run if anything is off.
+*/
+
+struct TestAgent {
+  NesAgentInfo info;
+  uint64_t stop;
+  uint64_t calls;
+};
+
+static void* create(const NesAgentInfo* info, const char* args) {
+  if (!strcmp(args, "fail") || info->count < 1 ||
+      info->observation_size !=
+          uint32_t(info->width) * uint32_t(info->height) ||
+      info->repeat < 1 || info->repeat > info->interval) {
+    return NULL;
+  }
+  TestAgent* agent = new TestAgent;
+  agent->info = *info;
+  agent->stop = ~uint64_t(0);
+  agent->calls = 0;
+  if (!strncmp(args, "stop ", 5)) {
+    agent->stop = strtoull(args + 5, NULL, 10);
+  }
+  return agent;
+}
+
+static void destroy(void* agent) {
+  delete static_cast<TestAgent*>(agent);
+}
+
+static int act(void* opaque, const NesAgentBatch* batch, uint8_t* actions) {
+  TestAgent* agent = static_cast<TestAgent*>(opaque);
+  if (batch->count != agent->info.count || batch->decision != agent->calls ||
+      batch->decision == agent->stop) {
+    return 1;
+  }
+  agent->calls++;
+  for (int i = 0; i < batch->count; i++) {
+    if (!batch->rams[i] || batch->dones[i] > 1) {
+      return 1;
+    }
+    actions[i] = batch->decision % 2 ? 0 : BUTTON_A;
+  }
+  return 0;
+}
+
+static const NesAgentApi API = {
+  NES_AGENT_ABI_VERSION, sizeof(NesAgentApi), create, destroy, act
+};
+
+extern "C" const NesAgentApi* nes_agent_get_api(uint32_t abi_version) {
+  return abi_version == NES_AGENT_ABI_VERSION ? &API : NULL;
+}
@@ -0,0 +1,150 @@
+#include "apu.h"
+
+namespace nesemu {
+
+const double APU::CPU_HZ = 39375000.0 / 22;
+const size_t APU::LOG_LIMIT;
+const int APU::UNREAD_SECONDS;
+
+// a DMC fetch halts the CPU for up to 4 cycles, the usual case
+static const int DMC_STALL = 4;
+
+APU::APU() {
+  reader = 0;
+  reader_context = 0;
+  stall_cycles = 0;
+  observed.set_dmc_reader(fetch, this);
+
+  sample_rate = 0;
+  dmc_replayed = 0;
+  level = 0;
+}
+
+/* Timing */
+void APU::run(uint64_t target) {
+  observed.run(target);
+  if (log.size() < LOG_LIMIT && dmc_bytes.size() < LOG_LIMIT) {
+    return;
+  }
+  replay();
+  int excess = blip.samples_available() - UNREAD_SECONDS * sample_rate;
+  if (excess > 0) {
+    blip.skip_samples(excess);
+  }
+}
+
+uint64_t APU::get_clock() const {
+  return observed.get_clock();
+}
+
+/* Registers */
+uint8_t APU::read_status() {
+  return observed.read_status();
+}
+
+void APU::write_register(uint16_t address, uint8_t value) {
+  if (sample_rate) {
+    LogEntry entry = {observed.get_clock(), address, value};
+    log.push_back(entry);
+  }
+  observed.write_register(address, value);
+}
+
+bool APU::get_irq() const {
+  return observed.get_irq();
+}
+
+/* DMC DMA */
+void APU::set_dmc_reader(DmcReader read, void* context) {
+  reader = read;
+  reader_context = context;
+}
+
+uint64_t APU::take_stall_cycles() {
+  uint64_t result = stall_cycles;
+  stall_cycles = 0;
+  return result;
+}
+
+uint8_t APU::fetch(void* context, uint16_t address) {
+  APU* apu = static_cast<APU*>(context);
+  uint8_t value = apu->reader ? apu->reader(apu->reader_context, address) : 0;
+  apu->stall_cycles += DMC_STALL;
+  if (apu->sample_rate) {
+    apu->dmc_bytes.push_back(value);
+  }
+  return value;
+}
+
+// the synthesizing copy fetches at the same clocks, in the same order
+uint8_t APU::replay_fetch(void* context, uint16_t /* address */) {
+  APU* apu = static_cast<APU*>(context);
+  return apu->dmc_bytes[apu->dmc_replayed++];
+}
+
+/* Audio */
+int APU::set_sample_rate(int rate) {
+  if (rate != 0 && (rate < 8000 || rate > 192000)) {
+    return 1;
+  }
+  sample_rate = rate;
+  log.clear();
+  dmc_bytes.clear();
+  dmc_replayed = 0;
+  if (!rate) {
+    blip.clear(0);
+    audio.set_synthesis(false);
+    return 0;
+  }
+  // start from the observed state, only the waveform phases are new
+  audio = observed;
+  audio.set_dmc_reader(replay_fetch, this);
+  blip.set_rates(CPU_HZ, rate, audio.get_clock());
+  level = 0;
+  audio.set_synthesis(true, level_changed, this);
+  return 0;
+}
+
+int APU::get_sample_rate() const {
+  return sample_rate;
+}
+
+int APU::read_samples(int16_t* out, int max) {
+  if (!sample_rate) {
+    return 0;
+  }
+  replay();
+  return blip.read_samples(out, max);
+}
+
+void APU::replay() {
+  for (size_t i = 0; i < log.size(); i++) {
+    audio.run(log[i].clock);
+    audio.write_register(log[i].address, log[i].value);
+  }
+  log.clear();
+  audio.run(observed.get_clock());
+  blip.end_frame(observed.get_clock());
+  dmc_bytes.erase(dmc_bytes.begin(), dmc_bytes.begin() + dmc_replayed);
+  dmc_replayed = 0;
+}
+
+/* State */
+void APU::save_state(APUState& state) const {
+  observed.save_state(state.core);
+  state.stall_cycles = stall_cycles;
+}
+
+void APU::load_state(const APUState& state) {
+  observed.load_state(state.core);
+  stall_cycles = state.stall_cycles;
+  set_sample_rate(sample_rate);
+}
+
+void APU::level_changed(void* context, uint64_t clock, float level) {
+  APU* apu = static_cast<APU*>(context);
+  apu->blip.add_delta(clock, level - apu->level);
+  apu->level = level;
+}
+
+} // namespace nesemu
@@ -0,0 +1,105 @@
+#ifndef NESEMU_APU_APU_H_
+#define NESEMU_APU_APU_H_
+
+#include "apu_core.h"
+#include "blip_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+// What the CPU can observe of an APU, plain data without handlers
+struct APUState {
+  APUCoreState core;
+  uint64_t stall_cycles;
+};
+
+/* Audio processing unit, $4000-$4013, $4015 and $4017
+  Only what the CPU can observe runs as the emulation goes: the frame IRQ,
+  the length counters behind $4015 and the DMC reader with its DMA stalls.
+  Samples are synthesized on demand. While a sample rate is set, register
+  writes and DMC sample bytes are logged with their CPU cycle, and
+  read_samples() replays the log through a second, synthesizing copy of the
+  channels up to the current clock. Its mixed level changes go into a
+  band-limited step buffer, so the cost follows the number of waveform
+  edges rather than the CPU clock. With no sample rate (the default)
+  nothing is logged or synthesized.
+
+  A caller that sets a rate and never reads still costs bounded memory:
+  once LOG_LIMIT writes or DMC bytes are logged, run() replays them as
+  read_samples() would, and unread samples beyond the last UNREAD_SECONDS
+  are dropped, oldest first.
+*/
+class APU {
+  public:
+    APU();
+
+    static const double CPU_HZ; // NTSC, 39375000 / 22
+
+    /* Timing */
+    // catch up to the given CPU cycle
+    void run(uint64_t target);
+    uint64_t get_clock() const;
+
+    /* CPU facing registers, at the current clock */
+    uint8_t read_status(); // $4015
+    void write_register(uint16_t address, uint8_t value);
+    bool get_irq() const;  // frame or DMC interrupt
+
+    /* DMC DMA */
+    void set_dmc_reader(DmcReader reader, void* context);
+    // CPU cycles stolen by DMC fetches since the last call
+    uint64_t take_stall_cycles();
+
+    /* Audio */
+    static const size_t LOG_LIMIT = 4096; // writes or DMC bytes
+    static const int UNREAD_SECONDS = 2;
+
+    // 0 turns synthesis off, otherwise 8000 - 192000 Hz. Returns 1 on a bad
+    // rate.
+    int set_sample_rate(int rate);
+    int get_sample_rate() const;
+    // Synthesizes everything up to the current clock and copies out at most
+    // max signed 16-bit mono samples, the rest is kept for the next call.
+    int read_samples(int16_t* out, int max);
+
+    /* State */
+    // Loading drops unread samples, synthesis carries on from the loaded
+    // state with new waveform phases.
+    void save_state(APUState& state) const;
+    void load_state(const APUState& state);
+
+  private:
+    struct LogEntry {
+      uint64_t clock;
+      uint16_t address;
+      uint8_t value;
+    };
+
+    APUCore observed; // always runs, channel timers off
+    APUCore audio;    // replays the log when samples are asked for
+
+    DmcReader reader;
+    void* reader_context;
+    uint64_t stall_cycles;
+
+    int sample_rate;
+    std::vector<LogEntry> log;
+    std::vector<uint8_t> dmc_bytes; // fetched by observed, replayed by audio
+    size_t dmc_replayed;
+
+    BlipBuffer blip; // level changes become band-limited steps
+    float level;     // last level passed to blip
+
+    void replay(); // the log into audio, up to the current clock
+
+    static uint8_t fetch(void* context, uint16_t address);
+    static uint8_t replay_fetch(void* context, uint16_t address);
+    static void level_changed(void* context, uint64_t clock, float level);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_APU_APU_H_
@@ -0,0 +1,117 @@
+#include "apu.h"
+#include "blip_buffer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace nesemu;
+
+static const int SECONDS = 20;
+static const uint64_t FRAME_CYCLES = 29781;
+static const int FRAMES_PER_SECOND = 60;
+static const double FRAME_MS = 1000.0 / 60.0988;
+
+static uint8_t sample_byte(void* /* context */, uint16_t address) {
+  return uint8_t(address * 73);
+}
+
+// Music-like traffic: every frame new notes and volumes on the pulses and
+// the triangle, a high noise hat and a looping DMC sample. Returns seconds
+// of host time per emulated second.
+static double run(int rate) {
+  APU apu;
+  apu.set_dmc_reader(sample_byte, NULL);
+  apu.set_sample_rate(rate);
+  apu.write_register(0x4015, 0x1F);
+  apu.write_register(0x4010, 0x4E); // loop, fast rate
+  apu.write_register(0x4012, 0x00);
+  apu.write_register(0x4013, 0x20);
+  apu.write_register(0x4015, 0x1F);
+  srand(32);
+  std::vector<int16_t> buffer(8192);
+  int frames = SECONDS * FRAMES_PER_SECOND;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int frame = 1; frame <= frames; frame++) {
+    apu.run(frame * FRAME_CYCLES);
+    for (int channel = 0; channel < 2; channel++) {
+      uint16_t base = uint16_t(0x4000 + 4 * channel);
+      apu.write_register(base, uint8_t(0x80 | (rand() & 0x0F)));
+      apu.write_register(base + 2, uint8_t(rand()));
+      if (frame % 8 == 0) {
+        apu.write_register(base + 3, uint8_t(0x08 | (rand() & 1)));
+      }
+    }
+    apu.write_register(0x4008, 0xFF);
+    apu.write_register(0x400A, uint8_t(rand()));
+    apu.write_register(0x400B, 0x08);
+    apu.write_register(0x400C, 0x34);
+    apu.write_register(0x400E, uint8_t(frame % 4 == 0 ? 0x02 : 0x05));
+    apu.write_register(0x400F, 0x08);
+    apu.take_stall_cycles();
+    if (rate) {
+      while (apu.read_samples(&buffer[0], int(buffer.size())) > 0) {
+      }
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / SECONDS;
+}
+
+// nanoseconds per delta, adding them and reading the result back
+static double run_blip(bool vectorized) {
+  const int deltas = 4000000;
+  std::vector<uint64_t> clocks(deltas);
+  std::vector<float> sizes(deltas);
+  srand(32);
+  uint64_t clock = 0;
+  for (int i = 0; i < deltas; i++) {
+    clock += 1 + rand() % 8;
+    clocks[i] = clock;
+    sizes[i] = (rand() % 31 - 15) / 512.0f;
+  }
+  BlipBuffer blip(vectorized);
+  blip.set_rates(APU::CPU_HZ, 48000);
+  std::vector<int16_t> buffer(4096);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < deltas; i++) {
+    blip.add_delta(clocks[i], sizes[i]);
+    if ((i & 1023) == 1023) {
+      blip.end_frame(clocks[i]);
+      while (blip.read_samples(&buffer[0], int(buffer.size())) > 0) {
+      }
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() * 1e9 / deltas;
+}
+
+int main() {
+  double none = run(0);
+  double cd = run(44100);
+  double dvd = run(48000);
+  double scalar = run_blip(false);
+  double vector = run_blip(true);
+
+  printf("APU cost per emulated second (%d s, music-like traffic)\n",
+         SECONDS);
+  printf("  no synthesis     %8.3f ms  %6.3f%% of frame time\n",
+         none * 1e3, none * 100);
+  printf("  44100 Hz         %8.3f ms  %6.3f%% of frame time\n",
+         cd * 1e3, cd * 100);
+  printf("  48000 Hz         %8.3f ms  %6.3f%% of frame time\n",
+         dvd * 1e3, dvd * 100);
+  printf("  per frame at 48000 Hz %.4f ms of %.2f ms\n",
+         dvd * 1e3 / 60.0988, FRAME_MS);
+  printf("Blip buffer ns per delta\n");
+  printf("  scalar           %8.2f\n", scalar);
+  printf("  %-16s %8.2f\n", BlipBuffer(true).is_vectorized() ? "sse2"
+                                                             : "(no sse2)",
+         vector);
+  return 0;
+}
@@ -0,0 +1,520 @@
+#include "apu_core.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nesemu {
+
+static const uint64_t NEVER = UINT64_MAX;
+
+static const uint8_t length_table[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+static const uint8_t duty_table[4][8] = {{0, 1, 0, 0, 0, 0, 0, 0},
+                                         {0, 1, 1, 0, 0, 0, 0, 0},
+                                         {0, 1, 1, 1, 1, 0, 0, 0},
+                                         {1, 0, 0, 1, 1, 1, 1, 1}};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15};
+
+// NTSC timer periods in CPU cycles
+static const uint16_t noise_periods[16] = {4,   8,   16,  32,  64,  96,
+                                           128, 160, 202, 254, 380, 508,
+                                           762, 1016, 2034, 4068};
+static const uint16_t dmc_periods[16] = {428, 380, 340, 320, 286, 254,
+                                         226, 214, 190, 160, 142, 128,
+                                         106, 84,  72,  54};
+
+/* Frame sequencer steps, CPU cycles from the start of the sequence */
+#define STEP_QUARTER 1
+#define STEP_HALF    2
+#define STEP_IRQ     4
+#define STEP_WRAP    8
+
+struct FrameStep {
+  uint32_t cycle;
+  int flags;
+};
+
+static const FrameStep frame_steps[2][6] = {
+    {{7457, STEP_QUARTER},
+     {14913, STEP_QUARTER | STEP_HALF},
+     {22371, STEP_QUARTER},
+     {29828, STEP_IRQ},
+     {29829, STEP_QUARTER | STEP_HALF | STEP_IRQ},
+     {29830, STEP_IRQ | STEP_WRAP}},
+    {{7457, STEP_QUARTER},
+     {14913, STEP_QUARTER | STEP_HALF},
+     {22371, STEP_QUARTER},
+     {29829, 0},
+     {37281, STEP_QUARTER | STEP_HALF},
+     {37282, STEP_WRAP}}};
+
+/* Nonlinear mixer, from the lookup table approximation */
+struct MixTables {
+  float pulse[31];
+  float tnd[203];
+  MixTables() {
+    pulse[0] = 0;
+    for (int i = 1; i < 31; i++) {
+      pulse[i] = float(95.52 / (8128.0 / i + 100));
+    }
+    tnd[0] = 0;
+    for (int i = 1; i < 203; i++) {
+      tnd[i] = float(163.67 / (24329.0 / i + 100));
+    }
+  }
+};
+
+static const MixTables mix;
+
+APUCore::APUCore() {
+  // padding included, see APUCoreState
+  memset(static_cast<APUCoreState*>(this), 0, sizeof(APUCoreState));
+  noise.period = noise_periods[0];
+  noise.shift = 1;
+  dmc.period = dmc_periods[0];
+  dmc.next = dmc.period;
+  dmc.sample_address = 0xC000;
+  dmc.sample_length = 1;
+  dmc.bits = 8;
+  dmc.silence = true;
+  pulse[0].next = pulse[1].next = triangle.next = noise.next = NEVER;
+
+  synthesize = false;
+  reader = 0;
+  reader_context = 0;
+  sink = 0;
+  sink_context = 0;
+  level = 0;
+}
+
+/* Timing */
+void APUCore::run(uint64_t target) {
+  for (;;) {
+    uint64_t frame = next_frame_event();
+    uint64_t next = std::min(frame, dmc.next);
+    if (synthesize) {
+      next = std::min(next, std::min(std::min(pulse[0].next, pulse[1].next),
+                                     std::min(triangle.next, noise.next)));
+    }
+    if (next > target) {
+      break;
+    }
+    clock = next;
+    if (frame == clock) {
+      frame_event();
+    }
+    if (dmc.next == clock) {
+      clock_dmc();
+    }
+    if (synthesize) {
+      for (int i = 0; i < 2; i++) {
+        if (pulse[i].next == clock) {
+          clock_pulse(pulse[i]);
+        }
+      }
+      if (triangle.next == clock) {
+        clock_triangle();
+      }
+      if (noise.next == clock) {
+        clock_noise();
+      }
+      update_level();
+    }
+  }
+  if (target > clock) {
+    clock = target;
+  }
+}
+
+uint64_t APUCore::get_clock() const {
+  return clock;
+}
+
+uint64_t APUCore::next_frame_event() const {
+  return frame_origin + frame_steps[five_step][frame_step].cycle;
+}
+
+void APUCore::frame_event() {
+  const FrameStep& step = frame_steps[five_step][frame_step];
+  if (step.flags & STEP_QUARTER) {
+    quarter_frame();
+  }
+  if (step.flags & STEP_HALF) {
+    half_frame();
+  }
+  if ((step.flags & STEP_IRQ) && !irq_inhibit) {
+    frame_irq = true;
+  }
+  if (step.flags & STEP_WRAP) {
+    frame_origin += step.cycle;
+    frame_step = 0;
+  } else {
+    frame_step++;
+  }
+}
+
+// envelopes and the triangle's linear counter
+void APUCore::quarter_frame() {
+  Envelope* envelopes[3] = {&pulse[0].envelope, &pulse[1].envelope,
+                            &noise.envelope};
+  for (int i = 0; i < 3; i++) {
+    Envelope& e = *envelopes[i];
+    if (e.start) {
+      e.start = false;
+      e.decay = 15;
+      e.divider = e.volume;
+    } else if (e.divider) {
+      e.divider--;
+    } else {
+      e.divider = e.volume;
+      if (e.decay) {
+        e.decay--;
+      } else if (e.loop) {
+        e.decay = 15;
+      }
+    }
+  }
+  if (triangle.linear_reload) {
+    triangle.linear = triangle.linear_load;
+  } else if (triangle.linear) {
+    triangle.linear--;
+  }
+  if (!triangle.control) {
+    triangle.linear_reload = false;
+  }
+}
+
+// length counters and sweeps
+void APUCore::half_frame() {
+  for (int i = 0; i < 2; i++) {
+    Pulse& channel = pulse[i];
+    if (channel.length && !channel.envelope.loop) {
+      channel.length--;
+    }
+    if (channel.sweep_divider == 0 && channel.sweep_enabled &&
+        channel.sweep_shift && !pulse_muted(channel)) {
+      int change = channel.period >> channel.sweep_shift;
+      if (channel.sweep_negate) {
+        channel.period -= change + (i == 0); // pulse 1 is ones' complement
+      } else {
+        channel.period += change;
+      }
+    }
+    if (channel.sweep_divider == 0 || channel.sweep_reload) {
+      channel.sweep_divider = channel.sweep_period;
+      channel.sweep_reload = false;
+    } else {
+      channel.sweep_divider--;
+    }
+  }
+  if (triangle.length && !triangle.control) {
+    triangle.length--;
+  }
+  if (noise.length && !noise.envelope.loop) {
+    noise.length--;
+  }
+}
+
+// the sweep target mutes the channel even while the sweep is disabled
+bool APUCore::pulse_muted(const Pulse& channel) const {
+  if (channel.period < 8) {
+    return true;
+  }
+  return !channel.sweep_negate &&
+         channel.period + (channel.period >> channel.sweep_shift) > 0x7FF;
+}
+
+/* Channel timers */
+void APUCore::clock_pulse(Pulse& channel) {
+  channel.step = (channel.step + 1) & 0x07;
+  channel.next += 2 * (uint64_t(channel.period) + 1);
+}
+
+void APUCore::clock_triangle() {
+  if (triangle.length && triangle.linear) {
+    triangle.step = (triangle.step + 1) & 0x1F;
+  }
+  // ultrasonic periods are stopped instead of producing a pop
+  triangle.next = triangle.period < 2 ? NEVER
+                                      : triangle.next + triangle.period + 1;
+}
+
+void APUCore::clock_noise() {
+  int tap = noise.mode ? 6 : 1;
+  int feedback = (noise.shift ^ (noise.shift >> tap)) & 0x01;
+  noise.shift = (noise.shift >> 1) | (feedback << 14);
+  noise.next += noise.period;
+}
+
+void APUCore::clock_dmc() {
+  if (!dmc.silence) {
+    if (dmc.shift & 0x01) {
+      if (dmc.level <= 125) {
+        dmc.level += 2;
+      }
+    } else if (dmc.level >= 2) {
+      dmc.level -= 2;
+    }
+  }
+  dmc.shift >>= 1;
+  if (--dmc.bits == 0) { // next output cycle
+    dmc.bits = 8;
+    dmc.silence = !dmc.buffer_full;
+    if (dmc.buffer_full) {
+      dmc.shift = dmc.buffer;
+      dmc.buffer_full = false;
+      fetch_sample();
+    }
+  }
+  dmc.next += dmc.period;
+}
+
+// DMA into the empty sample buffer
+void APUCore::fetch_sample() {
+  if (dmc.buffer_full || dmc.remaining == 0) {
+    return;
+  }
+  dmc.buffer = reader ? reader(reader_context, dmc.address) : 0;
+  dmc.buffer_full = true;
+  dmc_fetches++;
+  dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+  if (--dmc.remaining == 0) {
+    if (dmc.loop) {
+      dmc.address = dmc.sample_address;
+      dmc.remaining = dmc.sample_length;
+    } else if (dmc.irq_enabled) {
+      dmc.irq = true;
+    }
+  }
+}
+
+/* Registers */
+void APUCore::write_register(uint16_t address, uint8_t value) {
+  switch (address) {
+    case 0x4000:
+    case 0x4004: {
+      Pulse& channel = pulse[(address >> 2) & 1];
+      channel.duty = value >> 6;
+      channel.envelope.loop = value & 0x20;
+      channel.envelope.constant = value & 0x10;
+      channel.envelope.volume = value & 0x0F;
+      break;
+    }
+    case 0x4001:
+    case 0x4005: {
+      Pulse& channel = pulse[(address >> 2) & 1];
+      channel.sweep_enabled = value & 0x80;
+      channel.sweep_period = (value >> 4) & 0x07;
+      channel.sweep_negate = value & 0x08;
+      channel.sweep_shift = value & 0x07;
+      channel.sweep_reload = true;
+      break;
+    }
+    case 0x4002:
+    case 0x4006: {
+      Pulse& channel = pulse[(address >> 2) & 1];
+      channel.period = (channel.period & 0x0700) | value;
+      break;
+    }
+    case 0x4003:
+    case 0x4007: {
+      Pulse& channel = pulse[(address >> 2) & 1];
+      channel.period = (channel.period & 0x00FF) | ((value & 0x07) << 8);
+      if (channel.enabled) {
+        channel.length = length_table[value >> 3];
+      }
+      channel.step = 0;
+      channel.envelope.start = true;
+      break;
+    }
+    case 0x4008:
+      triangle.control = value & 0x80;
+      triangle.linear_load = value & 0x7F;
+      break;
+    case 0x400A:
+      triangle.period = (triangle.period & 0x0700) | value;
+      break;
+    case 0x400B:
+      triangle.period = (triangle.period & 0x00FF) | ((value & 0x07) << 8);
+      if (triangle.enabled) {
+        triangle.length = length_table[value >> 3];
+      }
+      triangle.linear_reload = true;
+      break;
+    case 0x400C:
+      noise.envelope.loop = value & 0x20;
+      noise.envelope.constant = value & 0x10;
+      noise.envelope.volume = value & 0x0F;
+      break;
+    case 0x400E:
+      noise.mode = value & 0x80;
+      noise.period = noise_periods[value & 0x0F];
+      break;
+    case 0x400F:
+      if (noise.enabled) {
+        noise.length = length_table[value >> 3];
+      }
+      noise.envelope.start = true;
+      break;
+    case 0x4010:
+      dmc.irq_enabled = value & 0x80;
+      if (!dmc.irq_enabled) {
+        dmc.irq = false;
+      }
+      dmc.loop = value & 0x40;
+      dmc.period = dmc_periods[value & 0x0F];
+      break;
+    case 0x4011:
+      dmc.level = value & 0x7F;
+      break;
+    case 0x4012:
+      dmc.sample_address = 0xC000 | (value << 6);
+      break;
+    case 0x4013:
+      dmc.sample_length = (value << 4) | 1;
+      break;
+    case 0x4015: {
+      bool* enabled[4] = {&pulse[0].enabled, &pulse[1].enabled,
+                          &triangle.enabled, &noise.enabled};
+      uint8_t* length[4] = {&pulse[0].length, &pulse[1].length,
+                            &triangle.length, &noise.length};
+      for (int i = 0; i < 4; i++) {
+        *enabled[i] = (value >> i) & 0x01;
+        if (!*enabled[i]) {
+          *length[i] = 0;
+        }
+      }
+      dmc.irq = false;
+      if (!(value & 0x10)) {
+        dmc.remaining = 0;
+      } else if (dmc.remaining == 0) {
+        dmc.address = dmc.sample_address;
+        dmc.remaining = dmc.sample_length;
+        fetch_sample();
+      }
+      break;
+    }
+    case 0x4017:
+      five_step = value & 0x80;
+      irq_inhibit = value & 0x40;
+      if (irq_inhibit) {
+        frame_irq = false;
+      }
+      // the sequencer restarts 3 or 4 cycles later depending on alignment
+      frame_origin = clock + ((clock & 1) ? 4 : 3);
+      frame_step = 0;
+      if (five_step) {
+        quarter_frame();
+        half_frame();
+      }
+      break;
+  }
+  if (synthesize) {
+    if (triangle.next == NEVER && triangle.period >= 2) {
+      triangle.next = clock + triangle.period + 1;
+    }
+    update_level();
+  }
+}
+
+uint8_t APUCore::peek_status() const {
+  return (pulse[0].length ? 0x01 : 0) | (pulse[1].length ? 0x02 : 0) |
+         (triangle.length ? 0x04 : 0) | (noise.length ? 0x08 : 0) |
+         (dmc.remaining ? 0x10 : 0) | (frame_irq ? 0x40 : 0) |
+         (dmc.irq ? 0x80 : 0);
+}
+
+uint8_t APUCore::read_status() {
+  uint8_t result = peek_status();
+  frame_irq = false;
+  return result;
+}
+
+bool APUCore::get_irq() const {
+  return frame_irq || dmc.irq;
+}
+
+/* DMC reader */
+void APUCore::set_dmc_reader(DmcReader read, void* context) {
+  reader = read;
+  reader_context = context;
+}
+
+uint64_t APUCore::get_dmc_fetches() const {
+  return dmc_fetches;
+}
+
+/* Synthesis */
+void APUCore::set_synthesis(bool enabled, LevelSink level_sink,
+                            void* context) {
+  synthesize = enabled;
+  sink = level_sink;
+  sink_context = context;
+  if (!enabled) {
+    pulse[0].next = pulse[1].next = triangle.next = noise.next = NEVER;
+    return;
+  }
+  schedule_timers();
+  update_level();
+}
+
+/* State */
+void APUCore::save_state(APUCoreState& state) const {
+  memcpy(&state, static_cast<const APUCoreState*>(this), sizeof state);
+}
+
+// the channel timers restart from the loaded clock when synthesizing, as
+// set_synthesis() starts them
+void APUCore::load_state(const APUCoreState& state) {
+  memcpy(static_cast<APUCoreState*>(this), &state, sizeof state);
+  if (synthesize) {
+    schedule_timers();
+    update_level();
+  } else {
+    pulse[0].next = pulse[1].next = triangle.next = noise.next = NEVER;
+  }
+}
+
+void APUCore::schedule_timers() {
+  for (int i = 0; i < 2; i++) {
+    pulse[i].next = clock + 2 * (uint64_t(pulse[i].period) + 1);
+  }
+  triangle.next = triangle.period < 2 ? NEVER : clock + triangle.period + 1;
+  noise.next = clock + noise.period;
+}
+
+void APUCore::update_level() {
+  int pulses = 0;
+  for (int i = 0; i < 2; i++) {
+    const Pulse& channel = pulse[i];
+    if (channel.length && !pulse_muted(channel) &&
+        duty_table[channel.duty][channel.step]) {
+      const Envelope& e = channel.envelope;
+      pulses += e.constant ? e.volume : e.decay;
+    }
+  }
+  int noise_out = 0;
+  if (noise.length && !(noise.shift & 0x01)) {
+    const Envelope& e = noise.envelope;
+    noise_out = e.constant ? e.volume : e.decay;
+  }
+  int tnd = 3 * triangle_table[triangle.step] + 2 * noise_out + dmc.level;
+  float mixed = mix.pulse[pulses] + mix.tnd[tnd];
+  if (mixed != level) {
+    level = mixed;
+    if (sink) {
+      sink(sink_context, clock, level);
+    }
+  }
+}
+
+float APUCore::get_level() const {
+  return level;
+}
+
+} // namespace nesemu
@@ -0,0 +1,155 @@
+#ifndef NESEMU_APU_APU_CORE_H_
+#define NESEMU_APU_APU_CORE_H_
+
+#include <cstdint>
+
+namespace nesemu {
+
+// DMC sample fetch, returns the byte at address
+typedef uint8_t (*DmcReader)(void* context, uint16_t address);
+// mixed output changed to level (0.0 - 1.0) at the given CPU cycle
+typedef void (*LevelSink)(void* context, uint64_t clock, float level);
+
+// The emulated state of an APUCore: channels, frame sequencer and DMC
+// fetch count, without the handlers or synthesis output. Plain data, and
+// an APUCore keeps its padding zeroed, so equal states are equal bytes.
+struct APUCoreState {
+  struct Envelope {
+    bool start;
+    bool loop; // also halts the length counter
+    bool constant;
+    uint8_t volume;
+    uint8_t divider;
+    uint8_t decay;
+  };
+
+  struct Pulse {
+    uint64_t next; // clock of the next timer expiry
+    uint16_t period;
+    uint8_t duty;
+    uint8_t step;
+    uint8_t length;
+    bool enabled;
+    Envelope envelope;
+    bool sweep_enabled;
+    bool sweep_negate;
+    bool sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+  };
+
+  struct Triangle {
+    uint64_t next;
+    uint16_t period;
+    uint8_t step;
+    uint8_t length;
+    bool enabled;
+    bool control; // also halts the length counter
+    bool linear_reload;
+    uint8_t linear_load;
+    uint8_t linear;
+  };
+
+  struct Noise {
+    uint64_t next;
+    uint16_t period;
+    uint16_t shift;
+    bool mode;
+    uint8_t length;
+    bool enabled;
+    Envelope envelope;
+  };
+
+  struct Dmc {
+    uint64_t next;
+    uint16_t period;
+    bool irq_enabled;
+    bool loop;
+    uint16_t sample_address;
+    uint16_t sample_length;
+    uint16_t address;
+    uint16_t remaining; // bytes left to fetch
+    uint8_t buffer;
+    bool buffer_full;
+    uint8_t shift;
+    uint8_t bits;
+    bool silence;
+    uint8_t level;
+    bool irq;
+  };
+
+  uint64_t clock;
+
+  /* Frame sequencer */
+  bool five_step;
+  bool irq_inhibit;
+  bool frame_irq;
+  uint64_t frame_origin; // clock the current sequence started at
+  int frame_step;        // next entry of the step table
+
+  Pulse pulse[2];
+  Triangle triangle;
+  Noise noise;
+  Dmc dmc;
+  uint64_t dmc_fetches;
+};
+
+/* APU channels and frame sequencer, timed in CPU cycles
+  Like the PPU it is caught up lazily: run() jumps between events (frame
+  sequencer steps, DMC timer and, when synthesizing, the channel timers).
+  Without synthesis the channel timers are never scheduled, which leaves
+  exactly what the CPU can observe: length counters for $4015, the frame
+  IRQ and the DMC reader with its IRQ and DMA fetches. Envelopes, sweeps
+  and the linear counter still follow the frame sequencer, so synthesis
+  can be switched on from any point.
+*/
+class APUCore : private APUCoreState {
+  public:
+    APUCore();
+
+    void run(uint64_t target);
+    uint64_t get_clock() const;
+
+    void write_register(uint16_t address, uint8_t value);
+    uint8_t read_status();       // $4015, clears the frame IRQ
+    uint8_t peek_status() const; // same without the side effect
+    bool get_irq() const;        // frame or DMC interrupt pending
+
+    void set_dmc_reader(DmcReader reader, void* context);
+    uint64_t get_dmc_fetches() const; // sample bytes read so far
+
+    // Starts or stops the channel timers. Synthesis restarts them from the
+    // current clock, sequencer positions are kept.
+    void set_synthesis(bool enabled, LevelSink sink = 0, void* context = 0);
+    float get_level() const;
+
+    /* State, the handlers and synthesis stay as they are */
+    void save_state(APUCoreState& state) const;
+    void load_state(const APUCoreState& state);
+
+  private:
+    bool synthesize;
+    DmcReader reader;
+    void* reader_context;
+    LevelSink sink;
+    void* sink_context;
+    float level;
+
+    uint64_t next_frame_event() const;
+    void frame_event();
+    void quarter_frame();
+    void half_frame();
+    void clock_pulse(Pulse& channel);
+    void clock_triangle();
+    void clock_noise();
+    void clock_dmc();
+    void fetch_sample();
+    void schedule_timers();
+    void update_level();
+    bool pulse_muted(const Pulse& channel) const;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_APU_APU_CORE_H_
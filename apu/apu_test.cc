@@ -0,0 +1,285 @@
+#include "apu.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace nesemu {
+
+// sample memory for the DMC: value is the low byte of the address
+static uint8_t address_byte(void* context, uint16_t address) {
+  if (context) {
+    static_cast<std::vector<uint16_t>*>(context)->push_back(address);
+  }
+  return uint8_t(address);
+}
+
+TEST (APUInitializeTest, FirstState) {
+  APU apu;
+  EXPECT_EQ(apu.get_clock(), 0);
+  EXPECT_EQ(apu.read_status(), 0);
+  EXPECT_FALSE(apu.get_irq());
+  EXPECT_EQ(apu.get_sample_rate(), 0);
+  EXPECT_EQ(apu.take_stall_cycles(), 0);
+}
+
+TEST (APULengthTest, CountsDownOnHalfFrames) {
+  APU apu;
+  apu.write_register(0x4015, 0x0F);
+  apu.write_register(0x4003, 0x18); // pulse 1, length 2
+  apu.write_register(0x400F, 0x18); // noise, length 2
+  apu.write_register(0x400C, 0x20); // noise length halted
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x09);
+  apu.run(14912);
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x09);
+  apu.run(14913);
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x09); // 1 left
+  apu.run(29829);
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x08);
+
+  // disabling clears, loading while disabled does nothing
+  apu.write_register(0x4015, 0x00);
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x00);
+  apu.write_register(0x400B, 0xF8);
+  EXPECT_EQ(apu.read_status() & 0x0F, 0x00);
+}
+
+TEST (APUFrameTest, FourStepIrq) {
+  APU apu;
+  apu.run(29827);
+  EXPECT_FALSE(apu.get_irq());
+  apu.run(29828);
+  EXPECT_TRUE(apu.get_irq());
+  EXPECT_EQ(apu.read_status() & 0x40, 0x40);
+  EXPECT_FALSE(apu.get_irq()); // cleared by the read
+  apu.run(29830);
+  EXPECT_TRUE(apu.get_irq()); // set again on the last cycles
+  apu.read_status();
+  apu.run(29830 + 29828);
+  EXPECT_TRUE(apu.get_irq());
+
+  // inhibit clears and blocks it
+  apu.write_register(0x4017, 0x40);
+  EXPECT_FALSE(apu.get_irq());
+  apu.run(10 * 29830);
+  EXPECT_FALSE(apu.get_irq());
+}
+
+TEST (APUFrameTest, FiveStepMode) {
+  APU apu;
+  apu.write_register(0x4015, 0x01);
+  apu.write_register(0x4003, 0x18); // length 2
+  apu.write_register(0x4017, 0x80); // clocks a half frame right away
+  EXPECT_EQ(apu.read_status() & 0x01, 0x01);
+  apu.run(3 + 14913);
+  EXPECT_EQ(apu.read_status() & 0x01, 0x00);
+  apu.run(10 * 37282);
+  EXPECT_FALSE(apu.get_irq());
+}
+
+TEST (APUFrameTest, WriteRestartsSequence) {
+  APU apu;
+  apu.run(20000);
+  apu.write_register(0x4017, 0x00); // even cycle, restarts 3 cycles later
+  apu.run(20003 + 29827);
+  EXPECT_FALSE(apu.get_irq());
+  apu.run(20003 + 29828);
+  EXPECT_TRUE(apu.get_irq());
+}
+
+TEST (APUDmcTest, FetchesStallsAndIrq) {
+  APU apu;
+  std::vector<uint16_t> reads;
+  apu.set_dmc_reader(address_byte, &reads);
+  apu.write_register(0x4017, 0x40);
+  apu.write_register(0x4010, 0x8F); // IRQ, fastest rate (54 cycles)
+  apu.write_register(0x4012, 0x01); // $C040
+  apu.write_register(0x4013, 0x01); // 17 bytes
+  apu.write_register(0x4015, 0x10); // first byte is fetched right away
+  ASSERT_EQ(reads.size(), 1u);
+  EXPECT_EQ(reads[0], 0xC040);
+  EXPECT_EQ(apu.read_status() & 0x10, 0x10);
+  EXPECT_EQ(apu.take_stall_cycles(), 4);
+  EXPECT_EQ(apu.take_stall_cycles(), 0);
+
+  // one byte per 8 timer periods once the output unit takes the buffer
+  apu.run(17 * 8 * 54 + 8 * 54);
+  ASSERT_EQ(reads.size(), 17u);
+  EXPECT_EQ(reads[16], 0xC050);
+  EXPECT_EQ(apu.take_stall_cycles(), 16 * 4);
+  EXPECT_EQ(apu.read_status() & 0x90, 0x80);
+  EXPECT_TRUE(apu.get_irq());
+  apu.write_register(0x4015, 0x00); // acknowledges
+  EXPECT_FALSE(apu.get_irq());
+}
+
+TEST (APUDmcTest, LoopAndWrap) {
+  APU apu;
+  std::vector<uint16_t> reads;
+  apu.set_dmc_reader(address_byte, &reads);
+  apu.write_register(0x4010, 0x4F); // loop, no IRQ
+  apu.write_register(0x4012, 0xFF); // $FFC0
+  apu.write_register(0x4013, 0x04); // 65 bytes, wraps to $8000
+  apu.write_register(0x4015, 0x10);
+  apu.run(200 * 8 * 54);
+  ASSERT_GT(reads.size(), 130u);
+  EXPECT_EQ(reads[63], 0xFFFF);
+  EXPECT_EQ(reads[64], 0x8000);
+  EXPECT_EQ(reads[65], 0xFFC0);
+  EXPECT_EQ(apu.read_status() & 0x90, 0x10);
+}
+
+// random register traffic, returns the samples of one emulated second read
+// every `every` cycles
+static std::vector<int16_t> play(int rate, uint64_t every, bool dmc) {
+  APU apu;
+  apu.set_dmc_reader(address_byte, NULL);
+  apu.set_sample_rate(rate);
+  srand(31);
+  std::vector<int16_t> result;
+  int16_t buffer[4096];
+  uint64_t next_read = every;
+  for (uint64_t clock = 0; clock < uint64_t(APU::CPU_HZ); clock += 97) {
+    apu.run(clock);
+    if (rand() % 40 == 0) {
+      uint16_t address = 0x4000 + rand() % 0x14;
+      if (!dmc && address >= 0x4010) {
+        continue;
+      }
+      apu.write_register(address, uint8_t(rand()));
+      apu.write_register(0x4015, dmc ? 0x1F : 0x0F);
+    }
+    if (clock >= next_read) {
+      int count;
+      while ((count = apu.read_samples(buffer, 4096)) > 0) {
+        result.insert(result.end(), buffer, buffer + count);
+      }
+      next_read += every;
+    }
+  }
+  int count;
+  while ((count = apu.read_samples(buffer, 4096)) > 0) {
+    result.insert(result.end(), buffer, buffer + count);
+  }
+  return result;
+}
+
+// when samples are asked for must not change what they are
+TEST (APUAudioTest, LazySynthesisIsExact) {
+  std::vector<int16_t> once = play(48000, UINT64_MAX, true);
+  std::vector<int16_t> per_frame = play(48000, 29781, true);
+  std::vector<int16_t> often = play(48000, 1000, true);
+  EXPECT_NEAR(double(once.size()), 48000.0, 8.0); // whole blocks
+  EXPECT_EQ(once, per_frame);
+  EXPECT_EQ(once, often);
+  int distinct = 0;
+  for (size_t i = 1; i < once.size(); i++) {
+    distinct += once[i] != once[i - 1];
+  }
+  EXPECT_GT(distinct, 1000);
+}
+
+// a caller that never reads keeps only the newest samples, as they were
+TEST (APUAudioTest, UnreadAudioIsBounded) {
+  const int rate = 22050;
+  APU reader, idle;
+  APU* apus[2] = {&reader, &idle};
+  for (int a = 0; a < 2; a++) {
+    apus[a]->set_dmc_reader(address_byte, NULL);
+    apus[a]->set_sample_rate(rate);
+    apus[a]->write_register(0x4010, 0x4F); // loop at the fastest rate
+    apus[a]->write_register(0x4013, 0xFF);
+    apus[a]->write_register(0x4015, 0x1F);
+  }
+  srand(7);
+  std::vector<int16_t> all, kept;
+  int16_t buffer[4096];
+  int count;
+  for (uint64_t clock = 0; clock < 6 * uint64_t(APU::CPU_HZ); clock += 97) {
+    reader.run(clock);
+    idle.run(clock);
+    if (rand() % 10 == 0) {
+      uint16_t address = 0x4000 + rand() % 0x10;
+      uint8_t value = uint8_t(rand());
+      reader.write_register(address, value);
+      idle.write_register(address, value);
+    }
+    if (clock % 29781 < 97) {
+      while ((count = reader.read_samples(buffer, 4096)) > 0) {
+        all.insert(all.end(), buffer, buffer + count);
+      }
+    }
+  }
+  while ((count = reader.read_samples(buffer, 4096)) > 0) {
+    all.insert(all.end(), buffer, buffer + count);
+  }
+  while ((count = idle.read_samples(buffer, 4096)) > 0) {
+    kept.insert(kept.end(), buffer, buffer + count);
+  }
+  EXPECT_GT(all.size(), size_t(5 * rate));
+  EXPECT_GE(kept.size(), size_t(APU::UNREAD_SECONDS * rate));
+  EXPECT_LE(kept.size(), size_t((APU::UNREAD_SECONDS + 1) * rate));
+  ASSERT_LT(kept.size(), all.size());
+  EXPECT_TRUE(std::equal(kept.begin(), kept.end(),
+                         all.end() - kept.size()));
+}
+
+TEST (APUAudioTest, PulseFrequency) {
+  APU apu;
+  apu.set_sample_rate(44100);
+  apu.write_register(0x4015, 0x01);
+  apu.write_register(0x4000, 0xBF); // 50% duty, halted, constant volume 15
+  apu.write_register(0x4002, 0xFD); // period 253, 440.4 Hz
+  apu.write_register(0x4003, 0x00);
+  apu.run(uint64_t(APU::CPU_HZ));
+  std::vector<int16_t> samples(50000);
+  int count = apu.read_samples(&samples[0], 50000);
+  EXPECT_NEAR(count, 44100, 8);
+  // the output is DC blocked, count zero crossings once the start settles
+  int rising = 0;
+  for (int i = count / 10; i < count; i++) {
+    rising += samples[i - 1] < 0 && samples[i] >= 0;
+  }
+  EXPECT_NEAR(rising, 396, 2); // 0.9 s of 440.4 Hz
+}
+
+// observable state does not depend on synthesis
+TEST (APUAudioTest, SynthesisDoesNotChangeStatus) {
+  APU headless, audible;
+  audible.set_sample_rate(44100);
+  headless.set_dmc_reader(address_byte, NULL);
+  audible.set_dmc_reader(address_byte, NULL);
+  srand(5);
+  int16_t buffer[2048];
+  for (uint64_t clock = 0; clock < 500000; clock += 113) {
+    headless.run(clock);
+    audible.run(clock);
+    if (rand() % 20 == 0) {
+      uint16_t address = 0x4000 + rand() % 0x18;
+      uint8_t value = uint8_t(rand());
+      if (address == 0x4014 || address == 0x4016) {
+        continue;
+      }
+      headless.write_register(address, value);
+      audible.write_register(address, value);
+    }
+    ASSERT_EQ(headless.read_status(), audible.read_status());
+    ASSERT_EQ(headless.take_stall_cycles(), audible.take_stall_cycles());
+    if (rand() % 50 == 0) {
+      audible.read_samples(buffer, 2048);
+    }
+  }
+}
+
+TEST (APUAudioTest, BadSampleRate) {
+  APU apu;
+  int16_t buffer[16];
+  EXPECT_EQ(apu.set_sample_rate(100), 1);
+  EXPECT_EQ(apu.set_sample_rate(400000), 1);
+  EXPECT_EQ(apu.get_sample_rate(), 0);
+  apu.run(100000);
+  EXPECT_EQ(apu.read_samples(buffer, 16), 0);
+}
+
+} // namespace nesemu
@@ -0,0 +1,250 @@
+#include "blip_buffer.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NESEMU_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace nesemu {
+
+static const int PHASE_BITS = 6; // log2 of KERNEL_PHASES
+static const float FULL_SCALE = 32767.0f;
+static const double DC_CUTOFF = 20.0; // Hz
+
+/* Kernels
+  One band-limited impulse per sixty-fourth of a sample: a sinc cut off a
+  little under the output Nyquist rate, Blackman windowed over the taps and
+  scaled to sum to exactly 1, so steps settle at their full height.
+*/
+struct ImpulseTable {
+  alignas(16) float taps[BlipBuffer::KERNEL_PHASES][BlipBuffer::KERNEL_TAPS];
+
+  ImpulseTable() {
+    const double pi = 3.14159265358979323846;
+    const double cutoff = 0.45; // of the sample rate
+    const double half = BlipBuffer::KERNEL_TAPS / 2;
+    for (int phase = 0; phase < BlipBuffer::KERNEL_PHASES; phase++) {
+      double center = half - 1 + double(phase) / BlipBuffer::KERNEL_PHASES;
+      double sum = 0;
+      double values[BlipBuffer::KERNEL_TAPS];
+      for (int i = 0; i < BlipBuffer::KERNEL_TAPS; i++) {
+        double x = i - center;
+        double sinc = x == 0 ? 2 * cutoff
+                             : sin(2 * pi * cutoff * x) / (pi * x);
+        double window = 0.42 + 0.5 * cos(pi * x / half) +
+                        0.08 * cos(2 * pi * x / half);
+        values[i] = sinc * window;
+        sum += values[i];
+      }
+      for (int i = 0; i < BlipBuffer::KERNEL_TAPS; i++) {
+        taps[phase][i] = float(values[i] / sum);
+      }
+    }
+  }
+};
+
+static const ImpulseTable impulse_table;
+
+/* Scalar kernels */
+static void add_impulse_scalar(float* out, const float* kernel, float delta) {
+  for (int i = 0; i < BlipBuffer::KERNEL_TAPS; i++) {
+    out[i] += kernel[i] * delta;
+  }
+}
+
+// y[n] = x[n] + pole * y[n - 1] is the running sum of the impulses with the
+// DC blocker folded in
+static float integrate_scalar(const float* in, int16_t* out, size_t count,
+                              float pole, float carry) {
+  for (size_t i = 0; i < count; i++) {
+    carry = in[i] + pole * carry;
+    float value = carry * FULL_SCALE;
+    value = value > 32767.0f ? 32767.0f : value < -32768.0f ? -32768.0f
+                                                            : value;
+    out[i] = int16_t(lrintf(value));
+  }
+  return carry;
+}
+
+/* SSE2 kernels */
+#ifdef NESEMU_X86
+
+__attribute__((target("sse2")))
+static void add_impulse_sse2(float* out, const float* kernel, float delta) {
+  __m128 scale = _mm_set1_ps(delta);
+  for (int i = 0; i < BlipBuffer::KERNEL_TAPS; i += 4) {
+    __m128 sum = _mm_add_ps(_mm_loadu_ps(out + i),
+                            _mm_mul_ps(_mm_load_ps(kernel + i), scale));
+    _mm_storeu_ps(out + i, sum);
+  }
+}
+
+// The recursion four samples at a time as a scan: two shifted
+// multiply-adds cover the samples inside the vector, one more brings in
+// the carry from the previous vector.
+__attribute__((target("sse2")))
+static __m128 scan4(__m128 x, __m128 pole1, __m128 pole2, __m128 powers,
+                    __m128 carry) {
+  __m128i bits = _mm_castps_si128(x);
+  x = _mm_add_ps(x, _mm_mul_ps(_mm_castsi128_ps(_mm_slli_si128(bits, 4)),
+                               pole1));
+  bits = _mm_castps_si128(x);
+  x = _mm_add_ps(x, _mm_mul_ps(_mm_castsi128_ps(_mm_slli_si128(bits, 8)),
+                               pole2));
+  return _mm_add_ps(x, _mm_mul_ps(carry, powers));
+}
+
+__attribute__((target("sse2")))
+static float integrate_sse2(const float* in, int16_t* out, size_t count,
+                            float pole, float carry) {
+  __m128 pole1 = _mm_set1_ps(pole);
+  __m128 pole2 = _mm_set1_ps(pole * pole);
+  __m128 powers = _mm_setr_ps(pole, pole * pole, pole * pole * pole,
+                              pole * pole * pole * pole);
+  __m128 scale = _mm_set1_ps(FULL_SCALE);
+  __m128 high = _mm_set1_ps(32767.0f);
+  __m128 low = _mm_set1_ps(-32768.0f);
+  __m128 last = _mm_set1_ps(carry);
+  for (size_t i = 0; i < count; i += 8) {
+    __m128 a = scan4(_mm_loadu_ps(in + i), pole1, pole2, powers, last);
+    last = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 b = scan4(_mm_loadu_ps(in + i + 4), pole1, pole2, powers, last);
+    last = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(a, scale), high), low);
+    b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(b, scale), high), low);
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+  }
+  return _mm_cvtss_f32(last);
+}
+
+static bool has_sse2() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+}
+
+#else // NESEMU_X86
+
+static bool has_sse2() {
+  return false;
+}
+
+#endif // NESEMU_X86
+
+BlipBuffer::BlipBuffer(bool vectorized) {
+  this->vectorized = vectorized && has_sse2();
+  factor = 0;
+  frame_start = 0;
+  offset = 0;
+  dc_pole = 1;
+  carry = 0;
+  samples_read = 0;
+}
+
+int BlipBuffer::set_rates(double clock_rate, int sample_rate, uint64_t clock) {
+  if (sample_rate <= 0 || sample_rate >= clock_rate) {
+    return 1;
+  }
+  factor = uint64_t(sample_rate / clock_rate * 4294967296.0 + 0.5);
+  dc_pole = float(exp(-2 * 3.14159265358979323846 * DC_CUTOFF / sample_rate));
+  clear(clock);
+  return 0;
+}
+
+void BlipBuffer::clear(uint64_t clock) {
+  frame_start = clock;
+  offset = 0;
+  carry = 0;
+  impulses.assign(BLOCK + KERNEL_TAPS, 0.0f);
+  samples.clear();
+  samples_read = 0;
+}
+
+void BlipBuffer::add_delta(uint64_t clock, float delta) {
+  uint64_t position = offset + (clock - frame_start) * factor;
+  size_t index = size_t(position >> 32);
+  int phase = int(position >> (32 - PHASE_BITS)) & (KERNEL_PHASES - 1);
+  if (impulses.size() < index + KERNEL_TAPS) {
+    impulses.resize(index + KERNEL_TAPS + BLOCK, 0.0f);
+  }
+  const float* kernel = impulse_table.taps[phase];
+#ifdef NESEMU_X86
+  if (vectorized) {
+    add_impulse_sse2(&impulses[index], kernel, delta);
+    return;
+  }
+#endif
+  add_impulse_scalar(&impulses[index], kernel, delta);
+}
+
+// samples before offset can no longer be reached by an impulse
+void BlipBuffer::end_frame(uint64_t clock) {
+  offset += (clock - frame_start) * factor;
+  frame_start = clock;
+  size_t ready = size_t(offset >> 32);
+  size_t count = ready - ready % BLOCK;
+  if (!count) {
+    return;
+  }
+  if (impulses.size() < count + KERNEL_TAPS) {
+    impulses.resize(count + KERNEL_TAPS, 0.0f);
+  }
+  if (samples_read == samples.size()) {
+    samples.clear();
+    samples_read = 0;
+  }
+  size_t start = samples.size();
+  samples.resize(start + count);
+#ifdef NESEMU_X86
+  if (vectorized) {
+    carry = integrate_sse2(&impulses[0], &samples[start], count, dc_pole,
+                           carry);
+  } else
+#endif
+  {
+    carry = integrate_scalar(&impulses[0], &samples[start], count, dc_pole,
+                             carry);
+  }
+  impulses.erase(impulses.begin(), impulses.begin() + count);
+  offset -= uint64_t(count) << 32;
+}
+
+int BlipBuffer::samples_available() const {
+  return int(samples.size() - samples_read);
+}
+
+int BlipBuffer::read_samples(int16_t* out, int max) {
+  int count = samples_available();
+  if (count > max) {
+    count = max;
+  }
+  if (count > 0) {
+    memcpy(out, &samples[samples_read], count * sizeof(int16_t));
+    samples_read += count;
+  }
+  return count;
+}
+
+// the kept samples move to the front, so skipping also frees their room
+int BlipBuffer::skip_samples(int max) {
+  int count = samples_available();
+  if (count > max) {
+    count = max;
+  }
+  if (count > 0) {
+    samples_read += count;
+  }
+  samples.erase(samples.begin(), samples.begin() + samples_read);
+  samples_read = 0;
+  return count;
+}
+
+bool BlipBuffer::is_vectorized() const {
+  return vectorized;
+}
+
+} // namespace nesemu
@@ -0,0 +1,62 @@
+#ifndef NESEMU_APU_BLIP_BUFFER_H_
+#define NESEMU_APU_BLIP_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* Band-limited step buffer, after blip_buf
+  The output is described by its changes: add_delta() places a windowed
+  sinc impulse at the exact fractional output position of a clock, and
+  reading integrates the impulses back into steps. Work is proportional to
+  the number of changes, not to the input clock rate. Integration runs
+  through a DC blocker and is done in fixed blocks of BLOCK samples, so
+  what comes out does not depend on how often end_frame() is called.
+
+  Clocks are absolute, add_delta() takes clocks at or after the last
+  end_frame() and end_frame() makes the samples before its clock readable.
+  The impulses reach KERNEL_TAPS samples ahead, which is also the delay of
+  the output.
+*/
+class BlipBuffer {
+  public:
+    static const int KERNEL_TAPS = 16;
+    static const int KERNEL_PHASES = 64;
+    static const int BLOCK = 8;
+
+    // vectorized false keeps the scalar kernels, for testing
+    explicit BlipBuffer(bool vectorized = true);
+
+    // Sets the clock and sample rates and restarts empty at the given clock.
+    // Returns 1 if the sample rate is not below the clock rate.
+    int set_rates(double clock_rate, int sample_rate, uint64_t clock = 0);
+    void clear(uint64_t clock);
+
+    // the output steps by delta (1.0 is full scale) at the given clock
+    void add_delta(uint64_t clock, float delta);
+    void end_frame(uint64_t clock);
+
+    int samples_available() const;
+    // copies out at most max samples, returns how many
+    int read_samples(int16_t* out, int max);
+    // drops at most max of the oldest samples, returns how many
+    int skip_samples(int max);
+    bool is_vectorized() const;
+
+  private:
+    bool vectorized;
+    uint64_t factor;      // output samples per clock, 32.32 fixed point
+    uint64_t frame_start; // clock of the last end_frame()
+    uint64_t offset;      // sample position of frame_start, 32.32 fixed
+    float dc_pole;
+    float carry;          // DC blocker output of the last sample
+    std::vector<float> impulses; // index 0 is the first unconverted sample
+    std::vector<int16_t> samples;
+    size_t samples_read;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_APU_BLIP_BUFFER_H_
@@ -0,0 +1,85 @@
+#include "blip_buffer.h"
+
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <vector>
+
+namespace nesemu {
+
+static const double CLOCK_RATE = 39375000.0 / 22;
+
+static std::vector<int16_t> read_all(BlipBuffer& blip) {
+  std::vector<int16_t> result;
+  int16_t buffer[1000];
+  int count;
+  while ((count = blip.read_samples(buffer, 1000)) > 0) {
+    result.insert(result.end(), buffer, buffer + count);
+  }
+  return result;
+}
+
+TEST (BlipBufferTest, BadRates) {
+  BlipBuffer blip;
+  EXPECT_EQ(blip.set_rates(CLOCK_RATE, 0), 1);
+  EXPECT_EQ(blip.set_rates(CLOCK_RATE, 2000000), 1);
+  EXPECT_EQ(blip.set_rates(CLOCK_RATE, 48000), 0);
+  EXPECT_EQ(blip.samples_available(), 0);
+}
+
+// a step lands where its clock falls, delayed by half the kernel, at its
+// full height, then the DC blocker slowly pulls it back to zero
+TEST (BlipBufferTest, StepPositionAndHeight) {
+  BlipBuffer blip;
+  blip.set_rates(CLOCK_RATE, 48000, 1000);
+  uint64_t clock = 1000 + 37290; // 1000 samples in
+  blip.add_delta(clock, 0.5f);
+  blip.end_frame(1000 + uint64_t(CLOCK_RATE));
+  std::vector<int16_t> out = read_all(blip);
+  ASSERT_GE(out.size(), 47990u);
+  int crossing = 0;
+  while (out[crossing] < 16384 / 2) {
+    crossing++;
+  }
+  EXPECT_EQ(crossing, 1000 + BlipBuffer::KERNEL_TAPS / 2 - 1);
+  for (int i = 0; i < 990; i++) {
+    EXPECT_EQ(out[i], 0);
+  }
+  EXPECT_NEAR(out[crossing + 8], 16384, 16384 * 0.05);
+  EXPECT_LT(std::abs(int(out[47000])), 10);
+}
+
+static std::vector<int16_t> noise(bool vectorized, uint64_t frame) {
+  BlipBuffer blip(vectorized);
+  blip.set_rates(CLOCK_RATE, 44100);
+  srand(32);
+  uint64_t clock = 0;
+  uint64_t frame_end = frame;
+  for (int i = 0; i < 200000; i++) {
+    clock += rand() % 40;
+    while (clock >= frame_end) {
+      blip.end_frame(frame_end);
+      frame_end += frame;
+    }
+    blip.add_delta(clock, (rand() % 31 - 15) / 64.0f);
+  }
+  blip.end_frame(clock);
+  return read_all(blip);
+}
+
+TEST (BlipBufferTest, EndFrameTimingDoesNotMatter) {
+  std::vector<int16_t> once = noise(true, UINT64_MAX / 2);
+  EXPECT_GT(once.size(), 90000u);
+  EXPECT_EQ(once, noise(true, 29781));
+  EXPECT_EQ(once, noise(true, 7));
+}
+
+TEST (BlipBufferTest, VectorizedMatchesScalar) {
+  std::vector<int16_t> scalar = noise(false, 29781);
+  std::vector<int16_t> vector = noise(true, 29781);
+  ASSERT_EQ(scalar.size(), vector.size());
+  for (size_t i = 0; i < scalar.size(); i++) {
+    ASSERT_NEAR(scalar[i], vector[i], 1) << "sample " << i;
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,218 @@
+#include "console.h"
+
+#include <cstring>
+#include <type_traits>
+
+namespace nesemu {
+
+// odd frames are a dot shorter with rendering on
+const double Console::FRAME_HZ = 39375000.0 / 22 / ((341.0 * 262 - 0.5) / 3);
+
+static_assert(std::is_trivially_copyable<ConsoleSnapshot>::value,
+              "snapshots are copied as bytes");
+
+static const size_t INES_HEADER = 16;
+static const size_t INES_TRAINER = 512;
+static const size_t PRG_BANK = 0x4000;
+static const size_t CHR_BANK = 0x2000;
+
+Console::Console() {
+  memset(ram, 0, sizeof ram);
+  memset(prg_ram, 0, sizeof prg_ram);
+  nmi_line = false;
+
+  Bus& bus = cpu.get_bus();
+  bus.unmap(0x0000, 0x10000);
+  bus.map_memory(0x0000, 0x2000, ram, sizeof ram);
+  bus.map_io(0x2000, 0x2000, read_ppu, write_ppu, this);
+  bus.map_io(0x4000, 0x100, read_io, write_io, this);
+  bus.map_memory(0x6000, 0x2000, prg_ram, sizeof prg_ram);
+  cpu.set_oam_dma(oam_dma, this);
+  apu.set_dmc_reader(Bus::read_bus, &bus);
+}
+
+/* Cartridge */
+int Console::load_rom(const uint8_t* image, size_t size) {
+  if (size < INES_HEADER || memcmp(image, "NES\x1A", 4)) {
+    return 1;
+  }
+  size_t prg_size = image[4] * PRG_BANK;
+  size_t chr_size = image[5] * CHR_BANK;
+  int mapper = (image[6] >> 4) | (image[7] & 0xF0);
+  size_t offset = INES_HEADER + ((image[6] & 0x04) ? INES_TRAINER : 0);
+  if (mapper != 0 || !prg_size || prg_size > 2 * PRG_BANK ||
+      chr_size > CHR_BANK || offset + prg_size + chr_size > size) {
+    return 1;
+  }
+  prg_rom.assign(image + offset, image + offset + prg_size);
+  cpu.get_bus().map_rom(0x8000, 0x8000, &prg_rom[0], uint32_t(prg_size));
+  for (size_t i = 0; i < CHR_BANK; i++) { // CHR RAM when there is no ROM
+    ppu.set_vram(uint16_t(i), chr_size ? image[offset + prg_size + i] : 0);
+  }
+  if (image[6] & 0x08) {
+    ppu.set_mirroring(MIRROR_FOUR_SCREEN);
+  } else {
+    ppu.set_mirroring((image[6] & 0x01) ? MIRROR_VERTICAL
+                                        : MIRROR_HORIZONTAL);
+  }
+  reset();
+  return 0;
+}
+
+void Console::reset() {
+  cpu.reset();
+  sync();
+}
+
+/* Running */
+void Console::sync() {
+  ppu.run(cpu.get_cycles() * 3);
+  apu.run(cpu.get_cycles());
+}
+
+int Console::run_frame() {
+  uint64_t frame = ppu.get_frame_count();
+  while (ppu.get_frame_count() == frame) {
+    bool nmi = ppu.get_nmi();
+    if (nmi && !nmi_line) {
+      cpu.nmi();
+    }
+    nmi_line = nmi;
+    if (cpu.step()) {
+      deliver_writes();
+      return 1;
+    }
+    sync();
+    uint64_t stall = apu.take_stall_cycles();
+    if (stall) {
+      cpu.add_stall_cycles(stall);
+      sync();
+    }
+  }
+  deliver_writes();
+  return 0;
+}
+
+void Console::deliver_writes() {
+  WriteWatch* watch = cpu.get_bus().get_write_watch();
+  if (watch) {
+    watch->deliver();
+  }
+}
+
+uint64_t Console::get_frame_count() const {
+  return ppu.get_frame_count();
+}
+
+/* Components */
+CPU& Console::get_cpu() {
+  return cpu;
+}
+
+PPU& Console::get_ppu() {
+  return ppu;
+}
+
+APU& Console::get_apu() {
+  return apu;
+}
+
+Controller& Console::get_controller(int port) {
+  return pads[port & 1];
+}
+
+const uint8_t* Console::get_ram() const {
+  return ram;
+}
+
+/* Savestates */
+void Console::save_state(ConsoleState& state) const {
+  cpu.save_state(state.cpu);
+  state.ppu = ppu;
+  state.apu = apu;
+  state.pads[0] = pads[0];
+  state.pads[1] = pads[1];
+  memcpy(state.ram, ram, sizeof ram);
+  memcpy(state.prg_ram, prg_ram, sizeof prg_ram);
+  state.nmi_line = nmi_line;
+}
+
+void Console::load_state(const ConsoleState& state) {
+  cpu.load_state(state.cpu);
+  ppu = state.ppu;
+  apu = state.apu;
+  pads[0] = state.pads[0];
+  pads[1] = state.pads[1];
+  memcpy(ram, state.ram, sizeof ram);
+  memcpy(prg_ram, state.prg_ram, sizeof prg_ram);
+  nmi_line = state.nmi_line;
+}
+
+void Console::save_snapshot(ConsoleSnapshot& snapshot) const {
+  memset(static_cast<void*>(&snapshot), 0, sizeof snapshot);
+  cpu.save_state(snapshot.cpu);
+  ppu.save_state(snapshot.ppu);
+  apu.save_state(snapshot.apu);
+  pads[0].save_state(snapshot.pads[0]);
+  pads[1].save_state(snapshot.pads[1]);
+  memcpy(snapshot.ram, ram, sizeof ram);
+  memcpy(snapshot.prg_ram, prg_ram, sizeof prg_ram);
+  snapshot.nmi_line = nmi_line;
+}
+
+void Console::load_snapshot(const ConsoleSnapshot& snapshot) {
+  cpu.load_state(snapshot.cpu);
+  ppu.load_state(snapshot.ppu);
+  apu.load_state(snapshot.apu);
+  pads[0].load_state(snapshot.pads[0]);
+  pads[1].load_state(snapshot.pads[1]);
+  memcpy(ram, snapshot.ram, sizeof ram);
+  memcpy(prg_ram, snapshot.prg_ram, sizeof prg_ram);
+  nmi_line = snapshot.nmi_line;
+}
+
+/* I/O */
+uint8_t Console::read_ppu(void* context, uint16_t address) {
+  Console* console = static_cast<Console*>(context);
+  console->sync();
+  return console->ppu.read_register(address);
+}
+
+void Console::write_ppu(void* context, uint16_t address, uint8_t value) {
+  Console* console = static_cast<Console*>(context);
+  console->sync();
+  console->ppu.write_register(address, value);
+}
+
+uint8_t Console::read_io(void* context, uint16_t address) {
+  Console* console = static_cast<Console*>(context);
+  switch (address) {
+    case 0x4015:
+      console->sync();
+      return console->apu.read_status();
+    case 0x4016:
+      return console->pads[0].read();
+    case 0x4017:
+      return console->pads[1].read();
+  }
+  return uint8_t(address >> 8); // open bus
+}
+
+void Console::write_io(void* context, uint16_t address, uint8_t value) {
+  Console* console = static_cast<Console*>(context);
+  if (address == 0x4016) {
+    console->pads[0].write_strobe(value);
+    console->pads[1].write_strobe(value);
+  } else if (address <= 0x4017) {
+    console->sync();
+    console->apu.write_register(address, value);
+  }
+}
+
+void Console::oam_dma(void* context, const uint8_t* page) {
+  Console* console = static_cast<Console*>(context);
+  console->sync();
+  console->ppu.write_oam_dma(page);
+}
+
+} // namespace nesemu
@@ -0,0 +1,115 @@
+#ifndef NESEMU_CONSOLE_CONSOLE_H_
+#define NESEMU_CONSOLE_CONSOLE_H_
+
+#include "apu/apu.h"
+#include "controller/controller.h"
+#include "cpu/cpu.h"
+#include "ppu/ppu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* Everything a savestate has to put back
+  Taken and restored by plain copies of the components, the CPU only by
+  its registers: its bus mapping does not change after load_rom() and the
+  memory behind it is ram and prg_ram. A state only loads into the console
+  that saved it: the PPU and APU keep pointing at that console's memory
+  and I/O handlers, which is what makes the copies cheap enough to take
+  every frame.
+*/
+struct ConsoleState {
+  CPUState cpu;
+  PPU ppu;
+  APU apu;
+  Controller pads[2];
+  uint8_t ram[0x800];
+  uint8_t prg_ram[0x2000];
+  bool nmi_line;
+};
+
+/* A savestate that loads into any console with the same ROM
+  Only the emulated state, with no pointers into the console that took it
+  and without the host side (PPU output, audio buffers, handlers). It is
+  trivially copyable: it can be copied with memcpy, written to disk and
+  read back by another process. save_snapshot() zeroes the padding, so
+  consoles in the same state save the same bytes, whichever process they
+  run in. The layout changes with the code, VERSION and sizeof tell stored
+  snapshots apart.
+*/
+struct ConsoleSnapshot {
+  static const uint32_t VERSION = 2;
+
+  CPUState cpu;
+  PPUState ppu;
+  APUState apu;
+  ControllerState pads[2];
+  uint8_t ram[0x800];
+  uint8_t prg_ram[0x2000];
+  bool nmi_line;
+};
+
+/* The console: CPU, PPU, APU and pads wired through the CPU bus
+  $0000-$1FFF 2KB RAM (mirrored), $2000-$3FFF PPU registers, $4000-$40FF
+  APU and pads, $6000-$7FFF PRG RAM, $8000-$FFFF PRG ROM. The PPU and APU
+  are caught up to the CPU after every instruction and before any register
+  access. Cartridges are iNES images with mapper 0 (NROM).
+*/
+class Console {
+  public:
+    Console();
+
+    static const double FRAME_HZ; // NTSC, 60.0988
+
+    // Loads an iNES image and resets. Returns 1 on a bad image or an
+    // unsupported mapper.
+    int load_rom(const uint8_t* image, size_t size);
+    void reset();
+
+    // Runs until the PPU completes a frame, then delivers the writes the
+    // bus's WriteWatch recorded. Returns 1 if the CPU met an opcode it
+    // does not know.
+    int run_frame();
+    uint64_t get_frame_count() const;
+
+    CPU& get_cpu();
+    PPU& get_ppu();
+    APU& get_apu();
+    Controller& get_controller(int port); // 0 or 1
+    const uint8_t* get_ram() const;       // 2KB work RAM
+
+    /* Savestates */
+    void save_state(ConsoleState& state) const;
+    void load_state(const ConsoleState& state);
+    // Portable savestates, see ConsoleSnapshot. Loading keeps the PPU
+    // output and audio settings of this console.
+    void save_snapshot(ConsoleSnapshot& snapshot) const;
+    void load_snapshot(const ConsoleSnapshot& snapshot);
+
+  private:
+    Console(const Console&);
+    Console& operator=(const Console&);
+
+    CPU cpu;
+    PPU ppu;
+    APU apu;
+    Controller pads[2];
+    uint8_t ram[0x800];
+    uint8_t prg_ram[0x2000];
+    std::vector<uint8_t> prg_rom;
+    bool nmi_line; // last level seen, NMI is taken on the rising edge
+
+    void sync();
+    void deliver_writes();
+    static uint8_t read_ppu(void* context, uint16_t address);
+    static void write_ppu(void* context, uint16_t address, uint8_t value);
+    static uint8_t read_io(void* context, uint16_t address);
+    static void write_io(void* context, uint16_t address, uint8_t value);
+    static void oam_dma(void* context, const uint8_t* page);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONSOLE_CONSOLE_H_
@@ -0,0 +1,87 @@
+#include "console.h"
+#include "run_ahead.h"
+#include "test_rom.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int FRAMES = 600;
+
+// host microseconds per savestate round trip
+static double time_states(Console& console) {
+  ConsoleState* state = new ConsoleState;
+  const int rounds = 2000;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    console.save_state(*state);
+    console.load_state(*state);
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  delete state;
+  return elapsed.count() / rounds;
+}
+
+static void ignore_write(void* /* context */, uint16_t /* address */,
+                         uint8_t /* value */) {
+}
+
+// host microseconds per frame, with no watch, one on an untouched page,
+// and one on the zero page the test program writes all the time
+static void time_watches(const std::vector<uint8_t>& image) {
+  const uint16_t watched[] = {0, 0x0700, 0x0012};
+  const char* names[] = {"none", "other page", "zero page"};
+  printf("Write-watch frame times, us\n");
+  for (int i = 0; i < 3; i++) {
+    Console console;
+    console.load_rom(&image[0], image.size());
+    WriteWatch watch;
+    if (watched[i]) {
+      watch.add(watched[i], ignore_write, NULL);
+      console.get_cpu().get_bus().set_write_watch(&watch);
+    }
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int frame = 0; frame < FRAMES; frame++) {
+      console.run_frame();
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("  %-10s  %8.1f\n", names[i], elapsed.count() / FRAMES);
+  }
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  printf("Run-ahead frame times, ms per displayed frame (%d frames, "
+         "44100 Hz audio)\n", FRAMES);
+  printf("  frames ahead    mean     p99     max  over 16.6 ms\n");
+  for (int frames = 0; frames <= 4; frames++) {
+    Console console;
+    console.load_rom(&image[0], image.size());
+    console.get_apu().set_sample_rate(44100);
+    RunAhead ahead(console);
+    ahead.set_frames(frames);
+    int16_t buffer[4096];
+    for (int i = 0; i < FRAMES; i++) {
+      console.get_controller(0).set_buttons((i / 30) & 1 ? BUTTON_A : 0);
+      ahead.run_frame();
+      while (ahead.read_samples(buffer, 4096) > 0) {
+      }
+    }
+    FrameStats stats = ahead.get_stats();
+    printf("  %12d  %6.3f  %6.3f  %6.3f  %12llu\n", frames, stats.mean_ms,
+           stats.p99_ms, stats.max_ms, (unsigned long long)stats.over_budget);
+  }
+  Console console;
+  console.load_rom(&image[0], image.size());
+  console.run_frame();
+  printf("Savestate save + load: %.1f us, %zu bytes\n", time_states(console),
+         sizeof(ConsoleState));
+  time_watches(image);
+  return 0;
+}
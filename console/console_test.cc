@@ -0,0 +1,176 @@
+#include "console.h"
+#include "test_rom.h"
+
+#include "gtest/gtest.h"
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace nesemu {
+
+TEST (ConsoleRomTest, BadImages) {
+  Console console;
+  std::vector<uint8_t> image = make_test_rom();
+  EXPECT_EQ(console.load_rom(&image[0], 8), 1);
+  EXPECT_EQ(console.load_rom(&image[0], image.size() - 1), 1); // truncated
+  image[6] |= 0x10; // mapper 1
+  EXPECT_EQ(console.load_rom(&image[0], image.size()), 1);
+  image[6] &= 0x0F;
+  image[0] = 'M';
+  EXPECT_EQ(console.load_rom(&image[0], image.size()), 1);
+  image[0] = 'N';
+  EXPECT_EQ(console.load_rom(&image[0], image.size()), 0);
+  EXPECT_EQ(console.get_cpu().get_pc(), 0xC000);
+  EXPECT_EQ(console.get_cpu().get_memory(0x8000), 0x78); // mirrored
+}
+
+TEST (ConsoleRunTest, RunsFramesWithNmi) {
+  Console console;
+  std::vector<uint8_t> image = make_test_rom();
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  console.get_controller(0).set_buttons(BUTTON_A);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(console.run_frame(), 0);
+  }
+  EXPECT_EQ(console.get_frame_count(), 10u);
+  const uint8_t* ram = console.get_ram();
+  EXPECT_EQ(ram[0x11], 1);
+  EXPECT_EQ(ram[0x12], 9); // the first vblank comes before NMI is on
+  EXPECT_NE(ram[0x10], 0);
+  EXPECT_EQ(console.get_ppu().get_oam(0), 0x40); // DMA from $0200
+  EXPECT_EQ(console.get_ppu().get_vram(0x3F01), 0x21);
+  EXPECT_EQ(console.get_cpu().get_memory(0x0812), 9); // RAM mirror
+}
+
+static void count_write(void* context, uint16_t /* address */,
+                        uint8_t value) {
+  static_cast<std::vector<uint8_t>*>(context)->push_back(value);
+}
+
+// writes to the NMI's frame counter come at the end of each frame
+TEST (ConsoleRunTest, DeliversWatchedWrites) {
+  Console console;
+  std::vector<uint8_t> image = make_test_rom();
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  std::vector<uint8_t> values;
+  WriteWatch watch;
+  watch.add(0x0012, count_write, &values);
+  console.get_cpu().get_bus().set_write_watch(&watch);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(console.run_frame(), 0);
+    EXPECT_EQ(watch.get_pending(), 0u);
+  }
+  ASSERT_EQ(values.size(), 3u);
+  EXPECT_EQ(values[2], 3);
+
+  // a loaded state is still watched
+  ConsoleState* state = new ConsoleState;
+  console.save_state(*state);
+  console.run_frame();
+  console.load_state(*state);
+  console.run_frame();
+  delete state;
+  ASSERT_EQ(values.size(), 5u);
+  EXPECT_EQ(values[3], 4);
+  EXPECT_EQ(values[4], 4);
+  EXPECT_EQ(console.get_ram()[0x12], 4);
+}
+
+TEST (ConsoleStateTest, LoadRepeatsTheFuture) {
+  Console console;
+  std::vector<uint8_t> image = make_test_rom();
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  console.get_apu().set_sample_rate(44100);
+  for (int i = 0; i < 5; i++) {
+    console.run_frame();
+  }
+  ConsoleState* state = new ConsoleState;
+  console.save_state(*state);
+  std::vector<int16_t> first(4000), second(4000);
+  for (int i = 0; i < 5; i++) {
+    console.get_controller(0).set_buttons(i & 1 ? BUTTON_A : 0);
+    console.run_frame();
+  }
+  std::vector<uint8_t> ram(console.get_ram(), console.get_ram() + 0x800);
+  std::vector<uint8_t> frame(console.get_ppu().get_frame_buffer(),
+                             console.get_ppu().get_frame_buffer() + 256 * 240);
+  int first_count = console.get_apu().read_samples(&first[0], 4000);
+  uint64_t cycles = console.get_cpu().get_cycles();
+
+  console.load_state(*state);
+  for (int i = 0; i < 5; i++) {
+    console.get_controller(0).set_buttons(i & 1 ? BUTTON_A : 0);
+    console.run_frame();
+  }
+  EXPECT_EQ(console.get_cpu().get_cycles(), cycles);
+  EXPECT_EQ(memcmp(&ram[0], console.get_ram(), 0x800), 0);
+  EXPECT_EQ(memcmp(&frame[0], console.get_ppu().get_frame_buffer(),
+                   frame.size()), 0);
+  int second_count = console.get_apu().read_samples(&second[0], 4000);
+  EXPECT_GT(first_count, 3000);
+  EXPECT_EQ(first_count, second_count);
+  EXPECT_EQ(first, second);
+  delete state;
+}
+
+// a snapshot taken headless carries on identically in another console
+TEST (ConsoleStateTest, SnapshotLoadsIntoAnotherConsole) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console* first = new Console;
+  Console* second = new Console;
+  ASSERT_EQ(first->load_rom(&image[0], image.size()), 0);
+  ASSERT_EQ(second->load_rom(&image[0], image.size()), 0);
+  first->get_ppu().set_render_mode(RENDER_NONE);
+  for (int i = 0; i < 7; i++) {
+    first->get_controller(0).set_buttons(i & 2 ? BUTTON_A : 0);
+    first->run_frame();
+  }
+  ConsoleSnapshot snapshot;
+  first->save_snapshot(snapshot);
+  first->get_ppu().set_render_mode(RENDER_FULL);
+  second->load_snapshot(snapshot);
+  EXPECT_EQ(second->get_frame_count(), first->get_frame_count());
+  for (int i = 0; i < 5; i++) {
+    for (int c = 0; c < 2; c++) {
+      Console* console = c ? second : first;
+      console->get_controller(0).set_buttons(i & 1 ? BUTTON_A : 0);
+      ASSERT_EQ(console->run_frame(), 0);
+    }
+    EXPECT_EQ(second->get_cpu().get_cycles(), first->get_cpu().get_cycles());
+    EXPECT_EQ(memcmp(first->get_ram(), second->get_ram(), 0x800), 0);
+    EXPECT_EQ(memcmp(first->get_ppu().get_frame_buffer(),
+                     second->get_ppu().get_frame_buffer(), 256 * 240), 0);
+  }
+  delete first;
+  delete second;
+}
+
+// consoles at different addresses, one built over junk, in the same state
+TEST (ConsoleStateTest, SameStateSavesSameBytes) {
+  std::vector<uint8_t> image = make_test_rom();
+  std::vector<uint8_t> junk(sizeof(Console) + 64, 0xA5);
+  Console* consoles[2] = {new Console, new (&junk[0]) Console};
+  ConsoleSnapshot* snapshots[2];
+  for (int c = 0; c < 2; c++) {
+    ASSERT_EQ(consoles[c]->load_rom(&image[0], image.size()), 0);
+    for (int i = 0; i < 7; i++) {
+      consoles[c]->get_controller(0).set_buttons(i & 2 ? BUTTON_A : 0);
+      ASSERT_EQ(consoles[c]->run_frame(), 0);
+    }
+    snapshots[c] = new ConsoleSnapshot;
+    memset(static_cast<void*>(snapshots[c]), c ? 0xFF : 0,
+           sizeof(ConsoleSnapshot));
+    consoles[c]->save_snapshot(*snapshots[c]);
+  }
+  const uint8_t* bytes[2] = {reinterpret_cast<uint8_t*>(snapshots[0]),
+                             reinterpret_cast<uint8_t*>(snapshots[1])};
+  for (size_t i = 0; i < sizeof(ConsoleSnapshot); i++) {
+    ASSERT_EQ(bytes[0][i], bytes[1][i]) << "byte " << i;
+  }
+  delete consoles[0];
+  consoles[1]->~Console();
+  delete snapshots[0];
+  delete snapshots[1];
+}
+
+} // namespace nesemu
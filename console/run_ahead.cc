@@ -0,0 +1,152 @@
+#include "run_ahead.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace nesemu {
+
+const double RunAhead::BIN_MS = 0.05;
+
+RunAhead::RunAhead(Console& console) : console(console) {
+  frames = 0;
+  real_audio = true;
+  frame.assign(PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT, 0);
+  samples_read = 0;
+  reset_stats();
+}
+
+int RunAhead::set_frames(int frames) {
+  if (frames < 0 || frames > MAX_FRAMES) {
+    return 1;
+  }
+  this->frames = frames;
+  return 0;
+}
+
+int RunAhead::get_frames() const {
+  return frames;
+}
+
+void RunAhead::set_real_audio(bool real) {
+  real_audio = real;
+}
+
+bool RunAhead::get_real_audio() const {
+  return real_audio;
+}
+
+int RunAhead::run_frame() {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  PPU& ppu = console.get_ppu();
+  int result = 0;
+  if (!frames) {
+    ppu.set_render_mode(RENDER_FULL);
+    result = console.run_frame();
+    take_samples(true);
+  } else {
+    ppu.set_render_mode(RENDER_NONE);
+    result = console.run_frame();
+    if (real_audio) {
+      take_samples(true);
+    }
+    console.save_state(state);
+    for (int i = 1; i <= frames && !result; i++) {
+      if (i == frames) {
+        ppu.set_render_mode(RENDER_FULL);
+        if (!real_audio) {
+          take_samples(false); // everything up to the frame shown
+        }
+      }
+      result = console.run_frame();
+    }
+    if (!real_audio) {
+      take_samples(true);
+    }
+  }
+  memcpy(&frame[0], ppu.get_frame_buffer(), frame.size());
+  if (frames) {
+    console.load_state(state);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  record(elapsed.count());
+  return result;
+}
+
+const uint8_t* RunAhead::get_frame_buffer() const {
+  return &frame[0];
+}
+
+// drains the APU, keeping or dropping what it had
+void RunAhead::take_samples(bool keep) {
+  APU& apu = console.get_apu();
+  if (!apu.get_sample_rate()) {
+    return;
+  }
+  if (samples_read == samples.size()) {
+    samples.clear();
+    samples_read = 0;
+  }
+  int16_t buffer[1024];
+  int count;
+  while ((count = apu.read_samples(buffer, 1024)) > 0) {
+    if (keep) {
+      samples.insert(samples.end(), buffer, buffer + count);
+    }
+  }
+}
+
+int RunAhead::read_samples(int16_t* out, int max) {
+  int count = int(samples.size() - samples_read);
+  if (count > max) {
+    count = max;
+  }
+  if (count > 0) {
+    memcpy(out, &samples[samples_read], count * sizeof(int16_t));
+    samples_read += count;
+  }
+  return count;
+}
+
+/* Statistics */
+void RunAhead::record(double ms) {
+  frame_count++;
+  total_ms += ms;
+  if (ms > max_ms) {
+    max_ms = ms;
+  }
+  if (ms > 1000.0 / Console::FRAME_HZ) {
+    over_budget++;
+  }
+  int bin = int(ms / BIN_MS);
+  histogram[bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS - 1]++;
+}
+
+FrameStats RunAhead::get_stats() const {
+  FrameStats stats;
+  stats.frames = frame_count;
+  stats.mean_ms = frame_count ? total_ms / frame_count : 0;
+  stats.max_ms = max_ms;
+  stats.over_budget = over_budget;
+  stats.p99_ms = 0;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BINS && frame_count; i++) {
+    seen += histogram[i];
+    if (seen * 100 >= frame_count * 99) {
+      stats.p99_ms = (i + 1) * BIN_MS;
+      break;
+    }
+  }
+  return stats;
+}
+
+void RunAhead::reset_stats() {
+  frame_count = 0;
+  total_ms = 0;
+  max_ms = 0;
+  over_budget = 0;
+  memset(histogram, 0, sizeof histogram);
+}
+
+} // namespace nesemu
@@ -0,0 +1,78 @@
+#ifndef NESEMU_CONSOLE_RUN_AHEAD_H_
+#define NESEMU_CONSOLE_RUN_AHEAD_H_
+
+#include "console.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* Frame time statistics, host milliseconds per displayed frame */
+struct FrameStats {
+  uint64_t frames;
+  double mean_ms;
+  double p99_ms;
+  double max_ms;
+  uint64_t over_budget; // frames longer than one NTSC frame (16.64 ms)
+};
+
+/* Run-ahead for interactive play
+  Each displayed frame runs the real frame with the current input, saves
+  the console, runs N more frames with the same input, shows the last of
+  them and restores. A game that reacts to input a frame or two late then
+  shows the reaction N frames sooner. Only the shown frame is rasterized:
+  the real frame and all but the last frame ahead run headless, which keeps
+  the CPU observable state exact and makes N + 1 emulated frames per
+  displayed frame affordable.
+
+  Audio comes by default from the real timeline only, so it never glitches
+  when the guess about future input is wrong. Otherwise it is the audio of
+  the last frame run ahead: N frames sooner, but a changed input can click.
+*/
+class RunAhead {
+  public:
+    explicit RunAhead(Console& console);
+
+    static const int MAX_FRAMES = 8;
+
+    int set_frames(int frames); // 0 - MAX_FRAMES, returns 1 otherwise
+    int get_frames() const;
+    void set_real_audio(bool real);
+    bool get_real_audio() const;
+
+    // One displayed frame. Returns 1 if the console stopped on a bad opcode.
+    int run_frame();
+    const uint8_t* get_frame_buffer() const; // 256x240 color indices
+    // audio of the displayed frames so far, as APU::read_samples()
+    int read_samples(int16_t* out, int max);
+
+    FrameStats get_stats() const;
+    void reset_stats();
+
+  private:
+    static const int HISTOGRAM_BINS = 1000;
+    static const double BIN_MS; // histogram resolution
+
+    Console& console;
+    int frames;
+    bool real_audio;
+    ConsoleState state;
+    std::vector<uint8_t> frame;
+    std::vector<int16_t> samples;
+    size_t samples_read;
+
+    uint64_t frame_count;
+    double total_ms;
+    double max_ms;
+    uint64_t over_budget;
+    uint32_t histogram[HISTOGRAM_BINS]; // the last bin takes everything over
+
+    void take_samples(bool keep);
+    void record(double ms);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONSOLE_RUN_AHEAD_H_
@@ -0,0 +1,92 @@
+#include "run_ahead.h"
+#include "test_rom.h"
+
+#include "gtest/gtest.h"
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+TEST (RunAheadTest, BadFrames) {
+  Console console;
+  RunAhead ahead(console);
+  EXPECT_EQ(ahead.set_frames(-1), 1);
+  EXPECT_EQ(ahead.set_frames(RunAhead::MAX_FRAMES + 1), 1);
+  EXPECT_EQ(ahead.set_frames(2), 0);
+  EXPECT_EQ(ahead.get_frames(), 2);
+  EXPECT_TRUE(ahead.get_real_audio());
+}
+
+// The frame shown is the one a plain console reaches N frames later, the
+// real timeline and its audio are not disturbed.
+TEST (RunAheadTest, ShowsFramesAhead) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console plain, console;
+  ASSERT_EQ(plain.load_rom(&image[0], image.size()), 0);
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  plain.get_apu().set_sample_rate(44100);
+  console.get_apu().set_sample_rate(44100);
+  RunAhead ahead(console);
+  ASSERT_EQ(ahead.set_frames(2), 0);
+
+  std::vector<std::vector<uint8_t> > plain_frames;
+  std::vector<int16_t> plain_audio, ahead_audio;
+  int16_t buffer[2048];
+  int count;
+  for (int i = 0; i < 12; i++) {
+    plain.get_controller(0).set_buttons(i >= 6 ? BUTTON_A : 0);
+    ASSERT_EQ(plain.run_frame(), 0);
+    const uint8_t* pixels = plain.get_ppu().get_frame_buffer();
+    plain_frames.push_back(std::vector<uint8_t>(pixels, pixels + 256 * 240));
+    while ((count = plain.get_apu().read_samples(buffer, 2048)) > 0) {
+      plain_audio.insert(plain_audio.end(), buffer, buffer + count);
+    }
+  }
+  for (int i = 0; i < 10; i++) {
+    console.get_controller(0).set_buttons(i >= 6 ? BUTTON_A : 0);
+    ASSERT_EQ(ahead.run_frame(), 0);
+    // a guess made before the input changed is wrong for frames after it
+    bool guessed_right = i < 4 || i >= 6;
+    EXPECT_EQ(memcmp(ahead.get_frame_buffer(), &plain_frames[i + 2][0],
+                     256 * 240) == 0, guessed_right) << "frame " << i;
+    EXPECT_EQ(console.get_frame_count(), uint64_t(i + 1));
+    while ((count = ahead.read_samples(buffer, 2048)) > 0) {
+      ahead_audio.insert(ahead_audio.end(), buffer, buffer + count);
+    }
+  }
+  ASSERT_GT(ahead_audio.size(), 7000u);
+  ASSERT_GE(plain_audio.size(), ahead_audio.size());
+  EXPECT_TRUE(std::equal(ahead_audio.begin(), ahead_audio.end(),
+                         plain_audio.begin()));
+
+  FrameStats stats = ahead.get_stats();
+  EXPECT_EQ(stats.frames, 10u);
+  EXPECT_GT(stats.mean_ms, 0.0);
+  EXPECT_GE(stats.max_ms, stats.mean_ms);
+  EXPECT_GT(stats.p99_ms, 0.0);
+  ahead.reset_stats();
+  EXPECT_EQ(ahead.get_stats().frames, 0u);
+}
+
+// audio from the last frame run ahead, one frame of it per frame shown
+TEST (RunAheadTest, AheadAudio) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  console.get_apu().set_sample_rate(48000);
+  RunAhead ahead(console);
+  ahead.set_frames(3);
+  ahead.set_real_audio(false);
+  int16_t buffer[4096];
+  int total = 0;
+  for (int i = 0; i < 60; i++) {
+    ahead.run_frame();
+    int count;
+    while ((count = ahead.read_samples(buffer, 4096)) > 0) {
+      total += count;
+    }
+  }
+  EXPECT_NEAR(total, 48000 * 60 / Console::FRAME_HZ, 800);
+}
+
+} // namespace nesemu
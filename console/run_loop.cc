@@ -0,0 +1,138 @@
+#include "run_loop.h"
+
+#include <cstring>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nesemu {
+
+const double RunLoop::JITTER_LIMIT_MS = 0.5;
+const double RunLoop::BIN_MS = 0.01;
+
+RunLoop::RunLoop(Console& console) : console(console) {
+  mode = PACE_UNTHROTTLED;
+  spin_ms = 1.5;
+  paced_frames = 0;
+  reset_jitter();
+}
+
+void RunLoop::set_mode(PaceMode mode) {
+  if (mode == PACE_REAL_TIME && this->mode != PACE_REAL_TIME) {
+    anchor = Clock::now();
+    paced_frames = 0;
+  }
+  this->mode = mode;
+}
+
+PaceMode RunLoop::get_mode() const {
+  return mode;
+}
+
+int RunLoop::set_spin_ms(double ms) {
+  if (!(ms >= 0 && ms <= 10)) {
+    return 1;
+  }
+  spin_ms = ms;
+  return 0;
+}
+
+double RunLoop::get_spin_ms() const {
+  return spin_ms;
+}
+
+int RunLoop::run_frame() {
+  int result = console.run_frame();
+  if (mode != PACE_REAL_TIME || result) {
+    return result;
+  }
+  paced_frames++;
+  // from the frame count so that rounding never accumulates
+  Clock::time_point deadline =
+      anchor + std::chrono::duration_cast<Clock::duration>(
+                   std::chrono::duration<double>(paced_frames /
+                                                 Console::FRAME_HZ));
+  wait_until(deadline);
+  Clock::time_point now = Clock::now();
+  std::chrono::duration<double, std::milli> late = now - deadline;
+  if (late.count() > 1000.0 / Console::FRAME_HZ) {
+    anchor = now;
+    paced_frames = 0;
+    resyncs++;
+  }
+  record(late.count());
+  return 0;
+}
+
+int RunLoop::run(uint64_t count) {
+  for (uint64_t i = 0; i < count; i++) {
+    if (run_frame()) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// sleeps while the scheduler can be trusted to wake up in time, then spins
+void RunLoop::wait_until(Clock::time_point deadline) const {
+  Clock::duration spin = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double, std::milli>(spin_ms));
+  Clock::time_point now = Clock::now();
+  if (deadline - now > spin) {
+    std::this_thread::sleep_until(deadline - spin);
+  }
+  while (Clock::now() < deadline) {
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+  }
+}
+
+/* Statistics */
+void RunLoop::record(double ms) {
+  frame_count++;
+  total_ms += ms;
+  if (ms > max_ms) {
+    max_ms = ms;
+  }
+  if (ms > JITTER_LIMIT_MS) {
+    over_limit++;
+  }
+  int bin = int(ms / BIN_MS);
+  histogram[bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS - 1]++;
+}
+
+JitterStats RunLoop::get_jitter() const {
+  JitterStats stats;
+  stats.frames = frame_count;
+  stats.mean_ms = frame_count ? total_ms / frame_count : 0;
+  stats.max_ms = max_ms;
+  stats.over_limit = over_limit;
+  stats.resyncs = resyncs;
+  stats.p99_ms = 0;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BINS && frame_count; i++) {
+    seen += histogram[i];
+    if (seen * 100 >= frame_count * 99) {
+      stats.p99_ms = (i + 1) * BIN_MS;
+      break;
+    }
+  }
+  return stats;
+}
+
+const uint32_t* RunLoop::get_jitter_histogram() const {
+  return histogram;
+}
+
+void RunLoop::reset_jitter() {
+  frame_count = 0;
+  total_ms = 0;
+  max_ms = 0;
+  over_limit = 0;
+  resyncs = 0;
+  memset(histogram, 0, sizeof histogram);
+}
+
+} // namespace nesemu
@@ -0,0 +1,88 @@
+#ifndef NESEMU_CONSOLE_RUN_LOOP_H_
+#define NESEMU_CONSOLE_RUN_LOOP_H_
+
+#include "console.h"
+
+#include <chrono>
+#include <cstdint>
+
+namespace nesemu {
+
+enum PaceMode {
+  PACE_UNTHROTTLED, // as fast as the host goes, for training
+  PACE_REAL_TIME    // one frame per 1 / 60.0988 s, for play
+};
+
+/* Pacing jitter, how far from its deadline each real-time frame ended */
+struct JitterStats {
+  uint64_t frames;
+  double mean_ms;
+  double p99_ms;
+  double max_ms;
+  uint64_t over_limit; // frames off by more than JITTER_LIMIT_MS
+  uint64_t resyncs;    // deadlines given up after falling a frame behind
+};
+
+/* Frame loop driving a Console
+  Unthrottled, run_frame() returns as soon as the frame is emulated: no
+  sleeping and no clock reads. In real time it then waits for the frame's
+  deadline, a fixed grid of NTSC frame periods from the moment real time
+  was entered, so the rate does not drift with per-frame rounding. The
+  wait sleeps until spin_ms before the deadline, which absorbs the
+  scheduler's wake-up latency, and spins the rest of the way.
+
+  Pacing only happens between frames, so switching modes at any point
+  leaves the emulation exactly where a loop that never switched would be.
+  Entering real time starts a new grid from the current moment. A frame
+  that ends more than a period late also starts a new grid, instead of
+  running the next frames back to back to catch up.
+*/
+class RunLoop {
+  public:
+    explicit RunLoop(Console& console);
+
+    static const double JITTER_LIMIT_MS; // 0.5
+    static const int HISTOGRAM_BINS = 1000;
+    static const double BIN_MS;          // histogram resolution, 0.01
+
+    void set_mode(PaceMode mode);
+    PaceMode get_mode() const;
+    // how long before a deadline sleeping stops, 0 - 10 ms. Returns 1
+    // otherwise.
+    int set_spin_ms(double ms);
+    double get_spin_ms() const;
+
+    // Emulates a frame and paces it. Returns 1 if the console stopped on a
+    // bad opcode.
+    int run_frame();
+    // Runs count frames, stopping early on a bad opcode as run_frame().
+    int run(uint64_t count);
+
+    JitterStats get_jitter() const;
+    // frames per bin, the last bin takes everything over
+    const uint32_t* get_jitter_histogram() const;
+    void reset_jitter();
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    Console& console;
+    PaceMode mode;
+    double spin_ms;
+    Clock::time_point anchor; // start of the deadline grid
+    uint64_t paced_frames;    // frames on the grid so far
+
+    uint64_t frame_count;
+    double total_ms;
+    double max_ms;
+    uint64_t over_limit;
+    uint64_t resyncs;
+    uint32_t histogram[HISTOGRAM_BINS];
+
+    void wait_until(Clock::time_point deadline) const;
+    void record(double ms);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONSOLE_RUN_LOOP_H_
@@ -0,0 +1,71 @@
+#include "run_loop.h"
+#include "test_rom.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int FRAMES = 300;
+
+// Paces FRAMES frames with the given spin margin and prints the jitter.
+static void pace(const std::vector<uint8_t>& image, double spin_ms) {
+  Console console;
+  console.load_rom(&image[0], image.size());
+  RunLoop loop(console);
+  loop.set_spin_ms(spin_ms);
+  loop.set_mode(PACE_REAL_TIME);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  loop.run(FRAMES);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  JitterStats stats = loop.get_jitter();
+  printf("  spin %.1f ms: %.4f Hz, jitter mean %.3f p99 %.3f max %.3f ms, "
+         "%llu over %.1f ms, %llu resyncs\n", spin_ms,
+         FRAMES / elapsed.count(), stats.mean_ms, stats.p99_ms, stats.max_ms,
+         (unsigned long long)stats.over_limit, RunLoop::JITTER_LIMIT_MS,
+         (unsigned long long)stats.resyncs);
+  // 0.05 ms buckets up to 1 ms, then the rest
+  const uint32_t* histogram = loop.get_jitter_histogram();
+  const int per_bucket = int(0.05 / RunLoop::BIN_MS + 0.5);
+  for (int bucket = 0; bucket <= 20; bucket++) {
+    int first = bucket * per_bucket;
+    int last = bucket < 20 ? first + per_bucket : RunLoop::HISTOGRAM_BINS;
+    uint32_t count = 0;
+    for (int i = first; i < last; i++) {
+      count += histogram[i];
+    }
+    if (!count) {
+      continue;
+    }
+    if (bucket < 20) {
+      printf("    %.2f-%.2f ms %5u\n", first * RunLoop::BIN_MS,
+             last * RunLoop::BIN_MS, count);
+    } else {
+      printf("    >= %.2f ms   %5u\n", first * RunLoop::BIN_MS, count);
+    }
+  }
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+
+  Console console;
+  console.load_rom(&image[0], image.size());
+  RunLoop loop(console);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  loop.run(FRAMES * 10);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("Unthrottled: %.0f frames/sec (%.1fx real time)\n",
+         FRAMES * 10 / elapsed.count(),
+         FRAMES * 10 / elapsed.count() / Console::FRAME_HZ);
+
+  printf("Real time at %.4f Hz, %d frames\n", Console::FRAME_HZ, FRAMES);
+  pace(image, 0);   // sleep only
+  pace(image, 1.5); // the default
+  return 0;
+}
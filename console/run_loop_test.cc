@@ -0,0 +1,82 @@
+#include "run_loop.h"
+#include "test_rom.h"
+
+#include "gtest/gtest.h"
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+TEST (RunLoopTest, Settings) {
+  Console console;
+  RunLoop loop(console);
+  EXPECT_EQ(loop.get_mode(), PACE_UNTHROTTLED);
+  EXPECT_EQ(loop.set_spin_ms(-1), 1);
+  EXPECT_EQ(loop.set_spin_ms(11), 1);
+  EXPECT_EQ(loop.set_spin_ms(2), 0);
+  EXPECT_EQ(loop.get_spin_ms(), 2);
+}
+
+TEST (RunLoopTest, UnthrottledDoesNotPace) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  RunLoop loop(console);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  ASSERT_EQ(loop.run(120), 0);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(console.get_frame_count(), 120u);
+  EXPECT_LT(elapsed.count(), 1.0); // two seconds of frames in real time
+  EXPECT_EQ(loop.get_jitter().frames, 0u);
+}
+
+TEST (RunLoopTest, RealTimeRate) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  RunLoop loop(console);
+  loop.set_mode(PACE_REAL_TIME);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  ASSERT_EQ(loop.run(30), 0);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_NEAR(elapsed.count(), 30 / Console::FRAME_HZ, 0.05);
+  JitterStats stats = loop.get_jitter();
+  EXPECT_EQ(stats.frames, 30u);
+  EXPECT_GE(stats.mean_ms, 0);
+  uint64_t binned = 0;
+  for (int i = 0; i < RunLoop::HISTOGRAM_BINS; i++) {
+    binned += loop.get_jitter_histogram()[i];
+  }
+  EXPECT_EQ(binned, 30u);
+  loop.reset_jitter();
+  EXPECT_EQ(loop.get_jitter().frames, 0u);
+}
+
+// Switching modes between frames leaves the console where a loop that never
+// switched would be.
+TEST (RunLoopTest, SwitchingKeepsState) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console plain, console;
+  ASSERT_EQ(plain.load_rom(&image[0], image.size()), 0);
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  RunLoop plain_loop(plain), loop(console);
+  for (int i = 0; i < 24; i++) {
+    loop.set_mode(i / 4 % 2 ? PACE_REAL_TIME : PACE_UNTHROTTLED);
+    plain.get_controller(0).set_buttons(i >= 10 ? BUTTON_START : 0);
+    console.get_controller(0).set_buttons(i >= 10 ? BUTTON_START : 0);
+    ASSERT_EQ(plain_loop.run_frame(), 0);
+    ASSERT_EQ(loop.run_frame(), 0);
+  }
+  EXPECT_EQ(loop.get_jitter().frames, 12u);
+  EXPECT_EQ(console.get_cpu().get_cycles(), plain.get_cpu().get_cycles());
+  EXPECT_EQ(memcmp(console.get_ram(), plain.get_ram(), 0x800), 0);
+  EXPECT_EQ(memcmp(console.get_ppu().get_frame_buffer(),
+                   plain.get_ppu().get_frame_buffer(), 256 * 240), 0);
+}
+
+} // namespace nesemu
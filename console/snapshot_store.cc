@@ -0,0 +1,244 @@
+#include "snapshot_store.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nesemu {
+
+// the first page of the file
+struct SnapshotStore::Header {
+  char magic[8];
+  uint32_t version;       // ConsoleSnapshot::VERSION
+  uint32_t snapshot_size; // sizeof(ConsoleSnapshot)
+  uint64_t slot_size;
+  uint32_t capacity;
+  uint32_t used;  // slots ever allocated, [0, used)
+  uint32_t free;  // first released slot, NONE for none
+  uint32_t count; // allocated
+};
+
+const uint32_t SnapshotStore::NONE;
+const size_t SnapshotStore::SLOT_ALIGN;
+
+static const char STORE_MAGIC[8] = {'N', 'E', 'S', 'S', 'L', 'O', 'T', 'S'};
+static const size_t HEADER_SIZE = 4096;
+static const size_t SLOT_SIZE =
+    (sizeof(ConsoleSnapshot) + SnapshotStore::SLOT_ALIGN - 1) /
+    SnapshotStore::SLOT_ALIGN * SnapshotStore::SLOT_ALIGN;
+
+SnapshotStore::SnapshotStore() {
+  memory = NULL;
+  size = 0;
+  header = NULL;
+  slots = NULL;
+}
+
+SnapshotStore::~SnapshotStore() {
+  close();
+}
+
+size_t SnapshotStore::get_size(uint32_t capacity) {
+  return HEADER_SIZE + size_t(capacity) * SLOT_SIZE;
+}
+
+int SnapshotStore::map(int fd, size_t size) {
+  void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return 1;
+  }
+  memory = static_cast<uint8_t*>(mapped);
+  this->size = size;
+  header = reinterpret_cast<Header*>(memory);
+  slots = memory + HEADER_SIZE;
+  return 0;
+}
+
+/* Files */
+int SnapshotStore::create(const std::string& path, uint32_t capacity) {
+  close();
+  if (capacity < 1 || capacity == NONE) {
+    return 1;
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+  size_t size = get_size(capacity);
+  if (ftruncate(fd, off_t(size))) {
+    ::close(fd);
+    unlink(path.c_str());
+    return 1;
+  }
+  if (map(fd, size)) {
+    unlink(path.c_str());
+    return 1;
+  }
+  memcpy(header->magic, STORE_MAGIC, sizeof STORE_MAGIC);
+  header->version = ConsoleSnapshot::VERSION;
+  header->snapshot_size = sizeof(ConsoleSnapshot);
+  header->slot_size = SLOT_SIZE;
+  header->capacity = capacity;
+  header->used = 0;
+  header->free = NONE;
+  header->count = 0;
+  in_use.clear();
+  return 0;
+}
+
+int SnapshotStore::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    return 1;
+  }
+  struct stat status;
+  if (fstat(fd, &status) || size_t(status.st_size) < HEADER_SIZE) {
+    ::close(fd);
+    return 1;
+  }
+  if (map(fd, size_t(status.st_size))) {
+    return 1;
+  }
+  bool good = !memcmp(header->magic, STORE_MAGIC, sizeof STORE_MAGIC) &&
+              header->version == ConsoleSnapshot::VERSION &&
+              header->snapshot_size == sizeof(ConsoleSnapshot) &&
+              header->slot_size == SLOT_SIZE && header->capacity >= 1 &&
+              header->capacity != NONE &&
+              get_size(header->capacity) == size &&
+              header->used <= header->capacity &&
+              header->count <= header->used;
+  if (!good || !load_free_list()) {
+    close();
+    return 1;
+  }
+  return 0;
+}
+
+// Marks the slots in use, every one ever allocated but those on the free
+// list. False when the list leaves the used slots, runs into a slot twice
+// or disagrees with the count.
+bool SnapshotStore::load_free_list() {
+  in_use.assign(header->used, 1);
+  uint32_t released = 0;
+  uint32_t slot = header->free;
+  while (slot != NONE) {
+    if (slot >= header->used || !in_use[slot]) {
+      return false;
+    }
+    in_use[slot] = 0;
+    released++;
+    memcpy(&slot, slots + size_t(slot) * SLOT_SIZE, sizeof slot);
+  }
+  return header->count == header->used - released;
+}
+
+void SnapshotStore::close() {
+  if (!memory) {
+    return;
+  }
+  munmap(memory, size);
+  memory = NULL;
+  size = 0;
+  header = NULL;
+  slots = NULL;
+  in_use.clear();
+}
+
+bool SnapshotStore::is_open() const {
+  return memory != NULL;
+}
+
+/* Slots */
+uint32_t SnapshotStore::allocate() {
+  std::lock_guard<std::mutex> hold(lock);
+  if (!memory) {
+    return NONE;
+  }
+  uint32_t slot = header->free;
+  if (slot != NONE) {
+    // a released slot starts with the next one's index, unless a save
+    // into the slot after its release overwrote it
+    uint32_t next;
+    if (slot >= header->used || in_use[slot]) {
+      return NONE;
+    }
+    memcpy(&next, slots + size_t(slot) * SLOT_SIZE, sizeof next);
+    if (next != NONE && (next >= header->used || in_use[next] ||
+                         next == slot)) {
+      return NONE;
+    }
+    header->free = next;
+  } else if (header->used < header->capacity) {
+    slot = header->used++;
+    in_use.push_back(0);
+  } else {
+    return NONE;
+  }
+  in_use[slot] = 1;
+  header->count++;
+  return slot;
+}
+
+int SnapshotStore::release(uint32_t slot) {
+  std::lock_guard<std::mutex> hold(lock);
+  if (!memory || slot >= header->used || !in_use[slot]) {
+    return 1;
+  }
+  memcpy(slots + size_t(slot) * SLOT_SIZE, &header->free,
+         sizeof header->free);
+  header->free = slot;
+  header->count--;
+  in_use[slot] = 0;
+  return 0;
+}
+
+ConsoleSnapshot* SnapshotStore::get(uint32_t slot) {
+  if (!memory || slot >= header->capacity) {
+    return NULL;
+  }
+  return reinterpret_cast<ConsoleSnapshot*>(slots + size_t(slot) * SLOT_SIZE);
+}
+
+const ConsoleSnapshot* SnapshotStore::get(uint32_t slot) const {
+  return const_cast<SnapshotStore*>(this)->get(slot);
+}
+
+/* Writing back */
+int SnapshotStore::sync(bool wait) {
+  if (!memory) {
+    return 1;
+  }
+  return msync(memory, size, wait ? MS_SYNC : MS_ASYNC) ? 1 : 0;
+}
+
+// msync() wants a page aligned start
+int SnapshotStore::sync(uint32_t slot, bool wait) {
+  if (!memory || slot >= header->capacity) {
+    return 1;
+  }
+  size_t page = size_t(sysconf(_SC_PAGESIZE));
+  size_t begin = HEADER_SIZE + size_t(slot) * SLOT_SIZE;
+  size_t end = begin + SLOT_SIZE;
+  begin -= begin % page;
+  return msync(memory + begin, end - begin, wait ? MS_SYNC : MS_ASYNC) ? 1
+                                                                        : 0;
+}
+
+uint32_t SnapshotStore::get_capacity() const {
+  return header ? header->capacity : 0;
+}
+
+uint32_t SnapshotStore::get_count() const {
+  std::lock_guard<std::mutex> hold(lock);
+  return header ? header->count : 0;
+}
+
+size_t SnapshotStore::get_slot_size() const {
+  return SLOT_SIZE;
+}
+
+} // namespace nesemu
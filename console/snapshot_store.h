@@ -0,0 +1,91 @@
+#ifndef NESEMU_CONSOLE_SNAPSHOT_STORE_H_
+#define NESEMU_CONSOLE_SNAPSHOT_STORE_H_
+
+#include "console.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nesemu {
+
+/* Millions of snapshots in one mapped file
+  The file is a header page and then capacity fixed-size slots, each
+  holding one ConsoleSnapshot, which is every component's state. It is
+  mapped whole, shared, so get() is a pointer into the mapping that a
+  console saves into or loads from directly: there is no serializing, no
+  heap block per state and no file per state. sync() writes the dirty
+  pages back with msync(), and open() maps the file again in a later
+  process as it was left.
+
+  Slots come off a free list kept in the file, released slots holding the
+  index of the next, then off the never used ones. Which slots are in use
+  is also kept in memory, rebuilt by open() walking the list, so a slot
+  released twice or a damaged list is refused rather than handing one slot
+  out twice. The file is sparse until slots are written, so a large
+  capacity costs address space only. Stores are told apart by
+  ConsoleSnapshot::VERSION and sizeof, so one written before a component's
+  state changed does not open.
+*/
+class SnapshotStore {
+  public:
+    SnapshotStore();
+    ~SnapshotStore(); // closes
+
+    static const uint32_t NONE = 0xFFFFFFFF; // no slot
+    static const size_t SLOT_ALIGN = 64;
+
+    // Makes the file at path afresh with capacity empty slots, or opens one
+    // made before. Return 1 when it cannot be made, mapped or is not a
+    // store of this build's snapshots.
+    int create(const std::string& path, uint32_t capacity);
+    int open(const std::string& path);
+    void close(); // without syncing, the kernel writes back in its time
+    bool is_open() const;
+
+    // A free slot, or NONE when all are used. Its contents are whatever
+    // was last there. A released slot holds the free list until it is
+    // allocated again: once something is saved into it, allocate() finds
+    // the list broken and returns NONE rather than a slot in use.
+    // Allocating and releasing are locked.
+    uint32_t allocate();
+    // Returns 1 when slot is not allocated, e.g. released already.
+    int release(uint32_t slot);
+
+    // the slot's snapshot in the mapping, valid until close()
+    ConsoleSnapshot* get(uint32_t slot);
+    const ConsoleSnapshot* get(uint32_t slot) const;
+
+    // Writes the whole mapping, or the pages of one slot, back to the
+    // file, waiting for it when wait. Only the first writes the free list
+    // and counts. Returns 1 on an msync() error.
+    int sync(bool wait = true);
+    int sync(uint32_t slot, bool wait = true);
+
+    uint32_t get_capacity() const;
+    uint32_t get_count() const; // allocated
+    size_t get_slot_size() const;
+
+  private:
+    SnapshotStore(const SnapshotStore&);
+    SnapshotStore& operator=(const SnapshotStore&);
+
+    struct Header;
+
+    uint8_t* memory;
+    size_t size;
+    Header* header;
+    uint8_t* slots;
+    mutable std::mutex lock;
+    std::vector<uint8_t> in_use; // of slots [0, used), guarded by lock
+
+    int map(int fd, size_t size);
+    bool load_free_list();
+    static size_t get_size(uint32_t capacity);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONSOLE_SNAPSHOT_STORE_H_
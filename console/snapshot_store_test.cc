@@ -0,0 +1,171 @@
+#include "snapshot_store.h"
+
+#include "test_rom.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace nesemu {
+
+// a file under a fresh directory, both removed after
+class SnapshotStoreTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      strcpy(directory, "/tmp/snapshot_store_testXXXXXX");
+      ASSERT_TRUE(mkdtemp(directory) != NULL);
+      path = std::string(directory) + "/states";
+    }
+
+    virtual void TearDown() {
+      unlink(path.c_str());
+      rmdir(directory);
+    }
+
+    char directory[32];
+    std::string path;
+};
+
+TEST_F (SnapshotStoreTest, AllocatesAndReleases) {
+  SnapshotStore store;
+  EXPECT_EQ(store.allocate(), SnapshotStore::NONE);
+  EXPECT_EQ(store.create(path, 0), 1);
+  ASSERT_EQ(store.create(path, 3), 0);
+  EXPECT_TRUE(store.is_open());
+  EXPECT_EQ(store.get_capacity(), 3u);
+  EXPECT_GE(store.get_slot_size(), sizeof(ConsoleSnapshot));
+  EXPECT_EQ(store.get_slot_size() % SnapshotStore::SLOT_ALIGN, 0u);
+  EXPECT_EQ(store.allocate(), 0u);
+  EXPECT_EQ(store.allocate(), 1u);
+  EXPECT_EQ(store.allocate(), 2u);
+  EXPECT_EQ(store.allocate(), SnapshotStore::NONE);
+  EXPECT_EQ(store.get_count(), 3u);
+  // released slots come back last in, first out, and only once
+  EXPECT_EQ(store.release(0), 0);
+  EXPECT_EQ(store.release(2), 0);
+  EXPECT_EQ(store.release(2), 1);
+  EXPECT_EQ(store.release(0), 1);
+  EXPECT_EQ(store.release(3), 1);
+  EXPECT_EQ(store.get_count(), 1u);
+  EXPECT_EQ(store.allocate(), 2u);
+  EXPECT_EQ(store.allocate(), 0u);
+  EXPECT_EQ(store.allocate(), SnapshotStore::NONE);
+  EXPECT_TRUE(store.get(2) != NULL);
+  EXPECT_TRUE(store.get(3) == NULL);
+}
+
+// a save into a released slot breaks the free list, which allocate()
+// refuses to follow
+TEST_F (SnapshotStoreTest, StaleSaveIntoReleasedSlot) {
+  const uint64_t links[3] = {0x12345678, 2, 1};
+  for (int i = 0; i < 3; i++) {
+    SnapshotStore store;
+    ASSERT_EQ(store.create(path, 4), 0);
+    for (uint32_t slot = 0; slot < 3; slot++) {
+      ASSERT_EQ(store.allocate(), slot);
+    }
+    ASSERT_EQ(store.release(1), 0);
+    store.get(1)->cpu.cycles = links[i]; // past the slots, in use, itself
+    EXPECT_EQ(store.allocate(), SnapshotStore::NONE) << links[i];
+    EXPECT_EQ(store.get_count(), 2u);
+  }
+}
+
+// slots are saved into and loaded from in place, and outlive the process's
+// mapping once synced
+TEST_F (SnapshotStoreTest, PersistsInPlace) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  uint32_t slots[2];
+  {
+    SnapshotStore store;
+    ASSERT_EQ(store.create(path, 1000), 0);
+    for (int i = 0; i < 2; i++) {
+      for (int frame = 0; frame < 5; frame++) {
+        ASSERT_EQ(console.run_frame(), 0);
+      }
+      slots[i] = store.allocate();
+      console.save_snapshot(*store.get(slots[i]));
+    }
+    store.release(store.allocate());
+    EXPECT_EQ(store.sync(slots[1]), 0);
+    EXPECT_EQ(store.sync(), 0);
+  }
+
+  SnapshotStore store;
+  ASSERT_EQ(store.open(path), 0);
+  EXPECT_EQ(store.get_capacity(), 1000u);
+  EXPECT_EQ(store.get_count(), 2u);
+  EXPECT_EQ(store.allocate(), 2u); // the released one
+  ConsoleSnapshot expected, state;
+  console.save_snapshot(expected);
+  Console loaded;
+  ASSERT_EQ(loaded.load_rom(&image[0], image.size()), 0);
+  loaded.load_snapshot(*store.get(slots[1]));
+  loaded.save_snapshot(state);
+  EXPECT_EQ(memcmp(state.ram, expected.ram, sizeof state.ram), 0);
+  EXPECT_EQ(state.cpu.pc, expected.cpu.pc);
+  EXPECT_EQ(state.cpu.cycles, expected.cpu.cycles);
+
+  // and runs on as the console it was saved from
+  loaded.load_snapshot(*store.get(slots[0]));
+  for (int frame = 0; frame < 5; frame++) {
+    ASSERT_EQ(loaded.run_frame(), 0);
+  }
+  loaded.save_snapshot(state);
+  EXPECT_EQ(memcmp(state.ram, expected.ram, sizeof state.ram), 0);
+  EXPECT_EQ(state.cpu.cycles, expected.cpu.cycles);
+}
+
+TEST_F (SnapshotStoreTest, RejectsOtherFiles) {
+  SnapshotStore store;
+  EXPECT_EQ(store.open(path), 1);
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  std::vector<char> junk(8192, 'x');
+  fwrite(&junk[0], 1, junk.size(), file);
+  fclose(file);
+  EXPECT_EQ(store.open(path), 1);
+  EXPECT_FALSE(store.is_open());
+
+  // cut short
+  ASSERT_EQ(store.create(path, 4), 0);
+  store.close();
+  ASSERT_EQ(truncate(path.c_str(), 4096 + 100), 0);
+  EXPECT_EQ(store.open(path), 1);
+}
+
+// a free list leaving the used slots or running in a circle does not open
+TEST_F (SnapshotStoreTest, RejectsDamagedFreeLists) {
+  // slot 0 is released first and ends the list: as left, out of range,
+  // back to slot 1
+  const uint32_t links[3] = {SnapshotStore::NONE, 7, 1};
+  for (int i = 0; i < 3; i++) {
+    SnapshotStore store;
+    ASSERT_EQ(store.create(path, 4), 0);
+    for (uint32_t slot = 0; slot < 3; slot++) {
+      ASSERT_EQ(store.allocate(), slot);
+    }
+    ASSERT_EQ(store.release(0), 0);
+    ASSERT_EQ(store.release(1), 0);
+    store.close();
+    ASSERT_EQ(store.open(path), 0);
+    EXPECT_EQ(store.release(1), 1); // still free after opening
+    EXPECT_EQ(store.release(2), 0);
+    EXPECT_EQ(store.allocate(), 2u);
+    store.close();
+
+    FILE* file = fopen(path.c_str(), "r+b");
+    ASSERT_TRUE(file != NULL);
+    fseek(file, 4096, SEEK_SET);
+    fwrite(&links[i], sizeof links[i], 1, file);
+    fclose(file);
+    EXPECT_EQ(store.open(path), i ? 1 : 0) << "link " << links[i];
+  }
+}
+
+} // namespace nesemu
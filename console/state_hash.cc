@@ -0,0 +1,178 @@
+#include "state_hash.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+static const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+// one per lane, so equal words in different lanes differ
+static const uint64_t KEYS[8] = {
+  0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL,
+  0x1F67B3B7A4A44072ULL, 0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL,
+  0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+};
+
+/* StateHash */
+StateHash::StateHash() {
+  memory = 0;
+  sum = 0;
+}
+
+uint64_t StateHash::mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDULL;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ULL;
+  return value ^ (value >> 33);
+}
+
+uint64_t StateHash::hash_line(const uint8_t* line, uint64_t index) {
+  // lanes are independent: 32x32 bit multiplies and adds the compiler can
+  // run as vectors
+  uint64_t lanes[8];
+  for (int i = 0; i < 8; i++) {
+    uint64_t word;
+    memcpy(&word, line + i * 8, 8);
+    uint64_t keyed = word ^ KEYS[i];
+    lanes[i] = (keyed & 0xFFFFFFFF) * (keyed >> 32) +
+               ((word << 32) | (word >> 32));
+  }
+  // and fold without a chain of multiplies through the lanes
+  uint64_t hash = (index + 1) * PRIME_1;
+  for (int i = 0; i < 8; i++) {
+    hash += (lanes[i] ^ (lanes[i] >> 31)) * PRIME_2;
+  }
+  return mix(hash);
+}
+
+uint64_t StateHash::hash_memory(const uint8_t* memory, size_t size) {
+  uint64_t sum = 0;
+  size_t index = 0;
+  for (; (index + 1) * LINE_SIZE <= size; index++) {
+    sum += hash_line(memory + index * LINE_SIZE, index);
+  }
+  if (size % LINE_SIZE) {
+    uint8_t line[LINE_SIZE] = {0};
+    memcpy(line, memory + index * LINE_SIZE, size % LINE_SIZE);
+    sum += hash_line(line, index);
+  }
+  return sum;
+}
+
+int StateHash::init(const uint8_t* memory, size_t size) {
+  if (!memory || !size || size % LINE_SIZE) {
+    return 1;
+  }
+  this->memory = memory;
+  line_hashes.assign(size / LINE_SIZE, 0);
+  rehash();
+  return 0;
+}
+
+size_t StateHash::get_lines() const {
+  return line_hashes.size();
+}
+
+uint64_t StateHash::rehash() {
+  sum = 0;
+  for (size_t i = 0; i < line_hashes.size(); i++) {
+    line_hashes[i] = hash_line(memory + i * LINE_SIZE, i);
+    sum += line_hashes[i];
+  }
+  return sum;
+}
+
+uint64_t StateHash::update(const uint64_t* dirty) {
+  for (size_t word = 0; word * 64 < line_hashes.size(); word++) {
+    uint64_t bits = dirty[word];
+    while (bits) {
+      size_t i = word * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      uint64_t hash = hash_line(memory + i * LINE_SIZE, i);
+      sum += hash - line_hashes[i];
+      line_hashes[i] = hash;
+    }
+  }
+  return sum;
+}
+
+uint64_t StateHash::get() const {
+  return sum;
+}
+
+/* ConsoleHash */
+ConsoleHash::ConsoleHash() {
+  console = 0;
+  ppu = false;
+  valid = false;
+  tracker = 0;
+  memset(dirty, 0, sizeof dirty);
+}
+
+ConsoleHash::~ConsoleHash() {
+  detach();
+}
+
+void ConsoleHash::attach(Console* console, bool ppu, bool tracking) {
+  detach();
+  this->console = console;
+  this->ppu = ppu;
+  ram.init(console->get_ram(), 0x800);
+  valid = true;
+  if (tracking) {
+    Bus& bus = console->get_cpu().get_bus();
+    tracker = bus.get_write_watch();
+    if (!tracker) {
+      tracker = &watch;
+      bus.set_write_watch(tracker);
+    }
+    tracker->track(console->get_ram(), 0x800);
+  }
+}
+
+void ConsoleHash::detach() {
+  if (tracker && console->get_cpu().get_bus().get_write_watch() == tracker) {
+    tracker->track(0, 0);
+    if (tracker == &watch) {
+      console->get_cpu().get_bus().set_write_watch(0);
+    }
+  }
+  console = 0;
+  tracker = 0;
+}
+
+void ConsoleHash::invalidate() {
+  valid = false;
+}
+
+uint64_t ConsoleHash::hash() {
+  // a watch replaced on the bus no longer tracks for us
+  bool tracked = tracker &&
+                 console->get_cpu().get_bus().get_write_watch() == tracker;
+  if (tracked) {
+    tracker->take_dirty(dirty);
+  }
+  uint64_t hash = tracked && valid ? ram.update(dirty) : ram.rehash();
+  valid = true;
+
+  CPUState cpu;
+  console->get_cpu().save_state(cpu);
+  uint64_t registers = uint64_t(cpu.pc) | uint64_t(cpu.sp) << 16 |
+                       uint64_t(cpu.r_x) << 24 | uint64_t(cpu.r_y) << 32 |
+                       uint64_t(cpu.r_acc) << 40 | uint64_t(cpu.r_st) << 48;
+  hash = StateHash::mix(hash ^ StateHash::mix(registers));
+  if (ppu) {
+    console->get_ppu().save_state(ppu_state);
+    hash += StateHash::hash_memory(&ppu_state.ciram[0],
+                                   ppu_state.ciram.size()) * PRIME_1;
+    hash += StateHash::hash_memory(&ppu_state.palette_ram[0],
+                                   ppu_state.palette_ram.size()) * PRIME_2;
+    hash = StateHash::mix(hash + StateHash::hash_memory(
+        &ppu_state.oam[0], ppu_state.oam.size()));
+  }
+  return hash;
+}
+
+} // namespace nesemu
@@ -0,0 +1,90 @@
+#ifndef NESEMU_CONSOLE_STATE_HASH_H_
+#define NESEMU_CONSOLE_STATE_HASH_H_
+
+#include "console.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* A 64-bit hash of a block of memory, kept up to date a line at a time
+  The block is hashed as 64 byte lines: each line's eight words go
+  through independent multiply and add lanes, as SIMD registers would
+  take them, and the lanes fold into a line hash seeded by the line's
+  place. The block's hash is the sum of its line hashes, so a changed line
+  is rehashed on its own and swapped into the sum. Rehashing every line
+  and updating only the dirty ones give the same value.
+*/
+class StateHash {
+  public:
+    StateHash();
+
+    static const int LINE_SIZE = 64;
+
+    // the hash of one line, index its place in the block
+    static uint64_t hash_line(const uint8_t* line, uint64_t index);
+    // a whole block of size bytes, padded with zeros to whole lines
+    static uint64_t hash_memory(const uint8_t* memory, size_t size);
+    // final mix of a value, e.g. a hash with registers folded in
+    static uint64_t mix(uint64_t value);
+
+    // Hashes size bytes at memory, a multiple of LINE_SIZE, which has to
+    // stay there. Returns 1 on a bad size.
+    int init(const uint8_t* memory, size_t size);
+    size_t get_lines() const;
+
+    uint64_t rehash(); // every line
+    // Only the lines set in dirty, line i at bit i % 64 of dirty[i / 64],
+    // e.g. from WriteWatch::take_dirty().
+    uint64_t update(const uint64_t* dirty);
+    uint64_t get() const;
+
+  private:
+    const uint8_t* memory;
+    std::vector<uint64_t> line_hashes;
+    uint64_t sum;
+};
+
+/* The hash of a console's progress, for deduplicating states
+  The CPU registers, apart from the cycle count, and the 2KB of RAM, and
+  optionally the PPU's nametable, palette and sprite memory. Equal states
+  reached at different times hash the same.
+
+  With tracking, the console's bus tracks RAM writes through its
+  WriteWatch (attaching one of the hash's own if it has none), and a hash
+  rehashes only the lines written since the last. RAM changed around the
+  bus, e.g. by loading a state, needs invalidate() first. PPU memory is
+  hashed whole every time.
+*/
+class ConsoleHash {
+  public:
+    ConsoleHash();
+    ~ConsoleHash(); // stops tracking
+
+    void attach(Console* console, bool ppu = false, bool tracking = true);
+    void detach();
+    void invalidate(); // the next hash() rehashes all of RAM
+
+    uint64_t hash();
+
+  private:
+    ConsoleHash(const ConsoleHash&);
+    ConsoleHash& operator=(const ConsoleHash&);
+
+    static const int RAM_LINES = 0x800 / StateHash::LINE_SIZE;
+
+    Console* console;
+    bool ppu;
+    bool valid;
+    StateHash ram;
+    WriteWatch watch; // when the bus has none
+    WriteWatch* tracker;
+    uint64_t dirty[(RAM_LINES + 63) / 64];
+    PPUState ppu_state;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONSOLE_STATE_HASH_H_
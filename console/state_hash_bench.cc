@@ -0,0 +1,95 @@
+#include "state_hash.h"
+#include "test_rom.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int ROUNDS = 20000;
+
+typedef std::chrono::steady_clock Clock;
+
+static double nanoseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+// Full against incremental hashing of the 64KB a bare CPU maps, after
+// writes through its bus to lines spread over the block.
+static void time_cpu_memory(int writes) {
+  CPU cpu;
+  Bus& bus = cpu.get_bus();
+  const uint8_t* memory = bus.get_host_page(0);
+  WriteWatch watch;
+  watch.track(memory, 0x10000);
+  bus.set_write_watch(&watch);
+  StateHash hash;
+  hash.init(memory, 0x10000);
+  std::vector<uint64_t> dirty(0x10000 / StateHash::LINE_SIZE / 64);
+
+  uint32_t seed = 1;
+  double full = 0, incremental = 0;
+  uint64_t check = 0;
+  for (int round = 0; round < ROUNDS / 20; round++) {
+    for (int i = 0; i < writes; i++) {
+      seed = seed * 1103515245 + 12345;
+      bus.write(uint16_t(seed >> 8), uint8_t(round));
+    }
+    Clock::time_point start = Clock::now();
+    watch.take_dirty(&dirty[0]);
+    check += hash.update(&dirty[0]);
+    Clock::time_point middle = Clock::now();
+    check -= hash.rehash();
+    incremental += nanoseconds(middle - start);
+    full += nanoseconds(Clock::now() - middle);
+  }
+  printf("  64KB, %4d writes  %10.0f %12.0f%s\n", writes,
+         full / (ROUNDS / 20), incremental / (ROUNDS / 20),
+         check ? "  MISMATCH" : "");
+}
+
+// the same for a console's registers and 2KB RAM after each frame
+static void time_console(const std::vector<uint8_t>& image) {
+  Console tracked, full;
+  tracked.load_rom(&image[0], image.size());
+  full.load_rom(&image[0], image.size());
+  ConsoleHash tracked_hash, full_hash;
+  tracked_hash.attach(&tracked, false, true);
+  full_hash.attach(&full, false, false);
+  double full_time = 0, tracked_time = 0;
+  int mismatches = 0;
+  const int frames = 600;
+  for (int frame = 0; frame < frames; frame++) {
+    tracked.run_frame();
+    full.run_frame();
+    Clock::time_point start = Clock::now();
+    uint64_t value = tracked_hash.hash();
+    Clock::time_point middle = Clock::now();
+    mismatches += value != full_hash.hash();
+    tracked_time += nanoseconds(middle - start);
+    full_time += nanoseconds(Clock::now() - middle);
+  }
+  printf("  2KB console frame  %10.0f %12.0f%s\n", full_time / frames,
+         tracked_time / frames, mismatches ? "  MISMATCH" : "");
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  std::vector<uint8_t> line(StateHash::LINE_SIZE, 0x5A);
+  Clock::time_point start = Clock::now();
+  uint64_t sink = 0;
+  for (int i = 0; i < ROUNDS * 10; i++) {
+    sink += StateHash::hash_line(&line[0], i);
+  }
+  double per_line = nanoseconds(Clock::now() - start) / (ROUNDS * 10);
+  printf("State hash, %.1f ns per 64 byte line (%.2f GB/s)%s\n", per_line,
+         StateHash::LINE_SIZE / per_line, sink ? "" : " ");
+  printf("  ns per hash           full  incremental\n");
+  time_console(image);
+  int writes[] = {16, 256, 4096};
+  for (int i = 0; i < 3; i++) {
+    time_cpu_memory(writes[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "state_hash.h"
+#include "test_rom.h"
+
+#include "gtest/gtest.h"
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+TEST (StateHashTest, UpdatesMatchRehash) {
+  std::vector<uint8_t> memory(0x1000);
+  for (size_t i = 0; i < memory.size(); i++) {
+    memory[i] = uint8_t(i * 7);
+  }
+  StateHash hash;
+  EXPECT_EQ(hash.init(&memory[0], 100), 1);
+  EXPECT_EQ(hash.init(NULL, 0x1000), 1);
+  ASSERT_EQ(hash.init(&memory[0], memory.size()), 0);
+  EXPECT_EQ(hash.get_lines(), 64u);
+  uint64_t first = hash.get();
+  EXPECT_EQ(first, StateHash::hash_memory(&memory[0], memory.size()));
+
+  memory[0x123] ^= 1;
+  memory[0xFC0] ^= 0x80;
+  uint64_t dirty[1] = {uint64_t(1) << 4 | uint64_t(1) << 63};
+  uint64_t second = hash.update(dirty);
+  EXPECT_NE(second, first);
+  EXPECT_EQ(second, StateHash::hash_memory(&memory[0], memory.size()));
+  EXPECT_EQ(hash.rehash(), second);
+
+  // lines are told apart by place as well as content
+  std::vector<uint8_t> swapped(memory);
+  memcpy(&swapped[0], &memory[64], 64);
+  memcpy(&swapped[64], &memory[0], 64);
+  EXPECT_NE(StateHash::hash_memory(&swapped[0], swapped.size()), second);
+  // a tail is hashed as a zero padded line
+  std::vector<uint8_t> tail(64, 0);
+  tail[0] = memory[64];
+  EXPECT_EQ(StateHash::hash_memory(&memory[0], 65),
+            StateHash::hash_line(&memory[0], 0) +
+            StateHash::hash_line(&tail[0], 1));
+}
+
+// tracked hashing agrees with rehashing a twin every frame
+TEST (StateHashTest, TracksConsoleWrites) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console tracked, full;
+  ASSERT_EQ(tracked.load_rom(&image[0], image.size()), 0);
+  ASSERT_EQ(full.load_rom(&image[0], image.size()), 0);
+  ConsoleHash tracked_hash, full_hash;
+  tracked_hash.attach(&tracked, true, true);
+  full_hash.attach(&full, true, false);
+  EXPECT_TRUE(tracked.get_cpu().get_bus().get_write_watch() != NULL);
+  EXPECT_TRUE(full.get_cpu().get_bus().get_write_watch() == NULL);
+  std::vector<uint64_t> hashes;
+  for (int i = 0; i < 10; i++) {
+    tracked.get_controller(0).set_buttons(i & 2 ? BUTTON_A : 0);
+    full.get_controller(0).set_buttons(i & 2 ? BUTTON_A : 0);
+    tracked.run_frame();
+    full.run_frame();
+    hashes.push_back(tracked_hash.hash());
+    ASSERT_EQ(hashes.back(), full_hash.hash()) << "frame " << i;
+  }
+  for (int i = 1; i < 10; i++) {
+    EXPECT_NE(hashes[i], hashes[i - 1]);
+  }
+
+  // a loaded state hashes as it did when saved, once invalidated
+  ConsoleState* state = new ConsoleState;
+  tracked.save_state(*state);
+  tracked.run_frame();
+  uint64_t later = tracked_hash.hash();
+  tracked.load_state(*state);
+  delete state;
+  tracked_hash.invalidate();
+  EXPECT_EQ(tracked_hash.hash(), hashes.back());
+  EXPECT_NE(later, hashes.back());
+
+  tracked_hash.detach();
+  EXPECT_TRUE(tracked.get_cpu().get_bus().get_write_watch() == NULL);
+}
+
+static void count_write(void* context, uint16_t /* address */,
+                        uint8_t /* value */) {
+  ++*static_cast<int*>(context);
+}
+
+// a watch already on the bus does the tracking and keeps its watchers
+TEST (StateHashTest, SharesTheBusWatch) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  int writes = 0;
+  WriteWatch watch;
+  watch.add(0x0012, count_write, &writes);
+  console.get_cpu().get_bus().set_write_watch(&watch);
+  ConsoleHash hash;
+  hash.attach(&console);
+  for (int i = 0; i < 3; i++) {
+    console.run_frame();
+  }
+  uint64_t value = hash.hash();
+  EXPECT_EQ(writes, 2);
+
+  Console twin;
+  ASSERT_EQ(twin.load_rom(&image[0], image.size()), 0);
+  ConsoleHash twin_hash;
+  twin_hash.attach(&twin, false, false);
+  for (int i = 0; i < 3; i++) {
+    twin.run_frame();
+  }
+  EXPECT_EQ(twin_hash.hash(), value);
+  hash.detach();
+  EXPECT_EQ(console.get_cpu().get_bus().get_write_watch(), &watch);
+}
+
+} // namespace nesemu
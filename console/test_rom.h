@@ -0,0 +1,83 @@
+#ifndef NESEMU_CONSOLE_TEST_ROM_H_
+#define NESEMU_CONSOLE_TEST_ROM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* A small NROM program for tests and benchmarks
+  Reset sets a palette, turns on NMI and rendering, starts a pulse tone and
+  spins incrementing $10. The NMI strobes pad 1 and stores the A button at
+  $11, counts frames at $12, scrolls x by the frame count and y by the A
+  button, retunes the pulse and copies $0200 to OAM by DMA.
+*/
+static const uint8_t TEST_RESET[] = {
+  0x78,               // $C000 SEI
+  0xA9, 0x3F,         // $C001 LDA #$3F
+  0x8D, 0x06, 0x20,   // $C003 STA $2006
+  0xA9, 0x00,         // $C006 LDA #$00
+  0x8D, 0x06, 0x20,   // $C008 STA $2006
+  0xA9, 0x0F,         // $C00B LDA #$0F
+  0x8D, 0x07, 0x20,   // $C00D STA $2007
+  0xA9, 0x21,         // $C010 LDA #$21
+  0x8D, 0x07, 0x20,   // $C012 STA $2007
+  0xA9, 0x11,         // $C015 LDA #$11
+  0x8D, 0x07, 0x20,   // $C017 STA $2007
+  0xA9, 0x30,         // $C01A LDA #$30
+  0x8D, 0x07, 0x20,   // $C01C STA $2007
+  0xA9, 0x90,         // $C01F LDA #$90
+  0x8D, 0x00, 0x20,   // $C021 STA $2000
+  0xA9, 0x1E,         // $C024 LDA #$1E
+  0x8D, 0x01, 0x20,   // $C026 STA $2001
+  0xA9, 0x40,         // $C029 LDA #$40
+  0x8D, 0x00, 0x02,   // $C02B STA $0200
+  0xA9, 0x01,         // $C02E LDA #$01
+  0x8D, 0x15, 0x40,   // $C030 STA $4015
+  0xA9, 0xBF,         // $C033 LDA #$BF
+  0x8D, 0x00, 0x40,   // $C035 STA $4000
+  0xA9, 0xFD,         // $C038 LDA #$FD
+  0x8D, 0x02, 0x40,   // $C03A STA $4002
+  0xA9, 0x00,         // $C03D LDA #$00
+  0x8D, 0x03, 0x40,   // $C03F STA $4003
+  0xE6, 0x10,         // $C042 INC $10
+  0x4C, 0x42, 0xC0,   // $C044 JMP loop
+};
+
+static const uint8_t TEST_NMI[] = {
+  0xA9, 0x01,         // $C100 LDA #$01
+  0x8D, 0x16, 0x40,   // $C102 STA $4016
+  0xA9, 0x00,         // $C105 LDA #$00
+  0x8D, 0x16, 0x40,   // $C107 STA $4016
+  0xAD, 0x16, 0x40,   // $C10A LDA $4016
+  0x29, 0x01,         // $C10D AND #$01
+  0x85, 0x11,         // $C10F STA $11
+  0xE6, 0x12,         // $C111 INC $12
+  0xA5, 0x12,         // $C113 LDA $12
+  0x8D, 0x05, 0x20,   // $C115 STA $2005
+  0x8D, 0x02, 0x40,   // $C118 STA $4002
+  0xA5, 0x11,         // $C11B LDA $11
+  0x8D, 0x05, 0x20,   // $C11D STA $2005
+  0xA9, 0x02,         // $C120 LDA #$02
+  0x8D, 0x14, 0x40,   // $C122 STA $4014
+  0x40,               // $C125 RTI
+};
+
+// iNES image: 16KB PRG at $C000 (mirrored at $8000), 8KB of CHR noise
+static std::vector<uint8_t> make_test_rom() {
+  std::vector<uint8_t> image(16 + 0x4000 + 0x2000, 0);
+  const uint8_t header[16] = {'N', 'E', 'S', 0x1A, 1, 1, 0x01};
+  std::copy(header, header + 16, image.begin());
+  uint8_t* prg = &image[16];
+  std::copy(TEST_RESET, TEST_RESET + sizeof TEST_RESET, prg);
+  std::copy(TEST_NMI, TEST_NMI + sizeof TEST_NMI, prg + 0x100);
+  const uint8_t vectors[6] = {0x00, 0xC1, 0x00, 0xC0, 0x00, 0xC0};
+  std::copy(vectors, vectors + 6, prg + 0x3FFA);
+  uint32_t seed = 35;
+  for (int i = 0; i < 0x2000; i++) {
+    seed = seed * 1103515245 + 12345;
+    image[16 + 0x4000 + i] = uint8_t(seed >> 16);
+  }
+  return image;
+}
+
+#endif // NESEMU_CONSOLE_TEST_ROM_H_
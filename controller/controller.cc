@@ -0,0 +1,66 @@
+#include "controller.h"
+
+namespace nesemu {
+
+static const uint8_t OPEN_BUS = 0x40;
+
+Controller::Controller() {
+  source = 0;
+  source_context = 0;
+  buttons = 0;
+  strobe = false;
+  shift = 0;
+  latch_count = 0;
+}
+
+void Controller::set_source(InputSource source, void* context) {
+  this->source = source;
+  source_context = context;
+}
+
+void Controller::set_buttons(uint8_t buttons) {
+  this->buttons = buttons;
+}
+
+void Controller::latch() {
+  shift = source ? source(source_context) : buttons;
+  latch_count++;
+}
+
+void Controller::write_strobe(uint8_t value) {
+  bool high = value & 0x01;
+  if (strobe && !high) { // the falling edge keeps the last latch
+    latch();
+  }
+  strobe = high;
+}
+
+uint8_t Controller::read() {
+  if (strobe) { // reloading, always the A button
+    latch();
+    return OPEN_BUS | (shift & 0x01);
+  }
+  uint8_t bit = shift & 0x01;
+  shift = uint8_t(0x80 | (shift >> 1));
+  return OPEN_BUS | bit;
+}
+
+uint64_t Controller::get_latch_count() const {
+  return latch_count;
+}
+
+void Controller::save_state(ControllerState& state) const {
+  state.buttons = buttons;
+  state.strobe = strobe;
+  state.shift = shift;
+  state.latch_count = latch_count;
+}
+
+void Controller::load_state(const ControllerState& state) {
+  buttons = state.buttons;
+  strobe = state.strobe;
+  shift = state.shift;
+  latch_count = state.latch_count;
+}
+
+} // namespace nesemu
@@ -0,0 +1,69 @@
+#ifndef NESEMU_CONTROLLER_CONTROLLER_H_
+#define NESEMU_CONTROLLER_CONTROLLER_H_
+
+#include <cstdint>
+
+namespace nesemu {
+
+/* Standard controller buttons, in the order they are shifted out */
+#define BUTTON_A      0x01
+#define BUTTON_B      0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START  0x08
+#define BUTTON_UP     0x10
+#define BUTTON_DOWN   0x20
+#define BUTTON_LEFT   0x40
+#define BUTTON_RIGHT  0x80
+
+// current buttons of a pad, polled when the game latches them
+typedef uint8_t (*InputSource)(void* context);
+
+// the shift register and latched buttons, plain data
+struct ControllerState {
+  uint8_t buttons;
+  bool strobe;
+  uint8_t shift;
+  uint64_t latch_count;
+};
+
+/* Standard controller, read through $4016 (pad 1) or $4017 (pad 2)
+  An 8-bit shift register. The buttons are taken from the input source at
+  the moment the game latches them: on the $4016 write that ends the strobe,
+  and on every read while the strobe is held. Input that arrives while the
+  frame is being emulated is seen by the game's next poll, not held until
+  the next frame starts. Without a source the last set_buttons() value is
+  latched.
+*/
+class Controller {
+  public:
+    Controller();
+
+    void set_source(InputSource source, void* context);
+    void set_buttons(uint8_t buttons);
+
+    // $4016 write, bit 0 is the strobe shared by both pads
+    void write_strobe(uint8_t value);
+    // Next bit in D0, the rest is open bus ($40). After eight reads an
+    // official pad returns 1.
+    uint8_t read();
+
+    uint64_t get_latch_count() const; // times the source was polled
+
+    // the input source is kept
+    void save_state(ControllerState& state) const;
+    void load_state(const ControllerState& state);
+
+  private:
+    InputSource source;
+    void* source_context;
+    uint8_t buttons;
+    bool strobe;
+    uint8_t shift;
+    uint64_t latch_count;
+
+    void latch();
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CONTROLLER_CONTROLLER_H_
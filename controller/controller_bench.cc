@@ -0,0 +1,135 @@
+#include "controller.h"
+#include "ppu/ppu.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace nesemu;
+
+static const int FRAMES = 3000;
+static const double FRAME_MS = 1000.0 / 60.0988;
+static const uint64_t FRAME_DOTS = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+
+/* Input-to-photon latency
+  A player presses and releases A at random times, paced in real time so
+  emulated time stands for wall time. The game polls the pad in its NMI and
+  shows the background while A is held, so a press reaches the screen with
+  the first frame rendered after the poll that saw it. Latency runs from
+  the change to the end of that frame. The frontend either samples the pad
+  once as each frame starts (scanline 0) or lets the game latch it.
+*/
+struct Player {
+  const PPU* ppu;
+  std::vector<uint64_t> changes; // clocks A toggles at, first is a press
+  uint8_t frame_start_buttons;
+
+  uint8_t buttons_at(uint64_t clock) const {
+    size_t count = 0;
+    while (count < changes.size() && changes[count] <= clock) {
+      count++;
+    }
+    return (count & 1) ? BUTTON_A : 0;
+  }
+};
+
+static uint8_t live_input(void* context) {
+  Player* player = static_cast<Player*>(context);
+  return player->buttons_at(player->ppu->get_clock());
+}
+
+static uint8_t frame_start_input(void* context) {
+  return static_cast<Player*>(context)->frame_start_buttons;
+}
+
+static void run_to(PPU& ppu, int scanline, int dot) {
+  int64_t distance =
+      int64_t((scanline - ppu.get_scanline() + PPU::LINES_PER_FRAME) %
+              PPU::LINES_PER_FRAME) * PPU::DOTS_PER_LINE +
+      (dot - ppu.get_dot());
+  if (distance <= 0) {
+    distance += FRAME_DOTS;
+  }
+  if (distance > 2) {
+    ppu.run(ppu.get_clock() + uint64_t(distance) - 2);
+  }
+  while (ppu.get_scanline() != scanline || ppu.get_dot() != dot) {
+    ppu.run(ppu.get_clock() + 1);
+  }
+}
+
+struct Latency {
+  double mean;
+  double min;
+  double max;
+};
+
+static Latency measure(bool late_latch) {
+  PPU ppu;
+  for (int row = 0; row < 8; row++) {
+    ppu.set_vram(0x0010 + row, 0xFF); // tile 1 solid
+  }
+  for (int i = 0; i < 960; i++) {
+    ppu.set_vram(0x2000 + i, 0x01);
+  }
+  ppu.set_vram(0x3F00, 0x0F);
+  ppu.set_vram(0x3F01, 0x30);
+
+  Player player;
+  player.ppu = &ppu;
+  player.frame_start_buttons = 0;
+  srand(34);
+  uint64_t clock = 2 * FRAME_DOTS;
+  while (clock < uint64_t(FRAMES - 4) * FRAME_DOTS) {
+    player.changes.push_back(clock);
+    clock += FRAME_DOTS * 3 + uint64_t(rand()) % (FRAME_DOTS * 5);
+  }
+
+  Controller pad;
+  pad.set_source(late_latch ? live_input : frame_start_input, &player);
+  std::vector<double> latencies;
+  size_t next_change = 0;
+  for (int frame = 0; frame < FRAMES; frame++) {
+    run_to(ppu, 0, 0);
+    player.frame_start_buttons = player.buttons_at(ppu.get_clock());
+    run_to(ppu, 241, 1); // vblank, the frame on screen is complete
+
+    // the photon: is the background showing in the finished frame
+    bool shown = ppu.get_frame_buffer()[120 * PPU::SCREEN_WIDTH + 128] != 0x0F;
+    while (next_change < player.changes.size() &&
+           player.changes[next_change] < ppu.get_clock() &&
+           shown == ((next_change & 1) == 0)) {
+      latencies.push_back(double(ppu.get_clock() -
+                                 player.changes[next_change]) /
+                          FRAME_DOTS * FRAME_MS);
+      next_change++;
+    }
+
+    // NMI handler: strobe, read A, show the background while it is held
+    pad.write_strobe(1);
+    pad.write_strobe(0);
+    bool pressed = pad.read() & 0x01;
+    ppu.write_register(0x2001, pressed ? 0x0A : 0x00);
+  }
+
+  Latency result = {0, 1e9, 0};
+  for (size_t i = 0; i < latencies.size(); i++) {
+    result.mean += latencies[i] / latencies.size();
+    result.min = latencies[i] < result.min ? latencies[i] : result.min;
+    result.max = latencies[i] > result.max ? latencies[i] : result.max;
+  }
+  return result;
+}
+
+int main() {
+  Latency early = measure(false);
+  Latency late = measure(true);
+  printf("Input to photon latency, ms (%d frames, pad polled in NMI)\n",
+         FRAMES);
+  printf("                          mean     min     max\n");
+  printf("  sampled at frame start %6.1f  %6.1f  %6.1f\n", early.mean,
+         early.min, early.max);
+  printf("  latched at strobe      %6.1f  %6.1f  %6.1f\n", late.mean,
+         late.min, late.max);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "controller.h"
+
+#include "gtest/gtest.h"
+
+namespace nesemu {
+
+static uint8_t live_buttons(void* context) {
+  return *static_cast<uint8_t*>(context);
+}
+
+TEST (ControllerTest, FirstState) {
+  Controller pad;
+  EXPECT_EQ(pad.get_latch_count(), 0u);
+  EXPECT_EQ(pad.read(), 0x40);
+}
+
+TEST (ControllerTest, ShiftsOutButtons) {
+  Controller pad;
+  pad.set_buttons(BUTTON_A | BUTTON_START | BUTTON_RIGHT);
+  pad.write_strobe(1);
+  pad.write_strobe(0);
+  const uint8_t expected[8] = {1, 0, 0, 1, 0, 0, 0, 1};
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(pad.read(), 0x40 | expected[i]) << "bit " << i;
+  }
+  EXPECT_EQ(pad.read(), 0x41); // official pads return 1 afterwards
+  EXPECT_EQ(pad.read(), 0x41);
+}
+
+// the buttons are the ones current when the strobe ends, not before
+TEST (ControllerTest, LatchesAtStrobe) {
+  Controller pad;
+  uint8_t buttons = BUTTON_B;
+  pad.set_source(live_buttons, &buttons);
+  pad.write_strobe(1);
+  buttons = BUTTON_A;
+  pad.write_strobe(0);
+  EXPECT_EQ(pad.get_latch_count(), 1u);
+  buttons = BUTTON_B; // too late for this poll
+  EXPECT_EQ(pad.read(), 0x41);
+  EXPECT_EQ(pad.read(), 0x40);
+
+  pad.write_strobe(1);
+  pad.write_strobe(0);
+  EXPECT_EQ(pad.read(), 0x40);
+  EXPECT_EQ(pad.read(), 0x41);
+  EXPECT_EQ(pad.get_latch_count(), 2u);
+}
+
+TEST (ControllerTest, StrobeHeldReadsA) {
+  Controller pad;
+  uint8_t buttons = BUTTON_A | BUTTON_B;
+  pad.set_source(live_buttons, &buttons);
+  pad.write_strobe(1);
+  EXPECT_EQ(pad.read(), 0x41);
+  EXPECT_EQ(pad.read(), 0x41);
+  buttons = BUTTON_B;
+  EXPECT_EQ(pad.read(), 0x40);
+  pad.write_strobe(1); // no falling edge, no latch
+  EXPECT_EQ(pad.get_latch_count(), 3u);
+}
+
+} // namespace nesemu
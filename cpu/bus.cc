@@ -0,0 +1,267 @@
+#include "bus.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+Bus::Bus() {
+  memset(pages, 0, sizeof pages);
+  watch = 0;
+}
+
+Bus::Bus(const Bus& other) {
+  watch = 0;
+  *this = other;
+}
+
+// Pages are only watched under a watch, without one on either side the
+// table copies as it is.
+Bus& Bus::operator=(const Bus& other) {
+  if (this == &other) {
+    return *this;
+  }
+  memcpy(pages, other.pages, sizeof pages);
+  if (watch || other.watch) {
+    for (int i = 0; i < PAGES; i++) {
+      update_page(i);
+    }
+  }
+  return *this;
+}
+
+bool Bus::bad_range(uint16_t address, uint32_t size,
+                    uint32_t memory_size) const {
+  return (address % PAGE_SIZE) || !size || (size % PAGE_SIZE) ||
+         address + size > 0x10000 || !memory_size ||
+         (memory_size % PAGE_SIZE);
+}
+
+/* Mapping */
+int Bus::map_memory(uint16_t address, uint32_t size, uint8_t* memory,
+                    uint32_t memory_size) {
+  if (bad_range(address, size, memory_size) || !memory) {
+    return 1;
+  }
+  for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
+    Page& page = pages[(address + offset) >> 8];
+    page.read_data = page.memory = memory + offset % memory_size;
+    page.reader = 0;
+    page.writer = 0;
+    page.context = 0;
+    update_page((address + offset) >> 8);
+  }
+  return 0;
+}
+
+int Bus::map_rom(uint16_t address, uint32_t size, const uint8_t* memory,
+                 uint32_t memory_size, BusWriter write, void* context) {
+  if (bad_range(address, size, memory_size) || !memory) {
+    return 1;
+  }
+  for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
+    Page& page = pages[(address + offset) >> 8];
+    page.read_data = memory + offset % memory_size;
+    page.write_data = 0;
+    page.memory = 0;
+    page.reader = 0;
+    page.writer = write;
+    page.context = context;
+    update_page((address + offset) >> 8);
+  }
+  return 0;
+}
+
+int Bus::map_io(uint16_t address, uint32_t size, BusReader read,
+                BusWriter write, void* context) {
+  if (bad_range(address, size, PAGE_SIZE)) {
+    return 1;
+  }
+  for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
+    Page& page = pages[(address + offset) >> 8];
+    page.read_data = 0;
+    page.write_data = 0;
+    page.memory = 0;
+    page.reader = read;
+    page.writer = write;
+    page.context = context;
+    update_page((address + offset) >> 8);
+  }
+  return 0;
+}
+
+int Bus::unmap(uint16_t address, uint32_t size) {
+  return map_io(address, size, 0, 0, 0);
+}
+
+void Bus::rebase(const uint8_t* from, uint32_t size, uint8_t* to) {
+  for (int i = 0; i < PAGES; i++) {
+    Page& page = pages[i];
+    uintptr_t offset = uintptr_t(page.read_data) - uintptr_t(from);
+    if (page.read_data && offset < size) {
+      page.read_data = to + offset;
+    }
+    offset = uintptr_t(page.memory) - uintptr_t(from);
+    if (page.memory && offset < size) {
+      page.memory = to + offset;
+      update_page(i);
+    }
+  }
+}
+
+uint8_t Bus::read_bus(void* bus, uint16_t address) {
+  return static_cast<Bus*>(bus)->read(address);
+}
+
+/* Write-watches */
+void Bus::set_write_watch(WriteWatch* watch) {
+  if (this->watch) {
+    this->watch->bus = 0;
+  }
+  if (watch && watch->bus && watch->bus != this) {
+    watch->bus->set_write_watch(0);
+  }
+  this->watch = watch;
+  if (watch) {
+    watch->bus = this;
+  }
+  for (int i = 0; i < PAGES; i++) {
+    update_page(i);
+  }
+}
+
+// a watched page has no write_data, so its writes miss the fast path
+void Bus::update_page(int page) {
+  Page& entry = pages[page];
+  entry.watched = watch && watch->takes_page(page, entry.memory);
+  entry.write_data = entry.watched ? 0 : entry.memory;
+}
+
+void Bus::write_watched(uint16_t address, uint8_t value) {
+  Page& page = pages[address >> 8];
+  uint8_t* memory = 0;
+  if (page.memory) {
+    memory = page.memory + (address & 0xFF);
+    *memory = value;
+  } else if (page.writer) {
+    page.writer(page.context, address, value);
+  }
+  watch->record(address, value, memory);
+}
+
+WriteWatch::WriteWatch() {
+  memset(map, 0, sizeof map);
+  memset(page_counts, 0, sizeof page_counts);
+  tracked = 0;
+  tracked_size = 0;
+  bus = 0;
+}
+
+WriteWatch::~WriteWatch() {
+  if (bus) {
+    bus->set_write_watch(0);
+  }
+}
+
+void WriteWatch::add(uint16_t address, WriteWatcher watcher, void* context) {
+  if (!is_watched(address)) {
+    map[address >> 6] |= uint64_t(1) << (address & 63);
+    if (!page_counts[address >> 8]++ && bus) {
+      bus->update_page(address >> 8);
+    }
+  }
+  Watcher entry = {address, watcher, context};
+  watchers.push_back(entry);
+}
+
+void WriteWatch::remove(uint16_t address) {
+  if (!is_watched(address)) {
+    return;
+  }
+  map[address >> 6] &= ~(uint64_t(1) << (address & 63));
+  if (!--page_counts[address >> 8] && bus) {
+    bus->update_page(address >> 8);
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < watchers.size(); i++) {
+    if (watchers[i].address != address) {
+      watchers[kept++] = watchers[i];
+    }
+  }
+  watchers.resize(kept);
+}
+
+void WriteWatch::clear() {
+  memset(map, 0, sizeof map);
+  memset(page_counts, 0, sizeof page_counts);
+  watchers.clear();
+  pending.clear();
+  if (bus) {
+    bus->set_write_watch(this);
+  }
+}
+
+bool WriteWatch::is_watched(uint16_t address) const {
+  return (map[address >> 6] >> (address & 63)) & 1;
+}
+
+// a write to a watched page, only kept if its address is watched
+void WriteWatch::record(uint16_t address, uint8_t value,
+                        const uint8_t* memory) {
+  uintptr_t offset = uintptr_t(memory) - tracked;
+  if (memory && offset < tracked_size) {
+    size_t line = offset / LINE_SIZE;
+    dirty[line / 64] |= uint64_t(1) << (line % 64);
+  }
+  if (is_watched(address)) {
+    Write write = {address, value};
+    pending.push_back(write);
+  }
+}
+
+size_t WriteWatch::deliver() {
+  // watchers may write, which is recorded for the next delivery
+  delivering.swap(pending);
+  for (size_t i = 0; i < delivering.size(); i++) {
+    const Write& write = delivering[i];
+    for (size_t j = 0; j < watchers.size(); j++) {
+      if (watchers[j].address == write.address) {
+        watchers[j].watcher(watchers[j].context, write.address, write.value);
+      }
+    }
+  }
+  size_t count = delivering.size();
+  delivering.clear();
+  return count;
+}
+
+size_t WriteWatch::get_pending() const {
+  return pending.size();
+}
+
+/* Dirty lines */
+void WriteWatch::track(const uint8_t* memory, size_t size) {
+  tracked = memory ? uintptr_t(memory) : 0;
+  tracked_size = memory ? size : 0;
+  size_t lines = (tracked_size + LINE_SIZE - 1) / LINE_SIZE;
+  dirty.assign((lines + 63) / 64, 0);
+  if (bus) {
+    bus->set_write_watch(this);
+  }
+}
+
+void WriteWatch::take_dirty(uint64_t* lines) {
+  for (size_t i = 0; i < dirty.size(); i++) {
+    lines[i] = dirty[i];
+    dirty[i] = 0;
+  }
+}
+
+// a page holding a watched address, or mapping into the tracked block
+bool WriteWatch::takes_page(int page, const uint8_t* memory) const {
+  uintptr_t start = uintptr_t(memory);
+  return page_counts[page] ||
+         (memory && tracked_size && start < tracked + tracked_size &&
+          tracked < start + Bus::PAGE_SIZE);
+}
+
+} // namespace nesemu
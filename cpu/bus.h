@@ -0,0 +1,190 @@
+#ifndef NESEMU_CPU_BUS_H_
+#define NESEMU_CPU_BUS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+// memory mapped I/O handlers, address is the full CPU address
+typedef uint8_t (*BusReader)(void* context, uint16_t address);
+typedef void (*BusWriter)(void* context, uint16_t address, uint8_t value);
+
+// told of a watched write, after the write took effect
+typedef void (*WriteWatcher)(void* context, uint16_t address, uint8_t value);
+
+class WriteWatch;
+
+/* CPU address space as a table of 256 byte pages
+  A page is either host memory, read (and for RAM written) straight through
+  a pointer, or memory mapped I/O dispatched to handlers. ROM pages read
+  through a pointer and hand writes to an optional handler, which is where
+  mapper registers go. Mirrors are pages pointing at the same memory.
+  Unmapped pages read back the high address byte, as the open bus does
+  after most absolute reads, and ignore writes.
+*/
+class Bus {
+  public:
+    Bus();
+    // Copies the mapping. A copy keeps its own write-watch, so a bus
+    // restored from a savestate goes on reporting what it did.
+    Bus(const Bus& other);
+    Bus& operator=(const Bus& other);
+
+    static const int PAGE_SIZE = 0x100;
+    static const int PAGES = 0x100;
+
+    /* Mapping, address and size in whole pages, memory_size a multiple of
+      the page size repeated across the range. Each returns 1 on a bad
+      range. */
+    int map_memory(uint16_t address, uint32_t size, uint8_t* memory,
+                   uint32_t memory_size);
+    int map_rom(uint16_t address, uint32_t size, const uint8_t* memory,
+                uint32_t memory_size, BusWriter write = 0, void* context = 0);
+    int map_io(uint16_t address, uint32_t size, BusReader read,
+               BusWriter write, void* context);
+    int unmap(uint16_t address, uint32_t size);
+    // Moves pages mapping into size bytes at from to the same place in to,
+    // e.g. onto a copy of that memory.
+    void rebase(const uint8_t* from, uint32_t size, uint8_t* to);
+
+    // host memory behind the page holding address, NULL for I/O
+    const uint8_t* get_host_page(uint16_t address) const;
+
+    uint8_t read(uint16_t address) const;
+    void write(uint16_t address, uint8_t value);
+
+    // BusReader over a Bus, e.g. for the DMC sample reader
+    static uint8_t read_bus(void* bus, uint16_t address);
+
+    /* Write-watches, see WriteWatch. Attaching one takes it from any other
+      bus, NULL detaches. */
+    void set_write_watch(WriteWatch* watch);
+    WriteWatch* get_write_watch() const;
+
+  private:
+    friend class WriteWatch; // flags the pages it watches
+
+    struct Page {
+      const uint8_t* read_data; // NULL: reader
+      uint8_t* write_data;      // NULL: writer, or the page is watched
+      BusReader reader;
+      BusWriter writer;
+      void* context;
+      uint8_t* memory; // written host memory, also while watched
+      bool watched;
+    };
+
+    Page pages[PAGES];
+    WriteWatch* watch;
+
+    bool bad_range(uint16_t address, uint32_t size, uint32_t memory_size)
+        const;
+    void update_page(int page); // whether the watch takes its writes
+    void write_watched(uint16_t address, uint8_t value);
+};
+
+/* Addresses whose writes are reported, checked only on their pages
+  A 64Kbit map of watched CPU addresses. The bus it is attached to sends
+  writes to a page holding a watched address down a slow path, where they
+  are recorded if the map has them; every other page keeps its single
+  branch store. Recorded writes are queued and handed to the watchers by
+  deliver(), at the end of an instruction batch rather than mid-instruction:
+  Console::run_frame() delivers after each frame, other callers of
+  CPU::step() deliver when they see fit. Mirrors are separate addresses.
+
+  A watch can also track a block of host memory: every page mapping into
+  it takes the slow path, mirrors included, and marks the 64 byte lines
+  written as dirty, e.g. for rehashing only those (see StateHash).
+
+  A watch detaches itself when destroyed, and has to be detached before
+  its bus goes away.
+*/
+class WriteWatch {
+  public:
+    WriteWatch();
+    ~WriteWatch();
+
+    // Calls watcher from deliver() for every write to address.
+    void add(uint16_t address, WriteWatcher watcher, void* context);
+    void remove(uint16_t address); // all watchers of address
+    void clear();
+    bool is_watched(uint16_t address) const;
+
+    // Calls the watchers of the writes recorded since the last delivery,
+    // in the order they were written. Returns the writes delivered.
+    size_t deliver();
+    size_t get_pending() const;
+
+    /* Dirty lines */
+    static const int LINE_SIZE = 64;
+    // Tracks bus writes into size bytes of host memory, a block at a time.
+    // NULL stops tracking.
+    void track(const uint8_t* memory, size_t size);
+    // Moves the dirty bits out, line i of the block to bit i % 64 of
+    // lines[i / 64], and clears them.
+    void take_dirty(uint64_t* lines);
+
+  private:
+    WriteWatch(const WriteWatch&);
+    WriteWatch& operator=(const WriteWatch&);
+
+    friend class Bus;
+
+    struct Watcher {
+      uint16_t address;
+      WriteWatcher watcher;
+      void* context;
+    };
+
+    struct Write {
+      uint16_t address;
+      uint8_t value;
+    };
+
+    uint64_t map[0x10000 / 64];
+    uint16_t page_counts[Bus::PAGES]; // watched addresses per page
+    std::vector<Watcher> watchers;
+    std::vector<Write> pending;
+    std::vector<Write> delivering;
+    uintptr_t tracked; // start of the tracked block
+    size_t tracked_size;
+    std::vector<uint64_t> dirty;
+    Bus* bus;
+
+    bool takes_page(int page, const uint8_t* memory) const;
+    void record(uint16_t address, uint8_t value, const uint8_t* memory);
+};
+
+inline const uint8_t* Bus::get_host_page(uint16_t address) const {
+  return pages[address >> 8].read_data;
+}
+
+inline uint8_t Bus::read(uint16_t address) const {
+  const Page& page = pages[address >> 8];
+  if (page.read_data) {
+    return page.read_data[address & 0xFF];
+  }
+  return page.reader ? page.reader(page.context, address)
+                     : uint8_t(address >> 8);
+}
+
+inline void Bus::write(uint16_t address, uint8_t value) {
+  Page& page = pages[address >> 8];
+  if (page.write_data) {
+    page.write_data[address & 0xFF] = value;
+  } else if (page.watched) {
+    write_watched(address, value);
+  } else if (page.writer) {
+    page.writer(page.context, address, value);
+  }
+}
+
+inline WriteWatch* Bus::get_write_watch() const {
+  return watch;
+}
+
+} // namespace nesemu
+
+#endif // NESEMU_CPU_BUS_H_
@@ -0,0 +1,223 @@
+#include "bus.h"
+
+#include "gtest/gtest.h"
+#include <vector>
+
+namespace nesemu {
+
+struct IoLog {
+  std::vector<uint16_t> reads;
+  std::vector<uint16_t> writes;
+  std::vector<uint8_t> values;
+};
+
+static uint8_t io_read(void* context, uint16_t address) {
+  static_cast<IoLog*>(context)->reads.push_back(address);
+  return uint8_t(address ^ 0x5A);
+}
+
+static void io_write(void* context, uint16_t address, uint8_t value) {
+  static_cast<IoLog*>(context)->writes.push_back(address);
+  static_cast<IoLog*>(context)->values.push_back(value);
+}
+
+TEST (BusTest, UnmappedIsOpenBus) {
+  Bus bus;
+  EXPECT_EQ(bus.read(0x1234), 0x12);
+  bus.write(0x1234, 0x99);
+  EXPECT_EQ(bus.read(0x1234), 0x12);
+  EXPECT_EQ(bus.get_host_page(0x1234), (const uint8_t*)NULL);
+}
+
+TEST (BusTest, MirroredMemory) {
+  Bus bus;
+  uint8_t ram[0x800] = {0};
+  ASSERT_EQ(bus.map_memory(0x0000, 0x2000, ram, sizeof ram), 0);
+  bus.write(0x0001, 0x11);
+  bus.write(0x1FFF, 0x22);
+  EXPECT_EQ(ram[0x001], 0x11);
+  EXPECT_EQ(ram[0x7FF], 0x22);
+  EXPECT_EQ(bus.read(0x0801), 0x11);
+  EXPECT_EQ(bus.read(0x17FF), 0x22);
+  EXPECT_EQ(bus.get_host_page(0x0923), ram + 0x100);
+}
+
+TEST (BusTest, RomWritesGoToHandler) {
+  Bus bus;
+  IoLog log;
+  uint8_t rom[0x4000];
+  for (int i = 0; i < 0x4000; i++) {
+    rom[i] = uint8_t(i >> 8);
+  }
+  ASSERT_EQ(bus.map_rom(0x8000, 0x8000, rom, sizeof rom, io_write, &log), 0);
+  EXPECT_EQ(bus.read(0x8123), 0x01);
+  EXPECT_EQ(bus.read(0xC123), 0x01); // 16KB mirrored
+  bus.write(0xC123, 0x77);
+  EXPECT_EQ(bus.read(0xC123), 0x01);
+  ASSERT_EQ(log.writes.size(), 1u);
+  EXPECT_EQ(log.writes[0], 0xC123);
+  EXPECT_EQ(log.values[0], 0x77);
+}
+
+TEST (BusTest, IoHandlers) {
+  Bus bus;
+  IoLog log;
+  ASSERT_EQ(bus.map_io(0x2000, 0x2000, io_read, io_write, &log), 0);
+  EXPECT_EQ(bus.read(0x2002), uint8_t(0x2002 ^ 0x5A));
+  bus.write(0x3FFF, 0x01);
+  ASSERT_EQ(log.reads.size(), 1u);
+  ASSERT_EQ(log.writes.size(), 1u);
+  EXPECT_EQ(log.writes[0], 0x3FFF);
+  EXPECT_EQ(bus.get_host_page(0x2000), (const uint8_t*)NULL);
+  EXPECT_EQ(Bus::read_bus(&bus, 0x2007), uint8_t(0x2007 ^ 0x5A));
+
+  ASSERT_EQ(bus.unmap(0x2000, 0x2000), 0);
+  EXPECT_EQ(bus.read(0x2002), 0x20);
+}
+
+TEST (BusTest, BadRanges) {
+  Bus bus;
+  uint8_t ram[0x800];
+  EXPECT_EQ(bus.map_memory(0x0010, 0x100, ram, sizeof ram), 1);
+  EXPECT_EQ(bus.map_memory(0x0000, 0x180, ram, sizeof ram), 1);
+  EXPECT_EQ(bus.map_memory(0xFF00, 0x200, ram, sizeof ram), 1);
+  EXPECT_EQ(bus.map_memory(0x0000, 0x800, ram, 0x80), 1);
+  EXPECT_EQ(bus.map_memory(0x0000, 0x800, NULL, 0x800), 1);
+  EXPECT_EQ(bus.map_io(0x4000, 0, io_read, io_write, NULL), 1);
+  EXPECT_EQ(bus.map_memory(0xFF00, 0x100, ram, sizeof ram), 0);
+}
+
+// writes a watch delivered, in order
+static void log_write(void* context, uint16_t address, uint8_t value) {
+  static_cast<IoLog*>(context)->writes.push_back(address);
+  static_cast<IoLog*>(context)->values.push_back(value);
+}
+
+TEST (BusTest, WriteWatchQueuesWatchedWrites) {
+  Bus bus;
+  uint8_t ram[0x800] = {0};
+  ASSERT_EQ(bus.map_memory(0x0000, 0x2000, ram, sizeof ram), 0);
+  IoLog log;
+  WriteWatch watch;
+  watch.add(0x0042, log_write, &log);
+  bus.set_write_watch(&watch);
+  EXPECT_EQ(bus.get_write_watch(), &watch);
+  EXPECT_TRUE(watch.is_watched(0x0042));
+  EXPECT_FALSE(watch.is_watched(0x0842)); // mirrors are other addresses
+  // only the watched page leaves host memory writes
+  EXPECT_EQ(bus.get_host_page(0x0042), ram);
+
+  bus.write(0x0042, 1);
+  bus.write(0x0043, 2); // same page, not watched
+  bus.write(0x0142, 3);
+  bus.write(0x0042, 4);
+  EXPECT_EQ(ram[0x42], 4);
+  EXPECT_EQ(ram[0x43], 2);
+  EXPECT_EQ(ram[0x142], 3);
+  EXPECT_TRUE(log.writes.empty()); // nothing until delivered
+  EXPECT_EQ(watch.get_pending(), 2u);
+  EXPECT_EQ(watch.deliver(), 2u);
+  ASSERT_EQ(log.values.size(), 2u);
+  EXPECT_EQ(log.values[0], 1);
+  EXPECT_EQ(log.values[1], 4);
+  EXPECT_EQ(watch.deliver(), 0u);
+
+  // a page with no watched address left is fast again
+  watch.remove(0x0042);
+  bus.write(0x0042, 5);
+  EXPECT_EQ(watch.get_pending(), 0u);
+  watch.add(0x01FF, log_write, &log);
+  watch.add(0x01FF, log_write, &log); // two watchers
+  bus.write(0x01FF, 6);
+  EXPECT_EQ(watch.deliver(), 1u);
+  EXPECT_EQ(log.values.size(), 4u);
+  watch.clear();
+  bus.write(0x01FF, 7);
+  EXPECT_EQ(watch.get_pending(), 0u);
+  EXPECT_EQ(ram[0x1FF], 7);
+}
+
+TEST (BusTest, WriteWatchOnHandlerPages) {
+  Bus bus;
+  IoLog io, watched;
+  uint8_t rom[0x4000] = {0};
+  ASSERT_EQ(bus.map_rom(0x8000, 0x8000, rom, sizeof rom, io_write, &io), 0);
+  ASSERT_EQ(bus.map_io(0x4000, 0x100, io_read, io_write, &io), 0);
+  WriteWatch watch;
+  bus.set_write_watch(&watch);
+  watch.add(0x8000, log_write, &watched); // after attaching
+  watch.add(0x4016, log_write, &watched);
+  bus.write(0x8000, 1);
+  bus.write(0x4016, 2);
+  bus.write(0x4017, 3);
+  EXPECT_EQ(io.writes.size(), 3u); // handlers still see every write
+  EXPECT_EQ(watch.deliver(), 2u);
+  ASSERT_EQ(watched.writes.size(), 2u);
+  EXPECT_EQ(watched.writes[1], 0x4016);
+
+  // remapping keeps the watch
+  uint8_t ram[0x100] = {0};
+  ASSERT_EQ(bus.map_memory(0x8000, 0x100, ram, sizeof ram), 0);
+  bus.write(0x8000, 9);
+  EXPECT_EQ(ram[0], 9);
+  EXPECT_EQ(watch.deliver(), 1u);
+}
+
+TEST (BusTest, WriteWatchTracksDirtyLines) {
+  Bus bus;
+  uint8_t ram[0x800] = {0};
+  ASSERT_EQ(bus.map_memory(0x0000, 0x2000, ram, sizeof ram), 0);
+  WriteWatch watch;
+  watch.track(ram, sizeof ram);
+  bus.set_write_watch(&watch);
+  bus.write(0x0001, 1);
+  bus.write(0x0FC0, 2); // a mirror of $07C0, line 31
+  bus.write(0x0040, 3);
+  uint64_t dirty[1];
+  watch.take_dirty(dirty);
+  EXPECT_EQ(dirty[0], uint64_t(1) | uint64_t(2) | uint64_t(1) << 31);
+  EXPECT_EQ(ram[0x7C0], 2);
+  EXPECT_EQ(watch.get_pending(), 0u); // no watchers, nothing queued
+  watch.take_dirty(dirty);
+  EXPECT_EQ(dirty[0], 0u);
+
+  watch.track(NULL, 0);
+  bus.write(0x0001, 4);
+  EXPECT_EQ(ram[1], 4);
+}
+
+TEST (BusTest, WriteWatchAttachment) {
+  uint8_t ram[0x100] = {0};
+  Bus bus, other;
+  ASSERT_EQ(bus.map_memory(0x0000, 0x100, ram, sizeof ram), 0);
+  ASSERT_EQ(other.map_memory(0x0000, 0x100, ram, sizeof ram), 0);
+  IoLog log;
+  {
+    WriteWatch watch;
+    watch.add(0x0010, log_write, &log);
+    bus.set_write_watch(&watch);
+
+    // copies keep their own watch
+    Bus copy(bus);
+    EXPECT_TRUE(copy.get_write_watch() == NULL);
+    copy.write(0x0010, 1);
+    other = bus;
+    other.write(0x0010, 2);
+    EXPECT_EQ(watch.get_pending(), 0u);
+    bus = copy;
+    bus.write(0x0010, 3);
+    EXPECT_EQ(watch.get_pending(), 1u);
+
+    other.set_write_watch(&watch); // moves over
+    EXPECT_TRUE(bus.get_write_watch() == NULL);
+    bus.write(0x0010, 4);
+    other.write(0x0010, 5);
+    EXPECT_EQ(watch.deliver(), 2u);
+  }
+  EXPECT_TRUE(other.get_write_watch() == NULL); // detached when destroyed
+  other.write(0x0010, 6);
+  EXPECT_EQ(ram[0x10], 6);
+  EXPECT_EQ(log.values.size(), 2u);
+}
+
+} // namespace nesemu
@@ -1,5 +1,6 @@
 #include "cpu.h"
 
+#include <cstring>
 #include <iostream>
 
 namespace nesemu {
@@ -156,6 +157,19 @@ const int instruction_cycles[256] = {
   2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0 //F
 };
 
+// every access goes through the bus, $4014 is the CPU's own
+inline uint8_t CPU::read(uint16_t address) const {
+  return bus.read(address);
+}
+
+inline void CPU::write(uint16_t address, uint8_t value) {
+  if (address == 0x4014) {
+    oam_dma(value);
+    return;
+  }
+  bus.write(address, value);
+}
+
 CPU::CPU() {
   pc = 0x34;
   sp = 0xFD;
@@ -165,10 +179,40 @@ CPU::CPU() {
   r_st = 0;
   cycles = 0;
   memset(memory, 0, sizeof memory);
+  bus.map_memory(0, 0x10000, memory, sizeof memory);
+  oam_sink = 0;
+  oam_context = 0;
+  oam_dma_pending = false;
+}
+
+CPU::CPU(const CPU& other) {
+  *this = other;
+}
+
+// Spelled out because Bus has its own copy, which would otherwise have the
+// compiler copy the 64KB of memory byte by byte.
+CPU& CPU::operator=(const CPU& other) {
+  if (this == &other) {
+    return *this;
+  }
+  cycles = other.cycles;
+  pc = other.pc;
+  sp = other.sp;
+  r_x = other.r_x;
+  r_y = other.r_y;
+  r_acc = other.r_acc;
+  r_st = other.r_st;
+  bus = other.bus;
+  oam_sink = other.oam_sink;
+  oam_context = other.oam_context;
+  oam_dma_pending = other.oam_dma_pending;
+  memcpy(memory, other.memory, sizeof memory);
+  bus.rebase(other.memory, sizeof memory, memory);
+  return *this;
 }
 
 int CPU::step() {
-  uint8_t opcode = memory[pc];
+  uint8_t opcode = read(pc);
   int instruction = instruction_type[opcode];
   // check valid opcode
   if (instruction == -1) {
@@ -180,9 +224,35 @@ int CPU::step() {
   pc += mode_byte_size[mode];
   execute(instruction, address, mode);
   cycles += instruction_cycles[opcode];
+  if (oam_dma_pending) {
+    // 513 cycles, one more to align when the DMA starts on an odd cycle
+    cycles += 513 + (cycles & 1);
+    oam_dma_pending = false;
+  }
   return 0;
 }
 
+int CPU::get_opcode_cycles(uint8_t opcode) {
+  return instruction_cycles[opcode];
+}
+
+/* Interrupts */
+void CPU::reset() {
+  pc = (uint16_t(read(0xFFFD)) << 8) | read(0xFFFC);
+  set_interrupt_disable();
+  cycles += 7;
+}
+
+// pushed the same way BRK does, with the break flag clear
+void CPU::nmi() {
+  write(0x0100 + (sp++), uint8_t(pc));
+  write(0x0100 + (sp++), uint8_t(pc >> 8));
+  write(0x0100 + (sp++), r_st & 0xEF);
+  set_interrupt_disable();
+  pc = (uint16_t(read(0xFFFB)) << 8) | read(0xFFFA);
+  cycles += 7;
+}
+
 uint16_t CPU::get_operand(uint8_t opcode) const {
   int mode = mode_table[opcode];
   uint16_t address = 0;
@@ -193,39 +263,39 @@ uint16_t CPU::get_operand(uint8_t opcode) const {
       address = pc + 1;
       break;
     case 1: // Zero Page 
-      address = memory[pc + 1];
+      address = read(pc + 1);
       break;
     case 2: // Zero Page X
-      address = (uint8_t)(memory[pc + 1] + r_x);
+      address = (uint8_t)(read(pc + 1) + r_x);
       break;
     case 3: // Zero Page Y
-      address = (uint8_t)(memory[pc + 1] + r_y);
+      address = (uint8_t)(read(pc + 1) + r_y);
       break;
     case 4: // Absolute
-      address = memory[pc + 2];
-      address = (address << 8) | memory[pc + 1];
+      address = read(pc + 2);
+      address = (address << 8) | read(pc + 1);
       break;
     case 5: // Absolute X
-      address = (uint16_t(memory[pc + 2]) << 8) | memory[pc + 1];
+      address = (uint16_t(read(pc + 2)) << 8) | read(pc + 1);
       address += r_x;
       break;
     case 6: // Absolute Y
-      address = (uint16_t(memory[pc + 2]) << 8) | memory[pc + 1];
+      address = (uint16_t(read(pc + 2)) << 8) | read(pc + 1);
       address += r_y;
       break;
     case 7: // Indirect X
-      address = uint8_t(memory[memory[pc + 1]] + r_x);
-      address = (memory[address + 1] << 8) | memory[address];
+      address = uint8_t(read(read(pc + 1)) + r_x);
+      address = (read(address + 1) << 8) | read(address);
       break;
     case 8: // Indirect Y
-      address = uint16_t(memory[memory[pc + 1] + 1] << 8) | memory[memory[pc + 1]];
+      address = uint16_t(read(read(pc + 1) + 1) << 8) | read(read(pc + 1));
       address += r_y;
       break;
     case 9: // Accumulator
       // ignore
       break;
     case 10: // Relative
-      address = memory[pc + 1];
+      address = read(pc + 1);
       if (address < 80) {
         address = pc + address + 2;
       } else {
@@ -236,8 +306,8 @@ uint16_t CPU::get_operand(uint8_t opcode) const {
       // ignore
       break;
     case 12: // Indirect 
-      address = (uint16_t(memory[pc + 2]) << 8) | memory[pc + 1];
-      address = (uint16_t(memory[address + 1]) << 8) | memory[address];
+      address = (uint16_t(read(pc + 2)) << 8) | read(pc + 1);
+      address = (uint16_t(read(address + 1)) << 8) | read(address);
       break;
     default:
       std::cerr << "Bad operand!" << std::endl;
@@ -262,7 +332,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
 
   switch (instruction) {
     case 0: // ADC
-      operand = memory[address];
+      operand = read(address);
       val16 = uint16_t(r_acc) + operand + get_carry();
       r_acc = uint8_t(val16);
       clear_carry();
@@ -279,7 +349,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 1: // AND
-      operand = memory[address];
+      operand = read(address);
       r_acc = r_acc & operand;
       clear_zero();
       clear_negative();
@@ -291,7 +361,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 2: // Asl
-      val8 = (mode == 9) ? r_acc : memory[address]; // checking if mode is accumulator
+      val8 = (mode == 9) ? r_acc : read(address); // checking if mode is accumulator
       clear_carry();
       clear_negative();
       clear_zero();
@@ -308,7 +378,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       if (mode == 9) { // Accumulator Mode
         r_acc = val8;
       } else {
-        memory[address] = val8;
+        write(address, val8);
       }
       break;
     case 3: // BCC
@@ -330,7 +400,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 6: // BIT
-      val8 = memory[address];
+      val8 = read(address);
       clear_zero();
       clear_overflow();
       clear_negative();
@@ -365,10 +435,10 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       break;
     case 10: // BRK
       pc++;
-      memory[0x0100 + (sp++)] = uint8_t(pc); 
-      memory[0x0100 + (sp++)] = uint8_t(pc >> 8);
-      memory[0x0100 + (sp++)] = r_st;
-      pc = (uint16_t(memory[0xFFFF]) << 8) | memory[0xFFFE];
+      write(0x0100 + (sp++), uint8_t(pc)); 
+      write(0x0100 + (sp++), uint8_t(pc >> 8));
+      write(0x0100 + (sp++), r_st);
+      pc = (uint16_t(read(0xFFFF)) << 8) | read(0xFFFE);
       set_break();
       break;
     case 11: // BVC
@@ -396,7 +466,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       clear_overflow();
       break;
     case 17: // CMP
-      val8 = memory[address];
+      val8 = read(address);
       clear_carry();
       clear_zero();
       clear_negative();
@@ -412,7 +482,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 18: // CPX
-      val8 = memory[address];
+      val8 = read(address);
       clear_carry();
       clear_zero();
       clear_negative();
@@ -428,7 +498,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 19: // CPY
-      val8 = memory[address];
+      val8 = read(address);
       clear_carry();
       clear_zero();
       clear_negative();
@@ -444,13 +514,14 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 20: // DEC
-      memory[address]--;
+      val8 = read(address) - 1;
+      write(address, val8);
       clear_zero();
       clear_negative();
-      if (!memory[address]) { // zero flag
+      if (!val8) { // zero flag
         set_zero();
       }
-      if (memory[address] & 0x80) { // negative flag
+      if (val8 & 0x80) { // negative flag
         set_negative();
       }
       break;
@@ -477,7 +548,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 23: // EOR
-      r_acc ^= memory[address];
+      r_acc ^= read(address);
       clear_zero();
       clear_negative();
       if (!r_acc) { // zero flag
@@ -488,13 +559,14 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 24: // INC
-      memory[address]++;
+      val8 = read(address) + 1;
+      write(address, val8);
       clear_zero();
       clear_negative();
-      if (!memory[address]) { // zero flag
+      if (!val8) { // zero flag
         set_zero();
       }
-      if (memory[address] & 0x80) { // negative flag
+      if (val8 & 0x80) { // negative flag
         set_negative();
       }
       break;
@@ -524,12 +596,12 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       pc = address;
       break;
     case 28: // JSR
-      memory[0x0100 + (sp++)] = uint8_t(pc - 1);
-      memory[0x0100 + (sp++)] = uint8_t((pc - 1) >> 8);
-      pc = uint16_t(memory[address + 1] << 8) | memory[address];
+      write(0x0100 + (sp++), uint8_t(pc - 1));
+      write(0x0100 + (sp++), uint8_t((pc - 1) >> 8));
+      pc = uint16_t(read(address + 1) << 8) | read(address);
       break;
     case 29: // LDA
-      r_acc = memory[address];
+      r_acc = read(address);
       clear_zero();
       clear_negative();
       if (r_acc == 0) { // zero flag
@@ -540,7 +612,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 30: // LDX
-      r_x = memory[address];
+      r_x = read(address);
       clear_zero();
       clear_negative();
       if (r_x == 0) { // zero flag
@@ -551,7 +623,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 31: // LDY
-      r_y = memory[address];
+      r_y = read(address);
       clear_zero();
       clear_negative();
       if (r_y == 0) { // zero flag
@@ -562,7 +634,7 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 32: // LSR
-      val8 = (mode == 9) ? r_acc : memory[address];
+      val8 = (mode == 9) ? r_acc : read(address);
       clear_carry();
       clear_zero();
       clear_negative(); // always 0
@@ -576,14 +648,14 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       if (mode == 9) { // accumulator mode
         r_acc = val8;
       } else {
-        memory[address] = val8;
+        write(address, val8);
       }
       break;
     case 33: // NOP
       // do nothing
       break;
     case 34: // ORA
-      val8 = memory[address];
+      val8 = read(address);
       r_acc |= val8;
       clear_zero();
       clear_negative();
@@ -595,16 +667,16 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       }
       break;
     case 35: // PHA
-      memory[0x0100 + sp] = r_acc;
+      write(0x0100 + sp, r_acc);
       sp--;
       break;
     case 36: // PHP
-      memory[0x0100 + sp] = r_st;
+      write(0x0100 + sp, r_st);
       sp--;
       break;
     case 37: // PLA
       sp++;
-      r_acc = memory[0x0100 + sp];
+      r_acc = read(0x0100 + sp);
       clear_zero();
       clear_negative();
       if (!r_acc) { // zero flag
@@ -616,10 +688,10 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       break;
     case 38: // PLP
       sp++;
-      r_st = memory[0x0100 + sp];
+      r_st = read(0x0100 + sp);
       break;
     case 39: // ROL
-      val8 = (mode == 9) ? r_acc : memory[address];
+      val8 = (mode == 9) ? r_acc : read(address);
       val16 = val8; // template holder
       val8 <<= 1;
       val8 |= get_carry();
@@ -638,11 +710,11 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       if (mode == 9) { // accumulator mode
         r_acc = val8;
       } else {
-        memory[address] = val8;
+        write(address, val8);
       }
       break;
     case 40: // ROR
-      val8 = (mode == 9) ? r_acc : memory[address];
+      val8 = (mode == 9) ? r_acc : read(address);
       val16 = val8; // template holder
       val8 >>= 1;
       val8 |= (get_carry() << 7);
@@ -661,21 +733,21 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       if (mode == 9) { // accumulator mode
         r_acc = val8;
       } else {
-        memory[address] = val8;
+        write(address, val8);
       }
       break;
     case 41: // RTI
-      r_st = memory[0x0100 + (--sp)];
-      pc = uint16_t(memory[0x0100 + (--sp)]) << 8; // high byte
-      pc |= memory[0x0100 + (--sp)]; // low byte
+      r_st = read(0x0100 + (--sp));
+      pc = uint16_t(read(0x0100 + (--sp))) << 8; // high byte
+      pc |= read(0x0100 + (--sp)); // low byte
       break;
     case 42: // RTS
-      pc = uint16_t(memory[0x0100 + (--sp)]) << 8; // high byte
-      pc |= memory[0x0100 + (--sp)]; // low byte
+      pc = uint16_t(read(0x0100 + (--sp))) << 8; // high byte
+      pc |= read(0x0100 + (--sp)); // low byte
       pc++;
       break;
     case 43: // SBC
-      val8 = memory[address];
+      val8 = read(address);
       val16 = uint16_t(r_acc) - val8 - get_carry();
       clear_carry();
       clear_zero();
@@ -701,13 +773,13 @@ int CPU::execute(int instruction, uint16_t address, int mode) {
       set_interrupt_disable();
       break;
     case 47: // STA
-      memory[address] = r_acc;
+      write(address, r_acc);
       break;
     case 48: // STX
-      memory[address] = r_x;
+      write(address, r_x);
       break;
     case 49: // STY
-      memory[address] = r_y;
+      write(address, r_y);
       break;
     case 50: // TAX
       r_x = r_acc;
@@ -780,11 +852,71 @@ uint64_t CPU::get_cycles() const {
 
 // set and get memory
 uint8_t CPU::get_memory(uint16_t address) const {
-  return memory[address];
+  return bus.read(address);
 }
 
 void CPU::set_memory(uint16_t address, uint8_t value) {
-  memory[address] = value;
+  bus.write(address, value);
+}
+
+/* Bus */
+Bus& CPU::get_bus() {
+  return bus;
+}
+
+const Bus& CPU::get_bus() const {
+  return bus;
+}
+
+/* DMA */
+void CPU::set_oam_dma(OamDmaSink sink, void* context) {
+  oam_sink = sink;
+  oam_context = context;
+}
+
+void CPU::add_stall_cycles(uint64_t count) {
+  cycles += count;
+}
+
+// the per-byte path only for sources without host memory, e.g. I/O pages
+void CPU::oam_dma(uint8_t page) {
+  uint16_t base = uint16_t(page << 8);
+  const uint8_t* source = bus.get_host_page(base);
+  if (oam_sink && source) {
+    oam_sink(oam_context, source);
+  } else if (oam_sink) {
+    uint8_t bytes[Bus::PAGE_SIZE];
+    for (int i = 0; i < Bus::PAGE_SIZE; i++) {
+      bytes[i] = bus.read(uint16_t(base | i));
+    }
+    oam_sink(oam_context, bytes);
+  } else {
+    for (int i = 0; i < Bus::PAGE_SIZE; i++) {
+      bus.write(0x2004, bus.read(uint16_t(base | i)));
+    }
+  }
+  oam_dma_pending = true;
+}
+
+/* State */
+void CPU::save_state(CPUState& state) const {
+  state.cycles = cycles;
+  state.pc = pc;
+  state.sp = sp;
+  state.r_x = r_x;
+  state.r_y = r_y;
+  state.r_acc = r_acc;
+  state.r_st = r_st;
+}
+
+void CPU::load_state(const CPUState& state) {
+  cycles = state.cycles;
+  pc = state.pc;
+  sp = state.sp;
+  r_x = state.r_x;
+  r_y = state.r_y;
+  r_acc = state.r_acc;
+  r_st = state.r_st;
 }
 
 // set and get program counter
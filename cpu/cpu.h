@@ -1,17 +1,45 @@
 #ifndef NESEMU_CPU_CPU_H_
 #define NESEMU_CPU_CPU_H_
 
+#include "bus.h"
+
 #include <iostream>
 
 namespace nesemu {
 
+// receives the 256 bytes of an OAM DMA, in the order $2004 would
+typedef void (*OamDmaSink)(void* context, const uint8_t* page);
+
+// Registers and cycle count, a CPU's state apart from the memory its bus
+// maps. Plain data, it can be copied anywhere.
+struct CPUState {
+  uint64_t cycles;
+  uint16_t pc;
+  uint8_t sp;
+  uint8_t r_x;
+  uint8_t r_y;
+  uint8_t r_acc;
+  uint8_t r_st;
+};
+
 class CPU {
   public:
     CPU();
+    // Copies registers, bus and memory, the memory in one memcpy. Pages
+    // the original mapped to its own memory map to the copy's, other host
+    // memory and handlers are shared.
+    CPU(const CPU& other);
+    CPU& operator=(const CPU& other);
 
     /* Cpu instructions */
     int step();
     int execute(int instruction, uint16_t address, int mode);
+    // cycles of an opcode before branch and DMA extras, 0 if unknown
+    static int get_opcode_cycles(uint8_t opcode);
+
+    /* Interrupts, taken between instructions */
+    void reset(); // jumps through $FFFC
+    void nmi();   // pushes pc and status, jumps through $FFFA
 
     /* Getters & Setters*/
     uint16_t get_pc() const;
@@ -70,7 +98,26 @@ class CPU {
     uint8_t get_memory(uint16_t address) const;
     void set_memory(uint16_t address, uint8_t value);
 
+    /* Bus */
+    // All 64KB map to the CPU's own memory until remapped.
+    Bus& get_bus();
+    const Bus& get_bus() const;
+
+    /* DMA */
+    // A $4014 write copies a page to the sink in one call, straight from
+    // host memory when the page has it. Without a sink the bytes go through
+    // $2004 on the bus one by one.
+    void set_oam_dma(OamDmaSink sink, void* context);
+    // cycles the CPU is halted for by other DMA, e.g. DMC fetches
+    void add_stall_cycles(uint64_t count);
+
+    /* State, between instructions */
+    void save_state(CPUState& state) const;
+    void load_state(const CPUState& state);
+
   private:
+    friend class LockstepCPU; // holds the registers of CPUs it steps
+
     uint64_t cycles;
     uint16_t pc;
     uint8_t sp;
@@ -83,7 +130,16 @@ class CPU {
     // get the memory address of the operand based on opcode
     uint16_t get_operand(uint8_t opcode) const;
 
-    uint8_t memory[0x10000]; // System memory
+    uint8_t read(uint16_t address) const;
+    void write(uint16_t address, uint8_t value);
+    void oam_dma(uint8_t page);
+
+    Bus bus;
+    OamDmaSink oam_sink;
+    void* oam_context;
+    bool oam_dma_pending; // stall is added once the instruction is counted
+
+    uint8_t memory[0x10000]; // System memory, mapped by default
 };
 
 } // namespace  nessim
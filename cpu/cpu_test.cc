@@ -3,6 +3,7 @@
 #include "gtest/gtest.h"
 #include "test_utils.h"
 #include <string>
+#include <vector>
 
 namespace nesemu {
 
@@ -2518,4 +2519,160 @@ TEST (ClockCyclePageCrossedTest, ORA_LogicalInclusiveOr) {
 TEST (ClockCyclePageCrossedTest, SBC_SubtractWithCarry) {
 }
 
+/* Interrupts */
+TEST (InterruptTest, ResetAndNmi) {
+  CPU cpu;
+  cpu.set_memory(0xFFFC, 0x00);
+  cpu.set_memory(0xFFFD, 0xC0);
+  cpu.set_memory(0xFFFA, 0x00);
+  cpu.set_memory(0xFFFB, 0xD0);
+  cpu.reset();
+  EXPECT_EQ(cpu.get_pc(), 0xC000);
+  EXPECT_EQ(cpu.get_interrupt_disable(), 1);
+  EXPECT_EQ(cpu.get_cycles(), 7u);
+
+  cpu.set_carry();
+  cpu.nmi();
+  EXPECT_EQ(cpu.get_pc(), 0xD000);
+  EXPECT_EQ(cpu.get_cycles(), 14u);
+  cpu.set_memory(0xD000, 0x40); // RTI
+  cpu.clear_carry();
+  cpu.step();
+  EXPECT_EQ(cpu.get_pc(), 0xC000);
+  EXPECT_EQ(cpu.get_carry(), 1);
+}
+
+/* OAM DMA */
+struct DmaLog {
+  std::vector<const uint8_t*> sources;
+  std::vector<uint8_t> bytes;
+  int reads;
+};
+
+static void dma_sink(void* context, const uint8_t* page) {
+  DmaLog* log = static_cast<DmaLog*>(context);
+  log->sources.push_back(page);
+  log->bytes.assign(page, page + 256);
+}
+
+static uint8_t dma_io_read(void* context, uint16_t address) {
+  static_cast<DmaLog*>(context)->reads++;
+  return uint8_t(address * 3);
+}
+
+static void dma_io_write(void* context, uint16_t address, uint8_t value) {
+  if (address == 0x2004) {
+    static_cast<DmaLog*>(context)->bytes.push_back(value);
+  }
+}
+
+// STA $4014 at the program counter, with the page in the accumulator
+static void store_dma(CPU& cpu, uint8_t page) {
+  cpu.set_acc(page);
+  cpu.set_memory(cpu.get_pc(), 0x8D);
+  cpu.set_memory(cpu.get_pc() + 1, 0x14);
+  cpu.set_memory(cpu.get_pc() + 2, 0x40);
+}
+
+TEST (OamDmaTest, RamPageIsCopiedInOneCall) {
+  CPU cpu;
+  DmaLog log;
+  log.reads = 0;
+  cpu.set_oam_dma(dma_sink, &log);
+  for (int i = 0; i < 256; i++) {
+    cpu.set_memory(0x0200 + i, uint8_t(i ^ 0xA5));
+  }
+  store_dma(cpu, 0x02);
+  cpu.step();
+  ASSERT_EQ(log.sources.size(), 1u);
+  EXPECT_EQ(log.sources[0], cpu.get_bus().get_host_page(0x0200));
+  for (int i = 0; i < 256; i++) {
+    ASSERT_EQ(log.bytes[i], uint8_t(i ^ 0xA5));
+  }
+  EXPECT_EQ(cpu.get_cycles(), 4u + 513); // even cycle after the store
+}
+
+TEST (OamDmaTest, OddCycleAddsOne) {
+  CPU cpu;
+  DmaLog log;
+  cpu.set_oam_dma(dma_sink, &log);
+  cpu.set_memory(cpu.get_pc(), 0xA5); // LDA zero page, 3 cycles
+  cpu.step();
+  store_dma(cpu, 0x03);
+  cpu.step();
+  EXPECT_EQ(cpu.get_cycles(), 3u + 4 + 514);
+
+  cpu.add_stall_cycles(4); // e.g. a DMC fetch
+  EXPECT_EQ(cpu.get_cycles(), 3u + 4 + 514 + 4);
+}
+
+TEST (OamDmaTest, IoPageIsReadByteByByte) {
+  CPU cpu;
+  DmaLog log;
+  log.reads = 0;
+  cpu.get_bus().map_io(0x5000, 0x100, dma_io_read, NULL, &log);
+  cpu.set_oam_dma(dma_sink, &log);
+  store_dma(cpu, 0x50);
+  cpu.step();
+  EXPECT_EQ(log.reads, 256);
+  ASSERT_EQ(log.bytes.size(), 256u);
+  EXPECT_EQ(log.bytes[1], 0x03);
+  EXPECT_EQ(log.bytes[255], uint8_t(0x50FF * 3));
+  EXPECT_EQ(cpu.get_cycles(), 4u + 513);
+}
+
+TEST (OamDmaTest, NoSinkWritesOamData) {
+  CPU cpu;
+  DmaLog log;
+  cpu.get_bus().map_io(0x2000, 0x2000, NULL, dma_io_write, &log);
+  for (int i = 0; i < 256; i++) {
+    cpu.set_memory(0x0700 + i, uint8_t(255 - i));
+  }
+  store_dma(cpu, 0x07);
+  cpu.step();
+  ASSERT_EQ(log.bytes.size(), 256u);
+  for (int i = 0; i < 256; i++) {
+    ASSERT_EQ(log.bytes[i], uint8_t(255 - i));
+  }
+}
+
+// a copy is a savestate of the CPU it came from
+TEST (CopyTest, RestoresRegistersAndMemory) {
+  CPU cpu;
+  cpu.set_memory(0x0010, 5);
+  cpu.set_memory(0xFFFF, 6);
+  cpu.set_acc(7);
+  CPU saved(cpu);
+  cpu.set_memory(0x0010, 9);
+  cpu.set_memory(0xFFFF, 9);
+  cpu.set_acc(1);
+  cpu = saved;
+  EXPECT_EQ(cpu.get_memory(0x0010), 5);
+  EXPECT_EQ(cpu.get_memory(0xFFFF), 6);
+  EXPECT_EQ(cpu.get_acc(), 7);
+}
+
+// and has memory of its own, which outlives the original
+TEST (CopyTest, IsIndependentOfItsSource) {
+  CPU* original = new CPU;
+  uint8_t ram[0x800] = {0};
+  original->get_bus().map_memory(0x0000, 0x2000, ram, sizeof ram);
+  original->set_memory(0x4000, 5);
+  CPU copy(*original);
+  CPU assigned;
+  assigned = *original;
+  copy.set_memory(0x4000, 6);
+  assigned.set_memory(0x4000, 7);
+  EXPECT_EQ(original->get_memory(0x4000), 5);
+  EXPECT_EQ(copy.get_memory(0x4000), 6);
+  EXPECT_EQ(assigned.get_memory(0x4000), 7);
+  // memory mapped from elsewhere stays shared
+  copy.set_memory(0x0801, 8);
+  EXPECT_EQ(original->get_memory(0x0001), 8);
+  delete original;
+  copy.set_memory(0x4001, 9);
+  EXPECT_EQ(copy.get_memory(0x4000), 6);
+  EXPECT_EQ(copy.get_memory(0x4001), 9);
+}
+
 } // namespace nesemu
@@ -0,0 +1,101 @@
+#include "lockstep_cpu.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int LANES = LockstepCPU::MAX_LANES;
+static const int STEPS = 200000;
+
+// A loop adding $20 into $10, counting into $30 when the sum's low bits
+// are clear and folding $11 into $0200, sixteen times per pass
+static const uint8_t PROGRAM[] = {
+  0xA2, 0x00,       // 8000 LDX #$00
+  0xA5, 0x10,       // 8002 LDA $10
+  0x18,             // 8004 CLC
+  0x65, 0x20,       // 8005 ADC $20
+  0x85, 0x10,       // 8007 STA $10
+  0x29, 0x07,       // 8009 AND #$07
+  0xD0, 0x03,       // 800B BNE $8010
+  0xE6, 0x30,       // 800D INC $30
+  0xEA,             // 800F NOP
+  0xAD, 0x00, 0x02, // 8010 LDA $0200
+  0x45, 0x11,       // 8013 EOR $11
+  0x8D, 0x00, 0x02, // 8015 STA $0200
+  0xE8,             // 8018 INX
+  0xE0, 0x10,       // 8019 CPX #$10
+  0xD0, 0xE5,       // 801B BNE $8002
+  0x4C, 0x00, 0x80  // 801D JMP $8000
+};
+
+// every lane the same data, or its own step for $20 so branches diverge
+static void set_up(std::vector<CPU>& cpus, bool divergent) {
+  for (int i = 0; i < LANES; i++) {
+    CPU& cpu = cpus[i];
+    for (size_t j = 0; j < sizeof PROGRAM; j++) {
+      cpu.set_memory(uint16_t(0x8000 + j), PROGRAM[j]);
+    }
+    cpu.set_memory(0x20, uint8_t(divergent ? 1 + i : 3));
+    cpu.set_memory(0x11, 0x5A);
+    cpu.set_pc(0x8000);
+  }
+}
+
+// nanoseconds per instruction of one CPU, each CPU stepped on its own
+static double run_plain(bool divergent) {
+  std::vector<CPU> cpus(LANES);
+  set_up(cpus, divergent);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int step = 0; step < STEPS; step++) {
+    for (int i = 0; i < LANES; i++) {
+      cpus[i].step();
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() * 1e9 / (double(STEPS) * LANES);
+}
+
+// the same through LockstepCPU, with the share of grouped lane steps
+static double run_lockstep(bool vectorized, bool divergent, double* grouped) {
+  std::vector<CPU> cpus(LANES);
+  set_up(cpus, divergent);
+  std::vector<CPU*> pointers;
+  for (int i = 0; i < LANES; i++) {
+    pointers.push_back(&cpus[i]);
+  }
+  LockstepCPU lockstep(vectorized);
+  lockstep.load(&pointers[0], LANES);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int step = 0; step < STEPS; step++) {
+    lockstep.step();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  lockstep.store();
+  *grouped = double(lockstep.get_group_steps()) /
+             double(lockstep.get_group_steps() + lockstep.get_single_steps());
+  return elapsed.count() * 1e9 / (double(STEPS) * LANES);
+}
+
+int main() {
+  printf("ns per instruction per CPU, %d CPUs, %d steps\n", LANES, STEPS);
+  const char* vector_name = LockstepCPU(true).is_vectorized() ? "avx2"
+                                                              : "(no avx2)";
+  for (int divergent = 0; divergent < 2; divergent++) {
+    double grouped, scalar_grouped;
+    double plain = run_plain(divergent);
+    double scalar = run_lockstep(false, divergent, &scalar_grouped);
+    double vector = run_lockstep(true, divergent, &grouped);
+    printf("%s\n", divergent ? "divergent branches" : "converged");
+    printf("  CPU::step()      %8.2f\n", plain);
+    printf("  lockstep scalar  %8.2f\n", scalar);
+    printf("  lockstep %-7s %8.2f  %5.1f%% of lane steps grouped\n",
+           vector_name, vector, grouped * 100);
+  }
+  return 0;
+}
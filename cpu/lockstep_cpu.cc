@@ -0,0 +1,684 @@
+#include "lockstep_cpu.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NESEMU_X86 1
+#include <immintrin.h>
+#endif
+
+namespace nesemu {
+
+/* Instructions with a group form */
+enum {
+  GROUP_NONE,
+  GROUP_LDA, GROUP_LDX, GROUP_LDY,
+  GROUP_AND, GROUP_ORA, GROUP_EOR, GROUP_ADC, GROUP_SBC,
+  GROUP_CMP, GROUP_CPX, GROUP_CPY, GROUP_BIT,
+  GROUP_STA, GROUP_STX, GROUP_STY, GROUP_INC, GROUP_DEC,
+  GROUP_INX, GROUP_INY, GROUP_DEX, GROUP_DEY,
+  GROUP_TAX, GROUP_TAY, GROUP_TXA, GROUP_TYA, GROUP_TSX, GROUP_TXS,
+  GROUP_ASL, GROUP_LSR, GROUP_ROL, GROUP_ROR, // accumulator only
+  GROUP_FLAG, GROUP_NOP, GROUP_BRANCH, GROUP_JMP
+};
+
+enum {
+  OPERAND_NONE, // implied and accumulator
+  OPERAND_IMMEDIATE,
+  OPERAND_ZERO_PAGE,
+  OPERAND_ABSOLUTE,
+  OPERAND_RELATIVE
+};
+
+static const int OPERAND_SIZE[5] = {1, 2, 2, 3, 2};
+static const int MAX_LANES_QUADS = LockstepCPU::MAX_LANES / 4;
+
+struct GroupOpcode {
+  uint8_t opcode;
+  uint8_t instruction;
+  uint8_t operand;
+  uint8_t flag;  // status bit a branch tests or a flag instruction changes
+  uint8_t value; // branch when the bit is this, or what the bit becomes
+};
+
+static const GroupOpcode GROUP_OPCODES[] = {
+  {0xA9, GROUP_LDA, OPERAND_IMMEDIATE, 0, 0},
+  {0xA5, GROUP_LDA, OPERAND_ZERO_PAGE, 0, 0},
+  {0xAD, GROUP_LDA, OPERAND_ABSOLUTE, 0, 0},
+  {0xA2, GROUP_LDX, OPERAND_IMMEDIATE, 0, 0},
+  {0xA6, GROUP_LDX, OPERAND_ZERO_PAGE, 0, 0},
+  {0xAE, GROUP_LDX, OPERAND_ABSOLUTE, 0, 0},
+  {0xA0, GROUP_LDY, OPERAND_IMMEDIATE, 0, 0},
+  {0xA4, GROUP_LDY, OPERAND_ZERO_PAGE, 0, 0},
+  {0xAC, GROUP_LDY, OPERAND_ABSOLUTE, 0, 0},
+  {0x29, GROUP_AND, OPERAND_IMMEDIATE, 0, 0},
+  {0x25, GROUP_AND, OPERAND_ZERO_PAGE, 0, 0},
+  {0x2D, GROUP_AND, OPERAND_ABSOLUTE, 0, 0},
+  {0x09, GROUP_ORA, OPERAND_IMMEDIATE, 0, 0},
+  {0x05, GROUP_ORA, OPERAND_ZERO_PAGE, 0, 0},
+  {0x0D, GROUP_ORA, OPERAND_ABSOLUTE, 0, 0},
+  {0x49, GROUP_EOR, OPERAND_IMMEDIATE, 0, 0},
+  {0x45, GROUP_EOR, OPERAND_ZERO_PAGE, 0, 0},
+  {0x4D, GROUP_EOR, OPERAND_ABSOLUTE, 0, 0},
+  {0x69, GROUP_ADC, OPERAND_IMMEDIATE, 0, 0},
+  {0x65, GROUP_ADC, OPERAND_ZERO_PAGE, 0, 0},
+  {0x6D, GROUP_ADC, OPERAND_ABSOLUTE, 0, 0},
+  {0xE9, GROUP_SBC, OPERAND_IMMEDIATE, 0, 0},
+  {0xE5, GROUP_SBC, OPERAND_ZERO_PAGE, 0, 0},
+  {0xED, GROUP_SBC, OPERAND_ABSOLUTE, 0, 0},
+  {0xC9, GROUP_CMP, OPERAND_IMMEDIATE, 0, 0},
+  {0xC5, GROUP_CMP, OPERAND_ZERO_PAGE, 0, 0},
+  {0xCD, GROUP_CMP, OPERAND_ABSOLUTE, 0, 0},
+  {0xE0, GROUP_CPX, OPERAND_IMMEDIATE, 0, 0},
+  {0xE4, GROUP_CPX, OPERAND_ZERO_PAGE, 0, 0},
+  {0xEC, GROUP_CPX, OPERAND_ABSOLUTE, 0, 0},
+  {0xC0, GROUP_CPY, OPERAND_IMMEDIATE, 0, 0},
+  {0xC4, GROUP_CPY, OPERAND_ZERO_PAGE, 0, 0},
+  {0xCC, GROUP_CPY, OPERAND_ABSOLUTE, 0, 0},
+  {0x24, GROUP_BIT, OPERAND_ZERO_PAGE, 0, 0},
+  {0x2C, GROUP_BIT, OPERAND_ABSOLUTE, 0, 0},
+  {0x85, GROUP_STA, OPERAND_ZERO_PAGE, 0, 0},
+  {0x8D, GROUP_STA, OPERAND_ABSOLUTE, 0, 0},
+  {0x86, GROUP_STX, OPERAND_ZERO_PAGE, 0, 0},
+  {0x8E, GROUP_STX, OPERAND_ABSOLUTE, 0, 0},
+  {0x84, GROUP_STY, OPERAND_ZERO_PAGE, 0, 0},
+  {0x8C, GROUP_STY, OPERAND_ABSOLUTE, 0, 0},
+  {0xE6, GROUP_INC, OPERAND_ZERO_PAGE, 0, 0},
+  {0xEE, GROUP_INC, OPERAND_ABSOLUTE, 0, 0},
+  {0xC6, GROUP_DEC, OPERAND_ZERO_PAGE, 0, 0},
+  {0xCE, GROUP_DEC, OPERAND_ABSOLUTE, 0, 0},
+  {0xE8, GROUP_INX, OPERAND_NONE, 0, 0},
+  {0xC8, GROUP_INY, OPERAND_NONE, 0, 0},
+  {0xCA, GROUP_DEX, OPERAND_NONE, 0, 0},
+  {0x88, GROUP_DEY, OPERAND_NONE, 0, 0},
+  {0xAA, GROUP_TAX, OPERAND_NONE, 0, 0},
+  {0xA8, GROUP_TAY, OPERAND_NONE, 0, 0},
+  {0x8A, GROUP_TXA, OPERAND_NONE, 0, 0},
+  {0x98, GROUP_TYA, OPERAND_NONE, 0, 0},
+  {0xBA, GROUP_TSX, OPERAND_NONE, 0, 0},
+  {0x9A, GROUP_TXS, OPERAND_NONE, 0, 0},
+  {0x0A, GROUP_ASL, OPERAND_NONE, 0, 0},
+  {0x4A, GROUP_LSR, OPERAND_NONE, 0, 0},
+  {0x2A, GROUP_ROL, OPERAND_NONE, 0, 0},
+  {0x6A, GROUP_ROR, OPERAND_NONE, 0, 0},
+  {0x18, GROUP_FLAG, OPERAND_NONE, 0x01, 0}, // CLC
+  {0x38, GROUP_FLAG, OPERAND_NONE, 0x01, 1}, // SEC
+  {0x58, GROUP_FLAG, OPERAND_NONE, 0x04, 0}, // CLI
+  {0x78, GROUP_FLAG, OPERAND_NONE, 0x04, 1}, // SEI
+  {0xB8, GROUP_FLAG, OPERAND_NONE, 0x40, 0}, // CLV
+  {0xD8, GROUP_FLAG, OPERAND_NONE, 0x08, 0}, // CLD
+  {0xF8, GROUP_FLAG, OPERAND_NONE, 0x08, 1}, // SED
+  {0xEA, GROUP_NOP, OPERAND_NONE, 0, 0},
+  {0x10, GROUP_BRANCH, OPERAND_RELATIVE, 0x80, 0}, // BPL
+  {0x30, GROUP_BRANCH, OPERAND_RELATIVE, 0x80, 1}, // BMI
+  {0x50, GROUP_BRANCH, OPERAND_RELATIVE, 0x40, 0}, // BVC
+  {0x70, GROUP_BRANCH, OPERAND_RELATIVE, 0x40, 1}, // BVS
+  {0x90, GROUP_BRANCH, OPERAND_RELATIVE, 0x01, 0}, // BCC
+  {0xB0, GROUP_BRANCH, OPERAND_RELATIVE, 0x01, 1}, // BCS
+  {0xD0, GROUP_BRANCH, OPERAND_RELATIVE, 0x02, 0}, // BNE
+  {0xF0, GROUP_BRANCH, OPERAND_RELATIVE, 0x02, 1}, // BEQ
+  {0x4C, GROUP_JMP, OPERAND_ABSOLUTE, 0, 0}
+};
+
+struct GroupTable {
+  GroupOpcode entries[256];
+
+  GroupTable() {
+    memset(entries, 0, sizeof entries);
+    for (size_t i = 0; i < sizeof GROUP_OPCODES / sizeof GROUP_OPCODES[0];
+         i++) {
+      entries[GROUP_OPCODES[i].opcode] = GROUP_OPCODES[i];
+    }
+  }
+};
+
+static const GroupOpcode& group_opcode(uint8_t opcode) {
+  static const GroupTable table;
+  return table.entries[opcode];
+}
+
+static bool writes_memory(int instruction) {
+  return instruction == GROUP_STA || instruction == GROUP_STX ||
+         instruction == GROUP_STY || instruction == GROUP_INC ||
+         instruction == GROUP_DEC;
+}
+
+static bool reads_memory(int instruction) {
+  return instruction != GROUP_STA && instruction != GROUP_STX &&
+         instruction != GROUP_STY && instruction != GROUP_JMP;
+}
+
+/* AVX2 kernels */
+struct LaneRegisters {
+  uint8_t* acc;
+  uint8_t* x;
+  uint8_t* y;
+  uint8_t* sp;
+  uint8_t* st;
+};
+
+#ifdef NESEMU_X86
+
+// one byte of 0xFF per set bit of mask
+__attribute__((target("avx2")))
+static __m256i expand_mask(uint32_t mask) {
+  const __m256i spread = _mm256_setr_epi64x(
+      0x0000000000000000LL, 0x0101010101010101LL, 0x0202020202020202LL,
+      0x0303030303030303LL);
+  const __m256i bits = _mm256_set1_epi64x(int64_t(0x8040201008040201ULL));
+  __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(int(mask)), spread);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+// N and Z of a result, as the status bits
+__attribute__((target("avx2")))
+static __m256i nz(__m256i value) {
+  __m256i zero = _mm256_setzero_si256();
+  return _mm256_or_si256(
+      _mm256_and_si256(value, _mm256_set1_epi8(char(0x80))),
+      _mm256_and_si256(_mm256_cmpeq_epi8(value, zero), _mm256_set1_epi8(2)));
+}
+
+// unsigned a >= b
+__attribute__((target("avx2")))
+static __m256i at_least(__m256i a, __m256i b) {
+  return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a);
+}
+
+__attribute__((target("avx2")))
+static uint32_t same_pc_avx2(const uint16_t* pc, uint16_t address) {
+  __m256i wanted = _mm256_set1_epi16(short(address));
+  __m256i low = _mm256_cmpeq_epi16(
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(pc)), wanted);
+  __m256i high = _mm256_cmpeq_epi16(
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(pc + 16)), wanted);
+  // packing interleaves the 128 bit halves, the permute puts lanes back
+  __m256i packed =
+      _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+  return uint32_t(_mm256_movemask_epi8(packed));
+}
+
+// Register and flag work of one instruction on the member lanes, with the
+// same results as CPU::execute(). value holds each lane's operand, or its
+// INC/DEC result. Returns the lanes that take a branch.
+__attribute__((target("avx2")))
+static uint32_t group_kernel_avx2(const GroupOpcode& op, uint32_t members,
+                                  const uint8_t* value,
+                                  const LaneRegisters& regs) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi8(char(0xFF));
+  const __m256i c_bit = _mm256_set1_epi8(0x01);
+  const __m256i z_bit = _mm256_set1_epi8(0x02);
+  const __m256i v_bit = _mm256_set1_epi8(0x40);
+  const __m256i n_bit = _mm256_set1_epi8(char(0x80));
+  const __m256i nz_bits = _mm256_set1_epi8(char(0x82));
+  const __m256i cnz_bits = _mm256_set1_epi8(char(0x83));
+
+  __m256i mask = expand_mask(members);
+  __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(value));
+  __m256i a = _mm256_load_si256(reinterpret_cast<__m256i*>(regs.acc));
+  __m256i x = _mm256_load_si256(reinterpret_cast<__m256i*>(regs.x));
+  __m256i y = _mm256_load_si256(reinterpret_cast<__m256i*>(regs.y));
+  __m256i s = _mm256_load_si256(reinterpret_cast<__m256i*>(regs.sp));
+  __m256i p = _mm256_load_si256(reinterpret_cast<__m256i*>(regs.st));
+  __m256i carry_in = _mm256_and_si256(p, c_bit);
+  __m256i carry_set = _mm256_cmpeq_epi8(carry_in, c_bit);
+  __m256i new_a = a, new_x = x, new_y = y, new_s = s;
+  __m256i clear = zero; // status bits cleared, then set
+  __m256i set = zero;
+  __m256i carry, result;
+
+  switch (op.instruction) {
+    case GROUP_LDA:
+      new_a = v;
+      clear = nz_bits;
+      set = nz(v);
+      break;
+    case GROUP_LDX:
+      new_x = v;
+      clear = nz_bits;
+      set = nz(v);
+      break;
+    case GROUP_LDY:
+      new_y = v;
+      clear = nz_bits;
+      set = nz(v);
+      break;
+    case GROUP_AND:
+      new_a = _mm256_and_si256(a, v);
+      clear = nz_bits;
+      set = nz(new_a);
+      break;
+    case GROUP_ORA:
+      new_a = _mm256_or_si256(a, v);
+      clear = nz_bits;
+      set = nz(new_a);
+      break;
+    case GROUP_EOR:
+      new_a = _mm256_xor_si256(a, v);
+      clear = nz_bits;
+      set = nz(new_a);
+      break;
+    case GROUP_ADC: {
+      // carry out of a + v, or of adding the carry to 0xFF
+      __m256i partial = _mm256_add_epi8(a, v);
+      carry = _mm256_or_si256(
+          _mm256_xor_si256(at_least(_mm256_xor_si256(v, ones), a), ones),
+          _mm256_and_si256(_mm256_cmpeq_epi8(partial, ones), carry_set));
+      new_a = _mm256_add_epi8(partial, carry_in);
+      // zero is taken from the 9 bit sum, as CPU::execute() does
+      clear = cnz_bits;
+      set = _mm256_or_si256(
+          _mm256_or_si256(_mm256_and_si256(carry, c_bit),
+                          _mm256_and_si256(new_a, n_bit)),
+          _mm256_andnot_si256(carry, _mm256_and_si256(
+              _mm256_cmpeq_epi8(new_a, zero), z_bit)));
+      break;
+    }
+    case GROUP_SBC: {
+      // a - v - c borrows when v > a, or when a == v and c is set
+      __m256i partial = _mm256_sub_epi8(a, v);
+      __m256i borrow = _mm256_or_si256(
+          _mm256_xor_si256(at_least(a, v), ones),
+          _mm256_and_si256(_mm256_cmpeq_epi8(partial, zero), carry_set));
+      new_a = _mm256_sub_epi8(partial, carry_in);
+      clear = cnz_bits;
+      set = _mm256_or_si256(_mm256_andnot_si256(borrow, c_bit), nz(new_a));
+      break;
+    }
+    case GROUP_CMP:
+    case GROUP_CPX:
+    case GROUP_CPY: {
+      __m256i reg = op.instruction == GROUP_CMP ? a
+                    : op.instruction == GROUP_CPX ? x : y;
+      carry = at_least(reg, v);
+      clear = cnz_bits;
+      set = _mm256_or_si256(_mm256_and_si256(carry, c_bit),
+                            nz(_mm256_sub_epi8(reg, v)));
+      break;
+    }
+    case GROUP_BIT:
+      clear = _mm256_set1_epi8(char(0xC2));
+      set = _mm256_or_si256(
+          _mm256_and_si256(v, _mm256_set1_epi8(char(0xC0))),
+          _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(a, v), zero),
+                           z_bit));
+      break;
+    case GROUP_INC:
+    case GROUP_DEC:
+      clear = nz_bits;
+      set = nz(v);
+      break;
+    case GROUP_INX:
+    case GROUP_DEX:
+      new_x = op.instruction == GROUP_INX ? _mm256_sub_epi8(x, ones)
+                                          : _mm256_add_epi8(x, ones);
+      clear = nz_bits;
+      set = nz(new_x);
+      break;
+    case GROUP_INY:
+    case GROUP_DEY:
+      new_y = op.instruction == GROUP_INY ? _mm256_sub_epi8(y, ones)
+                                          : _mm256_add_epi8(y, ones);
+      clear = nz_bits;
+      set = nz(new_y);
+      break;
+    case GROUP_TAX:
+      new_x = a;
+      clear = nz_bits;
+      set = nz(a);
+      break;
+    case GROUP_TAY:
+      new_y = a;
+      clear = nz_bits;
+      set = nz(a);
+      break;
+    case GROUP_TXA:
+      new_a = x;
+      clear = nz_bits;
+      set = nz(x);
+      break;
+    case GROUP_TYA:
+      new_a = y;
+      clear = nz_bits;
+      set = nz(y);
+      break;
+    case GROUP_TSX:
+      new_x = s;
+      clear = nz_bits;
+      set = nz(s);
+      break;
+    case GROUP_TXS:
+      new_s = x;
+      break;
+    case GROUP_ASL:
+    case GROUP_ROL:
+      carry = _mm256_cmpeq_epi8(_mm256_and_si256(a, n_bit), n_bit);
+      result = _mm256_add_epi8(a, a);
+      if (op.instruction == GROUP_ROL) {
+        result = _mm256_or_si256(result, carry_in);
+      }
+      new_a = result;
+      clear = cnz_bits;
+      set = _mm256_or_si256(_mm256_and_si256(carry, c_bit), nz(result));
+      break;
+    case GROUP_LSR:
+    case GROUP_ROR:
+      carry = _mm256_and_si256(a, c_bit);
+      result = _mm256_and_si256(_mm256_srli_epi16(a, 1),
+                                _mm256_set1_epi8(0x7F));
+      if (op.instruction == GROUP_ROR) {
+        result = _mm256_or_si256(result, _mm256_and_si256(carry_set, n_bit));
+      }
+      new_a = result;
+      clear = cnz_bits;
+      set = _mm256_or_si256(carry, nz(result));
+      break;
+    case GROUP_FLAG:
+      clear = _mm256_set1_epi8(char(op.flag));
+      set = op.value ? clear : zero;
+      break;
+    case GROUP_BRANCH: {
+      __m256i bit = _mm256_set1_epi8(char(op.flag));
+      __m256i taken = _mm256_cmpeq_epi8(_mm256_and_si256(p, bit),
+                                        op.value ? bit : zero);
+      return uint32_t(_mm256_movemask_epi8(taken)) & members;
+    }
+  }
+  (void)v_bit;
+
+  __m256i new_p = _mm256_or_si256(_mm256_andnot_si256(clear, p), set);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(regs.acc),
+                     _mm256_blendv_epi8(a, new_a, mask));
+  _mm256_store_si256(reinterpret_cast<__m256i*>(regs.x),
+                     _mm256_blendv_epi8(x, new_x, mask));
+  _mm256_store_si256(reinterpret_cast<__m256i*>(regs.y),
+                     _mm256_blendv_epi8(y, new_y, mask));
+  _mm256_store_si256(reinterpret_cast<__m256i*>(regs.sp),
+                     _mm256_blendv_epi8(s, new_s, mask));
+  _mm256_store_si256(reinterpret_cast<__m256i*>(regs.st),
+                     _mm256_blendv_epi8(p, new_p, mask));
+  return 0;
+}
+
+// pc to next, or to branch on taken lanes, and the cycles to match
+__attribute__((target("avx2")))
+static void advance_avx2(uint16_t* pc, uint64_t* cycles, uint32_t members,
+                         uint32_t taken, uint16_t next, uint16_t branch,
+                         uint64_t base) {
+  const __m256i word_bits = _mm256_setr_epi16(
+      0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+      0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000,
+      short(0x8000));
+  const __m256i quad_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  __m256i next_pc = _mm256_set1_epi16(short(next));
+  __m256i branch_pc = _mm256_set1_epi16(short(branch));
+  for (int half = 0; half < 2; half++) {
+    __m256i* at = reinterpret_cast<__m256i*>(pc + 16 * half);
+    __m256i in = _mm256_cmpeq_epi16(
+        _mm256_and_si256(_mm256_set1_epi16(short(members >> (16 * half))),
+                         word_bits), word_bits);
+    __m256i jump = _mm256_cmpeq_epi16(
+        _mm256_and_si256(_mm256_set1_epi16(short(taken >> (16 * half))),
+                         word_bits), word_bits);
+    __m256i target = _mm256_blendv_epi8(next_pc, branch_pc, jump);
+    _mm256_store_si256(at, _mm256_blendv_epi8(_mm256_load_si256(at), target,
+                                              in));
+  }
+  __m256i base_cycles = _mm256_set1_epi64x(int64_t(base));
+  __m256i one = _mm256_set1_epi64x(1);
+  for (int quad = 0; quad < MAX_LANES_QUADS; quad++) {
+    __m256i* at = reinterpret_cast<__m256i*>(cycles + 4 * quad);
+    __m256i in = _mm256_cmpeq_epi64(
+        _mm256_and_si256(_mm256_set1_epi64x(members >> (4 * quad)),
+                         quad_bits), quad_bits);
+    __m256i jump = _mm256_cmpeq_epi64(
+        _mm256_and_si256(_mm256_set1_epi64x(taken >> (4 * quad)),
+                         quad_bits), quad_bits);
+    __m256i add = _mm256_add_epi64(_mm256_and_si256(in, base_cycles),
+                                   _mm256_and_si256(jump, one));
+    _mm256_store_si256(at, _mm256_add_epi64(_mm256_load_si256(at), add));
+  }
+}
+
+static bool has_avx2() {
+  return __builtin_cpu_supports("avx2");
+}
+
+#else // NESEMU_X86
+
+static bool has_avx2() {
+  return false;
+}
+
+#endif // NESEMU_X86
+
+LockstepCPU::LockstepCPU(bool vectorized) {
+  this->vectorized = vectorized && has_avx2();
+  lanes = 0;
+  memset(cpus, 0, sizeof cpus);
+  memset(buses, 0, sizeof buses);
+  memset(pc, 0, sizeof pc);
+  memset(r_acc, 0, sizeof r_acc);
+  memset(r_x, 0, sizeof r_x);
+  memset(r_y, 0, sizeof r_y);
+  memset(sp, 0, sizeof sp);
+  memset(r_st, 0, sizeof r_st);
+  memset(cycles, 0, sizeof cycles);
+  group_steps = 0;
+  single_steps = 0;
+}
+
+int LockstepCPU::load(CPU* const* cpus, int count) {
+  if (count < 1 || count > MAX_LANES) {
+    return 1;
+  }
+  lanes = count;
+  for (int i = 0; i < count; i++) {
+    CPU& cpu = *cpus[i];
+    this->cpus[i] = &cpu;
+    buses[i] = &cpu.bus;
+    pc[i] = cpu.pc;
+    r_acc[i] = cpu.r_acc;
+    r_x[i] = cpu.r_x;
+    r_y[i] = cpu.r_y;
+    sp[i] = cpu.sp;
+    r_st[i] = cpu.r_st;
+    cycles[i] = cpu.cycles;
+  }
+  return 0;
+}
+
+void LockstepCPU::store() {
+  for (int i = 0; i < lanes; i++) {
+    CPU& cpu = *cpus[i];
+    cpu.pc = pc[i];
+    cpu.r_acc = r_acc[i];
+    cpu.r_x = r_x[i];
+    cpu.r_y = r_y[i];
+    cpu.sp = sp[i];
+    cpu.r_st = r_st[i];
+    cpu.cycles = cycles[i];
+  }
+}
+
+int LockstepCPU::get_lanes() const {
+  return lanes;
+}
+
+uint16_t LockstepCPU::get_pc(int lane) const {
+  return pc[lane];
+}
+
+uint64_t LockstepCPU::get_cycles(int lane) const {
+  return cycles[lane];
+}
+
+bool LockstepCPU::is_vectorized() const {
+  return vectorized;
+}
+
+uint64_t LockstepCPU::get_group_steps() const {
+  return group_steps;
+}
+
+uint64_t LockstepCPU::get_single_steps() const {
+  return single_steps;
+}
+
+/* Stepping */
+uint32_t LockstepCPU::step() {
+  uint32_t pending = lanes == 32 ? 0xFFFFFFFFu : (1u << lanes) - 1;
+  uint32_t failed = 0;
+  while (pending) {
+    int leader = __builtin_ctz(pending);
+    uint32_t group = vectorized ? same_pc(pc[leader]) & pending
+                                : 1u << leader;
+    uint32_t done = (group & (group - 1)) ? run_group(leader, group) : 0;
+    if (!done) { // no group form, every lane on its own
+      for (uint32_t rest = group; rest; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+        if (step_lane(lane)) {
+          failed |= 1u << lane;
+        }
+      }
+      done = group;
+    }
+    pending &= ~done;
+  }
+  return failed;
+}
+
+// CPU::step() on the lane's own CPU
+int LockstepCPU::step_lane(int lane) {
+  CPU& cpu = *cpus[lane];
+  cpu.pc = pc[lane];
+  cpu.r_acc = r_acc[lane];
+  cpu.r_x = r_x[lane];
+  cpu.r_y = r_y[lane];
+  cpu.sp = sp[lane];
+  cpu.r_st = r_st[lane];
+  cpu.cycles = cycles[lane];
+  int result = cpu.step();
+  pc[lane] = cpu.pc;
+  r_acc[lane] = cpu.r_acc;
+  r_x[lane] = cpu.r_x;
+  r_y[lane] = cpu.r_y;
+  sp[lane] = cpu.sp;
+  r_st[lane] = cpu.r_st;
+  cycles[lane] = cpu.cycles;
+  single_steps++;
+  return result;
+}
+
+// instruction bytes, only from host memory where reading has no effects
+bool LockstepCPU::fetch(int lane, uint16_t address, int size,
+                        uint8_t* bytes) const {
+  const uint8_t* page = buses[lane]->get_host_page(address);
+  if (page && (address & 0xFF) <= 0x100 - size) { // within one page
+    memcpy(bytes, page + (address & 0xFF), size);
+    return true;
+  }
+  for (int i = 0; i < size; i++) {
+    uint16_t at = uint16_t(address + i);
+    page = buses[lane]->get_host_page(at);
+    if (!page) {
+      return false;
+    }
+    bytes[i] = page[at & 0xFF];
+  }
+  return true;
+}
+
+uint32_t LockstepCPU::same_pc(uint16_t address) const {
+#ifdef NESEMU_X86
+  return same_pc_avx2(pc, address);
+#else
+  (void)address;
+  return 0;
+#endif
+}
+
+// Runs the leader's instruction on every lane of the group with the same
+// instruction bytes. Returns those lanes, 0 if it has no group form.
+uint32_t LockstepCPU::run_group(int leader, uint32_t group) {
+  uint16_t address = pc[leader];
+  uint8_t code[3];
+  if (!fetch(leader, address, 1, code)) {
+    return 0;
+  }
+  const GroupOpcode& op = group_opcode(code[0]);
+  int size = OPERAND_SIZE[op.operand];
+  if (op.instruction == GROUP_NONE || !fetch(leader, address, size, code)) {
+    return 0;
+  }
+  uint16_t target = op.operand == OPERAND_ABSOLUTE
+                        ? uint16_t(code[1] | (code[2] << 8))
+                        : code[1];
+  if (writes_memory(op.instruction) && target == 0x4014) {
+    return 0; // OAM DMA, CPU::step() handles the stall
+  }
+  uint32_t members = 1u << leader;
+  for (uint32_t rest = group & ~members; rest; rest &= rest - 1) {
+    int lane = __builtin_ctz(rest);
+    uint8_t other[3];
+    if (fetch(lane, address, size, other) && !memcmp(other, code, size)) {
+      members |= 1u << lane;
+    }
+  }
+  if (!(members & (members - 1))) {
+    return 0;
+  }
+
+  // operands and memory, per lane through each bus
+  alignas(32) uint8_t value[MAX_LANES];
+  int instruction = op.instruction;
+  if (op.operand == OPERAND_IMMEDIATE) {
+    memset(value, code[1], sizeof value);
+  } else if (op.operand == OPERAND_ZERO_PAGE ||
+             op.operand == OPERAND_ABSOLUTE) {
+    for (uint32_t rest = members; rest; rest &= rest - 1) {
+      int lane = __builtin_ctz(rest);
+      Bus& bus = *buses[lane];
+      if (instruction == GROUP_STA) {
+        bus.write(target, r_acc[lane]);
+      } else if (instruction == GROUP_STX) {
+        bus.write(target, r_x[lane]);
+      } else if (instruction == GROUP_STY) {
+        bus.write(target, r_y[lane]);
+      } else if (instruction == GROUP_INC || instruction == GROUP_DEC) {
+        value[lane] = uint8_t(bus.read(target) +
+                              (instruction == GROUP_INC ? 1 : -1));
+        bus.write(target, value[lane]);
+      } else if (reads_memory(instruction)) {
+        value[lane] = bus.read(target);
+      }
+    }
+  }
+
+  uint32_t taken = 0;
+  if (instruction != GROUP_STA && instruction != GROUP_STX &&
+      instruction != GROUP_STY && instruction != GROUP_NOP &&
+      instruction != GROUP_JMP) {
+#ifdef NESEMU_X86
+    LaneRegisters regs = {r_acc, r_x, r_y, sp, r_st};
+    taken = group_kernel_avx2(op, members, value, regs);
+#endif
+  }
+
+  // same target arithmetic as CPU::get_operand()
+  uint16_t next = uint16_t(address + size);
+  uint16_t branch = code[1] < 80 ? uint16_t(address + code[1] + 2)
+                                 : uint16_t(address + code[1] + 2 - 0x100);
+  if (instruction == GROUP_JMP) {
+    next = target;
+  }
+  uint64_t base = uint64_t(CPU::get_opcode_cycles(code[0]));
+#ifdef NESEMU_X86
+  advance_avx2(pc, cycles, members, taken, next, branch, base);
+#endif
+  group_steps += __builtin_popcount(members);
+  return members;
+}
+
+} // namespace nesemu
@@ -0,0 +1,76 @@
+#ifndef NESEMU_CPU_LOCKSTEP_CPU_H_
+#define NESEMU_CPU_LOCKSTEP_CPU_H_
+
+#include "cpu.h"
+
+#include <cstdint>
+
+namespace nesemu {
+
+/* Lockstep interpreter over a batch of CPUs
+  A batch playing the same ROM mostly sits at the same pc. The registers
+  of up to 32 CPUs are held here as arrays, one lane per CPU, and a step
+  decodes the instruction once for every lane at the same pc with the same
+  instruction bytes. Register, flag, ALU and branch work then runs across
+  those lanes at once with AVX2 masks; zero page and absolute operands are
+  read and written per lane through each CPU's own bus.
+
+  Instructions without a group form (indexed and indirect operands, the
+  stack, jumps to subroutines, DMA), lanes that diverged and lanes running
+  code outside host memory are stepped one at a time by their own
+  CPU::step(). Either way every lane ends up exactly where CPU::step()
+  would have taken it.
+*/
+class LockstepCPU {
+  public:
+    // vectorized false steps every lane on its own, for testing
+    explicit LockstepCPU(bool vectorized = true);
+
+    static const int MAX_LANES = 32;
+
+    // Takes the registers of count CPUs (1 - MAX_LANES) into the batch.
+    // The CPUs keep their memory, but their registers are stale until
+    // store(). Returns 1 on a bad count.
+    int load(CPU* const* cpus, int count);
+    void store(); // writes the registers back to the CPUs
+    int get_lanes() const;
+
+    // One instruction on every lane, as CPU::step() on each. Returns the
+    // lanes, a bit each, that met an unknown opcode and stayed put.
+    uint32_t step();
+
+    uint16_t get_pc(int lane) const;
+    uint64_t get_cycles(int lane) const;
+    bool is_vectorized() const;
+
+    // lane steps taken in groups and one lane at a time
+    uint64_t get_group_steps() const;
+    uint64_t get_single_steps() const;
+
+  private:
+    bool vectorized;
+    int lanes;
+    CPU* cpus[MAX_LANES];
+    Bus* buses[MAX_LANES];
+
+    /* Registers, lane i of every array is CPU i */
+    alignas(32) uint16_t pc[MAX_LANES];
+    alignas(32) uint8_t r_acc[MAX_LANES];
+    alignas(32) uint8_t r_x[MAX_LANES];
+    alignas(32) uint8_t r_y[MAX_LANES];
+    alignas(32) uint8_t sp[MAX_LANES];
+    alignas(32) uint8_t r_st[MAX_LANES];
+    alignas(32) uint64_t cycles[MAX_LANES];
+
+    uint64_t group_steps;
+    uint64_t single_steps;
+
+    int step_lane(int lane);
+    bool fetch(int lane, uint16_t address, int size, uint8_t* bytes) const;
+    uint32_t same_pc(uint16_t address) const;
+    uint32_t run_group(int leader, uint32_t group);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_CPU_LOCKSTEP_CPU_H_
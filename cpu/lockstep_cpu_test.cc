@@ -0,0 +1,222 @@
+#include "lockstep_cpu.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+static const uint16_t PROGRAM = 0x8000;
+
+// Opcodes with a group form, then some without (indexed, stack) so that
+// lanes also go through CPU::step()
+static const uint8_t GROUP_CODES[] = {
+  0xA9, 0xA5, 0xAD, 0xA2, 0xA6, 0xAE, 0xA0, 0xA4, 0xAC, 0x29, 0x25, 0x2D,
+  0x09, 0x05, 0x0D, 0x49, 0x45, 0x4D, 0x69, 0x65, 0x6D, 0xE9, 0xE5, 0xED,
+  0xC9, 0xC5, 0xCD, 0xE0, 0xE4, 0xEC, 0xC0, 0xC4, 0xCC, 0x24, 0x2C, 0x85,
+  0x8D, 0x86, 0x8E, 0x84, 0x8C, 0xE6, 0xEE, 0xC6, 0xCE, 0xE8, 0xC8, 0xCA,
+  0x88, 0xAA, 0xA8, 0x8A, 0x98, 0xBA, 0x9A, 0x0A, 0x4A, 0x2A, 0x6A, 0x18,
+  0x38, 0x58, 0x78, 0xB8, 0xD8, 0xF8, 0xEA, 0x10, 0x30, 0x50, 0x70, 0x90,
+  0xB0, 0xD0, 0xF0
+};
+static const uint8_t SINGLE_CODES[] = {
+  0xB5, 0x95, 0xBD, 0x99, 0x48, 0x68, 0x08, 0x28, 0x06, 0x46, 0x26, 0x66
+};
+
+static const uint8_t IMPLIED_CODES[] = {
+  0x0A, 0x4A, 0x2A, 0x6A, 0xE8, 0xC8, 0xCA, 0x88, 0xAA, 0xA8, 0x8A, 0x98,
+  0xBA, 0x9A, 0x18, 0x38, 0x58, 0x78, 0xB8, 0xD8, 0xF8, 0xEA, 0x48, 0x68,
+  0x08, 0x28
+};
+static const uint8_t ABSOLUTE_CODES[] = {
+  0xAD, 0xAE, 0xAC, 0x2D, 0x0D, 0x4D, 0x6D, 0xED, 0xCD, 0xEC, 0xCC, 0x2C,
+  0x8D, 0x8E, 0x8C, 0xEE, 0xCE, 0xBD, 0x99
+};
+
+static int operand_size(uint8_t opcode) {
+  if (memchr(IMPLIED_CODES, opcode, sizeof IMPLIED_CODES)) {
+    return 0;
+  }
+  return memchr(ABSOLUTE_CODES, opcode, sizeof ABSOLUTE_CODES) ? 2 : 1;
+}
+
+// A random program at PROGRAM of count instructions that jumps back to its
+// start. Memory operands are zero page or $0200 - $02FF, plus the odd
+// $4014; branches skip ahead a few whole instructions.
+static std::vector<uint8_t> make_program(int count, bool group_only,
+                                         unsigned int* seed) {
+  std::vector<uint8_t> opcodes;
+  std::vector<int> starts;
+  std::vector<uint8_t> code;
+  for (int i = 0; i < count; i++) {
+    uint8_t opcode;
+    if (group_only || rand_r(seed) % 5) {
+      opcode = GROUP_CODES[rand_r(seed) % sizeof GROUP_CODES];
+    } else {
+      opcode = SINGLE_CODES[rand_r(seed) % sizeof SINGLE_CODES];
+    }
+    starts.push_back(int(code.size()));
+    opcodes.push_back(opcode);
+    code.push_back(opcode);
+    int size = operand_size(opcode);
+    if (size == 1) {
+      code.push_back(uint8_t(rand_r(seed)));
+    } else if (size == 2) {
+      bool dma = !group_only && (opcode == 0x8D || opcode == 0xEE) &&
+                 rand_r(seed) % 4 == 0;
+      code.push_back(dma ? 0x14 : uint8_t(rand_r(seed)));
+      code.push_back(dma ? 0x40 : 0x02);
+    }
+  }
+  starts.push_back(int(code.size()));
+  code.push_back(0x4C); // JMP PROGRAM
+  code.push_back(PROGRAM & 0xFF);
+  code.push_back(PROGRAM >> 8);
+  for (int i = 0; i < count; i++) {
+    if ((opcodes[i] & 0x1F) == 0x10) {
+      int target = starts[std::min(count, i + 1 + int(rand_r(seed) % 4))];
+      code[starts[i] + 1] = uint8_t(target - (starts[i] + 2));
+    }
+  }
+  return code;
+}
+
+static void set_up(CPU* cpu, const std::vector<uint8_t>& program,
+                   unsigned int data_seed) {
+  for (size_t i = 0; i < program.size(); i++) {
+    cpu->set_memory(uint16_t(PROGRAM + i), program[i]);
+  }
+  for (int i = 0; i < 0x300; i++) {
+    if (i < 0x100 || i >= 0x200) { // the stack page starts clear
+      cpu->set_memory(uint16_t(i), uint8_t(rand_r(&data_seed)));
+    }
+  }
+  cpu->set_pc(PROGRAM);
+  cpu->set_acc(uint8_t(rand_r(&data_seed)));
+  cpu->set_rx(uint8_t(rand_r(&data_seed)));
+  cpu->set_ry(uint8_t(rand_r(&data_seed)));
+  cpu->set_sp(0x80);
+  unsigned int flags = rand_r(&data_seed);
+  if (flags & 0x01) {
+    cpu->set_carry();
+  }
+  if (flags & 0x02) {
+    cpu->set_zero();
+  }
+  if (flags & 0x40) {
+    cpu->set_overflow();
+  }
+  if (flags & 0x80) {
+    cpu->set_negative();
+  }
+}
+
+static void expect_same(const CPU& cpu, const CPU& reference, int lane,
+                        int step) {
+  ASSERT_EQ(cpu.get_pc(), reference.get_pc())
+      << "lane " << lane << " step " << step;
+  ASSERT_EQ(cpu.get_acc(), reference.get_acc()) << "lane " << lane;
+  ASSERT_EQ(cpu.get_rx(), reference.get_rx()) << "lane " << lane;
+  ASSERT_EQ(cpu.get_ry(), reference.get_ry()) << "lane " << lane;
+  ASSERT_EQ(cpu.get_sp(), reference.get_sp()) << "lane " << lane;
+  ASSERT_EQ(cpu.get_st(), reference.get_st()) << "lane " << lane;
+  ASSERT_EQ(cpu.get_cycles(), reference.get_cycles()) << "lane " << lane;
+  for (int i = 0; i < 0x300; i++) {
+    ASSERT_EQ(cpu.get_memory(uint16_t(i)), reference.get_memory(uint16_t(i)))
+        << "lane " << lane << " step " << step << " address " << i;
+  }
+}
+
+// Steps lanes CPUs through random programs in lockstep and each reference
+// CPU on its own, comparing them after every step.
+static void run_against_reference(bool vectorized, int lanes,
+                                  unsigned int seed, bool shared_data) {
+  std::vector<uint8_t> program = make_program(60, false, &seed);
+  std::vector<CPU> cpus(lanes), references(lanes);
+  std::vector<CPU*> pointers(lanes);
+  for (int i = 0; i < lanes; i++) {
+    unsigned int data_seed = shared_data ? seed : seed + 1 + i;
+    std::vector<uint8_t> lane_program = program;
+    if (i == 3) {
+      lane_program[1] ^= 0x5A; // one lane with other instruction bytes
+    }
+    set_up(&cpus[i], lane_program, data_seed);
+    set_up(&references[i], lane_program, data_seed);
+    pointers[i] = &cpus[i];
+  }
+  LockstepCPU lockstep(vectorized);
+  ASSERT_EQ(lockstep.load(&pointers[0], lanes), 0);
+  for (int step = 0; step < 2000; step++) {
+    uint32_t failed = lockstep.step();
+    lockstep.store();
+    for (int i = 0; i < lanes; i++) {
+      EXPECT_EQ((failed >> i) & 1, uint32_t(references[i].step()));
+      expect_same(cpus[i], references[i], i, step);
+      if (::testing::Test::HasFatalFailure()) {
+        return;
+      }
+      EXPECT_EQ(lockstep.get_pc(i), references[i].get_pc());
+      EXPECT_EQ(lockstep.get_cycles(i), references[i].get_cycles());
+    }
+  }
+}
+
+TEST (LockstepCPUTest, BadCount) {
+  CPU cpu;
+  CPU* pointer = &cpu;
+  LockstepCPU lockstep;
+  EXPECT_EQ(lockstep.load(&pointer, 0), 1);
+  EXPECT_EQ(lockstep.load(&pointer, LockstepCPU::MAX_LANES + 1), 1);
+  EXPECT_EQ(lockstep.load(&pointer, 1), 0);
+  EXPECT_EQ(lockstep.get_lanes(), 1);
+}
+
+TEST (LockstepCPUTest, MatchesStepDivergent) {
+  for (unsigned int seed = 1; seed <= 4; seed++) {
+    run_against_reference(true, LockstepCPU::MAX_LANES, seed, false);
+    if (HasFatalFailure()) {
+      return;
+    }
+  }
+  run_against_reference(true, 7, 99, false);
+}
+
+TEST (LockstepCPUTest, MatchesStepConverged) {
+  for (unsigned int seed = 1; seed <= 4; seed++) {
+    run_against_reference(true, LockstepCPU::MAX_LANES, seed, true);
+    if (HasFatalFailure()) {
+      return;
+    }
+  }
+}
+
+TEST (LockstepCPUTest, MatchesStepScalar) {
+  run_against_reference(false, LockstepCPU::MAX_LANES, 5, false);
+}
+
+// lanes that never diverge are stepped as one group throughout
+TEST (LockstepCPUTest, ConvergedLanesStepAsGroup) {
+  unsigned int seed = 42;
+  std::vector<uint8_t> program = make_program(40, true, &seed);
+  std::vector<CPU> cpus(LockstepCPU::MAX_LANES);
+  std::vector<CPU*> pointers;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    set_up(&cpus[i], program, 7);
+    pointers.push_back(&cpus[i]);
+  }
+  LockstepCPU lockstep;
+  ASSERT_EQ(lockstep.load(&pointers[0], int(pointers.size())), 0);
+  for (int step = 0; step < 1000; step++) {
+    ASSERT_EQ(lockstep.step(), 0u);
+  }
+  if (lockstep.is_vectorized()) {
+    EXPECT_EQ(lockstep.get_single_steps(), 0u);
+    EXPECT_EQ(lockstep.get_group_steps(), 1000u * LockstepCPU::MAX_LANES);
+  } else {
+    EXPECT_EQ(lockstep.get_single_steps(), 1000u * LockstepCPU::MAX_LANES);
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,513 @@
+#include "checkpoint_writer.h"
+
+#include "lz_block.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace nesemu {
+
+static const char CHECKPOINT_MAGIC[8] = {'N', 'E', 'S', 'C', 'K', 'P', 'N',
+                                         'T'};
+
+const unsigned CheckpointWriter::RING_ENTRIES;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;       // ConsoleSnapshot::VERSION
+  uint32_t snapshot_size; // sizeof(ConsoleSnapshot)
+};
+
+struct RecordHeader {
+  uint64_t sequence;
+  uint32_t size; // of the block that follows
+  uint32_t reserved;
+};
+
+/* The io_uring, set up by hand as EnvChannel does its futexes
+  The submission side is shared by the workers under lock, the completion
+  side belongs to the reaper. */
+struct CheckpointWriter::Ring {
+  Ring() {
+    fd = -1;
+    sq_map = cq_map = NULL;
+    sq_map_size = cq_map_size = 0;
+    sqes = NULL;
+    sqes_size = 0;
+    in_flight = 0;
+  }
+
+  ~Ring() {
+    if (sqes) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_map && cq_map != sq_map) {
+      munmap(cq_map, cq_map_size);
+    }
+    if (sq_map) {
+      munmap(sq_map, sq_map_size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  int fd;
+  unsigned entries;
+  uint8_t* sq_map;
+  size_t sq_map_size;
+  uint8_t* cq_map;
+  size_t cq_map_size;
+  io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  io_uring_cqe* cqes;
+
+  std::mutex lock;
+  std::condition_variable space; // for another write in flight
+  unsigned in_flight;
+};
+
+static uint8_t* map_ring(int fd, size_t size, off_t offset) {
+  void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, offset);
+  return mapped == MAP_FAILED ? NULL : static_cast<uint8_t*>(mapped);
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t size,
+                      uint64_t offset) {
+  while (size) {
+    ssize_t done = pwrite(fd, data, size, off_t(offset));
+    if (done < 0 && errno == EINTR) {
+      continue;
+    }
+    if (done <= 0) {
+      return false;
+    }
+    data += done;
+    size -= size_t(done);
+    offset += uint64_t(done);
+  }
+  return true;
+}
+
+CheckpointWriter::CheckpointWriter() {
+  fd = -1;
+  states = 0;
+  pending = 0;
+  file_end = 0;
+  written = 0;
+  failed = false;
+  stopping = false;
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  close();
+}
+
+/* Opening and closing */
+int CheckpointWriter::open(const std::string& path, int threads,
+                           bool uring) {
+  close();
+  if (threads < 1) {
+    return 1;
+  }
+  int made = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (made < 0) {
+    return 1;
+  }
+  FileHeader header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC);
+  header.version = ConsoleSnapshot::VERSION;
+  header.snapshot_size = sizeof(ConsoleSnapshot);
+  if (!write_all(made, reinterpret_cast<const uint8_t*>(&header),
+                 sizeof header, 0)) {
+    ::close(made);
+    unlink(path.c_str());
+    return 1;
+  }
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    fd = made;
+    states = 0;
+    pending = 0;
+    file_end = written = sizeof header;
+    failed = false;
+    stopping = false;
+  }
+  if (uring && setup_ring()) {
+    reaper = std::thread(&CheckpointWriter::reap_loop, this);
+  }
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(std::thread(&CheckpointWriter::work_loop, this));
+  }
+  return 0;
+}
+
+int CheckpointWriter::close() {
+  if (fd < 0) {
+    return 0;
+  }
+  int result = flush();
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    stopping = true;
+  }
+  work.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  workers.clear();
+  if (ring) {
+    // a no-op without a job tells the reaper to stop
+    if (submit(IORING_OP_NOP, NULL)) {
+      reaper.join();
+      ring.reset();
+    } else {
+      reaper.detach(); // still waiting on the ring, which it keeps
+      ring.release();
+    }
+  }
+  std::lock_guard<std::mutex> hold(lock);
+  ::close(fd);
+  fd = -1;
+  return result;
+}
+
+bool CheckpointWriter::is_open() const {
+  std::lock_guard<std::mutex> hold(lock);
+  return fd >= 0;
+}
+
+bool CheckpointWriter::is_using_uring() const {
+  return ring != NULL;
+}
+
+/* Adding states */
+CheckpointWriter::Job* CheckpointWriter::take_job() {
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    if (fd < 0) {
+      return NULL;
+    }
+    if (!free_jobs.empty()) {
+      Job* job = free_jobs.back();
+      free_jobs.pop_back();
+      return job;
+    }
+  }
+  std::unique_ptr<Job> made(new Job);
+  made->record.reserve(sizeof(RecordHeader) +
+                       LzBlock::get_bound(sizeof(ConsoleSnapshot)));
+  Job* job = made.get();
+  std::lock_guard<std::mutex> hold(lock);
+  jobs.push_back(std::move(made));
+  return job;
+}
+
+int64_t CheckpointWriter::queue_job(Job* job) {
+  int64_t sequence;
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    job->sequence = states++;
+    sequence = int64_t(job->sequence);
+    pending++;
+    queue.push_back(job);
+  }
+  work.notify_one();
+  return sequence;
+}
+
+int64_t CheckpointWriter::add(const Console& console) {
+  Job* job = take_job();
+  if (!job) {
+    return -1;
+  }
+  console.save_snapshot(job->snapshot);
+  return queue_job(job);
+}
+
+// as bytes, padding included, so the state reads back exactly
+int64_t CheckpointWriter::add(const ConsoleSnapshot& snapshot) {
+  Job* job = take_job();
+  if (!job) {
+    return -1;
+  }
+  memcpy(&job->snapshot, &snapshot, sizeof snapshot);
+  return queue_job(job);
+}
+
+int CheckpointWriter::flush() {
+  std::unique_lock<std::mutex> hold(lock);
+  while (pending) {
+    idle.wait(hold);
+  }
+  return failed ? 1 : 0;
+}
+
+uint64_t CheckpointWriter::get_states() const {
+  std::lock_guard<std::mutex> hold(lock);
+  return states;
+}
+
+uint64_t CheckpointWriter::get_written_bytes() const {
+  std::lock_guard<std::mutex> hold(lock);
+  return written;
+}
+
+/* Workers */
+void CheckpointWriter::work_loop() {
+  for (;;) {
+    Job* job;
+    {
+      std::unique_lock<std::mutex> hold(lock);
+      while (queue.empty() && !stopping) {
+        work.wait(hold);
+      }
+      if (queue.empty()) {
+        return;
+      }
+      job = queue.front();
+      queue.pop_front();
+    }
+    write(job);
+  }
+}
+
+// Compresses the job's state into its record and sends that off to the
+// next place in the file.
+void CheckpointWriter::write(Job* job) {
+  RecordHeader header;
+  header.sequence = job->sequence;
+  header.reserved = 0;
+  job->record.resize(sizeof header);
+  LzBlock::compress(reinterpret_cast<const uint8_t*>(&job->snapshot),
+                    sizeof(ConsoleSnapshot), job->record);
+  header.size = uint32_t(job->record.size() - sizeof header);
+  memcpy(&job->record[0], &header, sizeof header);
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    job->offset = file_end;
+    file_end += job->record.size();
+  }
+  if (ring && submit(IORING_OP_WRITE, job)) {
+    return;
+  }
+  finish(job, write_all(fd, &job->record[0], job->record.size(),
+                        job->offset));
+}
+
+void CheckpointWriter::finish(Job* job, bool good) {
+  std::lock_guard<std::mutex> hold(lock);
+  if (good) {
+    written += job->record.size();
+  } else {
+    failed = true;
+  }
+  free_jobs.push_back(job);
+  if (!--pending) {
+    idle.notify_all();
+  }
+}
+
+/* The ring */
+bool CheckpointWriter::setup_ring() {
+  io_uring_params params;
+  memset(&params, 0, sizeof params);
+  int ring_fd = int(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+  if (ring_fd < 0) {
+    return false;
+  }
+  std::unique_ptr<Ring> made(new Ring);
+  Ring& r = *made;
+  r.fd = ring_fd;
+  r.entries = params.sq_entries;
+  r.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r.cq_map_size = params.cq_off.cqes +
+                  params.cq_entries * sizeof(io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && r.cq_map_size > r.sq_map_size) {
+    r.sq_map_size = r.cq_map_size;
+  }
+  r.sq_map = map_ring(ring_fd, r.sq_map_size, IORING_OFF_SQ_RING);
+  r.cq_map = single ? r.sq_map
+                    : map_ring(ring_fd, r.cq_map_size, IORING_OFF_CQ_RING);
+  r.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  r.sqes = reinterpret_cast<io_uring_sqe*>(
+      map_ring(ring_fd, r.sqes_size, IORING_OFF_SQES));
+  if (!r.sq_map || !r.cq_map || !r.sqes) {
+    return false;
+  }
+  r.sq_head = reinterpret_cast<unsigned*>(r.sq_map + params.sq_off.head);
+  r.sq_tail = reinterpret_cast<unsigned*>(r.sq_map + params.sq_off.tail);
+  r.sq_mask = reinterpret_cast<unsigned*>(r.sq_map +
+                                          params.sq_off.ring_mask);
+  r.sq_array = reinterpret_cast<unsigned*>(r.sq_map + params.sq_off.array);
+  r.cq_head = reinterpret_cast<unsigned*>(r.cq_map + params.cq_off.head);
+  r.cq_tail = reinterpret_cast<unsigned*>(r.cq_map + params.cq_off.tail);
+  r.cq_mask = reinterpret_cast<unsigned*>(r.cq_map +
+                                          params.cq_off.ring_mask);
+  r.cqes = reinterpret_cast<io_uring_cqe*>(r.cq_map + params.cq_off.cqes);
+  ring.swap(made);
+  return true;
+}
+
+// Returns false when the kernel would not take it, the caller then writes
+// by hand.
+bool CheckpointWriter::submit(uint8_t opcode, Job* job) {
+  Ring& r = *ring;
+  std::unique_lock<std::mutex> hold(r.lock);
+  while (r.in_flight >= r.entries) {
+    r.space.wait(hold);
+  }
+  unsigned tail = *r.sq_tail;
+  unsigned index = tail & *r.sq_mask;
+  io_uring_sqe* sqe = &r.sqes[index];
+  memset(sqe, 0, sizeof *sqe);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  if (job) {
+    sqe->off = job->offset;
+    sqe->addr = uint64_t(uintptr_t(&job->record[0]));
+    sqe->len = uint32_t(job->record.size());
+  }
+  sqe->user_data = uint64_t(uintptr_t(job));
+  r.sq_array[index] = index;
+  __atomic_store_n(r.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  long submitted;
+  do {
+    submitted = syscall(__NR_io_uring_enter, r.fd, 1, 0, 0, NULL, 0);
+  } while (submitted < 0 && errno == EINTR);
+  if (submitted != 1 &&
+      __atomic_load_n(r.sq_head, __ATOMIC_ACQUIRE) != tail + 1) {
+    __atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+  r.in_flight++;
+  return true;
+}
+
+void CheckpointWriter::reap_loop() {
+  Ring& r = *ring;
+  for (;;) {
+    unsigned head = *r.cq_head;
+    if (head == __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+      syscall(__NR_io_uring_enter, r.fd, 0, 1, IORING_ENTER_GETEVENTS,
+              NULL, 0);
+      continue;
+    }
+    const io_uring_cqe& cqe = r.cqes[head & *r.cq_mask];
+    Job* job = reinterpret_cast<Job*>(uintptr_t(cqe.user_data));
+    int result = cqe.res;
+    __atomic_store_n(r.cq_head, head + 1, __ATOMIC_RELEASE);
+    {
+      std::lock_guard<std::mutex> hold(r.lock);
+      r.in_flight--;
+    }
+    r.space.notify_one();
+    if (!job) {
+      return;
+    }
+    // short, refused, or an opcode this kernel lacks: the rest by hand
+    size_t done = result > 0 ? size_t(result) : 0;
+    if (done >= job->record.size()) {
+      finish(job, true);
+    } else {
+      finish(job, write_all(fd, &job->record[done],
+                            job->record.size() - done, job->offset + done));
+    }
+  }
+}
+
+/* Reading back */
+// The records after the header, false when one is cut short or holds more
+// than a compressed snapshot can. Leaves the file after the header.
+static bool count_records(FILE* file, long file_size, uint64_t& count) {
+  const size_t bound = LzBlock::get_bound(sizeof(ConsoleSnapshot));
+  long at = long(sizeof(FileHeader));
+  count = 0;
+  while (at < file_size) {
+    RecordHeader record;
+    if (fseek(file, at, SEEK_SET) ||
+        fread(&record, sizeof record, 1, file) != 1 || record.size < 1 ||
+        record.size > bound ||
+        record.size > uint64_t(file_size - at) - sizeof record) {
+      return false;
+    }
+    at += long(sizeof record + record.size);
+    count++;
+  }
+  return !fseek(file, long(sizeof(FileHeader)), SEEK_SET);
+}
+
+int CheckpointWriter::read(const std::string& path,
+                           std::vector<ConsoleSnapshot>& states) {
+  states.clear();
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return 1;
+  }
+  long file_size = -1;
+  if (!fseek(file, 0, SEEK_END)) {
+    file_size = ftell(file);
+    rewind(file);
+  }
+  FileHeader header;
+  bool good = file_size >= 0 && fread(&header, sizeof header, 1, file) == 1 &&
+              !memcmp(header.magic, CHECKPOINT_MAGIC,
+                      sizeof CHECKPOINT_MAGIC) &&
+              header.version == ConsoleSnapshot::VERSION &&
+              header.snapshot_size == sizeof(ConsoleSnapshot);
+  // every sequence number up to the record count appears once, so none
+  // past it is allocated for
+  uint64_t count = 0;
+  good = good && count_records(file, file_size, count);
+  std::vector<uint8_t> seen;
+  std::vector<uint8_t> block;
+  for (uint64_t i = 0; good && i < count; i++) {
+    RecordHeader record;
+    good = fread(&record, sizeof record, 1, file) == 1 &&
+           record.sequence < count;
+    if (!good) {
+      break;
+    }
+    block.resize(record.size);
+    good = fread(&block[0], 1, record.size, file) == record.size;
+    size_t sequence = size_t(record.sequence);
+    if (good && sequence >= states.size()) {
+      states.resize(sequence + 1);
+      seen.resize(sequence + 1, 0);
+    }
+    good = good && !seen[sequence] &&
+           !LzBlock::decompress(&block[0], block.size(),
+                                reinterpret_cast<uint8_t*>(&states[sequence]),
+                                sizeof(ConsoleSnapshot));
+    if (good) {
+      seen[sequence] = 1;
+    }
+  }
+  fclose(file);
+  for (size_t i = 0; good && i < seen.size(); i++) {
+    good = seen[i];
+  }
+  if (!good) {
+    states.clear();
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace nesemu
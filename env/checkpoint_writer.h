@@ -0,0 +1,104 @@
+#ifndef NESEMU_ENV_CHECKPOINT_WRITER_H_
+#define NESEMU_ENV_CHECKPOINT_WRITER_H_
+
+#include "console/console.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nesemu {
+
+/* Checkpoints written behind the stepping threads
+  add() copies a state into a pooled buffer and queues it, which is all
+  the caller waits for. Worker threads compress the queued states with
+  LzBlock and write them to the file: through an io_uring when the kernel
+  gives one, the writes then completing on a reaper thread, or else with
+  pwrite() on the workers themselves. Buffers go back to the pool once
+  written, and a new one is allocated when the pool is empty, so a slow
+  disk costs memory rather than stepping time.
+
+  The file is a header, then one record per state: its sequence number
+  from add(), its compressed size and its block. Records land in the order
+  they finish compressing, read() puts them back in order.
+*/
+class CheckpointWriter {
+  public:
+    CheckpointWriter();
+    ~CheckpointWriter(); // closes
+
+    static const unsigned RING_ENTRIES = 64; // writes in flight at most
+
+    // Makes the file at path afresh and starts threads workers. Returns 1
+    // when the file cannot be made or threads is under 1.
+    int open(const std::string& path, int threads = 2, bool uring = true);
+    // Waits for all writes and stops the threads. Returns 1 if a write
+    // failed since open().
+    int close();
+    bool is_open() const;
+    bool is_using_uring() const;
+
+    // Queue a state. Return its sequence number, or -1 when not open.
+    int64_t add(const Console& console);
+    int64_t add(const ConsoleSnapshot& snapshot);
+    // Waits for everything added so far to be written. Returns 1 if a
+    // write failed since open().
+    int flush();
+
+    uint64_t get_states() const;        // added since open()
+    uint64_t get_written_bytes() const; // to the file, header included
+
+    // Reads a checkpoint back in sequence order. Returns 1 on a damaged
+    // file, a missing state or another build's snapshots.
+    static int read(const std::string& path,
+                    std::vector<ConsoleSnapshot>& states);
+
+  private:
+    CheckpointWriter(const CheckpointWriter&);
+    CheckpointWriter& operator=(const CheckpointWriter&);
+
+    struct Job {
+      ConsoleSnapshot snapshot;
+      std::vector<uint8_t> record; // header and block
+      uint64_t sequence;
+      uint64_t offset;
+    };
+    struct Ring;
+
+    int fd;
+    std::vector<std::thread> workers;
+    std::unique_ptr<Ring> ring;
+    std::thread reaper;
+
+    /* Guarded by lock */
+    mutable std::mutex lock;
+    std::condition_variable work; // queued jobs or stopping
+    std::condition_variable idle; // nothing pending
+    std::deque<Job*> queue;
+    std::vector<Job*> free_jobs;
+    std::vector<std::unique_ptr<Job> > jobs; // all, to free them
+    uint64_t states;
+    uint64_t pending; // added and not yet written
+    uint64_t file_end;
+    uint64_t written;
+    bool failed;
+    bool stopping;
+
+    Job* take_job();
+    int64_t queue_job(Job* job);
+    void work_loop();
+    void write(Job* job);
+    void finish(Job* job, bool good);
+    void reap_loop();
+    bool setup_ring();
+    bool submit(uint8_t opcode, Job* job);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_CHECKPOINT_WRITER_H_
@@ -0,0 +1,96 @@
+#include "checkpoint_writer.h"
+#include "lz_block.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace nesemu;
+
+static const int STATES = 2000;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Dumping STATES states: what the stepping thread is held up for per state
+// when it compresses and writes them itself, against add() with the
+// writer behind it, with and without the ring.
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  console.load_rom(&image[0], image.size());
+  std::vector<ConsoleSnapshot> states(STATES);
+  for (int i = 0; i < STATES; i++) {
+    console.get_controller(0).set_buttons(i & 16 ? BUTTON_A : 0);
+    console.run_frame();
+    console.save_snapshot(states[i]);
+  }
+  char directory[] = "/tmp/checkpoint_benchXXXXXX";
+  if (!mkdtemp(directory)) {
+    return 1;
+  }
+  std::string path = std::string(directory) + "/checkpoint";
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  std::vector<uint8_t> block;
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < STATES; i++) {
+    block.clear();
+    LzBlock::compress(reinterpret_cast<const uint8_t*>(&states[i]),
+                      sizeof(ConsoleSnapshot), block);
+    if (pwrite(fd, &block[0], block.size(), off_t(bytes)) < 0) {
+      break;
+    }
+    bytes += block.size();
+  }
+  double inline_stall = seconds_since(start) * 1e6 / STATES;
+  close(fd);
+
+  printf("%d states of %zu bytes, %.1fx compressed\n", STATES,
+         sizeof(ConsoleSnapshot),
+         double(STATES) * sizeof(ConsoleSnapshot) / bytes);
+  printf("                        stall us   worst us   drained ms\n");
+  ConsoleSnapshot* copy = new ConsoleSnapshot;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < STATES; i++) {
+    memcpy(copy, &states[i], sizeof(ConsoleSnapshot));
+  }
+  double copy_stall = seconds_since(start) * 1e6 / STATES;
+  delete copy;
+  printf("  copy only             %8.2f\n", copy_stall);
+  printf("  compress and pwrite   %8.2f\n", inline_stall);
+  for (int uring = 1; uring >= 0; uring--) {
+    CheckpointWriter writer;
+    writer.open(path, 2, uring != 0);
+    double worst = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < STATES; i++) {
+      std::chrono::steady_clock::time_point added =
+          std::chrono::steady_clock::now();
+      writer.add(states[i]);
+      double stall = seconds_since(added) * 1e6;
+      worst = stall > worst ? stall : worst;
+    }
+    double stall = seconds_since(start) * 1e6 / STATES;
+    bool ring = writer.is_using_uring();
+    writer.close();
+    printf("  writer, %-13s %8.2f %10.2f %12.1f\n",
+           ring ? "io_uring" :
+           uring ? "no io_uring" : "pwrite",
+           stall, worst, seconds_since(start) * 1e3);
+  }
+  unlink(path.c_str());
+  rmdir(directory);
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include "checkpoint_writer.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace nesemu {
+
+// the state after each of count frames
+static void play(std::vector<ConsoleSnapshot>& states, int count) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  states.resize(count);
+  for (int i = 0; i < count; i++) {
+    console.get_controller(0).set_buttons(i & 4 ? BUTTON_A : 0);
+    ASSERT_EQ(console.run_frame(), 0);
+    console.save_snapshot(states[i]);
+  }
+}
+
+// a file under a fresh directory, both removed after
+class CheckpointWriterTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      strcpy(directory, "/tmp/checkpoint_writer_testXXXXXX");
+      ASSERT_TRUE(mkdtemp(directory) != NULL);
+      path = std::string(directory) + "/checkpoint";
+    }
+
+    virtual void TearDown() {
+      unlink(path.c_str());
+      rmdir(directory);
+    }
+
+    char directory[40];
+    std::string path;
+};
+
+TEST_F (CheckpointWriterTest, WritesAndReadsBack) {
+  std::vector<ConsoleSnapshot> states;
+  play(states, 40);
+  // through the ring where the kernel has one, and with pwrite()
+  for (int uring = 1; uring >= 0; uring--) {
+    CheckpointWriter writer;
+    EXPECT_EQ(writer.add(states[0]), -1);
+    EXPECT_EQ(writer.open(path, 0), 1);
+    ASSERT_EQ(writer.open(path, 3, uring != 0), 0);
+    EXPECT_TRUE(writer.is_open());
+    if (!uring) {
+      EXPECT_FALSE(writer.is_using_uring());
+    }
+    for (size_t i = 0; i < states.size(); i++) {
+      EXPECT_EQ(writer.add(states[i]), int64_t(i));
+      if (i == 20) {
+        EXPECT_EQ(writer.flush(), 0);
+      }
+    }
+    EXPECT_EQ(writer.close(), 0);
+    EXPECT_FALSE(writer.is_open());
+    EXPECT_EQ(writer.get_states(), states.size());
+    // RAM compresses to almost nothing, the test ROM's CHR hardly at all
+    EXPECT_LT(writer.get_written_bytes(),
+              states.size() * sizeof(ConsoleSnapshot) / 2);
+
+    std::vector<ConsoleSnapshot> read;
+    ASSERT_EQ(CheckpointWriter::read(path, read), 0) << "uring " << uring;
+    ASSERT_EQ(read.size(), states.size());
+    for (size_t i = 0; i < states.size(); i++) {
+      EXPECT_EQ(memcmp(&read[i], &states[i], sizeof(ConsoleSnapshot)), 0)
+          << "state " << i;
+    }
+  }
+}
+
+TEST_F (CheckpointWriterTest, SavesConsoles) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  CheckpointWriter writer;
+  ASSERT_EQ(writer.open(path), 0);
+  std::vector<ConsoleSnapshot> states(3);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(console.run_frame(), 0);
+    console.save_snapshot(states[i]);
+    EXPECT_EQ(writer.add(console), int64_t(i));
+  }
+  EXPECT_EQ(writer.close(), 0);
+  std::vector<ConsoleSnapshot> read;
+  ASSERT_EQ(CheckpointWriter::read(path, read), 0);
+  ASSERT_EQ(read.size(), 3u);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(memcmp(read[i].ram, states[i].ram, sizeof states[i].ram), 0);
+    EXPECT_EQ(read[i].cpu.cycles, states[i].cpu.cycles);
+  }
+}
+
+TEST_F (CheckpointWriterTest, RejectsDamagedFiles) {
+  std::vector<ConsoleSnapshot> states, read;
+  play(states, 3);
+  EXPECT_EQ(CheckpointWriter::read(path, read), 1);
+  {
+    CheckpointWriter writer;
+    ASSERT_EQ(writer.open(path, 1), 0);
+    for (int i = 0; i < 3; i++) {
+      writer.add(states[i]);
+    }
+  }
+  ASSERT_EQ(CheckpointWriter::read(path, read), 0);
+
+  // a sequence number past the records is refused, not allocated for
+  const long first = 16; // the record after the file header
+  FILE* file = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(file != NULL);
+  uint64_t sequence;
+  fseek(file, first, SEEK_SET);
+  ASSERT_EQ(fread(&sequence, sizeof sequence, 1, file), 1u);
+  const uint64_t bad[2] = {3, uint64_t(1) << 40};
+  for (int i = 0; i < 2; i++) {
+    fseek(file, first, SEEK_SET);
+    fwrite(&bad[i], sizeof bad[i], 1, file);
+    fflush(file);
+    EXPECT_EQ(CheckpointWriter::read(path, read), 1) << bad[i];
+    EXPECT_TRUE(read.empty());
+  }
+  fseek(file, first, SEEK_SET);
+  fwrite(&sequence, sizeof sequence, 1, file);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  ASSERT_EQ(CheckpointWriter::read(path, read), 0);
+
+  ASSERT_EQ(truncate(path.c_str(), size - 1), 0);
+  EXPECT_EQ(CheckpointWriter::read(path, read), 1);
+  EXPECT_TRUE(read.empty());
+}
+
+} // namespace nesemu
@@ -0,0 +1,298 @@
+#include "env_channel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+namespace nesemu {
+
+static const char CHANNEL_MAGIC[8] = {'N', 'E', 'S', 'E', 'N', 'V', 'S', 'H'};
+static const uint32_t CHANNEL_VERSION = 1;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "doorbells must be plain words for futexes");
+
+/* Start of the segment, the slots follow */
+struct EnvChannel::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint64_t observation_size;
+  uint64_t size; // of the segment
+  uint32_t depth;
+  int32_t server;
+  std::atomic<int32_t> client; // 0 for none
+  std::atomic<uint32_t> stopped;
+  Doorbell requests;
+  Doorbell responses;
+};
+
+static size_t round_up(size_t size) {
+  return (size + 63) & ~size_t(63);
+}
+
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value,
+                  const timespec* timeout) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value,
+                 timeout, NULL, 0);
+}
+
+static inline void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static bool is_gone(pid_t pid) {
+  return kill(pid, 0) && errno == ESRCH;
+}
+
+EnvChannel::EnvChannel() {
+  owner = false;
+  memory = NULL;
+  size = 0;
+  header = NULL;
+  slot_size = 0;
+  actions_offset = rewards_offset = dones_offset = observations_offset = 0;
+}
+
+EnvChannel::~EnvChannel() {
+  close();
+}
+
+int EnvChannel::create(const std::string& name, int count,
+                       size_t observation_size, int depth) {
+  close();
+  if (count < 1 || depth < 1 || depth > MAX_DEPTH || (depth & (depth - 1)) ||
+      name.size() < 2 || name[0] != '/') {
+    return 1;
+  }
+  lay_out(count, observation_size);
+  size = round_up(sizeof(Header)) + slot_size * depth;
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return 1;
+  }
+  void* mapped = MAP_FAILED;
+  if (!ftruncate(fd, off_t(size))) {
+    mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return 1;
+  }
+  memory = static_cast<uint8_t*>(mapped);
+  header = new (memory) Header();
+  header->version = CHANNEL_VERSION;
+  header->count = uint32_t(count);
+  header->observation_size = observation_size;
+  header->size = size;
+  header->depth = uint32_t(depth);
+  header->server = int32_t(getpid());
+  // the magic goes in last, a client seeing it sees the rest
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, CHANNEL_MAGIC, sizeof CHANNEL_MAGIC);
+  this->name = name;
+  owner = true;
+  return 0;
+}
+
+int EnvChannel::open(const std::string& name) {
+  close();
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return 1;
+  }
+  struct stat status;
+  void* mapped = MAP_FAILED;
+  if (!fstat(fd, &status) && size_t(status.st_size) >= sizeof(Header)) {
+    size = size_t(status.st_size);
+    mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return 1;
+  }
+  memory = static_cast<uint8_t*>(mapped);
+  header = reinterpret_cast<Header*>(memory);
+  bool good = !memcmp(header->magic, CHANNEL_MAGIC, sizeof CHANNEL_MAGIC);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  good = good && header->version == CHANNEL_VERSION &&
+         header->size == size && header->count >= 1 && header->depth >= 1 &&
+         header->depth <= uint32_t(MAX_DEPTH) &&
+         !(header->depth & (header->depth - 1)) && !header->stopped.load();
+  if (good) {
+    lay_out(int(header->count), size_t(header->observation_size));
+    good = round_up(sizeof(Header)) + slot_size * header->depth == size;
+  }
+  // take the client's place, or that of one that died holding it
+  int32_t client = 0;
+  int32_t self = int32_t(getpid());
+  if (good && !header->client.compare_exchange_strong(client, self)) {
+    good = is_gone(client) &&
+           header->client.compare_exchange_strong(client, self);
+  }
+  if (!good) {
+    munmap(memory, size);
+    memory = NULL;
+    header = NULL;
+    size = 0;
+    return 1;
+  }
+  this->name = name;
+  return 0;
+}
+
+void EnvChannel::close() {
+  if (!memory) {
+    return;
+  }
+  if (owner) {
+    set_stopped();
+    shm_unlink(name.c_str());
+  } else if (header->client.load() == int32_t(getpid())) {
+    release_client();
+  }
+  munmap(memory, size);
+  memory = NULL;
+  header = NULL;
+  size = 0;
+  owner = false;
+  name.clear();
+}
+
+bool EnvChannel::is_open() const {
+  return memory != NULL;
+}
+
+int EnvChannel::get_count() const {
+  return header ? int(header->count) : 0;
+}
+
+size_t EnvChannel::get_observation_size() const {
+  return header ? size_t(header->observation_size) : 0;
+}
+
+int EnvChannel::get_depth() const {
+  return header ? int(header->depth) : 0;
+}
+
+uint32_t& EnvChannel::get_command(int slot) {
+  return *reinterpret_cast<uint32_t*>(get_slot(slot));
+}
+
+uint8_t* EnvChannel::get_actions(int slot) {
+  return get_slot(slot) + actions_offset;
+}
+
+float* EnvChannel::get_rewards(int slot) {
+  return reinterpret_cast<float*>(get_slot(slot) + rewards_offset);
+}
+
+uint8_t* EnvChannel::get_dones(int slot) {
+  return get_slot(slot) + dones_offset;
+}
+
+uint8_t* EnvChannel::get_observations(int slot) {
+  return get_slot(slot) + observations_offset;
+}
+
+EnvChannel::Doorbell& EnvChannel::get_requests() {
+  return header->requests;
+}
+
+EnvChannel::Doorbell& EnvChannel::get_responses() {
+  return header->responses;
+}
+
+pid_t EnvChannel::get_server() const {
+  return pid_t(header->server);
+}
+
+pid_t EnvChannel::get_client() const {
+  return pid_t(header->client.load());
+}
+
+void EnvChannel::release_client() {
+  header->client.store(0);
+}
+
+void EnvChannel::set_stopped() {
+  header->stopped.store(1);
+  futex(&header->requests.sequence, FUTEX_WAKE, 1, NULL);
+  futex(&header->responses.sequence, FUTEX_WAKE, 1, NULL);
+}
+
+bool EnvChannel::is_stopped() const {
+  return header->stopped.load() != 0;
+}
+
+void EnvChannel::ring(Doorbell& bell) {
+  bell.sequence.fetch_add(1);
+  if (bell.sleeping.exchange(0)) {
+    futex(&bell.sequence, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+// Sleeping is announced before the last look at the sequence, so a ring
+// either comes before that look or sees the announcement and wakes us.
+int EnvChannel::wait(Doorbell& bell, uint32_t seen, int spins) const {
+  for (int i = 0; i < spins; i++) {
+    if (bell.sequence.load(std::memory_order_acquire) != seen) {
+      return 0;
+    }
+    pause();
+  }
+  timespec timeout = {0, WAIT_MS * 1000000L};
+  for (;;) {
+    bell.sleeping.store(1);
+    if (bell.sequence.load() != seen) {
+      return 0;
+    }
+    if (header->stopped.load()) {
+      return 1;
+    }
+    futex(&bell.sequence, FUTEX_WAIT, seen, &timeout);
+    if (bell.sequence.load() != seen) {
+      return 0;
+    }
+    if (header->stopped.load()) {
+      return 1;
+    }
+    pid_t peer = owner ? get_client() : get_server();
+    if (peer && is_gone(peer)) {
+      return 1;
+    }
+  }
+}
+
+int EnvChannel::get_default_spins() {
+  return std::thread::hardware_concurrency() > 1 ? 4000 : 0;
+}
+
+// command, actions, rewards, dones and observations, each from a line
+void EnvChannel::lay_out(int count, size_t observation_size) {
+  actions_offset = 64;
+  rewards_offset = actions_offset + round_up(count);
+  dones_offset = rewards_offset + round_up(count * sizeof(float));
+  observations_offset = dones_offset + round_up(count);
+  slot_size = observations_offset + round_up(count * observation_size);
+}
+
+uint8_t* EnvChannel::get_slot(int slot) {
+  return memory + round_up(sizeof(Header)) + slot_size * slot;
+}
+
+} // namespace nesemu
@@ -0,0 +1,111 @@
+#ifndef NESEMU_ENV_ENV_CHANNEL_H_
+#define NESEMU_ENV_ENV_CHANNEL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+namespace nesemu {
+
+/* Shared memory between an EnvServer and its client
+  One POSIX shared memory segment holds a ring of depth slots, each with
+  the command, actions, rewards, done flags and observations of one batch
+  step. The client fills a slot and rings the request doorbell; the server
+  steps its VecEnv with the observations written straight into the slot and
+  rings the response doorbell. Nothing is serialized or copied in between.
+
+  A doorbell is a sequence number on a cache line of its own, so a step
+  hands over two lines. A waiter spins a little, then sleeps on the number
+  with a futex, and the ringer only makes the wake up call when the waiter
+  said it sleeps. Sleeps are cut short now and then to notice a peer that
+  died, or a server that stopped.
+*/
+class EnvChannel {
+  public:
+    EnvChannel();
+    ~EnvChannel();
+
+    static const int MAX_DEPTH = 16;
+    static const int WAIT_MS = 100; // longest sleep between peer checks
+
+    enum Command {
+      COMMAND_STEP,
+      COMMAND_RESET,
+      COMMAND_PING, // answered without stepping
+      COMMAND_CLOSE // the client hangs up
+    };
+
+    struct alignas(64) Doorbell {
+      std::atomic<uint32_t> sequence; // rings so far
+      std::atomic<uint32_t> sleeping; // set by a waiter about to sleep
+    };
+
+    // Makes the segment, replacing a stale one of the same name ("/name").
+    // depth is a power of two, so slots follow sequence numbers through
+    // their wrap. Returns 1 on bad arguments or a segment that cannot be
+    // made.
+    int create(const std::string& name, int count, size_t observation_size,
+               int depth);
+    // Maps the segment of a server. Returns 1 when there is none, it is of
+    // another version, or another client holds it.
+    int open(const std::string& name);
+    void close(); // unmaps, and removes the segment if it was made here
+    bool is_open() const;
+
+    int get_count() const;
+    size_t get_observation_size() const;
+    int get_depth() const;
+
+    /* Slot i of the ring, 0 - depth - 1 */
+    uint32_t& get_command(int slot);
+    uint8_t* get_actions(int slot);
+    float* get_rewards(int slot);
+    uint8_t* get_dones(int slot);
+    uint8_t* get_observations(int slot);
+
+    Doorbell& get_requests();
+    Doorbell& get_responses();
+
+    /* The peers */
+    pid_t get_server() const;
+    pid_t get_client() const;
+    void release_client(); // a new client may open
+    void set_stopped(); // wakes both sides, for good
+    bool is_stopped() const;
+
+    static void ring(Doorbell& bell);
+    // Waits for bell to move past seen, spinning spins times before
+    // sleeping. Returns 1 once the other side, the client if any when this
+    // made the segment and the server otherwise, is gone, or the server
+    // stopped.
+    int wait(Doorbell& bell, uint32_t seen, int spins) const;
+    static int get_default_spins(); // 0 on a single CPU
+
+  private:
+    EnvChannel(const EnvChannel&);
+    EnvChannel& operator=(const EnvChannel&);
+
+    struct Header;
+
+    std::string name;
+    bool owner;
+    uint8_t* memory;
+    size_t size;
+    Header* header;
+    size_t slot_size;
+
+    /* Offsets within a slot */
+    size_t actions_offset;
+    size_t rewards_offset;
+    size_t dones_offset;
+    size_t observations_offset;
+
+    void lay_out(int count, size_t observation_size);
+    uint8_t* get_slot(int slot);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_ENV_CHANNEL_H_
@@ -0,0 +1,132 @@
+#include "env_client.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+EnvClient::EnvClient() {
+  spins = EnvChannel::get_default_spins();
+  submitted = 0;
+  received = 0;
+  last = 0;
+}
+
+EnvClient::~EnvClient() {
+  disconnect();
+}
+
+int EnvClient::connect(const std::string& name) {
+  disconnect();
+  if (channel.open(name)) {
+    return 1;
+  }
+  // steps of a client before us that were never answered are not ours
+  submitted = channel.get_requests().sequence.load();
+  received = submitted;
+  last = 0;
+  return 0;
+}
+
+void EnvClient::disconnect() {
+  if (!channel.is_open()) {
+    return;
+  }
+  // the hang up is not waited for, a server not running gets it later
+  if (!get_actions()) {
+    wait();
+  }
+  submit(EnvChannel::COMMAND_CLOSE);
+  channel.close();
+}
+
+void EnvClient::set_spins(int spins) {
+  this->spins = spins < 0 ? 0 : spins;
+}
+
+int EnvClient::get_count() const {
+  return channel.get_count();
+}
+
+size_t EnvClient::get_observation_size() const {
+  return channel.get_observation_size();
+}
+
+int EnvClient::get_depth() const {
+  return channel.get_depth();
+}
+
+uint8_t* EnvClient::get_actions() {
+  if (!channel.is_open() ||
+      submitted - received >= uint32_t(channel.get_depth())) {
+    return NULL;
+  }
+  return channel.get_actions(int(submitted & (channel.get_depth() - 1)));
+}
+
+int EnvClient::submit_step() {
+  return submit(EnvChannel::COMMAND_STEP);
+}
+
+int EnvClient::submit_reset() {
+  return submit(EnvChannel::COMMAND_RESET);
+}
+
+int EnvClient::wait() {
+  if (!channel.is_open() || submitted == received) {
+    return 1;
+  }
+  EnvChannel::Doorbell& responses = channel.get_responses();
+  for (;;) {
+    uint32_t answered = responses.sequence.load(std::memory_order_acquire);
+    if (int32_t(answered - received) > 0) {
+      break;
+    }
+    if (channel.wait(responses, answered, spins)) {
+      return 1;
+    }
+  }
+  last = int(received & (channel.get_depth() - 1));
+  received++;
+  return 0;
+}
+
+const uint8_t* EnvClient::get_observations() {
+  return channel.get_observations(last);
+}
+
+const float* EnvClient::get_rewards() {
+  return channel.get_rewards(last);
+}
+
+const uint8_t* EnvClient::get_dones() {
+  return channel.get_dones(last);
+}
+
+int EnvClient::reset() {
+  return submit_reset() || wait();
+}
+
+int EnvClient::step(const uint8_t* actions) {
+  uint8_t* next = get_actions();
+  if (!next) {
+    return 1;
+  }
+  memcpy(next, actions, channel.get_count());
+  return submit_step() || wait();
+}
+
+int EnvClient::ping() {
+  return submit(EnvChannel::COMMAND_PING) || wait();
+}
+
+int EnvClient::submit(uint32_t command) {
+  if (!get_actions() || channel.is_stopped()) {
+    return 1;
+  }
+  channel.get_command(int(submitted & (channel.get_depth() - 1))) = command;
+  submitted++;
+  EnvChannel::ring(channel.get_requests());
+  return 0;
+}
+
+} // namespace nesemu
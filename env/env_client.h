@@ -0,0 +1,76 @@
+#ifndef NESEMU_ENV_ENV_CLIENT_H_
+#define NESEMU_ENV_ENV_CLIENT_H_
+
+#include "env_channel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace nesemu {
+
+/* An agent's end of an EnvServer
+  Steps are submitted into the server's shared memory ring and their
+  results read back from it where the server's consoles wrote them. Up to
+  depth steps can be in flight, e.g. to fill the next actions while the
+  last step runs, or step() waits for each in turn. Needs only
+  env_channel.o, not the emulator.
+*/
+class EnvClient {
+  public:
+    EnvClient();
+    ~EnvClient();
+
+    // Returns 1 when the server is not there or has another client.
+    int connect(const std::string& name);
+    // Hangs up, the server's run() returns once it served the steps in
+    // flight. Waits only for a free slot when the ring is full.
+    void disconnect();
+    // pause instructions before sleeping, see EnvChannel
+    void set_spins(int spins);
+
+    int get_count() const;
+    size_t get_observation_size() const; // bytes per console
+    int get_depth() const;
+
+    /* Pipelined */
+    // pad 1 buttons of the next step to submit, get_count() bytes, or NULL
+    // when depth steps are in flight
+    uint8_t* get_actions();
+    // Return 1 when depth steps are in flight or the client is not
+    // connected.
+    int submit_step();
+    int submit_reset();
+    // Waits for the oldest step in flight. Returns 1 when there is none or
+    // the server stopped or died.
+    int wait();
+
+    /* Results of the step last waited for, valid until depth more
+      submits */
+    const uint8_t* get_observations();
+    const float* get_rewards();
+    const uint8_t* get_dones();
+
+    /* One step at a time, results as above */
+    int reset();
+    int step(const uint8_t* actions);
+    // A round trip without a step, after which there are no results to
+    // read. Returns 1 when the server is gone.
+    int ping();
+
+  private:
+    EnvClient(const EnvClient&);
+    EnvClient& operator=(const EnvClient&);
+
+    EnvChannel channel;
+    int spins;
+    uint32_t submitted; // request sequence numbers
+    uint32_t received;
+    int last; // slot of the last step waited for
+
+    int submit(uint32_t command);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_ENV_CLIENT_H_
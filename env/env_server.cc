@@ -0,0 +1,88 @@
+#include "env_server.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+EnvServer::EnvServer() {
+  env = NULL;
+  spins = EnvChannel::get_default_spins();
+  steps = 0;
+}
+
+int EnvServer::create(VecEnv* env, const std::string& name, int depth) {
+  close();
+  if (!env || env->get_count() < 1 ||
+      channel.create(name, env->get_count(), env->get_observation_size(),
+                     depth)) {
+    return 1;
+  }
+  this->env = env;
+  return 0;
+}
+
+void EnvServer::close() {
+  channel.close();
+  env = NULL;
+}
+
+int EnvServer::run() {
+  if (!channel.is_open()) {
+    return 1;
+  }
+  EnvChannel::Doorbell& requests = channel.get_requests();
+  EnvChannel::Doorbell& responses = channel.get_responses();
+  uint32_t mask = uint32_t(channel.get_depth() - 1);
+  uint32_t served = responses.sequence.load();
+  for (;;) {
+    if (requests.sequence.load(std::memory_order_acquire) == served) {
+      if (channel.wait(requests, served, spins)) {
+        if (channel.is_stopped()) {
+          return 0;
+        }
+        channel.release_client(); // died
+        return 1;
+      }
+      continue;
+    }
+    int slot = int(served & mask);
+    uint32_t command = channel.get_command(slot);
+    serve(slot, command);
+    served++;
+    EnvChannel::ring(responses);
+    if (command == EnvChannel::COMMAND_CLOSE) {
+      channel.release_client();
+      return 0;
+    }
+  }
+}
+
+void EnvServer::stop() {
+  if (channel.is_open()) {
+    channel.set_stopped();
+  }
+}
+
+void EnvServer::set_spins(int spins) {
+  this->spins = spins < 0 ? 0 : spins;
+}
+
+uint64_t EnvServer::get_steps() const {
+  return steps;
+}
+
+void EnvServer::serve(int slot, uint32_t command) {
+  int count = env->get_count();
+  if (command == EnvChannel::COMMAND_STEP) {
+    env->step(channel.get_actions(slot), channel.get_observations(slot),
+              channel.get_rewards(slot), channel.get_dones(slot));
+    steps++;
+  } else if (command == EnvChannel::COMMAND_RESET) {
+    env->reset(channel.get_observations(slot));
+    memset(channel.get_rewards(slot), 0, count * sizeof(float));
+    memset(channel.get_dones(slot), 0, count);
+    steps++;
+  }
+}
+
+} // namespace nesemu
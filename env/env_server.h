@@ -0,0 +1,53 @@
+#ifndef NESEMU_ENV_ENV_SERVER_H_
+#define NESEMU_ENV_ENV_SERVER_H_
+
+#include "env_channel.h"
+#include "vec_env.h"
+
+#include <cstdint>
+#include <string>
+
+namespace nesemu {
+
+/* Serves a VecEnv to an agent in another process
+  The batch's actions, observations, rewards and done flags live in a ring
+  in shared memory (see EnvChannel), and the env reads and writes them
+  there in place: a step costs the client's doorbell, the step itself and
+  the server's doorbell. One client at a time, connected through
+  EnvClient; steps are served in the order they were submitted.
+*/
+class EnvServer {
+  public:
+    EnvServer();
+
+    // Serves env, already initialized, under the shared memory name
+    // ("/name") with a ring of depth steps, a power of two. Returns 1 on
+    // bad arguments or a segment that cannot be made.
+    int create(VecEnv* env, const std::string& name, int depth = 2);
+    void close(); // removes the segment, clients see the server stop
+
+    // Serves steps until the client hangs up (0), the client dies (1) or
+    // stop() is called (0). Run it again for the next client.
+    int run();
+    void stop(); // from any thread, ends run() for good
+    // pause instructions before sleeping on the doorbell, see
+    // EnvChannel::get_default_spins()
+    void set_spins(int spins);
+
+    uint64_t get_steps() const; // steps and resets served
+
+  private:
+    EnvServer(const EnvServer&);
+    EnvServer& operator=(const EnvServer&);
+
+    EnvChannel channel;
+    VecEnv* env;
+    int spins;
+    uint64_t steps;
+
+    void serve(int slot, uint32_t command);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_ENV_SERVER_H_
@@ -0,0 +1,117 @@
+#include "env_client.h"
+#include "env_server.h"
+
+#include "console/test_rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace nesemu;
+
+static const int STEPS = 2000;
+
+typedef std::chrono::steady_clock Clock;
+
+static double microseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// step time of count consoles in process, the cost a server adds to
+static double run_local(const std::vector<uint8_t>& image, int count) {
+  VecEnv env;
+  env.init(&image[0], image.size(), count);
+  std::vector<uint8_t> observations(count * env.get_observation_size());
+  std::vector<uint8_t> actions(count), dones(count);
+  std::vector<float> rewards(count);
+  env.reset(&observations[0]);
+  Clock::time_point start = Clock::now();
+  for (int step = 0; step < STEPS; step++) {
+    memset(&actions[0], step & 8 ? BUTTON_A : 0, count);
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+  }
+  return microseconds(Clock::now() - start) / STEPS;
+}
+
+static void print_times(const char* name, std::vector<double>& times,
+                        double local) {
+  double mean = 0;
+  for (size_t i = 0; i < times.size(); i++) {
+    mean += times[i] / times.size();
+  }
+  std::sort(times.begin(), times.end());
+  printf("    %-6s %9.2f %9.2f", name, mean, times[times.size() * 99 / 100]);
+  if (local > 0) {
+    printf(" %9.2f", mean - local);
+  }
+  printf("\n");
+}
+
+// Round trips in microseconds from a client process to a server process
+// stepping count consoles: pings, which cost only the two doorbells, then
+// steps, also against stepping in process.
+static void run_remote(const std::vector<uint8_t>& image, int count,
+                       int spins, double local) {
+  char name[64];
+  snprintf(name, sizeof name, "/nesemu_bench_%d", int(getpid()));
+  pid_t child = fork();
+  if (!child) {
+    VecEnv env;
+    env.init(&image[0], image.size(), count);
+    EnvServer server;
+    server.set_spins(spins);
+    int result = server.create(&env, name) || server.run();
+    server.close();
+    _exit(result);
+  }
+
+  EnvClient client;
+  client.set_spins(spins);
+  while (client.connect(name)) {
+    if (waitpid(child, NULL, WNOHANG) == child) {
+      printf("  no shared memory\n");
+      return;
+    }
+    usleep(1000);
+  }
+  printf("  %d consoles, spins %d\n", count, spins);
+  std::vector<double> times(STEPS);
+  for (int ping = 0; ping < STEPS; ping++) {
+    Clock::time_point start = Clock::now();
+    client.ping();
+    times[ping] = microseconds(Clock::now() - start);
+  }
+  print_times("ping", times, 0);
+
+  client.reset();
+  std::vector<uint8_t> actions(count);
+  for (int step = 0; step < STEPS; step++) {
+    memset(&actions[0], step & 8 ? BUTTON_A : 0, count);
+    Clock::time_point start = Clock::now();
+    client.step(&actions[0]);
+    times[step] = microseconds(Clock::now() - start);
+  }
+  print_times("step", times, local);
+  client.disconnect();
+  waitpid(child, NULL, 0);
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  int counts[] = {1, 16};
+  printf("round trips through shared memory, us (%d each)\n", STEPS);
+  printf("                mean       p99  over in process\n");
+  for (size_t i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+    double local = run_local(image, counts[i]);
+    printf("  %d consoles in process %.2f\n", counts[i], local);
+    run_remote(image, counts[i], 0, local);
+    if (EnvChannel::get_default_spins()) {
+      run_remote(image, counts[i], EnvChannel::get_default_spins(), local);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include "env_client.h"
+#include "env_server.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace nesemu {
+
+static const int SIZE = 84 * 84;
+
+static float a_held(void* /* context */, const Console& console,
+                    bool* /* done */) {
+  return console.get_ram()[0x11] ? 1.0f : 0.0f;
+}
+
+static uint8_t action_at(int env, int step) {
+  return (env + step / 3) % 3 == 0 ? BUTTON_A : 0;
+}
+
+static std::string test_name(const char* test) {
+  char name[64];
+  snprintf(name, sizeof name, "/nesemu_%s_%d", test, int(getpid()));
+  return name;
+}
+
+TEST (EnvServerTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  EnvServer server;
+  EXPECT_EQ(server.create(&env, test_name("bad")), 1); // not initialized
+  ASSERT_EQ(env.init(&image[0], image.size(), 2), 0);
+  EXPECT_EQ(server.create(&env, "no_slash"), 1);
+  EXPECT_EQ(server.create(&env, test_name("bad"), 3), 1);
+  EXPECT_EQ(server.create(&env, test_name("bad"), EnvChannel::MAX_DEPTH * 2),
+            1);
+  EXPECT_EQ(server.run(), 1);
+  EnvClient client;
+  EXPECT_EQ(client.connect(test_name("missing")), 1);
+  EXPECT_EQ(client.wait(), 1);
+  EXPECT_TRUE(client.get_actions() == NULL);
+}
+
+// a served env steps as the same env would in process
+TEST (EnvServerTest, MatchesVecEnv) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 3;
+  VecEnv served, local;
+  ASSERT_EQ(served.init(&image[0], image.size(), count), 0);
+  ASSERT_EQ(local.init(&image[0], image.size(), count), 0);
+  served.set_reward(a_held, NULL);
+  local.set_reward(a_held, NULL);
+  served.set_max_frames(25);
+  local.set_max_frames(25);
+  EnvServer server;
+  std::string name = test_name("match");
+  ASSERT_EQ(server.create(&served, name), 0);
+  int result = -1;
+  std::thread thread([&server, &result] { result = server.run(); });
+
+  EnvClient client;
+  ASSERT_EQ(client.connect(name), 0);
+  EXPECT_EQ(client.get_count(), count);
+  EXPECT_EQ(client.get_observation_size(), size_t(SIZE));
+  EXPECT_EQ(client.get_depth(), 2);
+  EnvClient other;
+  EXPECT_EQ(other.connect(name), 1); // one client at a time
+
+  std::vector<uint8_t> observations(count * SIZE), actions(count);
+  std::vector<uint8_t> dones(count);
+  std::vector<float> rewards(count);
+  EXPECT_EQ(client.ping(), 0);
+  local.reset(&observations[0]);
+  ASSERT_EQ(client.reset(), 0);
+  EXPECT_EQ(memcmp(client.get_observations(), &observations[0],
+                   observations.size()), 0);
+  for (int step = 0; step < 40; step++) {
+    for (int i = 0; i < count; i++) {
+      actions[i] = action_at(i, step);
+    }
+    local.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    ASSERT_EQ(client.step(&actions[0]), 0);
+    ASSERT_EQ(memcmp(client.get_observations(), &observations[0],
+                     observations.size()), 0) << "step " << step;
+    EXPECT_EQ(memcmp(client.get_rewards(), &rewards[0],
+                     count * sizeof(float)), 0);
+    EXPECT_EQ(memcmp(client.get_dones(), &dones[0], count), 0);
+  }
+  client.disconnect();
+  thread.join();
+  EXPECT_EQ(result, 0);
+  EXPECT_EQ(server.get_steps(), 41u);
+
+  // the next client is served by the next run
+  thread = std::thread([&server, &result] { result = server.run(); });
+  ASSERT_EQ(other.connect(name), 0);
+  EXPECT_EQ(other.reset(), 0);
+  other.disconnect();
+  thread.join();
+  EXPECT_EQ(result, 0);
+}
+
+// steps submitted ahead are answered in order, each in its own slot
+TEST (EnvServerTest, Pipelined) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv served, local;
+  ASSERT_EQ(served.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(local.init(&image[0], image.size(), 1), 0);
+  EnvServer server;
+  std::string name = test_name("pipe");
+  ASSERT_EQ(server.create(&served, name, 4), 0);
+  std::thread thread([&server] { server.run(); });
+  EnvClient client;
+  ASSERT_EQ(client.connect(name), 0);
+  ASSERT_EQ(client.submit_reset(), 0);
+  for (int step = 0; step < 3; step++) {
+    uint8_t* actions = client.get_actions();
+    ASSERT_TRUE(actions != NULL);
+    actions[0] = action_at(0, step * 3);
+    ASSERT_EQ(client.submit_step(), 0);
+  }
+  EXPECT_TRUE(client.get_actions() == NULL);
+  EXPECT_EQ(client.submit_step(), 1);
+
+  std::vector<uint8_t> observation(SIZE);
+  float reward;
+  uint8_t done;
+  local.reset(&observation[0]);
+  for (int step = -1; step < 3; step++) {
+    if (step >= 0) {
+      uint8_t action = action_at(0, step * 3);
+      local.step(&action, &observation[0], &reward, &done);
+    }
+    ASSERT_EQ(client.wait(), 0);
+    EXPECT_EQ(memcmp(client.get_observations(), &observation[0], SIZE), 0)
+        << "step " << step;
+  }
+  EXPECT_EQ(client.wait(), 1); // nothing in flight
+  client.disconnect();
+  thread.join();
+}
+
+// a client in another process, and one that dies mid-session
+TEST (EnvServerTest, AcrossProcesses) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  ASSERT_EQ(env.init(&image[0], image.size(), 2), 0);
+  env.set_reward(a_held, NULL);
+  EnvServer server;
+  std::string name = test_name("fork");
+  ASSERT_EQ(server.create(&env, name), 0);
+
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (!child) {
+    EnvClient client;
+    int failed = client.connect(name) || client.reset();
+    uint8_t actions[2] = {BUTTON_A, 0};
+    for (int step = 0; step < 10 && !failed; step++) {
+      failed = client.step(actions);
+    }
+    failed = failed || client.get_rewards()[0] != 1.0f ||
+             client.get_rewards()[1] != 0.0f;
+    client.disconnect();
+    _exit(failed);
+  }
+  EXPECT_EQ(server.run(), 0);
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_EQ(server.get_steps(), 11u);
+
+  child = fork();
+  ASSERT_GE(child, 0);
+  if (!child) {
+    EnvClient client;
+    client.connect(name);
+    client.reset();
+    _exit(0); // without hanging up
+  }
+  // reaped at once, a zombie would still look alive
+  std::thread reaper([child] { waitpid(child, NULL, 0); });
+  EXPECT_EQ(server.run(), 1);
+  reaper.join();
+  EnvClient client;
+  EXPECT_EQ(client.connect(name), 0); // the dead client's place is free
+}
+
+TEST (EnvServerTest, StopWakesClient) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  ASSERT_EQ(env.init(&image[0], image.size(), 1), 0);
+  EnvServer server;
+  std::string name = test_name("stop");
+  ASSERT_EQ(server.create(&env, name), 0);
+  EnvClient client;
+  ASSERT_EQ(client.connect(name), 0);
+  ASSERT_EQ(client.submit_reset(), 0);
+  // nobody serves, the client sleeps until the server stops
+  std::thread thread([&server] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    server.stop();
+  });
+  EXPECT_EQ(client.wait(), 1);
+  thread.join();
+  EXPECT_EQ(server.run(), 0);
+  EXPECT_EQ(client.submit_reset(), 1);
+  EXPECT_EQ(client.ping(), 1);
+  server.close();
+  EXPECT_EQ(client.connect(name), 1);
+}
+
+} // namespace nesemu
@@ -0,0 +1,141 @@
+#include "expander.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nesemu {
+
+Expander::Expander() {
+  observation_size = 0;
+  record_size = 0;
+  reward = 0;
+  reward_context = 0;
+  pool = 0;
+  hash_ppu = false;
+  state = 0;
+  inputs = 0;
+  first = 0;
+  frames = 0;
+  results = 0;
+}
+
+int Expander::init(const uint8_t* image, size_t size, int consoles, int mode,
+                   int width, int height) {
+  if (consoles < 1 || width < 1 || height < 1) {
+    return 1;
+  }
+  std::vector<std::unique_ptr<Slot> > made(consoles);
+  std::vector<uint8_t> scratch(size_t(width) * height);
+  for (int i = 0; i < consoles; i++) {
+    made[i].reset(new Slot);
+    Console& console = made[i]->console;
+    if (console.load_rom(image, size) ||
+        console.get_ppu().set_output(mode, &scratch[0], width, height)) {
+      return 1;
+    }
+  }
+  slots.swap(made);
+  set_hash_ppu(hash_ppu);
+  observation_size = scratch.size();
+  record_size = (sizeof(Expansion) + observation_size + RECORD_ALIGN - 1) /
+                RECORD_ALIGN * RECORD_ALIGN;
+  return 0;
+}
+
+/* Settings */
+void Expander::set_reward(RewardFunction reward, void* context) {
+  this->reward = reward;
+  reward_context = context;
+}
+
+void Expander::set_pool(WorkerPool* pool) {
+  this->pool = pool;
+}
+
+// RAM is rehashed whole after every load, so nothing is tracked
+void Expander::set_hash_ppu(bool ppu) {
+  hash_ppu = ppu;
+  for (size_t i = 0; i < slots.size(); i++) {
+    slots[i]->hash.attach(&slots[i]->console, ppu, false);
+  }
+}
+
+int Expander::get_consoles() const {
+  return int(slots.size());
+}
+
+size_t Expander::get_observation_size() const {
+  return observation_size;
+}
+
+size_t Expander::get_record_size() const {
+  return record_size;
+}
+
+/* Expanding */
+int Expander::expand(const ConsoleSnapshot& state, const uint8_t* inputs,
+                     int count, int frames, uint8_t* results) {
+  if (slots.empty() || count < 0 || frames < 1 || frames > 0xFFFF ||
+      (count && (!inputs || !results))) {
+    return 1;
+  }
+  this->state = &state;
+  this->inputs = inputs;
+  this->frames = frames;
+  this->results = results;
+  // a round per console's worth of sequences
+  const int consoles = int(slots.size());
+  for (first = 0; first < count; first += consoles) {
+    int round = std::min(consoles, count - first);
+    if (pool) {
+      pool->run(round, 1, expand_batch, this);
+    } else {
+      expand_batch(this, 0, round);
+    }
+  }
+  return 0;
+}
+
+void Expander::expand_batch(void* expander, int begin, int end) {
+  Expander* self = static_cast<Expander*>(expander);
+  for (int i = begin; i < end; i++) {
+    self->play(i);
+  }
+}
+
+void Expander::play(int slot) {
+  Slot& own = *slots[slot];
+  Console& console = own.console;
+  const int sequence = first + slot;
+  uint8_t* record = results + size_t(sequence) * record_size;
+  const uint8_t* input = inputs + size_t(sequence) * frames;
+  Expansion expansion;
+  memset(&expansion, 0, sizeof expansion);
+
+  console.load_snapshot(*state);
+  console.get_ppu().set_output_buffer(record + sizeof(Expansion));
+  bool done = false;
+  for (int frame = 0; frame < frames; frame++) {
+    console.get_controller(0).set_buttons(input[frame]);
+    console.get_ppu().set_render_mode(frame == frames - 1 ? RENDER_FULL
+                                                          : RENDER_NONE);
+    if (console.run_frame()) {
+      // no frame was shown
+      memset(record + sizeof(Expansion), 0, observation_size);
+      expansion.crashed = 1;
+      done = true;
+      break;
+    }
+    if (!done) {
+      expansion.frames++;
+      if (reward) {
+        expansion.reward += reward(reward_context, console, &done);
+      }
+    }
+  }
+  expansion.done = done;
+  expansion.hash = own.hash.hash();
+  memcpy(record, &expansion, sizeof expansion);
+}
+
+} // namespace nesemu
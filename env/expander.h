@@ -0,0 +1,93 @@
+#ifndef NESEMU_ENV_EXPANDER_H_
+#define NESEMU_ENV_EXPANDER_H_
+
+#include "console/state_hash.h"
+#include "vec_env.h"
+#include "worker_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace nesemu {
+
+// head of an expansion's record, its observation follows
+struct Expansion {
+  uint64_t hash;    // ConsoleHash of the state reached
+  float reward;     // up to the frame that ended the episode
+  uint8_t done;     // the reward function ended it, or the game crashed
+  uint8_t crashed;
+  uint16_t frames;  // played before done, or all of them
+};
+
+/* Every child of one state, for tree search
+  expand() plays count input sequences of the same length from one
+  snapshot, e.g. each legal pad input held for K frames, and writes what
+  each led to into one caller-owned buffer of get_record_size() byte
+  records: an Expansion, then the observation of the last frame.
+
+  Each sequence runs on a console of its own, forked from the snapshot by
+  loading it, which copies about 23KB in a few large blocks; the consoles
+  are spread over a WorkerPool like VecEnv's. All frames but the last run
+  headless. A sequence is played out after the reward function signals
+  done, so every observation is of the same frame, but its reward stops
+  there.
+*/
+class Expander {
+  public:
+    Expander();
+
+    static const size_t RECORD_ALIGN = 64; // records start on cache lines
+
+    // Builds consoles consoles, the expansions run at once, observed as
+    // VecEnv's are. Returns 1 on a bad image or arguments.
+    int init(const uint8_t* image, size_t size, int consoles,
+             int mode = OUTPUT_GRAY_AREA, int width = 84, int height = 84);
+    // rewards are 0 and nothing is done without one; called from several
+    // threads at once with a pool
+    void set_reward(RewardFunction reward, void* context);
+    void set_pool(WorkerPool* pool); // NULL for the calling thread only
+    void set_hash_ppu(bool ppu);     // see ConsoleHash
+
+    int get_consoles() const;
+    size_t get_observation_size() const;
+    size_t get_record_size() const;
+
+    // Plays sequence i of frames pad 1 bytes, inputs[i * frames] on, from
+    // state into record i of results, count records. Returns 1 on bad
+    // arguments or before init().
+    int expand(const ConsoleSnapshot& state, const uint8_t* inputs,
+               int count, int frames, uint8_t* results);
+
+  private:
+    Expander(const Expander&);
+    Expander& operator=(const Expander&);
+
+    struct alignas(WorkerPool::CACHE_LINE) Slot {
+      Console console;
+      ConsoleHash hash;
+    };
+
+    std::vector<std::unique_ptr<Slot> > slots;
+    size_t observation_size;
+    size_t record_size;
+    RewardFunction reward;
+    void* reward_context;
+    WorkerPool* pool;
+    bool hash_ppu;
+
+    /* The call in progress */
+    const ConsoleSnapshot* state;
+    const uint8_t* inputs;
+    int first; // sequence of slot 0
+    int frames;
+    uint8_t* results;
+
+    static void expand_batch(void* expander, int begin, int end);
+    void play(int slot);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_EXPANDER_H_
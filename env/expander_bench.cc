@@ -0,0 +1,111 @@
+#include "expander.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace nesemu;
+
+static const int ACTIONS = 9;
+static const int FRAMES = 4;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Microseconds to fork a console: a round trip of the memory a per-byte
+// savestate can reach (RAM and PRG RAM, 10KB) through get_memory and
+// set_memory, against loading a whole snapshot.
+static void run_setup(const std::vector<uint8_t>& image) {
+  Console* console = new Console;
+  console->load_rom(&image[0], image.size());
+  for (int frame = 0; frame < 10; frame++) {
+    console->run_frame();
+  }
+  CPU& cpu = console->get_cpu();
+  std::vector<uint8_t> saved(0x2800);
+  const int trips = 2000;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < trips; i++) {
+    for (int address = 0; address < 0x800; address++) {
+      saved[address] = cpu.get_memory(uint16_t(address));
+    }
+    for (int address = 0x6000; address < 0x8000; address++) {
+      saved[address - 0x5800] = cpu.get_memory(uint16_t(address));
+    }
+    for (int address = 0; address < 0x800; address++) {
+      cpu.set_memory(uint16_t(address), saved[address]);
+    }
+    for (int address = 0x6000; address < 0x8000; address++) {
+      cpu.set_memory(uint16_t(address), saved[address - 0x5800]);
+    }
+  }
+  double bytes = seconds_since(start) * 1e6 / trips;
+
+  ConsoleSnapshot* snapshot = new ConsoleSnapshot;
+  console->save_snapshot(*snapshot);
+  const int loads = 20000;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loads; i++) {
+    console->load_snapshot(*snapshot);
+  }
+  double load = seconds_since(start) * 1e6 / loads;
+  delete snapshot;
+  delete console;
+
+  printf("Forking a state\n");
+  printf("  per-byte round trip, 10KB     %10.2f us\n", bytes);
+  printf("  load a snapshot, %zu bytes %10.2f us\n", sizeof(ConsoleSnapshot),
+         load);
+}
+
+// expansions/sec of every action held FRAMES frames from one state
+static double run_expand(const std::vector<uint8_t>& image, int threads) {
+  Console console;
+  console.load_rom(&image[0], image.size());
+  for (int frame = 0; frame < 10; frame++) {
+    console.run_frame();
+  }
+  ConsoleSnapshot* state = new ConsoleSnapshot;
+  console.save_snapshot(*state);
+  Expander expander;
+  expander.init(&image[0], image.size(), ACTIONS);
+  WorkerPool pool(threads);
+  if (threads > 1) {
+    expander.set_pool(&pool);
+  }
+  std::vector<uint8_t> inputs(ACTIONS * FRAMES);
+  for (int i = 0; i < ACTIONS * FRAMES; i++) {
+    inputs[i] = uint8_t(1 << (i / FRAMES % 8));
+  }
+  std::vector<uint8_t> results(ACTIONS * expander.get_record_size());
+  const int calls = 200;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; i++) {
+    expander.expand(*state, &inputs[0], ACTIONS, FRAMES, &results[0]);
+  }
+  double seconds = seconds_since(start);
+  delete state;
+  return double(calls) * ACTIONS / seconds;
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  run_setup(image);
+  int threads = int(std::thread::hardware_concurrency());
+  threads = threads < 1 ? 1 : threads;
+  printf("%d sequences of %d frames, 84x84 gray\n", ACTIONS, FRAMES);
+  printf("  one thread                    %10.0f expansions/sec\n",
+         run_expand(image, 1));
+  if (threads > 1) {
+    printf("  %2d threads                    %10.0f expansions/sec\n",
+           threads, run_expand(image, threads));
+  }
+  return 0;
+}
@@ -0,0 +1,176 @@
+#include "expander.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+static const int SIZE = 84 * 84;
+
+// reward 1 while A is held
+static float a_held(void* /* context */, const Console& console,
+                    bool* /* done */) {
+  return console.get_ram()[0x11] ? 1.0f : 0.0f;
+}
+
+// reward 1 and done at once
+static float first_frame(void* /* context */, const Console& /* console */,
+                         bool* done) {
+  *done = true;
+  return 1.0f;
+}
+
+static uint8_t input_at(int sequence, int frame) {
+  return (sequence + frame / 2) % 3 == 0 ? BUTTON_A : 0;
+}
+
+// a state some frames in
+static void make_state(const std::vector<uint8_t>& image,
+                       ConsoleSnapshot& state) {
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  for (int frame = 0; frame < 10; frame++) {
+    ASSERT_EQ(console.run_frame(), 0);
+  }
+  console.save_snapshot(state);
+}
+
+static Expansion expansion_at(const std::vector<uint8_t>& results,
+                              size_t record_size, int i) {
+  Expansion expansion;
+  memcpy(&expansion, &results[i * record_size], sizeof expansion);
+  return expansion;
+}
+
+TEST (ExpanderTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  Expander expander;
+  ConsoleSnapshot state;
+  uint8_t inputs[4] = {0};
+  std::vector<uint8_t> results(4096);
+  EXPECT_EQ(expander.expand(state, inputs, 1, 1, &results[0]), 1);
+  EXPECT_EQ(expander.init(&image[0], image.size(), 0), 1);
+  EXPECT_EQ(expander.init(&image[0], 10, 2), 1);
+  EXPECT_EQ(expander.init(&image[0], image.size(), 2, OUTPUT_GRAY_AREA, 300,
+                          84), 1);
+  EXPECT_EQ(expander.get_consoles(), 0);
+  ASSERT_EQ(expander.init(&image[0], image.size(), 2), 0);
+  EXPECT_EQ(expander.get_consoles(), 2);
+  EXPECT_EQ(expander.get_observation_size(), size_t(SIZE));
+  EXPECT_EQ(expander.get_record_size() % Expander::RECORD_ALIGN, 0u);
+  EXPECT_GE(expander.get_record_size(), sizeof(Expansion) + SIZE);
+  EXPECT_EQ(expander.expand(state, inputs, 1, 0, &results[0]), 1);
+  EXPECT_EQ(expander.expand(state, NULL, 1, 1, &results[0]), 1);
+  EXPECT_EQ(expander.expand(state, inputs, 1, 1, NULL), 1);
+  EXPECT_EQ(expander.expand(state, NULL, 0, 1, NULL), 0);
+}
+
+// every record holds what a console forked from the state on its own
+// shows, with more sequences than consoles
+TEST (ExpanderTest, MatchesSingleConsoles) {
+  std::vector<uint8_t> image = make_test_rom();
+  ConsoleSnapshot state;
+  make_state(image, state);
+  const int count = 5, frames = 6;
+  Expander expander;
+  ASSERT_EQ(expander.init(&image[0], image.size(), 2), 0);
+  expander.set_reward(a_held, NULL);
+  expander.set_hash_ppu(true);
+  std::vector<uint8_t> inputs(count * frames);
+  for (int i = 0; i < count; i++) {
+    for (int frame = 0; frame < frames; frame++) {
+      inputs[i * frames + frame] = input_at(i, frame);
+    }
+  }
+  const size_t record_size = expander.get_record_size();
+  std::vector<uint8_t> results(count * record_size);
+  ASSERT_EQ(expander.expand(state, &inputs[0], count, frames, &results[0]),
+            0);
+
+  for (int i = 0; i < count; i++) {
+    Console console;
+    ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+    std::vector<uint8_t> observation(SIZE);
+    console.get_ppu().set_output(OUTPUT_GRAY_AREA, &observation[0], 84, 84);
+    console.load_snapshot(state);
+    float reward = 0;
+    for (int frame = 0; frame < frames; frame++) {
+      console.get_controller(0).set_buttons(input_at(i, frame));
+      ASSERT_EQ(console.run_frame(), 0);
+      reward += a_held(NULL, console, NULL);
+    }
+    ConsoleHash hash;
+    hash.attach(&console, true, false);
+
+    Expansion expansion = expansion_at(results, record_size, i);
+    EXPECT_EQ(expansion.hash, hash.hash()) << "sequence " << i;
+    EXPECT_EQ(expansion.reward, reward);
+    EXPECT_EQ(expansion.done, 0);
+    EXPECT_EQ(expansion.crashed, 0);
+    EXPECT_EQ(expansion.frames, frames);
+    EXPECT_TRUE(std::equal(observation.begin(), observation.end(),
+                           results.begin() + i * record_size +
+                           sizeof(Expansion)));
+  }
+  // different inputs, different states
+  EXPECT_NE(expansion_at(results, record_size, 0).hash,
+            expansion_at(results, record_size, 1).hash);
+  EXPECT_EQ(expansion_at(results, record_size, 0).hash,
+            expansion_at(results, record_size, 3).hash);
+}
+
+TEST (ExpanderTest, PoolMatchesCallingThread) {
+  std::vector<uint8_t> image = make_test_rom();
+  ConsoleSnapshot state;
+  make_state(image, state);
+  const int count = 9, frames = 4;
+  Expander serial, parallel;
+  ASSERT_EQ(serial.init(&image[0], image.size(), 9), 0);
+  ASSERT_EQ(parallel.init(&image[0], image.size(), 4), 0);
+  WorkerPool pool(3);
+  parallel.set_pool(&pool);
+  serial.set_reward(a_held, NULL);
+  parallel.set_reward(a_held, NULL);
+  std::vector<uint8_t> inputs(count * frames);
+  for (int i = 0; i < count * frames; i++) {
+    inputs[i] = input_at(i / frames, i % frames);
+  }
+  std::vector<uint8_t> serial_results(count * serial.get_record_size());
+  std::vector<uint8_t> results(count * parallel.get_record_size());
+  ASSERT_EQ(serial.expand(state, &inputs[0], count, frames,
+                          &serial_results[0]), 0);
+  ASSERT_EQ(parallel.expand(state, &inputs[0], count, frames, &results[0]),
+            0);
+  EXPECT_EQ(results, serial_results);
+}
+
+// the sequence plays out, but its reward stops at done
+TEST (ExpanderTest, DoneStopsReward) {
+  std::vector<uint8_t> image = make_test_rom();
+  ConsoleSnapshot state;
+  make_state(image, state);
+  Expander expander, plain;
+  ASSERT_EQ(expander.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(plain.init(&image[0], image.size(), 1), 0);
+  expander.set_reward(first_frame, NULL);
+  const int frames = 5;
+  std::vector<uint8_t> inputs(frames, BUTTON_A);
+  std::vector<uint8_t> results(expander.get_record_size());
+  std::vector<uint8_t> plain_results(plain.get_record_size());
+  ASSERT_EQ(expander.expand(state, &inputs[0], 1, frames, &results[0]), 0);
+  ASSERT_EQ(plain.expand(state, &inputs[0], 1, frames, &plain_results[0]), 0);
+  Expansion expansion = expansion_at(results, results.size(), 0);
+  Expansion played = expansion_at(plain_results, plain_results.size(), 0);
+  EXPECT_EQ(expansion.done, 1);
+  EXPECT_EQ(expansion.reward, 1.0f);
+  EXPECT_EQ(expansion.frames, 1);
+  EXPECT_EQ(played.done, 0);
+  EXPECT_EQ(played.frames, frames);
+  EXPECT_EQ(expansion.hash, played.hash);
+  EXPECT_TRUE(std::equal(results.begin() + sizeof(Expansion), results.end(),
+                         plain_results.begin() + sizeof(Expansion)));
+}
+
+} // namespace nesemu
@@ -0,0 +1,145 @@
+#include "lz_block.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+static const int HASH_BITS = 12;
+
+static inline uint32_t load32(const uint8_t* data) {
+  uint32_t word;
+  memcpy(&word, data, sizeof word);
+  return word;
+}
+
+static inline uint32_t hash_word(uint32_t word) {
+  return (word * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// a length past the nibble, as bytes of up to 255
+static void put_length(std::vector<uint8_t>& out, size_t length) {
+  while (length >= 255) {
+    out.push_back(255);
+    length -= 255;
+  }
+  out.push_back(uint8_t(length));
+}
+
+static void put_sequence(std::vector<uint8_t>& out, const uint8_t* literals,
+                         size_t literal_count, size_t offset,
+                         size_t match_length) {
+  size_t extra = match_length ? match_length - LzBlock::MIN_MATCH : 0;
+  out.push_back(uint8_t((literal_count < 15 ? literal_count : 15) << 4 |
+                        (extra < 15 ? extra : 15)));
+  if (literal_count >= 15) {
+    put_length(out, literal_count - 15);
+  }
+  out.insert(out.end(), literals, literals + literal_count);
+  if (!match_length) {
+    return;
+  }
+  out.push_back(uint8_t(offset));
+  out.push_back(uint8_t(offset >> 8));
+  if (extra >= 15) {
+    put_length(out, extra - 15);
+  }
+}
+
+void LzBlock::compress(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>& out) {
+  uint32_t table[1 << HASH_BITS];
+  memset(table, 0, sizeof table);
+  out.reserve(out.size() + get_bound(size));
+  size_t anchor = 0; // first literal not yet written
+  size_t at = 0;
+  while (at + MIN_MATCH <= size) {
+    uint32_t word = load32(data + at);
+    uint32_t& slot = table[hash_word(word)];
+    size_t candidate = slot;
+    slot = uint32_t(at);
+    if (candidate >= at || at - candidate > MAX_OFFSET ||
+        load32(data + candidate) != word) {
+      at++;
+      continue;
+    }
+    size_t length = MIN_MATCH;
+    while (at + length < size &&
+           data[candidate + length] == data[at + length]) {
+      length++;
+    }
+    put_sequence(out, data + anchor, at - anchor, at - candidate, length);
+    at += length;
+    anchor = at;
+  }
+  put_sequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+// a length past the nibble, false when the block ends within it
+static bool get_length(const uint8_t*& in, const uint8_t* end,
+                       size_t& length) {
+  uint8_t byte;
+  do {
+    if (in == end) {
+      return false;
+    }
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+int LzBlock::decompress(const uint8_t* block, size_t block_size,
+                        uint8_t* out, size_t size) {
+  const uint8_t* in = block;
+  const uint8_t* end = block + block_size;
+  size_t at = 0;
+  while (in < end) {
+    uint8_t token = *in++;
+    size_t literal_count = token >> 4;
+    if (literal_count == 15 && !get_length(in, end, literal_count)) {
+      return 1;
+    }
+    if (literal_count > size_t(end - in) || literal_count > size - at) {
+      return 1;
+    }
+    memcpy(out + at, in, literal_count);
+    in += literal_count;
+    at += literal_count;
+    if (in == end) {
+      break;
+    }
+    if (end - in < 2) {
+      return 1;
+    }
+    size_t offset = size_t(in[0]) | size_t(in[1]) << 8;
+    in += 2;
+    size_t length = token & 15;
+    if (length == 15 && !get_length(in, end, length)) {
+      return 1;
+    }
+    length += MIN_MATCH;
+    if (!offset || offset > at || length > size - at) {
+      return 1;
+    }
+    // byte by byte where the match overlaps what it copies
+    const uint8_t* from = out + at - offset;
+    if (offset >= length) {
+      memcpy(out + at, from, length);
+    } else {
+      for (size_t i = 0; i < length; i++) {
+        out[at + i] = from[i];
+      }
+    }
+    at += length;
+    if (in == end) {
+      return 1; // the last sequence has to follow
+    }
+  }
+  return at == size ? 0 : 1;
+}
+
+size_t LzBlock::get_bound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+} // namespace nesemu
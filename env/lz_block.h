@@ -0,0 +1,37 @@
+#ifndef NESEMU_ENV_LZ_BLOCK_H_
+#define NESEMU_ENV_LZ_BLOCK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* A fast LZ77 block codec, in the manner of LZ4
+  A block is a run of sequences, each a token byte (literal count in the
+  high nibble, match length less MIN_MATCH in the low, 15 meaning more
+  bytes follow, each adding up to 255), the literals, then a 2-byte
+  little-endian offset back into the output and the match's extra length
+  bytes. The last sequence has literals only.
+
+  Matches are found through a table of the last place each hashed 4-byte
+  word was seen, one probe per position, so compressing runs at memory
+  speed on snapshots, which are mostly zeros and repeated tiles.
+*/
+class LzBlock {
+  public:
+    static const int MIN_MATCH = 4;
+    static const size_t MAX_OFFSET = 0xFFFF;
+
+    // Appends the compressed block to out.
+    static void compress(const uint8_t* data, size_t size,
+                         std::vector<uint8_t>& out);
+    // Returns 1 on a damaged block or one that is not size bytes.
+    static int decompress(const uint8_t* block, size_t block_size,
+                          uint8_t* out, size_t size);
+    static size_t get_bound(size_t size); // worst compressed size
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_LZ_BLOCK_H_
@@ -0,0 +1,42 @@
+#include "lz_block.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <vector>
+
+namespace nesemu {
+
+TEST (LzBlockTest, RoundTrips) {
+  std::vector<std::vector<uint8_t> > inputs(5);
+  inputs[1].assign(1, 7);
+  inputs[2].assign(100000, 0); // one long match
+  for (int i = 0; i < 5000; i++) {
+    inputs[3].push_back(uint8_t(i * 2654435761u >> 24)); // no matches
+  }
+  for (int i = 0; i < 70000; i++) {
+    inputs[4].push_back(uint8_t(i % 300 < 20 ? i : i / 7)); // some of each
+  }
+  for (size_t i = 0; i < inputs.size(); i++) {
+    const std::vector<uint8_t>& input = inputs[i];
+    std::vector<uint8_t> block;
+    LzBlock::compress(input.data(), input.size(), block);
+    EXPECT_LE(block.size(), LzBlock::get_bound(input.size()));
+    std::vector<uint8_t> output(input.size() + 1, 0xAA);
+    ASSERT_EQ(LzBlock::decompress(block.data(), block.size(), output.data(),
+                                  input.size()), 0) << "input " << i;
+    EXPECT_TRUE(std::equal(input.begin(), input.end(), output.begin()));
+    EXPECT_EQ(output[input.size()], 0xAA); // nothing past the end
+    // the wrong size, or cut short
+    EXPECT_EQ(LzBlock::decompress(block.data(), block.size(), output.data(),
+                                  input.size() + 1), 1);
+    if (!input.empty()) {
+      EXPECT_EQ(LzBlock::decompress(block.data(), block.size() - 1,
+                                    output.data(), input.size()), 1);
+    }
+  }
+  std::vector<uint8_t> zeros;
+  LzBlock::compress(&inputs[2][0], inputs[2].size(), zeros);
+  EXPECT_LT(zeros.size(), 500u);
+}
+
+} // namespace nesemu
@@ -0,0 +1,599 @@
+#include "ram_watch.h"
+
+#include "start_cache.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace nesemu {
+
+/* Recursive descent over one line, into the node pool */
+class RamWatch::Parser {
+  public:
+    Parser(const std::string& line, std::vector<Node>& nodes,
+           const std::map<std::string, int>& names)
+        : line(line), nodes(nodes), names(names) {
+      position = 0;
+    }
+
+    // the expression at the cursor, to the end of the line; -1 on error
+    int parse_all() {
+      int node = parse_or();
+      skip_space();
+      if (node >= 0 && position < line.size()) {
+        return fail("unexpected '" + line.substr(position, 1) + "'");
+      }
+      return node;
+    }
+
+    bool parse_name(std::string& name) {
+      skip_space();
+      size_t start = position;
+      while (position < line.size() &&
+             (isalnum((unsigned char)line[position]) ||
+              line[position] == '_')) {
+        position++;
+      }
+      name = line.substr(start, position - start);
+      return !name.empty() && !isdigit((unsigned char)name[0]);
+    }
+
+    bool accept(const char* token) {
+      static const char* PAIRS[] = {"<=", ">=", "==", "!=", "&&", "||"};
+      skip_space();
+      size_t length = strlen(token);
+      if (line.compare(position, length, token) != 0) {
+        return false;
+      }
+      // '<' is not the start of "<=", '|' of "||" and so on
+      for (int i = 0; i < 6 && length == 1; i++) {
+        if (line.compare(position, 2, PAIRS[i]) == 0) {
+          return false;
+        }
+      }
+      position += length;
+      return true;
+    }
+
+    std::string rest() {
+      skip_space();
+      return line.substr(position);
+    }
+
+    const std::string& get_error() const {
+      return error;
+    }
+
+  private:
+    const std::string& line;
+    std::vector<Node>& nodes;
+    const std::map<std::string, int>& names;
+    size_t position;
+    std::string error;
+
+    void skip_space() {
+      while (position < line.size() && isspace((unsigned char)line[position])) {
+        position++;
+      }
+    }
+
+    int fail(const std::string& reason) {
+      if (error.empty()) {
+        error = reason;
+      }
+      return -1;
+    }
+
+    int add(Op op, int a = -1, int b = -1, int c = -1) {
+      Node node;
+      node.op = op;
+      node.address = 0;
+      node.count = 0;
+      node.value = 0;
+      node.args[0] = a;
+      node.args[1] = b;
+      node.args[2] = c;
+      nodes.push_back(node);
+      return int(nodes.size() - 1);
+    }
+
+    int parse_or() {
+      int left = parse_and();
+      while (left >= 0 && accept("||")) {
+        int right = parse_and();
+        left = right < 0 ? -1 : add(OP_LOGICAL_OR, left, right);
+      }
+      return left;
+    }
+
+    int parse_and() {
+      int left = parse_comparison();
+      while (left >= 0 && accept("&&")) {
+        int right = parse_comparison();
+        left = right < 0 ? -1 : add(OP_LOGICAL_AND, left, right);
+      }
+      return left;
+    }
+
+    int parse_comparison() {
+      static const char* TOKENS[] = {"==", "!=", "<=", ">=", "<", ">"};
+      static const Op OPS[] = {OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT};
+      int left = parse_sum();
+      for (int i = 0; i < 6 && left >= 0; i++) {
+        if (accept(TOKENS[i])) {
+          int right = parse_sum();
+          return right < 0 ? -1 : add(OPS[i], left, right);
+        }
+      }
+      return left;
+    }
+
+    int parse_sum() {
+      int left = parse_product();
+      while (left >= 0) {
+        Op op;
+        if (accept("+")) {
+          op = OP_ADD;
+        } else if (accept("-")) {
+          op = OP_SUB;
+        } else if (accept("|")) {
+          op = OP_OR;
+        } else {
+          break;
+        }
+        int right = parse_product();
+        left = right < 0 ? -1 : add(op, left, right);
+      }
+      return left;
+    }
+
+    int parse_product() {
+      int left = parse_unary();
+      while (left >= 0) {
+        Op op;
+        if (accept("*")) {
+          op = OP_MUL;
+        } else if (accept("/")) {
+          op = OP_DIV;
+        } else if (accept("%")) {
+          op = OP_MOD;
+        } else if (accept("&")) {
+          op = OP_AND;
+        } else {
+          break;
+        }
+        int right = parse_unary();
+        left = right < 0 ? -1 : add(op, left, right);
+      }
+      return left;
+    }
+
+    int parse_unary() {
+      if (accept("-")) {
+        int operand = parse_unary();
+        return operand < 0 ? -1 : add(OP_NEG, operand);
+      }
+      if (accept("!")) {
+        int operand = parse_unary();
+        return operand < 0 ? -1 : add(OP_NOT, operand);
+      }
+      return parse_primary();
+    }
+
+    int parse_primary() {
+      skip_space();
+      if (position >= line.size()) {
+        return fail("missing operand");
+      }
+      if (accept("(")) {
+        int inner = parse_or();
+        if (inner >= 0 && !accept(")")) {
+          return fail("missing ')'");
+        }
+        return inner;
+      }
+      if (isdigit((unsigned char)line[position]) || line[position] == '.') {
+        const char* start = line.c_str() + position;
+        char* end;
+        double value = line.compare(position, 2, "0x") == 0 ||
+                               line.compare(position, 2, "0X") == 0
+                           ? double(strtoull(start, &end, 16))
+                           : strtod(start, &end);
+        position += end - start;
+        int node = add(OP_CONST);
+        nodes[node].value = value;
+        return node;
+      }
+      std::string name;
+      if (!parse_name(name)) {
+        return fail("unexpected '" + line.substr(position, 1) + "'");
+      }
+      if (accept("(")) {
+        return parse_call(name);
+      }
+      std::map<std::string, int>::const_iterator found = names.find(name);
+      if (found == names.end()) {
+        return fail("unknown name " + name);
+      }
+      return found->second;
+    }
+
+    // ram(a), bcd(a, n) and friends take constants, the rest expressions
+    int parse_call(const std::string& name) {
+      static const char* MEMORY[] = {"ram", "ram16", "bcd", "digits"};
+      static const Op MEMORY_OPS[] = {OP_RAM, OP_RAM16, OP_BCD, OP_DIGITS};
+      static const char* FUNCTIONS[] = {"prev", "delta", "abs", "min",
+                                        "max", "if"};
+      static const Op FUNCTION_OPS[] = {OP_PREV, OP_DELTA, OP_ABS, OP_MIN,
+                                        OP_MAX, OP_IF};
+      static const int ARITY[] = {1, 1, 1, 2, 2, 3};
+      for (int i = 0; i < 4; i++) {
+        if (name == MEMORY[i]) {
+          return parse_memory(MEMORY_OPS[i]);
+        }
+      }
+      for (int i = 0; i < 6; i++) {
+        if (name != FUNCTIONS[i]) {
+          continue;
+        }
+        int args[3] = {-1, -1, -1};
+        for (int j = 0; j < ARITY[i]; j++) {
+          if (j > 0 && !accept(",")) {
+            return fail(name + "() takes " +
+                        std::string(1, char('0' + ARITY[i])) + " arguments");
+          }
+          args[j] = parse_or();
+          if (args[j] < 0) {
+            return -1;
+          }
+        }
+        if (!accept(")")) {
+          return fail("missing ')'");
+        }
+        return add(FUNCTION_OPS[i], args[0], args[1], args[2]);
+      }
+      return fail("unknown function " + name);
+    }
+
+    int parse_memory(Op op) {
+      int address = parse_constant();
+      int count = op == OP_RAM16 ? 2 : 1;
+      if (address >= 0 && (op == OP_BCD || op == OP_DIGITS)) {
+        if (!accept(",")) {
+          return fail("missing byte count");
+        }
+        count = parse_constant();
+        if (count < 1 || count > 8) {
+          return fail("byte counts are 1 - 8");
+        }
+      }
+      if (address < 0 || !accept(")")) {
+        return fail("bad RAM address");
+      }
+      if (address + count > RAM_SIZE) {
+        return fail("RAM address past 0x7FF");
+      }
+      int node = add(op);
+      nodes[node].address = address;
+      nodes[node].count = count;
+      return node;
+    }
+
+    int parse_constant() {
+      skip_space();
+      if (position >= line.size() || !isdigit((unsigned char)line[position])) {
+        return -1;
+      }
+      const char* start = line.c_str() + position;
+      char* end;
+      unsigned long value = strtoul(start, &end, 0);
+      position += end - start;
+      return value > 0xFFFF ? -1 : int(value);
+    }
+};
+
+RamWatch::RamWatch() {
+  memory_size = 0;
+  rom = 0;
+  has_rom = false;
+}
+
+int RamWatch::compile(const std::string& text) {
+  reward_code.clear();
+  done_code.clear();
+  memory_size = 0;
+  has_rom = false;
+  error.clear();
+  std::vector<Node> nodes;
+  std::map<std::string, int> names;
+  std::vector<int> rewards, dones;
+  std::istringstream lines(text);
+  std::string line;
+  for (int number = 1; std::getline(lines, line); number++) {
+    line = line.substr(0, line.find('#'));
+    Parser parser(line, nodes, names);
+    std::string name, reason;
+    if (parser.rest().empty()) {
+      continue;
+    }
+    if (!parser.parse_name(name) || !parser.accept("=")) {
+      reason = "expected name = expression";
+    } else if (name == "rom") {
+      std::string value = parser.rest();
+      char* end;
+      rom = strtoull(value.c_str(), &end, 0);
+      has_rom = true;
+      if (value.empty() || *end) {
+        reason = "bad rom hash";
+      }
+    } else {
+      int node = parser.parse_all();
+      if (node < 0) {
+        reason = parser.get_error();
+      } else if (name == "reward") {
+        rewards.push_back(node);
+      } else if (name == "done") {
+        dones.push_back(node);
+      } else if (!names.insert(std::make_pair(name, node)).second) {
+        reason = name + " is defined twice";
+      }
+    }
+    if (!reason.empty()) {
+      char prefix[32];
+      snprintf(prefix, sizeof prefix, "line %d: ", number);
+      error = prefix + reason;
+      reward_code.clear();
+      return 1;
+    }
+  }
+  // rewards add up and done flags or together
+  int ok = 0;
+  for (size_t i = 0; i < rewards.size() && !ok; i++) {
+    ok = emit(nodes, rewards[i], reward_code, i > 0 ? 1 : 0);
+    if (i > 0) {
+      Instruction add = {OP_ADD, 0, 0, 0};
+      reward_code.push_back(add);
+    }
+  }
+  for (size_t i = 0; i < dones.size() && !ok; i++) {
+    ok = emit(nodes, dones[i], done_code, i > 0 ? 1 : 0);
+    if (i > 0) {
+      Instruction either = {OP_LOGICAL_OR, 0, 0, 0};
+      done_code.push_back(either);
+    }
+  }
+  if (ok) {
+    error = "expression too deep";
+    reward_code.clear();
+    done_code.clear();
+    memory_size = 0;
+    return 1;
+  }
+  return 0;
+}
+
+int RamWatch::load(const std::string& path, const uint8_t* image,
+                   size_t size) {
+  std::ifstream file(path.c_str());
+  if (!file) {
+    error = "cannot read " + path;
+    return 1;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  if (compile(text.str())) {
+    return 1;
+  }
+  if (has_rom && image && StartCache::hash(image, size) != rom) {
+    error = path + " is for another ROM";
+    reward_code.clear();
+    done_code.clear();
+    memory_size = 0;
+    return 1;
+  }
+  return 0;
+}
+
+const std::string& RamWatch::get_error() const {
+  return error;
+}
+
+bool RamWatch::has_reward() const {
+  return !reward_code.empty();
+}
+
+bool RamWatch::has_done() const {
+  return !done_code.empty();
+}
+
+size_t RamWatch::get_memory_size() const {
+  return memory_size;
+}
+
+// Postorder, prev() and delta() getting a memory slot each. depth is the
+// stack below the node; returns 1 once it would overflow.
+int RamWatch::emit(const std::vector<Node>& nodes, int node,
+                   std::vector<Instruction>& code, int depth) {
+  const Node& n = nodes[node];
+  for (int i = 0; i < 3 && n.args[i] >= 0; i++) {
+    if (emit(nodes, n.args[i], code, depth + i)) {
+      return 1;
+    }
+  }
+  if (depth + 1 > MAX_STACK) {
+    return 1;
+  }
+  Instruction instruction;
+  instruction.op = uint8_t(n.op);
+  instruction.address = uint16_t(n.address);
+  instruction.count = uint8_t(n.count);
+  instruction.value = n.value;
+  if (n.op == OP_PREV || n.op == OP_DELTA) {
+    instruction.address = uint16_t(memory_size++);
+  }
+  code.push_back(instruction);
+  return 0;
+}
+
+void RamWatch::prime(const uint8_t* ram, double* memory) const {
+  double result;
+  // run with no memory to read, every prev() then stores and passes on
+  run(reward_code, &ram, &memory, -1, &result);
+  run(done_code, &ram, &memory, -1, &result);
+}
+
+void RamWatch::evaluate(const uint8_t* const* rams, double* const* memories,
+                        int count, float* rewards, uint8_t* dones) const {
+  double results[MAX_LANES];
+  for (int first = 0; first < count; first += MAX_LANES) {
+    int lanes = count - first < MAX_LANES ? count - first : MAX_LANES;
+    if (reward_code.empty()) {
+      memset(rewards + first, 0, lanes * sizeof(float));
+    } else {
+      run(reward_code, rams + first, memories + first, lanes, results);
+      for (int i = 0; i < lanes; i++) {
+        rewards[first + i] = float(results[i]);
+      }
+    }
+    if (done_code.empty()) {
+      memset(dones + first, 0, lanes);
+    } else {
+      run(done_code, rams + first, memories + first, lanes, results);
+      for (int i = 0; i < lanes; i++) {
+        dones[first + i] = results[i] != 0;
+      }
+    }
+  }
+}
+
+static double to_bool(bool value) {
+  return value ? 1.0 : 0.0;
+}
+
+// a op b into a, over every lane
+#define BINARY(expression)                 \
+  for (int i = 0; i < lanes; i++) {        \
+    double x = a[i], y = b[i];             \
+    a[i] = (expression);                   \
+  }                                        \
+  top--;                                   \
+  break
+
+// One instruction at a time over every lane. count -1 is one lane being
+// primed: prev() stores its operand and passes it on.
+void RamWatch::run(const std::vector<Instruction>& code,
+                   const uint8_t* const* rams, double* const* memories,
+                   int count, double* result) const {
+  double stack[MAX_STACK][MAX_LANES];
+  bool priming = count < 0;
+  int lanes = priming ? 1 : count;
+  int top = -1;
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    const Instruction& in = code[pc];
+    double* a = stack[top > 0 ? top - 1 : 0];
+    double* b = stack[top >= 0 ? top : 0];
+    double* c = b;
+    switch (in.op) {
+      case OP_CONST:
+        c = stack[++top];
+        for (int i = 0; i < lanes; i++) {
+          c[i] = in.value;
+        }
+        break;
+      case OP_RAM:
+        c = stack[++top];
+        for (int i = 0; i < lanes; i++) {
+          c[i] = rams[i][in.address];
+        }
+        break;
+      case OP_RAM16:
+        c = stack[++top];
+        for (int i = 0; i < lanes; i++) {
+          c[i] = rams[i][in.address] | rams[i][in.address + 1] << 8;
+        }
+        break;
+      case OP_BCD:
+        c = stack[++top];
+        for (int i = 0; i < lanes; i++) {
+          double value = 0;
+          for (int j = 0; j < in.count; j++) {
+            uint8_t byte = rams[i][in.address + j];
+            value = value * 100 + (byte >> 4) * 10 + (byte & 0x0F);
+          }
+          c[i] = value;
+        }
+        break;
+      case OP_DIGITS:
+        c = stack[++top];
+        for (int i = 0; i < lanes; i++) {
+          double value = 0;
+          for (int j = 0; j < in.count; j++) {
+            value = value * 10 + rams[i][in.address + j];
+          }
+          c[i] = value;
+        }
+        break;
+      case OP_PREV:
+      case OP_DELTA:
+        for (int i = 0; i < lanes; i++) {
+          double& last = memories[i][in.address];
+          double now = b[i];
+          double before = priming ? now : last;
+          last = now;
+          b[i] = in.op == OP_PREV ? before : now - before;
+        }
+        break;
+      case OP_ABS:
+        for (int i = 0; i < lanes; i++) {
+          b[i] = std::fabs(b[i]);
+        }
+        break;
+      case OP_NEG:
+        for (int i = 0; i < lanes; i++) {
+          b[i] = -b[i];
+        }
+        break;
+      case OP_NOT:
+        for (int i = 0; i < lanes; i++) {
+          b[i] = to_bool(b[i] == 0);
+        }
+        break;
+      case OP_IF:
+        // condition, then, else
+        c = stack[top - 2];
+        for (int i = 0; i < lanes; i++) {
+          c[i] = c[i] != 0 ? a[i] : b[i];
+        }
+        top -= 2;
+        break;
+      case OP_MIN: BINARY(x < y ? x : y);
+      case OP_MAX: BINARY(x > y ? x : y);
+      case OP_ADD: BINARY(x + y);
+      case OP_SUB: BINARY(x - y);
+      case OP_MUL: BINARY(x * y);
+      case OP_DIV: BINARY(y != 0 ? x / y : 0);
+      case OP_MOD: BINARY(int64_t(y) ? double(int64_t(x) % int64_t(y)) : 0);
+      case OP_AND: BINARY(double(int64_t(x) & int64_t(y)));
+      case OP_OR: BINARY(double(int64_t(x) | int64_t(y)));
+      case OP_EQ: BINARY(to_bool(x == y));
+      case OP_NE: BINARY(to_bool(x != y));
+      case OP_LT: BINARY(to_bool(x < y));
+      case OP_LE: BINARY(to_bool(x <= y));
+      case OP_GT: BINARY(to_bool(x > y));
+      case OP_GE: BINARY(to_bool(x >= y));
+      case OP_LOGICAL_AND: BINARY(to_bool(x != 0 && y != 0));
+      case OP_LOGICAL_OR: BINARY(to_bool(x != 0 || y != 0));
+    }
+  }
+  for (int i = 0; i < lanes; i++) {
+    result[i] = top >= 0 ? stack[top][i] : 0;
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,139 @@
+#ifndef NESEMU_ENV_RAM_WATCH_H_
+#define NESEMU_ENV_RAM_WATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nesemu {
+
+/* Rewards and episode ends read from game RAM
+  A watch is a few lines of expressions over the 2KB of CPU RAM, one
+  config file per game, e.g. for a score kept as six digits, one per byte:
+
+    # comments run to the end of the line
+    rom = 0x1A2B3C4D5E6F7081          # optional, the StartCache::hash of
+                                      # the iNES image it is for
+    score = digits(0x07DD, 6)         # names are expanded where used
+    x = ram(0x006D) * 256 + ram(0x0086)
+    reward = delta(score) / 100 + delta(x)
+    done = ram(0x075A) < prev(ram(0x075A))
+
+  reward lines add up and done lines are or'ed; without any, rewards are 0
+  and episodes do not end here. Values are doubles, false is 0 and true
+  is 1.
+    ram(a)          the byte at a, 0 - 0x7FF
+    ram16(a)        the little endian word at a
+    bcd(a, n)       n bytes of packed BCD, most significant first
+    digits(a, n)    n bytes of one decimal digit each, most significant
+                    first
+    prev(e)         e after the previous frame (after the reset at the
+                    start of an episode)
+    delta(e)        e - prev(e)
+    abs(e), min(e, f), max(e, f), if(c, e, f)
+  Operators, loosest first: ||, &&, comparisons (== != < <= > >=, not
+  chained), + - |, * / % &, unary - and !. & | and % work on the integer
+  parts, and dividing by 0 gives 0.
+
+  The text is compiled once into bytecode for a stack machine. A batch of
+  consoles is evaluated an instruction at a time across all of them, so
+  decoding is paid once per batch rather than per console. prev() and
+  delta() keep their last values in memory the caller holds per console.
+*/
+class RamWatch {
+  public:
+    RamWatch();
+
+    static const int RAM_SIZE = 0x800;
+    static const int MAX_STACK = 32;
+    static const int MAX_LANES = 32; // consoles per pass of evaluate()
+
+    // Returns 1 on a syntax error, see get_error().
+    int compile(const std::string& text);
+    // Compiles a config file, that has to be for image when it names a
+    // rom. Returns 1 when it cannot be read, is for another ROM, or does
+    // not compile.
+    int load(const std::string& path, const uint8_t* image = NULL,
+             size_t size = 0);
+    const std::string& get_error() const; // line and reason, or empty
+    bool has_reward() const;
+    bool has_done() const;
+
+    /* Evaluation */
+    size_t get_memory_size() const; // doubles of prev() memory per console
+    // Sets a console's memory from its RAM at the start of an episode, so
+    // the first deltas are 0.
+    void prime(const uint8_t* ram, double* memory) const;
+    // Evaluates count consoles after a frame: rewards[i] and dones[i]
+    // from rams[i], advancing memories[i].
+    void evaluate(const uint8_t* const* rams, double* const* memories,
+                  int count, float* rewards, uint8_t* dones) const;
+
+  private:
+    enum Op {
+      OP_CONST,
+      OP_RAM,
+      OP_RAM16,
+      OP_BCD,
+      OP_DIGITS,
+      OP_PREV,
+      OP_DELTA,
+      OP_ABS,
+      OP_MIN,
+      OP_MAX,
+      OP_IF,
+      OP_NEG,
+      OP_NOT,
+      OP_ADD,
+      OP_SUB,
+      OP_MUL,
+      OP_DIV,
+      OP_MOD,
+      OP_AND,
+      OP_OR,
+      OP_EQ,
+      OP_NE,
+      OP_LT,
+      OP_LE,
+      OP_GT,
+      OP_GE,
+      OP_LOGICAL_AND,
+      OP_LOGICAL_OR
+    };
+
+    struct Instruction {
+      uint8_t op;
+      uint16_t address; // RAM ops, and prev() memory slot
+      uint8_t count;    // bytes of bcd() and digits()
+      double value;     // OP_CONST
+    };
+
+    // parsed expression, its arguments as indices into nodes
+    struct Node {
+      Op op;
+      int address;
+      int count;
+      double value;
+      int args[3];
+    };
+
+    class Parser;
+
+    std::vector<Instruction> reward_code;
+    std::vector<Instruction> done_code;
+    size_t memory_size;
+    uint64_t rom;
+    bool has_rom;
+    std::string error;
+
+    int emit(const std::vector<Node>& nodes, int node,
+             std::vector<Instruction>& code, int depth);
+    void run(const std::vector<Instruction>& code,
+             const uint8_t* const* rams, double* const* memories, int count,
+             double* result) const;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_RAM_WATCH_H_
@@ -0,0 +1,203 @@
+#include "ram_watch.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include "vec_env.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+namespace nesemu {
+
+// reward and done of one console's RAM, advancing memory
+static void evaluate(const RamWatch& watch, const uint8_t* ram,
+                     std::vector<double>& memory, float* reward,
+                     uint8_t* done) {
+  double* memories[1] = {memory.empty() ? NULL : &memory[0]};
+  watch.evaluate(&ram, memories, 1, reward, done);
+}
+
+static float value_of(const char* expression, const uint8_t* ram) {
+  RamWatch watch;
+  EXPECT_EQ(watch.compile(std::string("reward = ") + expression), 0)
+      << expression << ": " << watch.get_error();
+  std::vector<double> memory(watch.get_memory_size());
+  float reward;
+  uint8_t done;
+  evaluate(watch, ram, memory, &reward, &done);
+  return reward;
+}
+
+TEST (RamWatchTest, SyntaxErrors) {
+  const char* bad[] = {
+    "reward ram(1)",        "reward = ram(0x800)",   "reward = ram16(0x7FF)",
+    "reward = ram(x)",      "reward = bcd(0, 9)",    "reward = 1 +",
+    "reward = (1",          "reward = min(1)",       "reward = foo(1)",
+    "reward = score",       "x = 1\nx = 2",          "reward = 1 2",
+    "rom = bad",            "reward = 1 < 2 < 3",
+  };
+  for (size_t i = 0; i < sizeof bad / sizeof bad[0]; i++) {
+    RamWatch watch;
+    EXPECT_EQ(watch.compile(bad[i]), 1) << bad[i];
+    EXPECT_FALSE(watch.get_error().empty());
+    EXPECT_FALSE(watch.has_reward());
+  }
+  RamWatch watch;
+  EXPECT_EQ(watch.compile("# nothing\n\nx = 1\nreward = x\nreward = (x"), 1);
+  EXPECT_EQ(watch.get_error().compare(0, 7, "line 5:"), 0);
+  std::string deep = "reward = ";
+  for (int i = 0; i < RamWatch::MAX_STACK; i++) {
+    deep += "1 + (";
+  }
+  deep += "1" + std::string(RamWatch::MAX_STACK, ')');
+  EXPECT_EQ(watch.compile(deep), 1);
+}
+
+TEST (RamWatchTest, Values) {
+  uint8_t ram[RamWatch::RAM_SIZE] = {0};
+  ram[0x10] = 0x12;
+  ram[0x11] = 0x34;
+  ram[0x20] = 1;
+  ram[0x21] = 2;
+  ram[0x22] = 3;
+  EXPECT_EQ(value_of("ram(0x10)", ram), 0x12);
+  EXPECT_EQ(value_of("ram16(0x10)", ram), 0x3412);
+  EXPECT_EQ(value_of("bcd(0x10, 2)", ram), 1234);
+  EXPECT_EQ(value_of("digits(0x20, 3)", ram), 123);
+  EXPECT_EQ(value_of("1 + 2 * 3 - 4 / 2", ram), 5);
+  EXPECT_EQ(value_of("-(1 + 2) * 2", ram), -6);
+  EXPECT_EQ(value_of("7 % 4 + (6 & 3) + (4 | 1)", ram), 3 + 2 + 5);
+  EXPECT_EQ(value_of("1 / 0 + 5 % 0", ram), 0);
+  EXPECT_EQ(value_of("1 < 2 && 2 <= 2 && 3 > 2 && (2 >= 3) == 0", ram), 1);
+  EXPECT_EQ(value_of("1 != 1 || !0", ram), 1);
+  EXPECT_EQ(value_of("0 || 0", ram), 0);
+  EXPECT_EQ(value_of("if(ram(0x20) == 1, 10, 20) + min(3, 4) + max(3, 4)",
+                     ram), 17);
+  EXPECT_EQ(value_of("abs(1 - 3) + 0.5", ram), 2.5f);
+}
+
+TEST (RamWatchTest, DeltasAndDone) {
+  RamWatch watch;
+  ASSERT_EQ(watch.compile(
+      "score = bcd(0x00, 2)   # two bytes\n"
+      "reward = delta(score)\n"
+      "reward = prev(ram(0x02)) * 1000\n"
+      "done = ram(0x03) < prev(ram(0x03))\n"), 0) << watch.get_error();
+  EXPECT_TRUE(watch.has_reward());
+  EXPECT_TRUE(watch.has_done());
+  ASSERT_EQ(watch.get_memory_size(), 3u);
+  uint8_t ram[RamWatch::RAM_SIZE] = {0};
+  ram[0x01] = 0x50;
+  ram[0x03] = 3;
+  std::vector<double> memory(watch.get_memory_size());
+  watch.prime(ram, &memory[0]);
+  float reward;
+  uint8_t done;
+  evaluate(watch, ram, memory, &reward, &done); // nothing changed
+  EXPECT_EQ(reward, 0);
+  EXPECT_EQ(done, 0);
+  ram[0x00] = 0x01;
+  ram[0x02] = 1;
+  evaluate(watch, ram, memory, &reward, &done);
+  EXPECT_EQ(reward, 100); // 50 to 150, ram(2) still 0 before
+  EXPECT_EQ(done, 0);
+  ram[0x03] = 2;
+  evaluate(watch, ram, memory, &reward, &done);
+  EXPECT_EQ(reward, 1000);
+  EXPECT_EQ(done, 1);
+}
+
+// across more consoles than one pass takes, each with its own memory
+TEST (RamWatchTest, Batch) {
+  RamWatch watch;
+  ASSERT_EQ(watch.compile("reward = delta(ram(0)) + ram(1)\n"
+                          "done = ram(1) == 7"), 0);
+  const int count = RamWatch::MAX_LANES * 2 + 3;
+  std::vector<std::vector<uint8_t> > rams(count,
+                                          std::vector<uint8_t>(0x800, 0));
+  std::vector<std::vector<double> > memory(count,
+      std::vector<double>(watch.get_memory_size()));
+  std::vector<const uint8_t*> pointers;
+  std::vector<double*> memories;
+  for (int i = 0; i < count; i++) {
+    watch.prime(&rams[i][0], &memory[i][0]);
+    rams[i][0] = uint8_t(i);
+    rams[i][1] = uint8_t(i % 8);
+    pointers.push_back(&rams[i][0]);
+    memories.push_back(&memory[i][0]);
+  }
+  std::vector<float> rewards(count);
+  std::vector<uint8_t> dones(count);
+  watch.evaluate(&pointers[0], &memories[0], count, &rewards[0], &dones[0]);
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(rewards[i], float(i + i % 8));
+    EXPECT_EQ(dones[i], i % 8 == 7);
+  }
+}
+
+TEST (RamWatchTest, LoadChecksRom) {
+  std::vector<uint8_t> image = make_test_rom();
+  char path[] = "/tmp/ram_watch_testXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  char text[128];
+  int length = snprintf(text, sizeof text, "rom = 0x%016llx\nreward = 1\n",
+                        (unsigned long long)StartCache::hash(&image[0],
+                                                             image.size()));
+  ASSERT_EQ(write(fd, text, length), length);
+  close(fd);
+  RamWatch watch;
+  EXPECT_EQ(watch.load(path, &image[0], image.size()), 0)
+      << watch.get_error();
+  image[100] ^= 1;
+  EXPECT_EQ(watch.load(path, &image[0], image.size()), 1);
+  EXPECT_EQ(watch.load(path), 0); // no image to check against
+  unlink(path);
+  EXPECT_EQ(watch.load(path), 1);
+}
+
+// a watch scores a VecEnv as the same C++ reward function would
+static float a_held(void* /* context */, const Console& console,
+                    bool* done) {
+  if (console.get_ram()[0x12] >= 100) {
+    *done = true;
+  }
+  return console.get_ram()[0x11] ? 1.0f : 0.0f;
+}
+
+TEST (RamWatchTest, ScoresVecEnv) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 5;
+  RamWatch watch;
+  ASSERT_EQ(watch.compile("reward = ram(0x11) != 0\n"
+                          "done = ram(0x12) >= 100\n"), 0);
+  VecEnv watched, plain;
+  ASSERT_EQ(watched.init(&image[0], image.size(), count), 0);
+  ASSERT_EQ(plain.init(&image[0], image.size(), count), 0);
+  watched.set_ram_watch(&watch);
+  plain.set_reward(a_held, NULL);
+  watched.set_action_repeat(3);
+  plain.set_action_repeat(3);
+  size_t size = plain.get_observation_size();
+  std::vector<uint8_t> observations(count * size), actions(count);
+  std::vector<uint8_t> plain_observations(count * size);
+  std::vector<uint8_t> dones(count), plain_dones(count);
+  std::vector<float> rewards(count), plain_rewards(count);
+  int ended = 0;
+  for (int step = 0; step < 60; step++) {
+    for (int i = 0; i < count; i++) {
+      actions[i] = (i + step) % 3 ? BUTTON_A : 0;
+    }
+    watched.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    plain.step(&actions[0], &plain_observations[0], &plain_rewards[0],
+               &plain_dones[0]);
+    ASSERT_EQ(rewards, plain_rewards) << "step " << step;
+    ASSERT_EQ(dones, plain_dones) << "step " << step;
+    EXPECT_EQ(observations, plain_observations);
+    ended += dones[0];
+  }
+  EXPECT_GT(ended, 0);
+}
+
+} // namespace nesemu
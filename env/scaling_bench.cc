@@ -0,0 +1,54 @@
+#include "vec_env.h"
+#include "worker_pool.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace nesemu;
+
+static const int COUNT = 256;
+static const int STEPS = 30;
+static const int BATCH = 8;
+
+// frames/sec of COUNT consoles stepped on the given number of threads
+static double run(VecEnv& env, int threads) {
+  WorkerPool pool(threads, true);
+  env.set_pool(&pool, BATCH);
+  std::vector<uint8_t> observations(COUNT * env.get_observation_size());
+  std::vector<uint8_t> actions(COUNT), dones(COUNT);
+  std::vector<float> rewards(COUNT);
+  env.reset(&observations[0]);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int step = 0; step < STEPS; step++) {
+    memset(&actions[0], step & 8 ? BUTTON_A : 0, COUNT);
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  env.set_pool(NULL);
+  return double(COUNT) * STEPS / elapsed.count();
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  env.init(&image[0], image.size(), COUNT);
+  printf("%d consoles, 84x84 gray, batches of %d, pinned, %u hardware "
+         "threads\n", COUNT, BATCH, std::thread::hardware_concurrency());
+  printf("  threads  frames/sec  efficiency\n");
+  double one = 0;
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    double rate = run(env, threads);
+    if (threads == 1) {
+      one = rate;
+    }
+    printf("  %7d  %10.0f  %9.0f%%\n", threads, rate,
+           100 * rate / (one * threads));
+  }
+  return 0;
+}
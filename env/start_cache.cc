@@ -0,0 +1,189 @@
+#include "start_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+
+namespace nesemu {
+
+StartRecipe::StartRecipe() {
+  pool_size = 1;
+  noop_max = 0;
+  seed = 1;
+}
+
+StartCache::StartCache(const std::string& directory) {
+  this->directory = directory;
+  boots = 0;
+  disk_loads = 0;
+}
+
+const std::vector<ConsoleSnapshot>* StartCache::get(const uint8_t* image,
+                                                    size_t size,
+                                                    const StartRecipe& recipe) {
+  if (recipe.pool_size < 1 || recipe.pool_size > MAX_POOL ||
+      recipe.noop_max < 0) {
+    return NULL;
+  }
+  uint64_t key = get_key(image, size, recipe);
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<uint64_t, std::vector<ConsoleSnapshot> >::iterator found =
+      pools.find(key);
+  if (found != pools.end()) {
+    return &found->second;
+  }
+  std::vector<ConsoleSnapshot> pool;
+  if (!directory.empty() && !read_pool(key, pool)) {
+    disk_loads++;
+  } else {
+    if (boot(image, size, recipe, pool)) {
+      return NULL;
+    }
+    boots++;
+    if (!directory.empty()) {
+      write_pool(key, pool);
+    }
+  }
+  std::vector<ConsoleSnapshot>& stored = pools[key];
+  stored.swap(pool);
+  return &stored;
+}
+
+uint64_t StartCache::hash(const uint8_t* data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+std::string StartCache::get_path(uint64_t key) const {
+  char name[32];
+  snprintf(name, sizeof name, "%016llx.start", (unsigned long long)key);
+  return directory + "/" + name;
+}
+
+int StartCache::get_boots() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return boots;
+}
+
+int StartCache::get_disk_loads() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return disk_loads;
+}
+
+uint64_t StartCache::get_key(const uint8_t* image, size_t size,
+                             const StartRecipe& recipe) {
+  uint64_t key = hash(image, size);
+  uint32_t counts[4] = {uint32_t(recipe.prefix.size()),
+                        uint32_t(recipe.pool_size),
+                        uint32_t(recipe.noop_max), recipe.seed};
+  key = hash(reinterpret_cast<const uint8_t*>(counts), sizeof counts, key);
+  if (!recipe.prefix.empty()) {
+    key = hash(&recipe.prefix[0], recipe.prefix.size(), key);
+  }
+  return key;
+}
+
+// Starts are taken in order of their no-op counts along a single run
+int StartCache::boot(const uint8_t* image, size_t size,
+                     const StartRecipe& recipe,
+                     std::vector<ConsoleSnapshot>& pool) {
+  Console* console = new Console;
+  if (console->load_rom(image, size)) {
+    delete console;
+    return 1;
+  }
+  console->get_ppu().set_render_mode(RENDER_NONE);
+  Controller& pad = console->get_controller(0);
+  int result = 0;
+  for (size_t i = 0; i < recipe.prefix.size() && !result; i++) {
+    pad.set_buttons(recipe.prefix[i]);
+    result = console->run_frame();
+  }
+  std::minstd_rand random(recipe.seed);
+  std::vector<std::pair<int, int> > waits; // no-op frames, pool index
+  for (int i = 0; i < recipe.pool_size; i++) {
+    waits.push_back(std::make_pair(int(random() % (recipe.noop_max + 1)), i));
+  }
+  std::sort(waits.begin(), waits.end());
+  pool.resize(recipe.pool_size);
+  pad.set_buttons(0);
+  int frames = 0;
+  for (size_t i = 0; i < waits.size() && !result; i++) {
+    for (; frames < waits[i].first && !result; frames++) {
+      result = console->run_frame();
+    }
+    console->save_snapshot(pool[waits[i].second]);
+  }
+  delete console;
+  return result;
+}
+
+/* Pool files
+  A header, then the snapshots as they are in memory. Files are written
+  under a temporary name and renamed, so a reader never sees half a file.
+*/
+struct PoolHeader {
+  char magic[8];
+  uint32_t version;       // ConsoleSnapshot::VERSION
+  uint32_t snapshot_size; // sizeof(ConsoleSnapshot)
+  uint64_t key;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+static const char POOL_MAGIC[8] = {'N', 'E', 'S', 'S', 'T', 'A', 'R', 'T'};
+
+int StartCache::read_pool(uint64_t key,
+                          std::vector<ConsoleSnapshot>& pool) const {
+  FILE* file = fopen(get_path(key).c_str(), "rb");
+  if (!file) {
+    return 1;
+  }
+  PoolHeader header;
+  bool good = fread(&header, sizeof header, 1, file) == 1 &&
+              !memcmp(header.magic, POOL_MAGIC, sizeof POOL_MAGIC) &&
+              header.version == ConsoleSnapshot::VERSION &&
+              header.snapshot_size == sizeof(ConsoleSnapshot) &&
+              header.key == key && header.count >= 1 &&
+              header.count <= uint32_t(MAX_POOL);
+  if (good) {
+    pool.resize(header.count);
+    good = fread(&pool[0], sizeof(ConsoleSnapshot), header.count, file) ==
+               header.count && fgetc(file) == EOF;
+  }
+  fclose(file);
+  return good ? 0 : 1;
+}
+
+// a pool that cannot be stored is booted again next time
+void StartCache::write_pool(uint64_t key,
+                            const std::vector<ConsoleSnapshot>& pool) const {
+  std::string path = get_path(key);
+  char suffix[32];
+  snprintf(suffix, sizeof suffix, ".%d.tmp", int(getpid()));
+  std::string temporary = path + suffix;
+  FILE* file = fopen(temporary.c_str(), "wb");
+  if (!file) {
+    return;
+  }
+  PoolHeader header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, POOL_MAGIC, sizeof POOL_MAGIC);
+  header.version = ConsoleSnapshot::VERSION;
+  header.snapshot_size = sizeof(ConsoleSnapshot);
+  header.key = key;
+  header.count = uint32_t(pool.size());
+  bool good = fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(&pool[0], sizeof(ConsoleSnapshot), pool.size(), file) ==
+                  pool.size();
+  good = fclose(file) == 0 && good;
+  if (!good || rename(temporary.c_str(), path.c_str())) {
+    remove(temporary.c_str());
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,84 @@
+#ifndef NESEMU_ENV_START_CACHE_H_
+#define NESEMU_ENV_START_CACHE_H_
+
+#include "console/console.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nesemu {
+
+/* How the start states of episodes are made from power on
+  The prefix is played from power on, one pad 1 byte per frame, e.g. to get
+  through the title screen. Each of the pool_size start states then waits
+  a further 0 - noop_max frames without input, the counts drawn from seed,
+  for randomized no-op starts.
+*/
+struct StartRecipe {
+  StartRecipe();
+
+  std::vector<uint8_t> prefix;
+  int pool_size; // 1 - StartCache::MAX_POOL
+  int noop_max;
+  uint32_t seed;
+};
+
+/* Start states per ROM and recipe
+  A pool is made once by booting a console headless through the recipe and
+  taking a snapshot at every start, after which any number of consoles
+  start from it by loading a snapshot. Pools are kept for the life of the
+  cache and, given a directory, stored in it, one file per ROM hash and
+  recipe, so that later processes load them instead of booting. Files
+  from another snapshot layout, or damaged ones, are booted over.
+  Thread safe.
+*/
+class StartCache {
+  public:
+    // an empty directory keeps pools in memory only
+    explicit StartCache(const std::string& directory = std::string());
+
+    static const int MAX_POOL = 256;
+
+    // The pool of an iNES image and recipe, from memory, the directory or
+    // a boot, in that order. NULL on a bad image or recipe, or a game that
+    // crashes during the recipe.
+    const std::vector<ConsoleSnapshot>* get(const uint8_t* image, size_t size,
+                                            const StartRecipe& recipe);
+
+    // 64-bit FNV-1a, continuing from hash
+    static uint64_t hash(const uint8_t* data, size_t size,
+                         uint64_t hash = 0xCBF29CE484222325ULL);
+    // pools are keyed by the image and recipe
+    static uint64_t get_key(const uint8_t* image, size_t size,
+                            const StartRecipe& recipe);
+    std::string get_path(uint64_t key) const; // file of a pool
+
+    /* Where pools came from so far */
+    int get_boots() const;
+    int get_disk_loads() const;
+
+  private:
+    StartCache(const StartCache&);
+    StartCache& operator=(const StartCache&);
+
+    std::string directory;
+    std::map<uint64_t, std::vector<ConsoleSnapshot> > pools;
+    mutable std::mutex lock;
+    int boots;
+    int disk_loads;
+
+    static int boot(const uint8_t* image, size_t size,
+                    const StartRecipe& recipe,
+                    std::vector<ConsoleSnapshot>& pool);
+    int read_pool(uint64_t key, std::vector<ConsoleSnapshot>& pool) const;
+    void write_pool(uint64_t key, const std::vector<ConsoleSnapshot>& pool)
+        const;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_START_CACHE_H_
@@ -0,0 +1,122 @@
+#include "start_cache.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+namespace nesemu {
+
+static StartRecipe make_recipe() {
+  StartRecipe recipe;
+  for (int i = 0; i < 8; i++) {
+    recipe.prefix.push_back(i % 3 ? BUTTON_A : 0);
+  }
+  recipe.pool_size = 6;
+  recipe.noop_max = 5;
+  recipe.seed = 7;
+  return recipe;
+}
+
+TEST (StartCacheTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  StartCache cache;
+  StartRecipe recipe;
+  recipe.pool_size = 0;
+  EXPECT_TRUE(cache.get(&image[0], image.size(), recipe) == NULL);
+  recipe.pool_size = StartCache::MAX_POOL + 1;
+  EXPECT_TRUE(cache.get(&image[0], image.size(), recipe) == NULL);
+  recipe.pool_size = 1;
+  EXPECT_TRUE(cache.get(&image[0], 10, recipe) == NULL);
+  EXPECT_EQ(cache.get_boots(), 0);
+}
+
+// every start is the state after the prefix and its no-op frames
+TEST (StartCacheTest, PoolFollowsRecipe) {
+  std::vector<uint8_t> image = make_test_rom();
+  StartRecipe recipe = make_recipe();
+  StartCache cache;
+  const std::vector<ConsoleSnapshot>* pool =
+      cache.get(&image[0], image.size(), recipe);
+  ASSERT_TRUE(pool != NULL);
+  ASSERT_EQ(pool->size(), size_t(recipe.pool_size));
+  EXPECT_EQ(cache.get(&image[0], image.size(), recipe), pool);
+  EXPECT_EQ(cache.get_boots(), 1);
+
+  Console* console = new Console;
+  ASSERT_EQ(console->load_rom(&image[0], image.size()), 0);
+  for (size_t i = 0; i < recipe.prefix.size(); i++) {
+    console->get_controller(0).set_buttons(recipe.prefix[i]);
+    console->run_frame();
+  }
+  console->get_controller(0).set_buttons(0);
+  uint64_t first = console->get_frame_count();
+  std::vector<int> seen(recipe.noop_max + 1, 0);
+  for (int noops = 0; noops <= recipe.noop_max; noops++) {
+    for (size_t i = 0; i < pool->size(); i++) {
+      const ConsoleSnapshot& start = (*pool)[i];
+      if (start.ppu.frame_count == first + noops) {
+        seen[noops]++;
+        EXPECT_EQ(start.cpu.cycles, console->get_cpu().get_cycles());
+        EXPECT_EQ(memcmp(start.ram, console->get_ram(), sizeof start.ram),
+                  0);
+      }
+    }
+    console->run_frame();
+  }
+  int counts = 0, total = 0;
+  for (size_t i = 0; i < seen.size(); i++) {
+    counts += seen[i] ? 1 : 0;
+    total += seen[i];
+  }
+  EXPECT_EQ(total, recipe.pool_size);
+  EXPECT_GT(counts, 1);
+  delete console;
+
+  // another recipe is another pool
+  recipe.seed = 8;
+  EXPECT_NE(cache.get(&image[0], image.size(), recipe), pool);
+  EXPECT_EQ(cache.get_boots(), 2);
+}
+
+TEST (StartCacheTest, PersistsAcrossCaches) {
+  std::vector<uint8_t> image = make_test_rom();
+  StartRecipe recipe = make_recipe();
+  char directory[] = "/tmp/start_cache_testXXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+
+  StartCache first(directory);
+  const std::vector<ConsoleSnapshot>* booted =
+      first.get(&image[0], image.size(), recipe);
+  ASSERT_TRUE(booted != NULL);
+  EXPECT_EQ(first.get_boots(), 1);
+  EXPECT_EQ(first.get_disk_loads(), 0);
+
+  StartCache second(directory);
+  const std::vector<ConsoleSnapshot>* loaded =
+      second.get(&image[0], image.size(), recipe);
+  ASSERT_TRUE(loaded != NULL);
+  EXPECT_EQ(second.get_boots(), 0);
+  EXPECT_EQ(second.get_disk_loads(), 1);
+  ASSERT_EQ(loaded->size(), booted->size());
+  EXPECT_EQ(memcmp(&(*loaded)[0], &(*booted)[0],
+                   booted->size() * sizeof(ConsoleSnapshot)), 0);
+
+  // a cut short file is booted over, and written again
+  std::string path =
+      first.get_path(StartCache::get_key(&image[0], image.size(), recipe));
+  ASSERT_EQ(truncate(path.c_str(), 100), 0);
+  StartCache third(directory);
+  ASSERT_TRUE(third.get(&image[0], image.size(), recipe) != NULL);
+  EXPECT_EQ(third.get_boots(), 1);
+  StartCache fourth(directory);
+  ASSERT_TRUE(fourth.get(&image[0], image.size(), recipe) != NULL);
+  EXPECT_EQ(fourth.get_disk_loads(), 1);
+
+  EXPECT_EQ(unlink(path.c_str()), 0);
+  EXPECT_EQ(rmdir(directory), 0);
+}
+
+} // namespace nesemu
@@ -0,0 +1,322 @@
+#include "vec_env.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nesemu {
+
+VecEnv::VecEnv() {
+  observation_size = 0;
+  mode = OUTPUT_GRAY_AREA;
+  width = 0;
+  height = 0;
+  max_pool = false;
+  repeat = 1;
+  hold = 0;
+  max_frames = 0;
+  reward = 0;
+  reward_context = 0;
+  watch = 0;
+  pool = 0;
+  batch = 8;
+  actions = 0;
+  observations = 0;
+  rewards = 0;
+  dones = 0;
+}
+
+VecEnv::~VecEnv() {
+  clear();
+}
+
+void VecEnv::clear() {
+  for (size_t i = 0; i < slots.size(); i++) {
+    delete slots[i];
+  }
+  slots.clear();
+  starts.clear();
+}
+
+int VecEnv::init(const uint8_t* image, size_t size, int count, int mode,
+                 int width, int height, bool max_pool, int start_frames) {
+  if (start_frames < 0) {
+    return 1;
+  }
+  int shown = std::min(start_frames, max_pool ? 2 : 1);
+  StartRecipe recipe;
+  recipe.prefix.assign(start_frames - shown, 0);
+  return build(image, size, count, recipe, NULL, mode, width, height,
+               max_pool, shown);
+}
+
+int VecEnv::init(const uint8_t* image, size_t size, int count,
+                 const StartRecipe& recipe, StartCache* cache, int mode,
+                 int width, int height, bool max_pool) {
+  return build(image, size, count, recipe, cache, mode, width, height,
+               max_pool, max_pool ? 2 : 1);
+}
+
+// The cached starts are played on for the shown frames once, on the first
+// console, which gives the starts the consoles reset to and their
+// observations.
+int VecEnv::build(const uint8_t* image, size_t size, int count,
+                  const StartRecipe& recipe, StartCache* cache, int mode,
+                  int width, int height, bool max_pool, int shown) {
+  if (count < 1) {
+    return 1;
+  }
+  clear();
+  const std::vector<ConsoleSnapshot>* pool =
+      (cache ? cache : &own_cache)->get(image, size, recipe);
+  if (!pool) {
+    return 1;
+  }
+  this->mode = mode;
+  this->width = width;
+  this->height = height;
+  this->max_pool = max_pool;
+  observation_size = size_t(width) * height;
+  start_observations.assign(pool->size() * observation_size, 0);
+  for (int i = 0; i < count; i++) {
+    Slot* slot = new Slot;
+    slots.push_back(slot);
+    slot->episode_frames = 0;
+    slot->random = (recipe.seed + uint32_t(i)) * 2654435761u | 1;
+    if (slot->console.load_rom(image, size) ||
+        slot->console.get_ppu().set_output(mode, &start_observations[0],
+                                           width, height, max_pool)) {
+      clear();
+      return 1;
+    }
+  }
+  Console& console = slots[0]->console;
+  starts.resize(pool->size());
+  for (size_t i = 0; i < pool->size(); i++) {
+    console.load_snapshot((*pool)[i]);
+    console.get_ppu().set_output_buffer(&start_observations[0] +
+                                        i * observation_size);
+    console.get_controller(0).set_buttons(0);
+    for (int frame = 0; frame < shown; frame++) {
+      if (console.run_frame()) {
+        clear();
+        return 1;
+      }
+    }
+    console.save_snapshot(starts[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    slots[i]->console.load_snapshot(starts[0]);
+  }
+  set_ram_watch(watch);
+  return 0;
+}
+
+/* Settings */
+void VecEnv::set_reward(RewardFunction reward, void* context) {
+  this->reward = reward;
+  reward_context = context;
+}
+
+void VecEnv::set_ram_watch(const RamWatch* watch) {
+  this->watch = watch;
+  for (size_t i = 0; i < slots.size(); i++) {
+    Slot& slot = *slots[i];
+    slot.watch_memory.assign(watch ? watch->get_memory_size() : 0, 0.0);
+    if (watch) {
+      watch->prime(slot.console.get_ram(),
+                   slot.watch_memory.empty() ? NULL : &slot.watch_memory[0]);
+    }
+  }
+}
+
+int VecEnv::set_action_repeat(int repeat) {
+  if (repeat < 1 || repeat > MAX_REPEAT) {
+    return 1;
+  }
+  this->repeat = repeat;
+  return 0;
+}
+
+int VecEnv::get_action_repeat() const {
+  return repeat;
+}
+
+int VecEnv::set_action_hold(int frames) {
+  if (frames < 0 || frames > MAX_REPEAT) {
+    return 1;
+  }
+  hold = frames;
+  return 0;
+}
+
+int VecEnv::get_action_hold() const {
+  return hold;
+}
+
+void VecEnv::set_max_frames(uint64_t frames) {
+  max_frames = frames;
+}
+
+uint64_t VecEnv::get_max_frames() const {
+  return max_frames;
+}
+
+void VecEnv::set_pool(WorkerPool* pool, int batch) {
+  this->pool = pool;
+  this->batch = batch < 1 ? 1 : batch;
+}
+
+int VecEnv::get_count() const {
+  return int(slots.size());
+}
+
+size_t VecEnv::get_observation_size() const {
+  return observation_size;
+}
+
+int VecEnv::get_output_mode() const {
+  return mode;
+}
+
+int VecEnv::get_output_width() const {
+  return width;
+}
+
+int VecEnv::get_output_height() const {
+  return height;
+}
+
+int VecEnv::get_start_count() const {
+  return int(starts.size());
+}
+
+Console& VecEnv::get_console(int index) {
+  return slots[index]->console;
+}
+
+/* Stepping */
+void VecEnv::reset(uint8_t* observations) {
+  this->observations = observations;
+  if (pool) {
+    pool->run(get_count(), batch, reset_batch, this);
+  } else {
+    reset_batch(this, 0, get_count());
+  }
+}
+
+void VecEnv::step(const uint8_t* actions, uint8_t* observations,
+                  float* rewards, uint8_t* dones) {
+  this->actions = actions;
+  this->observations = observations;
+  this->rewards = rewards;
+  this->dones = dones;
+  if (pool) {
+    pool->run(get_count(), batch, step_batch, this);
+  } else {
+    step_batch(this, 0, get_count());
+  }
+}
+
+void VecEnv::reset_batch(void* env, int begin, int end) {
+  VecEnv* vec = static_cast<VecEnv*>(env);
+  for (int i = begin; i < end; i++) {
+    vec->reset_env(i, vec->observations + i * vec->observation_size);
+  }
+}
+
+void VecEnv::step_batch(void* env, int begin, int end) {
+  VecEnv* vec = static_cast<VecEnv*>(env);
+  for (int first = begin; first < end; first += RamWatch::MAX_LANES) {
+    vec->step_group(first, std::min(end, first + RamWatch::MAX_LANES));
+  }
+}
+
+void VecEnv::reset_env(int index, uint8_t* observation) {
+  Slot& slot = *slots[index];
+  size_t start = 0;
+  if (starts.size() > 1) {
+    slot.random ^= slot.random << 13;
+    slot.random ^= slot.random >> 17;
+    slot.random ^= slot.random << 5;
+    start = slot.random % starts.size();
+  }
+  slot.console.load_snapshot(starts[start]);
+  slot.episode_frames = 0;
+  if (watch) {
+    watch->prime(slot.console.get_ram(),
+                 slot.watch_memory.empty() ? NULL : &slot.watch_memory[0]);
+  }
+  memcpy(observation, &start_observations[0] + start * observation_size,
+         observation_size);
+}
+
+// The consoles of a group run frame by frame together, so that the watch
+// is evaluated across all of them after each frame.
+void VecEnv::step_group(int begin, int end) {
+  const int lanes = RamWatch::MAX_LANES;
+  float totals[lanes];
+  bool finished[lanes];
+  int ran[lanes]; // consoles that ran the current frame
+  const uint8_t* rams[lanes];
+  double* memories[lanes];
+  float watch_rewards[lanes];
+  uint8_t watch_dones[lanes];
+  int count = end - begin;
+  for (int i = 0; i < count; i++) {
+    Console& console = slots[begin + i]->console;
+    // the output may still point wherever it was when the state was saved
+    console.get_ppu().set_output_buffer(observations +
+                                        (begin + i) * observation_size);
+    console.get_controller(0).set_buttons(actions[begin + i]);
+    totals[i] = 0;
+    finished[i] = false;
+  }
+  for (int frame = 0; frame < repeat; frame++) {
+    bool shown = frame >= repeat - (max_pool ? 2 : 1);
+    int running = 0;
+    for (int i = 0; i < count; i++) {
+      if (finished[i]) {
+        continue;
+      }
+      Slot& slot = *slots[begin + i];
+      Console& console = slot.console;
+      if (frame == hold && hold) {
+        console.get_controller(0).set_buttons(0);
+      }
+      console.get_ppu().set_render_mode(shown ? RENDER_FULL : RENDER_NONE);
+      if (console.run_frame()) {
+        finished[i] = true; // bad opcode, the game has crashed
+        continue;
+      }
+      slot.episode_frames++;
+      if (reward) {
+        totals[i] += reward(reward_context, console, &finished[i]);
+      }
+      if (max_frames && slot.episode_frames >= max_frames) {
+        finished[i] = true;
+      }
+      ran[running] = i;
+      rams[running] = console.get_ram();
+      memories[running] = slot.watch_memory.empty() ? NULL
+                                                    : &slot.watch_memory[0];
+      running++;
+    }
+    if (watch && running) {
+      watch->evaluate(rams, memories, running, watch_rewards, watch_dones);
+      for (int j = 0; j < running; j++) {
+        totals[ran[j]] += watch_rewards[j];
+        finished[ran[j]] = finished[ran[j]] || watch_dones[j];
+      }
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    int index = begin + i;
+    rewards[index] = totals[i];
+    dones[index] = finished[i];
+    if (finished[i]) {
+      reset_env(index, observations + index * observation_size);
+    }
+  }
+}
+
+} // namespace nesemu
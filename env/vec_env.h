@@ -0,0 +1,145 @@
+#ifndef NESEMU_ENV_VEC_ENV_H_
+#define NESEMU_ENV_VEC_ENV_H_
+
+#include "console/console.h"
+#include "ram_watch.h"
+#include "start_cache.h"
+#include "worker_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+// scores a console after a step, sets done at the end of an episode
+typedef float (*RewardFunction)(void* context, const Console& console,
+                                bool* done);
+
+/* A batch of consoles stepped together, for agents
+  One call steps every console a frame, or action repeat frames, with its
+  pad 1 buttons taken from an action array. Each PPU writes its observation
+  straight into the caller's array, so observations are never copied out;
+  rewards and done flags go into arrays of their own. Only the last frame of
+  a repeat is rendered (the last two with max pooling), the others run
+  headless.
+
+  A console whose episode ends is reset by loading a start snapshot, drawn
+  at random when there are several, and its slot then holds that start's
+  observation. The reward and done flag are still those of the step that
+  ended the episode. Start states come from a StartCache, so the boot is
+  played once per ROM and recipe, not per console or episode, and not at
+  all when the cache has it on disk.
+
+  With a WorkerPool the consoles are stepped in batches across its threads.
+  Each console, its start state and its counters sit in a slot of their
+  own, aligned to cache lines, so consoles stepped by different threads
+  never share a line.
+*/
+class VecEnv {
+  public:
+    VecEnv();
+    ~VecEnv();
+
+    static const int MAX_REPEAT = 16;
+
+    // Builds count consoles from an iNES image, observed through the given
+    // PPU output (see PPU::set_output), that start after start_frames
+    // frames without input. Returns 1 on a bad image or arguments.
+    int init(const uint8_t* image, size_t size, int count,
+             int mode = OUTPUT_GRAY_AREA, int width = 84, int height = 84,
+             bool max_pool = false, int start_frames = 60);
+    // Same with the starts of a recipe, through cache (NULL for one of this
+    // env's own). Each start is followed by one frame without input, two
+    // with max pooling, that renders its observation.
+    int init(const uint8_t* image, size_t size, int count,
+             const StartRecipe& recipe, StartCache* cache,
+             int mode = OUTPUT_GRAY_AREA, int width = 84, int height = 84,
+             bool max_pool = false);
+
+    // without a reward function rewards are 0 and episodes never end
+    void set_reward(RewardFunction reward, void* context);
+    // Adds the rewards and done flags of watch, evaluated across a batch
+    // of consoles after every frame; NULL for none. The watch must outlive
+    // its use, and consoles start its prev() memory afresh here and at
+    // every reset.
+    void set_ram_watch(const RamWatch* watch);
+    int set_action_repeat(int repeat); // 1 - MAX_REPEAT, returns 1 otherwise
+    int get_action_repeat() const;
+    // Buttons are held the first frames of a repeat and released for the
+    // rest, so a game sees a new press every step; 0 (the default) holds
+    // them throughout. 0 - MAX_REPEAT, returns 1 otherwise.
+    int set_action_hold(int frames);
+    int get_action_hold() const;
+    void set_max_frames(uint64_t frames); // episode length limit, 0 none
+    uint64_t get_max_frames() const;
+    // Steps batches of batch consoles on the pool's threads, NULL for the
+    // calling thread only. The reward function is then called from several
+    // threads at once.
+    void set_pool(WorkerPool* pool, int batch = 8);
+
+    int get_count() const;
+    size_t get_observation_size() const; // bytes per console
+    // as given to init
+    int get_output_mode() const;
+    int get_output_width() const;
+    int get_output_height() const;
+    int get_start_count() const;
+
+    /* Stepping, arrays of get_count() entries, observations of
+      get_observation_size() bytes each */
+    // puts every console back at its start state
+    void reset(uint8_t* observations);
+    void step(const uint8_t* actions, uint8_t* observations, float* rewards,
+              uint8_t* dones);
+
+    Console& get_console(int index);
+
+  private:
+    VecEnv(const VecEnv&);
+    VecEnv& operator=(const VecEnv&);
+
+    struct alignas(WorkerPool::CACHE_LINE) Slot {
+      Console console;
+      uint64_t episode_frames;
+      uint32_t random; // xorshift state, picks starts
+      std::vector<double> watch_memory;
+    };
+
+    std::vector<Slot*> slots;
+    StartCache own_cache;
+    std::vector<ConsoleSnapshot> starts;  // after the shown frames
+    std::vector<uint8_t> start_observations; // one per start
+    size_t observation_size;
+    int mode;
+    int width;
+    int height;
+    bool max_pool;
+    int repeat;
+    int hold;
+    uint64_t max_frames;
+    RewardFunction reward;
+    void* reward_context;
+    const RamWatch* watch;
+    WorkerPool* pool;
+    int batch;
+
+    /* Arrays of the call in progress */
+    const uint8_t* actions;
+    uint8_t* observations;
+    float* rewards;
+    uint8_t* dones;
+
+    void clear();
+    int build(const uint8_t* image, size_t size, int count,
+              const StartRecipe& recipe, StartCache* cache, int mode,
+              int width, int height, bool max_pool, int shown);
+    static void reset_batch(void* env, int begin, int end);
+    static void step_batch(void* env, int begin, int end);
+    void reset_env(int index, uint8_t* observation);
+    void step_group(int begin, int end);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_VEC_ENV_H_
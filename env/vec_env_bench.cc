@@ -0,0 +1,136 @@
+#include "vec_env.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace nesemu;
+
+static const int COUNT = 32;
+static const int STEPS = 200;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// One call per console per frame, copying the full frame out afterwards:
+// what an agent does without the batch API. Returns frames/sec.
+static double run_single(const std::vector<uint8_t>& image) {
+  std::vector<Console*> consoles;
+  for (int i = 0; i < COUNT; i++) {
+    consoles.push_back(new Console);
+    consoles[i]->load_rom(&image[0], image.size());
+  }
+  std::vector<uint8_t> frames(COUNT * 256 * 240);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int step = 0; step < STEPS; step++) {
+    for (int i = 0; i < COUNT; i++) {
+      consoles[i]->get_controller(0).set_buttons(step & 8 ? BUTTON_A : 0);
+      consoles[i]->run_frame();
+      memcpy(&frames[i * 256 * 240], consoles[i]->get_ppu().get_frame_buffer(),
+             256 * 240);
+    }
+  }
+  double seconds = seconds_since(start);
+  for (int i = 0; i < COUNT; i++) {
+    delete consoles[i];
+  }
+  return double(COUNT) * STEPS / seconds;
+}
+
+// frames/sec through VecEnv with the given output and action repeat
+static double run_vec(const std::vector<uint8_t>& image, int mode, int width,
+                      int height, int repeat) {
+  VecEnv env;
+  env.init(&image[0], image.size(), COUNT, mode, width, height);
+  env.set_action_repeat(repeat);
+  std::vector<uint8_t> observations(COUNT * env.get_observation_size());
+  std::vector<uint8_t> actions(COUNT), dones(COUNT);
+  std::vector<float> rewards(COUNT);
+  env.reset(&observations[0]);
+  int steps = STEPS / repeat;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int step = 0; step < steps; step++) {
+    memset(&actions[0], step * repeat & 8 ? BUTTON_A : 0, COUNT);
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+  }
+  return double(COUNT) * steps * repeat / seconds_since(start);
+}
+
+// Reset costs in microseconds: booting 60 frames again, or loading a
+// start snapshot; then VecEnv::init with a cold and a stored start cache.
+static void run_starts(const std::vector<uint8_t>& image) {
+  Console* console = new Console;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  const int boots = 20;
+  for (int i = 0; i < boots; i++) {
+    console->load_rom(&image[0], image.size());
+    console->get_ppu().set_render_mode(RENDER_NONE);
+    for (int frame = 0; frame < 60; frame++) {
+      console->run_frame();
+    }
+  }
+  double boot = seconds_since(start) * 1e6 / boots;
+  ConsoleSnapshot* snapshot = new ConsoleSnapshot;
+  console->save_snapshot(*snapshot);
+  const int loads = 20000;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loads; i++) {
+    console->load_snapshot(*snapshot);
+  }
+  double load = seconds_since(start) * 1e6 / loads;
+  delete snapshot;
+  delete console;
+
+  char directory[] = "/tmp/vec_env_benchXXXXXX";
+  if (!mkdtemp(directory)) {
+    return;
+  }
+  StartRecipe recipe;
+  recipe.prefix.assign(600, 0);
+  recipe.pool_size = 30;
+  recipe.noop_max = 30;
+  double init[2];
+  for (int warm = 0; warm < 2; warm++) {
+    StartCache cache(directory);
+    VecEnv env;
+    start = std::chrono::steady_clock::now();
+    env.init(&image[0], image.size(), COUNT, recipe, &cache);
+    init[warm] = seconds_since(start) * 1e3;
+  }
+  unlink(StartCache(directory).get_path(
+      StartCache::get_key(&image[0], image.size(), recipe)).c_str());
+  rmdir(directory);
+
+  printf("Resets\n");
+  printf("  boot 60 frames headless       %10.1f us\n", boot);
+  printf("  load a start snapshot         %10.2f us (%zu bytes)\n", load,
+         sizeof(ConsoleSnapshot));
+  printf("  init, 600 frame recipe, 30 no-op starts\n");
+  printf("    booted                      %10.1f ms\n", init[0]);
+  printf("    from the stored cache       %10.1f ms\n", init[1]);
+}
+
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  printf("%d consoles, %d frames each, one thread\n", COUNT, STEPS);
+  printf("  per console calls, full frame copied  %8.0f frames/sec\n",
+         run_single(image));
+  printf("  VecEnv full frame, repeat 1           %8.0f frames/sec\n",
+         run_vec(image, OUTPUT_INDEX, 256, 240, 1));
+  printf("  VecEnv 84x84 gray, repeat 1           %8.0f frames/sec\n",
+         run_vec(image, OUTPUT_GRAY_AREA, 84, 84, 1));
+  printf("  VecEnv 84x84 gray, repeat 4           %8.0f frames/sec\n",
+         run_vec(image, OUTPUT_GRAY_AREA, 84, 84, 4));
+  run_starts(image);
+  return 0;
+}
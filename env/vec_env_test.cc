@@ -0,0 +1,256 @@
+#include "vec_env.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+namespace nesemu {
+
+static const int SIZE = 84 * 84;
+
+// reward 1 while A is held, done once the game has counted 100 NMIs
+static float a_held(void* /* context */, const Console& console,
+                    bool* done) {
+  if (console.get_ram()[0x12] >= 100) {
+    *done = true;
+  }
+  return console.get_ram()[0x11] ? 1.0f : 0.0f;
+}
+
+static uint8_t action_at(int env, int step) {
+  return (env + step / 3) % 3 == 0 ? BUTTON_A : 0;
+}
+
+TEST (VecEnvTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv env;
+  EXPECT_EQ(env.init(&image[0], image.size(), 0), 1);
+  EXPECT_EQ(env.init(&image[0], 10, 2), 1);
+  EXPECT_EQ(env.init(&image[0], image.size(), 2, OUTPUT_GRAY_AREA, 300, 84),
+            1);
+  EXPECT_EQ(env.get_count(), 0);
+  EXPECT_EQ(env.init(&image[0], image.size(), 2), 0);
+  EXPECT_EQ(env.get_count(), 2);
+  EXPECT_EQ(env.get_observation_size(), size_t(SIZE));
+  EXPECT_EQ(env.set_action_repeat(0), 1);
+  EXPECT_EQ(env.set_action_repeat(VecEnv::MAX_REPEAT + 1), 1);
+  EXPECT_EQ(env.set_action_repeat(4), 0);
+  EXPECT_EQ(env.get_action_repeat(), 4);
+}
+
+// every slot holds what a console stepped on its own would show
+TEST (VecEnvTest, MatchesSingleConsoles) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 4;
+  VecEnv env;
+  ASSERT_EQ(env.init(&image[0], image.size(), count, OUTPUT_GRAY_AREA, 84,
+                     84, false, 10), 0);
+  env.set_reward(a_held, NULL);
+
+  std::vector<Console*> plain;
+  std::vector<std::vector<uint8_t> > plain_observations(count);
+  for (int i = 0; i < count; i++) {
+    plain.push_back(new Console);
+    ASSERT_EQ(plain[i]->load_rom(&image[0], image.size()), 0);
+    plain_observations[i].assign(SIZE, 0);
+    plain[i]->get_ppu().set_output(OUTPUT_GRAY_AREA,
+                                   &plain_observations[i][0], 84, 84);
+    for (int frame = 0; frame < 10; frame++) {
+      plain[i]->run_frame();
+    }
+  }
+
+  std::vector<uint8_t> observations(count * SIZE), actions(count);
+  std::vector<float> rewards(count);
+  std::vector<uint8_t> dones(count);
+  env.reset(&observations[0]);
+  for (int i = 0; i < count; i++) {
+    EXPECT_TRUE(std::equal(plain_observations[i].begin(),
+                           plain_observations[i].end(),
+                           observations.begin() + i * SIZE));
+  }
+  for (int step = 0; step < 20; step++) {
+    for (int i = 0; i < count; i++) {
+      actions[i] = action_at(i, step);
+    }
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    for (int i = 0; i < count; i++) {
+      plain[i]->get_controller(0).set_buttons(actions[i]);
+      ASSERT_EQ(plain[i]->run_frame(), 0);
+      EXPECT_EQ(dones[i], 0);
+      EXPECT_EQ(rewards[i], plain[i]->get_ram()[0x11] ? 1.0f : 0.0f);
+      ASSERT_TRUE(std::equal(plain_observations[i].begin(),
+                             plain_observations[i].end(),
+                             observations.begin() + i * SIZE))
+          << "env " << i << " step " << step;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    delete plain[i];
+  }
+}
+
+TEST (VecEnvTest, ActionRepeat) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv single, repeated;
+  ASSERT_EQ(single.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(repeated.init(&image[0], image.size(), 1), 0);
+  single.set_reward(a_held, NULL);
+  repeated.set_reward(a_held, NULL);
+  ASSERT_EQ(repeated.set_action_repeat(4), 0);
+  std::vector<uint8_t> single_observation(SIZE), observation(SIZE);
+  float reward, total;
+  uint8_t done;
+  for (int step = 0; step < 6; step++) {
+    uint8_t action = action_at(0, step * 3);
+    total = 0;
+    for (int frame = 0; frame < 4; frame++) {
+      single.step(&action, &single_observation[0], &reward, &done);
+      total += reward;
+    }
+    repeated.step(&action, &observation[0], &reward, &done);
+    EXPECT_EQ(reward, total);
+    EXPECT_EQ(observation, single_observation) << "step " << step;
+    EXPECT_EQ(repeated.get_console(0).get_frame_count(),
+              single.get_console(0).get_frame_count());
+  }
+}
+
+// a held action is released for the rest of the repeat
+TEST (VecEnvTest, ActionHold) {
+  std::vector<uint8_t> image = make_test_rom();
+  VecEnv single, held;
+  ASSERT_EQ(single.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(held.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(held.set_action_repeat(4), 0);
+  EXPECT_EQ(held.set_action_hold(VecEnv::MAX_REPEAT + 1), 1);
+  ASSERT_EQ(held.set_action_hold(1), 0);
+  EXPECT_EQ(held.get_action_hold(), 1);
+  std::vector<uint8_t> single_observation(SIZE), observation(SIZE);
+  float reward;
+  uint8_t done;
+  for (int step = 0; step < 6; step++) {
+    for (int frame = 0; frame < 4; frame++) {
+      uint8_t action = frame == 0 ? BUTTON_A : 0;
+      single.step(&action, &single_observation[0], &reward, &done);
+    }
+    uint8_t action = BUTTON_A;
+    held.step(&action, &observation[0], &reward, &done);
+    EXPECT_EQ(observation, single_observation) << "step " << step;
+    EXPECT_EQ(held.get_console(0).get_ram()[0x11],
+              single.get_console(0).get_ram()[0x11]);
+  }
+}
+
+// stepped across threads, every console does what it does stepped alone
+TEST (VecEnvTest, PoolMatchesCallingThread) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 13;
+  VecEnv serial, parallel;
+  ASSERT_EQ(serial.init(&image[0], image.size(), count), 0);
+  ASSERT_EQ(parallel.init(&image[0], image.size(), count), 0);
+  WorkerPool pool(4);
+  parallel.set_pool(&pool, 3);
+  serial.set_reward(a_held, NULL);
+  parallel.set_reward(a_held, NULL);
+  serial.set_max_frames(25);
+  parallel.set_max_frames(25);
+  std::vector<uint8_t> serial_observations(count * SIZE);
+  std::vector<uint8_t> observations(count * SIZE), actions(count);
+  std::vector<uint8_t> serial_dones(count), dones(count);
+  std::vector<float> serial_rewards(count), rewards(count);
+  serial.reset(&serial_observations[0]);
+  parallel.reset(&observations[0]);
+  EXPECT_EQ(observations, serial_observations);
+  for (int step = 0; step < 40; step++) {
+    for (int i = 0; i < count; i++) {
+      actions[i] = action_at(i, step);
+    }
+    serial.step(&actions[0], &serial_observations[0], &serial_rewards[0],
+                &serial_dones[0]);
+    parallel.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    ASSERT_EQ(observations, serial_observations) << "step " << step;
+    EXPECT_EQ(rewards, serial_rewards);
+    EXPECT_EQ(dones, serial_dones);
+  }
+}
+
+TEST (VecEnvTest, AutoReset) {
+  std::vector<uint8_t> image = make_test_rom();
+  const int count = 3;
+  VecEnv env;
+  ASSERT_EQ(env.init(&image[0], image.size(), count), 0);
+  env.set_reward(a_held, NULL);
+  env.set_max_frames(30);
+  std::vector<uint8_t> start(count * SIZE), observations(count * SIZE);
+  std::vector<uint8_t> actions(count, BUTTON_A), dones(count);
+  std::vector<float> rewards(count);
+  env.reset(&start[0]);
+  uint64_t start_frame = env.get_console(0).get_frame_count();
+  int ended = 0;
+  for (int step = 1; step <= 60; step++) {
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(dones[i], step % 30 == 0) << "step " << step;
+      if (dones[i]) {
+        ended++;
+        EXPECT_EQ(rewards[i], 1.0f); // the last frame is still scored
+        EXPECT_EQ(env.get_console(i).get_frame_count(), start_frame);
+        EXPECT_TRUE(std::equal(observations.begin() + i * SIZE,
+                               observations.begin() + (i + 1) * SIZE,
+                               start.begin() + i * SIZE));
+      }
+    }
+  }
+  EXPECT_EQ(ended, 2 * count);
+
+  // the reward function ends episodes too
+  env.set_max_frames(0);
+  env.reset(&observations[0]);
+  int steps = 0;
+  do {
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    steps++;
+  } while (!dones[0] && steps < 200);
+  EXPECT_EQ(env.get_console(0).get_frame_count(), start_frame);
+  EXPECT_EQ(steps, 100 - env.get_console(0).get_ram()[0x12]);
+}
+
+// resets draw from a pool of no-op starts, booted once for both envs
+TEST (VecEnvTest, RandomNoopStarts) {
+  std::vector<uint8_t> image = make_test_rom();
+  StartRecipe recipe;
+  recipe.prefix.assign(20, 0);
+  recipe.pool_size = 8;
+  recipe.noop_max = 10;
+  StartCache cache;
+  VecEnv env, other;
+  ASSERT_EQ(env.init(&image[0], image.size(), 3, recipe, &cache), 0);
+  ASSERT_EQ(other.init(&image[0], image.size(), 1, recipe, &cache), 0);
+  EXPECT_EQ(cache.get_boots(), 1);
+  EXPECT_EQ(env.get_start_count(), 8);
+  env.set_max_frames(3);
+  std::vector<uint8_t> observations(3 * SIZE), actions(3), dones(3);
+  std::vector<float> rewards(3);
+  env.reset(&observations[0]);
+  std::vector<int> seen(12, 0);
+  for (int step = 0; step < 90; step++) {
+    env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+    for (int i = 0; i < 3; i++) {
+      if (dones[i]) {
+        // the prefix, the no-ops and the frame that renders the start
+        uint64_t frames = env.get_console(i).get_frame_count();
+        ASSERT_GE(frames, 21u);
+        ASSERT_LE(frames, 31u);
+        seen[frames - 20]++;
+      }
+    }
+  }
+  int distinct = 0;
+  for (size_t i = 0; i < seen.size(); i++) {
+    distinct += seen[i] ? 1 : 0;
+  }
+  EXPECT_GT(distinct, 2);
+}
+
+} // namespace nesemu
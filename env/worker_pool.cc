@@ -0,0 +1,151 @@
+#include "worker_pool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace nesemu {
+
+WorkerPool::WorkerPool(int threads, bool pin)
+    : deques(threads < 1 ? 1 : threads) {
+  fn = 0;
+  context = 0;
+  count = 0;
+  batch = 1;
+  pending = 0;
+  generation = 0;
+  stopping = false;
+  for (size_t i = 0; i < deques.size(); i++) {
+    deques[i].head = 0;
+    deques[i].tail = 0;
+    deques[i].steals = 0;
+  }
+  // the calling thread is worker 0 and keeps its own affinity
+  for (int i = 1; i < int(deques.size()); i++) {
+    this->threads.push_back(std::thread(&WorkerPool::work, this, i, pin));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake_up.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+int WorkerPool::get_threads() const {
+  return int(deques.size());
+}
+
+uint64_t WorkerPool::get_steals() const {
+  uint64_t steals = 0;
+  for (size_t i = 0; i < deques.size(); i++) {
+    steals += deques[i].steals;
+  }
+  return steals;
+}
+
+void WorkerPool::run(int count, int batch, BatchFunction fn, void* context) {
+  if (count <= 0) {
+    return;
+  }
+  if (batch < 1) {
+    batch = 1;
+  }
+  int batches = (count + batch - 1) / batch;
+  int workers = int(deques.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // set before the deques are filled, a worker taking a batch sees them
+    this->fn = fn;
+    this->context = context;
+    this->count = count;
+    this->batch = batch;
+    pending = batches;
+    for (int i = 0; i < workers; i++) {
+      std::lock_guard<std::mutex> deque_lock(deques[i].lock);
+      deques[i].head = int(int64_t(batches) * i / workers);
+      deques[i].tail = int(int64_t(batches) * (i + 1) / workers);
+    }
+    generation++;
+  }
+  if (workers > 1) {
+    wake_up.notify_all();
+  }
+  run_batches(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  while (pending.load()) {
+    job_done.wait(lock);
+  }
+}
+
+void WorkerPool::work(int worker, bool pin) {
+#ifdef __linux__
+  if (pin) {
+    unsigned cpus = std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus ? worker % cpus : 0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+  }
+#else
+  (void)pin;
+#endif
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!stopping && generation == seen) {
+        wake_up.wait(lock);
+      }
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+    run_batches(worker);
+  }
+}
+
+void WorkerPool::run_batches(int worker) {
+  int index;
+  while (take(worker, &index)) {
+    int begin = index * batch;
+    int end = begin + batch < count ? begin + batch : count;
+    fn(context, begin, end);
+    if (pending.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      job_done.notify_all();
+    }
+  }
+}
+
+// own deque from the back, then the others' from the front
+bool WorkerPool::take(int worker, int* batch_index) {
+  int workers = int(deques.size());
+  {
+    Deque& own = deques[worker];
+    std::lock_guard<std::mutex> lock(own.lock);
+    if (own.head < own.tail) {
+      *batch_index = --own.tail;
+      return true;
+    }
+  }
+  for (int i = 1; i < workers; i++) {
+    Deque& victim = deques[(worker + i) % workers];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (victim.head < victim.tail) {
+      *batch_index = victim.head++;
+      deques[worker].steals++; // only ever written by its worker
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace nesemu
@@ -0,0 +1,78 @@
+#ifndef NESEMU_ENV_WORKER_POOL_H_
+#define NESEMU_ENV_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nesemu {
+
+// runs items [begin, end) of a job
+typedef void (*BatchFunction)(void* context, int begin, int end);
+
+/* Work-stealing thread pool for per-frame jobs
+  A job is count items, e.g. consoles to step a frame, cut into batches of
+  K consecutive items. Every worker starts with a deque of neighbouring
+  batches, works it from the back and, once empty, steals from the front of
+  the others' deques, so a worker stuck with slow consoles (a busy scene,
+  a reset) is helped out instead of holding up the frame. The calling
+  thread is worker 0 and works on the job too.
+
+  Workers can be pinned to a CPU each, worker i to CPU i modulo the CPUs
+  there are, so caches stay warm across frames. Per-worker state sits on
+  its own cache line.
+*/
+class WorkerPool {
+  public:
+    explicit WorkerPool(int threads, bool pin = false); // threads >= 1
+    ~WorkerPool();
+
+    static const int CACHE_LINE = 64;
+
+    int get_threads() const;
+    // Runs fn over [0, count) in batches of batch items and returns when
+    // all are done. One job at a time.
+    void run(int count, int batch, BatchFunction fn, void* context);
+    uint64_t get_steals() const; // batches run by a worker they were not
+                                 // given to, since the pool was made
+
+  private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    // batches [head, tail) of the current job
+    struct alignas(CACHE_LINE) Deque {
+      std::mutex lock;
+      int head;
+      int tail;
+      uint64_t steals;
+    };
+
+    std::vector<Deque> deques;
+    std::vector<std::thread> threads;
+
+    /* Current job */
+    BatchFunction fn;
+    void* context;
+    int count;
+    int batch;
+    alignas(CACHE_LINE) std::atomic<int> pending; // batches not yet done
+
+    /* Waking and finishing */
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    std::condition_variable job_done;
+    uint64_t generation; // jobs started, guarded by mutex
+    bool stopping;
+
+    void work(int worker, bool pin);
+    void run_batches(int worker);
+    bool take(int worker, int* batch_index);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_ENV_WORKER_POOL_H_
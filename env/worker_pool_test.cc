@@ -0,0 +1,67 @@
+#include "worker_pool.h"
+
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace nesemu {
+
+struct Job {
+  std::vector<std::atomic<int> >* runs;
+  int slow_end; // items before it take a millisecond
+};
+
+static void count_items(void* context, int begin, int end) {
+  Job* job = static_cast<Job*>(context);
+  for (int i = begin; i < end; i++) {
+    (*job->runs)[i]++;
+    if (i < job->slow_end) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+TEST (WorkerPoolTest, RunsEveryItemOnce) {
+  const int threads[4] = {0, 1, 3, 8};
+  for (int t = 0; t < 4; t++) {
+    WorkerPool pool(threads[t]);
+    EXPECT_EQ(pool.get_threads(), threads[t] ? threads[t] : 1);
+    for (int count = 0; count <= 1000; count += 97) {
+      std::vector<std::atomic<int> > runs(count + 1);
+      Job job = {&runs, 0};
+      pool.run(count, 7, count_items, &job);
+      for (int i = 0; i < count; i++) {
+        ASSERT_EQ(runs[i].load(), 1) << "item " << i << " of " << count;
+      }
+      EXPECT_EQ(runs[count].load(), 0);
+    }
+  }
+}
+
+TEST (WorkerPoolTest, ManySmallJobs) {
+  WorkerPool pool(4, true);
+  std::vector<std::atomic<int> > runs(64);
+  Job job = {&runs, 0};
+  for (int i = 0; i < 2000; i++) {
+    pool.run(64, 1 + i % 9, count_items, &job);
+  }
+  for (int i = 0; i < 64; i++) {
+    EXPECT_EQ(runs[i].load(), 2000);
+  }
+}
+
+// the worker given the slow batches is helped by the others
+TEST (WorkerPoolTest, StealsFromSlowWorker) {
+  WorkerPool pool(4);
+  std::vector<std::atomic<int> > runs(400);
+  Job job = {&runs, 100}; // all of worker 0's batches
+  pool.run(400, 4, count_items, &job);
+  EXPECT_GT(pool.get_steals(), 0u);
+  for (int i = 0; i < 400; i++) {
+    EXPECT_EQ(runs[i].load(), 1);
+  }
+}
+
+} // namespace nesemu
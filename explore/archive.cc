@@ -0,0 +1,245 @@
+#include "archive.h"
+
+#include "console/state_hash.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+Archive::Archive(const ConsoleSnapshot& base) : shards(SHARDS) {
+  // as bytes, padding included, for states packed against the caller's
+  memcpy(&this->base, &base, sizeof base);
+  size = 0;
+  packed_bytes = 0;
+}
+
+/* Cells */
+Archive::Shard& Archive::shard_of(uint64_t key) {
+  return shards[StateHash::mix(key) % SHARDS];
+}
+
+const Archive::Shard& Archive::shard_of(uint64_t key) const {
+  return shards[StateHash::mix(key) % SHARDS];
+}
+
+// a state is better with more score, or as much in fewer frames
+bool Archive::better(const Cell& cell, double score, uint32_t frames) {
+  return score > cell.score || (score == cell.score && frames < cell.frames);
+}
+
+bool Archive::wants(uint64_t key, double score, uint32_t frames) const {
+  const Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> hold(shard.lock);
+  std::unordered_map<uint64_t, uint32_t>::const_iterator found =
+      shard.index.find(key);
+  return found == shard.index.end() ||
+         better(shard.cells[found->second], score, frames);
+}
+
+bool Archive::offer(uint64_t key, double score, uint32_t frames,
+                    const ConsoleSnapshot& snapshot) {
+  // packed outside the lock
+  std::vector<uint8_t> state;
+  pack(snapshot, base, state);
+  Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> hold(shard.lock);
+  std::unordered_map<uint64_t, uint32_t>::iterator found =
+      shard.index.find(key);
+  if (found == shard.index.end()) {
+    shard.index[key] = uint32_t(shard.cells.size());
+    shard.cells.push_back(Cell());
+    Cell& cell = shard.cells.back();
+    cell.key = key;
+    cell.score = score;
+    cell.frames = frames;
+    cell.chosen = 0;
+    packed_bytes += state.size();
+    cell.state.swap(state);
+    shard.count.store(uint32_t(shard.cells.size()),
+                      std::memory_order_relaxed);
+    size++;
+    return true;
+  }
+  Cell& cell = shard.cells[found->second];
+  if (!better(cell, score, frames)) {
+    return false;
+  }
+  cell.score = score;
+  cell.frames = frames;
+  packed_bytes += state.size();
+  packed_bytes -= cell.state.size();
+  cell.state.swap(state);
+  return true;
+}
+
+bool Archive::choose(uint32_t seed, ConsoleSnapshot& snapshot, Cell* info) {
+  if (!size) {
+    return false;
+  }
+  uint64_t best_key = 0;
+  uint32_t best_chosen = 0;
+  int found = 0;
+  for (int draw = 0; draw < CANDIDATES; draw++) {
+    // from a random shard on to the first with cells, which only walks
+    // far while the archive is small
+    seed = seed * 1664525 + 1013904223;
+    uint32_t first = (seed >> 8) % SHARDS;
+    for (int i = 0; i < SHARDS; i++) {
+      const Shard& shard = shards[(first + i) % SHARDS];
+      if (!shard.count.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      std::lock_guard<std::mutex> hold(shard.lock);
+      if (shard.cells.empty()) {
+        continue;
+      }
+      seed = seed * 1664525 + 1013904223;
+      const Cell& cell = shard.cells[(seed >> 8) % shard.cells.size()];
+      if (!found++ || cell.chosen < best_chosen) {
+        best_key = cell.key;
+        best_chosen = cell.chosen;
+      }
+      break;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  std::vector<uint8_t> state;
+  {
+    Shard& shard = shard_of(best_key);
+    std::lock_guard<std::mutex> hold(shard.lock);
+    Cell& cell = shard.cells[shard.index[best_key]];
+    cell.chosen++;
+    state = cell.state;
+    if (info) {
+      info->key = cell.key;
+      info->score = cell.score;
+      info->frames = cell.frames;
+      info->chosen = cell.chosen;
+    }
+  }
+  return !unpack(state.data(), state.size(), base, snapshot);
+}
+
+bool Archive::get(uint64_t key, Cell& cell) const {
+  const Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> hold(shard.lock);
+  std::unordered_map<uint64_t, uint32_t>::const_iterator found =
+      shard.index.find(key);
+  if (found == shard.index.end()) {
+    return false;
+  }
+  cell = shard.cells[found->second];
+  return true;
+}
+
+void Archive::get_cells(std::vector<Cell>& cells) const {
+  cells.clear();
+  for (int i = 0; i < SHARDS; i++) {
+    std::lock_guard<std::mutex> hold(shards[i].lock);
+    const std::vector<Cell>& shard = shards[i].cells;
+    cells.insert(cells.end(), shard.begin(), shard.end());
+  }
+}
+
+size_t Archive::get_size() const {
+  return size;
+}
+
+size_t Archive::get_packed_bytes() const {
+  return packed_bytes;
+}
+
+/* Packed states
+  The snapshot's bytes XOR the base's, as pairs of varints: a run of equal
+  bytes to skip, then a run of differing bytes that follow XORed, and so
+  on to the end. */
+const ConsoleSnapshot& Archive::get_base() const {
+  return base;
+}
+
+static void put_varint(std::vector<uint8_t>& out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back(uint8_t(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(uint8_t(value));
+}
+
+static bool get_varint(const uint8_t*& data, const uint8_t* end,
+                       size_t& value) {
+  value = 0;
+  for (int shift = 0; data < end && shift < 35; shift += 7) {
+    uint8_t byte = *data++;
+    value |= size_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Archive::pack(const ConsoleSnapshot& snapshot,
+                   const ConsoleSnapshot& base, std::vector<uint8_t>& out) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&snapshot);
+  const uint8_t* base_bytes = reinterpret_cast<const uint8_t*>(&base);
+  const size_t size = sizeof(ConsoleSnapshot);
+  out.clear();
+  size_t at = 0;
+  while (at < size) {
+    size_t equal = at;
+    // whole words first, equal stretches are long
+    while (equal + 8 <= size &&
+           !memcmp(bytes + equal, base_bytes + equal, 8)) {
+      equal += 8;
+    }
+    while (equal < size && bytes[equal] == base_bytes[equal]) {
+      equal++;
+    }
+    if (equal == size) {
+      break;
+    }
+    // a differing run ends at two equal bytes in a row
+    size_t differ = equal + 1;
+    while (differ < size &&
+           (bytes[differ] != base_bytes[differ] ||
+            (differ + 1 < size &&
+             bytes[differ + 1] != base_bytes[differ + 1]))) {
+      differ++;
+    }
+    put_varint(out, equal - at);
+    put_varint(out, differ - equal);
+    for (size_t i = equal; i < differ; i++) {
+      out.push_back(bytes[i] ^ base_bytes[i]);
+    }
+    at = differ;
+  }
+}
+
+int Archive::unpack(const uint8_t* data, size_t size,
+                    const ConsoleSnapshot& base, ConsoleSnapshot& snapshot) {
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&snapshot);
+  if (&snapshot != &base) {
+    memcpy(bytes, &base, sizeof(ConsoleSnapshot));
+  }
+  const uint8_t* end = data + size;
+  size_t at = 0;
+  while (data < end) {
+    size_t equal, differ;
+    if (!get_varint(data, end, equal) || !get_varint(data, end, differ) ||
+        equal > sizeof(ConsoleSnapshot) - at ||
+        differ > sizeof(ConsoleSnapshot) - at - equal ||
+        differ > size_t(end - data)) {
+      return 1;
+    }
+    at += equal;
+    for (size_t i = 0; i < differ; i++) {
+      bytes[at++] ^= *data++;
+    }
+  }
+  return 0;
+}
+
+} // namespace nesemu
@@ -0,0 +1,94 @@
+#ifndef NESEMU_EXPLORE_ARCHIVE_H_
+#define NESEMU_EXPLORE_ARCHIVE_H_
+
+#include "console/console.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace nesemu {
+
+// one distinct state of the archive, under the key of its cell
+struct Cell {
+  uint64_t key;
+  double score;          // reward collected on the way here
+  uint32_t frames;       // from the start
+  uint32_t chosen;       // times explored from
+  std::vector<uint8_t> state; // packed ConsoleSnapshot, see Archive::pack()
+};
+
+/* The distinct states an exploration has found, one per cell
+  A cell is whatever a cell function makes of a state, e.g. the level and
+  a coarse position read from RAM, and the archive keeps the best state
+  reaching each: the highest score, then the fewest frames.
+
+  The cells are spread over SHARDS shards by a mix of their key, each with
+  its own lock, map and cell array, so threads adding and choosing cells
+  only meet when they land on the same shard and there is no global lock.
+  States are packed against a base snapshot, e.g. the start: the bytes
+  that differ from it, as runs between runs of equal bytes. Most of a
+  snapshot (CHR, most nametables, untouched RAM) is equal, so a packed
+  state is about 110 bytes on the test ROM rather than a whole snapshot.
+*/
+class Archive {
+  public:
+    explicit Archive(const ConsoleSnapshot& base);
+
+    static const int SHARDS = 256;
+    static const int CANDIDATES = 4; // drawn per choose()
+
+    /* Cells */
+    // Whether offer() would add or replace the cell, to skip packing a
+    // state that would not be kept.
+    bool wants(uint64_t key, double score, uint32_t frames) const;
+    // Adds the cell, or replaces a worse state of it. Returns true if the
+    // snapshot was kept.
+    bool offer(uint64_t key, double score, uint32_t frames,
+               const ConsoleSnapshot& snapshot);
+    // Picks a cell to explore from, the least chosen of CANDIDATES drawn
+    // at random with seed, and unpacks its state. Returns false when the
+    // archive is empty.
+    bool choose(uint32_t seed, ConsoleSnapshot& snapshot, Cell* info = NULL);
+    bool get(uint64_t key, Cell& cell) const;
+    void get_cells(std::vector<Cell>& cells) const; // a copy of all
+    size_t get_size() const;
+    size_t get_packed_bytes() const; // of all states
+
+    /* Packed states */
+    const ConsoleSnapshot& get_base() const;
+    static void pack(const ConsoleSnapshot& snapshot,
+                     const ConsoleSnapshot& base, std::vector<uint8_t>& out);
+    // Returns 1 on a damaged state.
+    static int unpack(const uint8_t* data, size_t size,
+                      const ConsoleSnapshot& base, ConsoleSnapshot& snapshot);
+
+  private:
+    Archive(const Archive&);
+    Archive& operator=(const Archive&);
+
+    struct alignas(64) Shard {
+      Shard() : count(0) {}
+
+      mutable std::mutex lock;
+      std::unordered_map<uint64_t, uint32_t> index; // key to cells
+      std::vector<Cell> cells;
+      std::atomic<uint32_t> count; // cells, read without the lock
+    };
+
+    ConsoleSnapshot base;
+    std::vector<Shard> shards;
+    alignas(64) std::atomic<size_t> size;
+    std::atomic<size_t> packed_bytes;
+
+    Shard& shard_of(uint64_t key);
+    const Shard& shard_of(uint64_t key) const;
+    static bool better(const Cell& cell, double score, uint32_t frames);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_EXPLORE_ARCHIVE_H_
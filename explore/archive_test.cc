@@ -0,0 +1,115 @@
+#include "archive.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace nesemu {
+
+static void snapshot_after(int frames, ConsoleSnapshot& snapshot) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  console.load_rom(&image[0], image.size());
+  console.get_controller(0).set_buttons(BUTTON_A);
+  for (int i = 0; i < frames; i++) {
+    console.run_frame();
+  }
+  console.save_snapshot(snapshot);
+}
+
+TEST (ArchiveTest, PacksAgainstTheBase) {
+  ConsoleSnapshot base, later, unpacked;
+  snapshot_after(0, base);
+  snapshot_after(30, later);
+  std::vector<uint8_t> packed;
+  Archive::pack(later, base, packed);
+  EXPECT_LT(packed.size(), sizeof(ConsoleSnapshot) / 4);
+  ASSERT_EQ(Archive::unpack(packed.data(), packed.size(), base, unpacked),
+            0);
+  EXPECT_EQ(memcmp(&unpacked, &later, sizeof later), 0);
+
+  Archive::pack(base, base, packed);
+  EXPECT_TRUE(packed.empty());
+  ASSERT_EQ(Archive::unpack(NULL, 0, base, unpacked), 0);
+  EXPECT_EQ(memcmp(&unpacked, &base, sizeof base), 0);
+
+  const uint8_t damaged[] = {0xFF, 0xFF, 0x7F, 0x01, 0x00};
+  EXPECT_EQ(Archive::unpack(damaged, sizeof damaged, base, unpacked), 1);
+  const uint8_t short_run[] = {0x00, 0x05, 0x01};
+  EXPECT_EQ(Archive::unpack(short_run, sizeof short_run, base, unpacked), 1);
+}
+
+TEST (ArchiveTest, KeepsTheBestStatePerCell) {
+  ConsoleSnapshot base, later, out;
+  snapshot_after(0, base);
+  snapshot_after(5, later);
+  Archive archive(base);
+  EXPECT_FALSE(archive.choose(1, out));
+  EXPECT_TRUE(archive.offer(7, 1.0, 100, base));
+  EXPECT_FALSE(archive.wants(7, 0.5, 10));  // less score
+  EXPECT_FALSE(archive.offer(7, 1.0, 100, later)); // no better
+  EXPECT_TRUE(archive.wants(7, 1.0, 99));  // as much, sooner
+  EXPECT_TRUE(archive.offer(7, 2.0, 200, later));
+  EXPECT_TRUE(archive.offer(8, 0.0, 1, base));
+  EXPECT_EQ(archive.get_size(), 2u);
+
+  Cell cell;
+  ASSERT_TRUE(archive.get(7, cell));
+  EXPECT_EQ(cell.score, 2.0);
+  EXPECT_EQ(cell.frames, 200u);
+  ASSERT_EQ(Archive::unpack(cell.state.data(), cell.state.size(),
+                            archive.get_base(), out), 0);
+  EXPECT_EQ(memcmp(&out, &later, sizeof later), 0);
+  EXPECT_FALSE(archive.get(9, cell));
+
+  // choosing spreads over the cells, the least chosen first
+  int chosen[2] = {0, 0};
+  for (uint32_t seed = 1; seed <= 40; seed++) {
+    Cell info;
+    ASSERT_TRUE(archive.choose(seed, out, &info));
+    chosen[info.key - 7]++;
+  }
+  EXPECT_GE(chosen[0], 15);
+  EXPECT_GE(chosen[1], 15);
+  std::vector<Cell> cells;
+  archive.get_cells(cells);
+  ASSERT_EQ(cells.size(), 2u);
+  EXPECT_EQ(cells[0].chosen + cells[1].chosen, 40u);
+}
+
+// threads offering overlapping cells end up with one state each
+TEST (ArchiveTest, ConcurrentOffers) {
+  ConsoleSnapshot base, out;
+  snapshot_after(0, base);
+  Archive archive(base);
+  const int threads = 4, keys = 2000;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&archive, &base, t] {
+      ConsoleSnapshot snapshot = base;
+      for (int key = 0; key < keys; key++) {
+        snapshot.ram[0] = uint8_t(t);
+        // the thread with the highest number has the best score
+        archive.offer(key, t, 10, snapshot);
+        ConsoleSnapshot chosen;
+        archive.choose(uint32_t(key * threads + t + 1), chosen);
+      }
+    }));
+  }
+  for (int t = 0; t < threads; t++) {
+    workers[t].join();
+  }
+  EXPECT_EQ(archive.get_size(), size_t(keys));
+  for (int key = 0; key < keys; key += 97) {
+    Cell cell;
+    ASSERT_TRUE(archive.get(key, cell));
+    EXPECT_EQ(cell.score, threads - 1);
+    ASSERT_EQ(Archive::unpack(cell.state.data(), cell.state.size(),
+                              archive.get_base(), out), 0);
+    EXPECT_EQ(out.ram[0], threads - 1);
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,212 @@
+#include "explorer.h"
+
+#include "console/state_hash.h"
+
+namespace nesemu {
+
+static uint32_t next_random(uint32_t& state) {
+  // xorshift32, never 0 once seeded with non-zero
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+Explorer::Explorer() {
+  cell = ram_cell;
+  cell_context = 0;
+  reward = 0;
+  reward_context = 0;
+  const uint8_t defaults[] = {
+    0, BUTTON_A, BUTTON_B, BUTTON_UP, BUTTON_DOWN, BUTTON_LEFT, BUTTON_RIGHT,
+    BUTTON_RIGHT | BUTTON_A, BUTTON_LEFT | BUTTON_A
+  };
+  actions.assign(defaults, defaults + sizeof defaults);
+  steps = 100;
+  repeat = 4;
+  sticky = uint32_t(0.95 * 4294967295.0);
+  seed = 1;
+}
+
+Explorer::~Explorer() {
+}
+
+int Explorer::init(const uint8_t* image, size_t size, int count,
+                   int threads) {
+  if (count < 1 || threads < 1) {
+    return 1;
+  }
+  std::vector<Slot> made(count);
+  for (int i = 0; i < count; i++) {
+    made[i].console.reset(new Console);
+    if (made[i].console->load_rom(image, size)) {
+      return 1;
+    }
+    made[i].console->get_ppu().set_render_mode(RENDER_NONE);
+    made[i].frames = 0;
+    made[i].plays = 0;
+    made[i].crashed = false;
+  }
+  slots.swap(made);
+  set_seed(seed);
+  pool.reset(new WorkerPool(threads));
+
+  ConsoleSnapshot start;
+  slots[0].console->save_snapshot(start);
+  archive.reset(new Archive(start));
+  archive->offer(cell(cell_context, *slots[0].console), 0, 0, start);
+  return 0;
+}
+
+/* Search settings */
+void Explorer::set_cell_function(CellFunction cell, void* context) {
+  this->cell = cell ? cell : ram_cell;
+  cell_context = context;
+}
+
+void Explorer::set_reward(RewardFunction reward, void* context) {
+  this->reward = reward;
+  reward_context = context;
+}
+
+void Explorer::set_actions(const std::vector<uint8_t>& actions) {
+  if (!actions.empty()) {
+    this->actions = actions;
+  }
+}
+
+void Explorer::set_scripts(
+    const std::vector<std::vector<uint8_t> >& scripts) {
+  this->scripts.clear();
+  for (size_t i = 0; i < scripts.size(); i++) {
+    if (!scripts[i].empty()) {
+      this->scripts.push_back(scripts[i]);
+    }
+  }
+}
+
+void Explorer::set_steps(int steps) {
+  this->steps = steps < 1 ? 1 : steps;
+}
+
+void Explorer::set_repeat(int frames) {
+  repeat = frames < 1 ? 1 : frames;
+}
+
+void Explorer::set_sticky_probability(double probability) {
+  probability = probability < 0 ? 0 : probability > 1 ? 1 : probability;
+  sticky = uint32_t(probability * 4294967295.0);
+}
+
+// every console draws from its own stream
+void Explorer::set_seed(uint32_t seed) {
+  this->seed = seed;
+  for (size_t i = 0; i < slots.size(); i++) {
+    uint32_t state = uint32_t(StateHash::mix(uint64_t(seed) << 32 | i));
+    slots[i].random = state ? state : 1;
+  }
+}
+
+/* Running */
+int Explorer::run(int iterations) {
+  if (slots.empty()) {
+    return 1;
+  }
+  for (int i = 0; i < iterations; i++) {
+    pool->run(int(slots.size()), 1, explore_batch, this);
+  }
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (slots[i].crashed) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void Explorer::explore_batch(void* context, int begin, int end) {
+  Explorer* explorer = static_cast<Explorer*>(context);
+  for (int i = begin; i < end; i++) {
+    explorer->play(explorer->slots[i]);
+  }
+}
+
+void Explorer::play(Slot& slot) {
+  Cell from;
+  if (slot.crashed ||
+      !archive->choose(next_random(slot.random), slot.snapshot, &from)) {
+    return;
+  }
+  Console& console = *slot.console;
+  console.load_snapshot(slot.snapshot);
+  const std::vector<uint8_t>* script = 0;
+  if (!scripts.empty()) {
+    script = &scripts[next_random(slot.random) % scripts.size()];
+  }
+  int count = script ? int(script->size()) : steps;
+  double score = from.score;
+  uint32_t frames = from.frames;
+  uint8_t action = 0;
+  for (int step = 0; step < count; step++) {
+    if (script) {
+      action = (*script)[step];
+    } else if (!step || next_random(slot.random) >= sticky) {
+      action = actions[next_random(slot.random) % actions.size()];
+    }
+    console.get_controller(0).set_buttons(action);
+    // the episode ends on the frame the reward function says so
+    bool done = false;
+    int played = 0;
+    while (played < repeat && !done) {
+      if (console.run_frame()) {
+        slot.crashed = true;
+        return;
+      }
+      played++;
+      if (reward) {
+        score += reward(reward_context, console, &done);
+      }
+    }
+    frames += played;
+    slot.frames += played;
+    if (done) {
+      break;
+    }
+    uint64_t key = cell(cell_context, console);
+    if (archive->wants(key, score, frames)) {
+      console.save_snapshot(slot.snapshot);
+      archive->offer(key, score, frames, slot.snapshot);
+    }
+  }
+  slot.plays++;
+}
+
+uint64_t Explorer::ram_cell(void* /* context */, const Console& console) {
+  return StateHash::hash_memory(console.get_ram(), 0x800);
+}
+
+/* Getters */
+Archive& Explorer::get_archive() {
+  return *archive;
+}
+
+int Explorer::get_count() const {
+  return int(slots.size());
+}
+
+uint64_t Explorer::get_frames() const {
+  uint64_t frames = 0;
+  for (size_t i = 0; i < slots.size(); i++) {
+    frames += slots[i].frames;
+  }
+  return frames;
+}
+
+uint64_t Explorer::get_plays() const {
+  uint64_t plays = 0;
+  for (size_t i = 0; i < slots.size(); i++) {
+    plays += slots[i].plays;
+  }
+  return plays;
+}
+
+} // namespace nesemu
@@ -0,0 +1,98 @@
+#ifndef NESEMU_EXPLORE_EXPLORER_H_
+#define NESEMU_EXPLORE_EXPLORER_H_
+
+#include "archive.h"
+#include "env/vec_env.h"
+#include "env/worker_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace nesemu {
+
+// the cell a console's state falls in, e.g. from its RAM
+typedef uint64_t (*CellFunction)(void* context, const Console& console);
+
+/* Go-Explore style search over a game's states
+  An iteration has each of N consoles choose a cell from the archive,
+  load its state and play on from it: random actions from the action
+  set, each held for repeat frames and kept with sticky_probability, or
+  a script drawn from the scripts given. After every action the console's
+  cell is worked out and the archive offered the state, which it keeps
+  when the cell is new or the state reaches it with more score or in
+  fewer frames. A play stops after steps actions, or when the reward
+  function signals done, e.g. a life lost; that state is not offered.
+
+  The consoles are spread over a WorkerPool, one item each, and only meet
+  in the archive's shards, so iterations scale with the threads. Without
+  a cell function a cell is the hash of all of RAM, which only folds
+  exact duplicates.
+*/
+class Explorer {
+  public:
+    Explorer();
+    ~Explorer();
+
+    // Loads the image into count consoles run by threads workers and
+    // seeds the archive with the state after power on. Returns 1 on a bad
+    // image or count.
+    int init(const uint8_t* image, size_t size, int count, int threads = 1);
+
+    /* Search settings, between iterations */
+    void set_cell_function(CellFunction cell, void* context);
+    void set_reward(RewardFunction reward, void* context);
+    void set_actions(const std::vector<uint8_t>& actions); // not empty
+    void set_scripts(const std::vector<std::vector<uint8_t> >& scripts);
+    void set_steps(int steps);   // actions per play, 1 -
+    void set_repeat(int frames); // frames per action, 1 -
+    void set_sticky_probability(double probability);
+    void set_seed(uint32_t seed);
+
+    // Runs iterations of every console exploring from a chosen cell.
+    // Returns 1 if a console met an opcode the CPU does not know.
+    int run(int iterations);
+
+    Archive& get_archive();
+    int get_count() const;
+    uint64_t get_frames() const; // emulated, by all consoles
+    uint64_t get_plays() const;
+
+  private:
+    Explorer(const Explorer&);
+    Explorer& operator=(const Explorer&);
+
+    // one console and what it works with, on its own cache lines
+    struct alignas(WorkerPool::CACHE_LINE) Slot {
+      std::unique_ptr<Console> console;
+      ConsoleSnapshot snapshot;
+      uint32_t random;
+      uint64_t frames;
+      uint64_t plays;
+      bool crashed;
+    };
+
+    std::vector<Slot> slots;
+    std::unique_ptr<WorkerPool> pool;
+    std::unique_ptr<Archive> archive;
+
+    CellFunction cell;
+    void* cell_context;
+    RewardFunction reward;
+    void* reward_context;
+    std::vector<uint8_t> actions;
+    std::vector<std::vector<uint8_t> > scripts;
+    int steps;
+    int repeat;
+    uint32_t sticky; // probability in 1/2^32
+    uint32_t seed;
+
+    static uint64_t ram_cell(void* context, const Console& console);
+    static void explore_batch(void* context, int begin, int end);
+    void play(Slot& slot);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_EXPLORE_EXPLORER_H_
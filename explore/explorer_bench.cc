@@ -0,0 +1,44 @@
+#include "explorer.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace nesemu;
+
+// a coarse cell: frame count modulo 64 and the held A button
+static uint64_t frame_cell(void* /* context */, const Console& console) {
+  return (console.get_ram()[0x12] & 0x3F) | console.get_ram()[0x11] << 8;
+}
+
+// Frames per second of exploration on 1 to 64 threads, with a console
+// per thread times four, against the one thread rate.
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  int cpus = int(std::thread::hardware_concurrency());
+  printf("Exploration, %d CPUs\n", cpus);
+  printf("  threads  frames/s   scaling    cells  KB packed\n");
+  double single = 0;
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    Explorer explorer;
+    explorer.set_cell_function(frame_cell, NULL);
+    explorer.set_steps(25);
+    explorer.init(&image[0], image.size(), threads * 4, threads);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    explorer.run(4);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double rate = explorer.get_frames() / elapsed.count();
+    if (threads == 1) {
+      single = rate;
+    }
+    printf("  %7d  %8.0f  %7.0f%%  %7zu  %9.1f\n", threads, rate,
+           100 * rate / (single * (threads < cpus ? threads : cpus)),
+           explorer.get_archive().get_size(),
+           explorer.get_archive().get_packed_bytes() / 1024.0);
+  }
+  return 0;
+}
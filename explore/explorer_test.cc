@@ -0,0 +1,114 @@
+#include "explorer.h"
+
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+namespace nesemu {
+
+// the test program's frame count and held A button
+static uint64_t frame_cell(void* /* context */, const Console& console) {
+  return console.get_ram()[0x12] | console.get_ram()[0x11] << 8;
+}
+
+static float a_held(void* /* context */, const Console& console,
+                    bool* /* done */) {
+  return console.get_ram()[0x11] ? 1.0f : 0.0f;
+}
+
+static float end_at_once(void* /* context */, const Console& /* console */,
+                         bool* done) {
+  *done = true;
+  return 1.0f;
+}
+
+TEST (ExplorerTest, BadArguments) {
+  std::vector<uint8_t> image = make_test_rom();
+  Explorer explorer;
+  EXPECT_EQ(explorer.run(1), 1); // not initialized
+  EXPECT_EQ(explorer.init(&image[0], image.size(), 0), 1);
+  EXPECT_EQ(explorer.init(&image[0], 10, 2), 1);
+  ASSERT_EQ(explorer.init(&image[0], image.size(), 2), 0);
+  EXPECT_EQ(explorer.get_count(), 2);
+  EXPECT_EQ(explorer.get_archive().get_size(), 1u); // the start
+}
+
+TEST (ExplorerTest, FindsNewCells) {
+  std::vector<uint8_t> image = make_test_rom();
+  Explorer explorer;
+  explorer.set_cell_function(frame_cell, NULL);
+  explorer.set_reward(a_held, NULL);
+  explorer.set_steps(5);
+  explorer.set_repeat(2);
+  ASSERT_EQ(explorer.init(&image[0], image.size(), 4, 2), 0);
+  ASSERT_EQ(explorer.run(10), 0);
+  Archive& archive = explorer.get_archive();
+  EXPECT_GT(archive.get_size(), 20u);
+  EXPECT_EQ(explorer.get_plays(), 40u);
+  EXPECT_GT(explorer.get_frames(), 40u * 2);
+
+  // each cell's state is reached in as few frames as the cell says
+  std::vector<Cell> cells;
+  archive.get_cells(cells);
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  for (size_t i = 0; i < cells.size(); i++) {
+    ConsoleSnapshot snapshot;
+    ASSERT_EQ(Archive::unpack(cells[i].state.data(), cells[i].state.size(),
+                              archive.get_base(), snapshot), 0);
+    console.load_snapshot(snapshot);
+    EXPECT_EQ(frame_cell(NULL, console), cells[i].key);
+    EXPECT_EQ(console.get_frame_count(), cells[i].frames);
+    EXPECT_LE(cells[i].score, cells[i].frames);
+  }
+}
+
+// no frames are played past the one that ends the episode
+TEST (ExplorerTest, DoneStopsRepeat) {
+  std::vector<uint8_t> image = make_test_rom();
+  Explorer explorer;
+  explorer.set_reward(end_at_once, NULL);
+  explorer.set_repeat(4);
+  ASSERT_EQ(explorer.init(&image[0], image.size(), 2, 1), 0);
+  ASSERT_EQ(explorer.run(3), 0);
+  EXPECT_EQ(explorer.get_plays(), 6u);
+  EXPECT_EQ(explorer.get_frames(), 6u);
+  EXPECT_EQ(explorer.get_archive().get_size(), 1u); // nothing offered
+}
+
+// one thread and a seed repeat a search exactly
+TEST (ExplorerTest, Deterministic) {
+  std::vector<uint8_t> image = make_test_rom();
+  size_t sizes[2];
+  for (int run = 0; run < 2; run++) {
+    Explorer explorer;
+    explorer.set_cell_function(frame_cell, NULL);
+    explorer.set_steps(3);
+    explorer.set_seed(99);
+    ASSERT_EQ(explorer.init(&image[0], image.size(), 3), 0);
+    ASSERT_EQ(explorer.run(5), 0);
+    sizes[run] = explorer.get_archive().get_size();
+  }
+  EXPECT_EQ(sizes[0], sizes[1]);
+}
+
+TEST (ExplorerTest, PlaysScripts) {
+  std::vector<uint8_t> image = make_test_rom();
+  Explorer explorer;
+  explorer.set_cell_function(frame_cell, NULL);
+  std::vector<std::vector<uint8_t> > scripts(1,
+                                             std::vector<uint8_t>(4, 0));
+  explorer.set_scripts(scripts);
+  explorer.set_repeat(1);
+  ASSERT_EQ(explorer.init(&image[0], image.size(), 1), 0);
+  ASSERT_EQ(explorer.run(3), 0);
+  // never pressing A, only frame counts 0 - 12 are reached
+  std::vector<Cell> cells;
+  explorer.get_archive().get_cells(cells);
+  for (size_t i = 0; i < cells.size(); i++) {
+    EXPECT_LT(cells[i].key, 0x100u);
+  }
+  EXPECT_EQ(explorer.get_frames(), 12u);
+}
+
+} // namespace nesemu
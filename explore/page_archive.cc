@@ -0,0 +1,164 @@
+#include "page_archive.h"
+
+#include "console/state_hash.h"
+
+#include <cstring>
+#include <utility>
+
+namespace nesemu {
+
+const size_t PageArchive::PAGE_SIZE;
+const uint32_t PageArchive::NONE;
+
+PageArchive::PageArchive(size_t page_size, PageHash hash) {
+  const size_t line = StateHash::LINE_SIZE;
+  if (!page_size) {
+    page_size = PAGE_SIZE;
+  }
+  this->page_size = (page_size + line - 1) / line * line;
+  pages_per_state =
+      (sizeof(ConsoleSnapshot) + this->page_size - 1) / this->page_size;
+  this->hash = hash ? hash : StateHash::hash_memory;
+  page_count = 0;
+  state_count = 0;
+}
+
+/* Pages */
+// The page holding these bytes, shared or new, with one more reference.
+uint32_t PageArchive::intern(const uint8_t* page) {
+  uint64_t key = hash(page, page_size);
+  std::pair<PageIndex::iterator, PageIndex::iterator> found =
+      index.equal_range(key);
+  for (PageIndex::iterator it = found.first; it != found.second; ++it) {
+    if (!memcmp(&pages[size_t(it->second) * page_size], page, page_size)) {
+      references[it->second]++;
+      return it->second;
+    }
+  }
+  uint32_t id;
+  if (!free_pages.empty()) {
+    id = free_pages.back();
+    free_pages.pop_back();
+  } else {
+    id = uint32_t(references.size());
+    references.push_back(0);
+    hashes.push_back(0);
+    pages.resize(pages.size() + page_size);
+  }
+  memcpy(&pages[size_t(id) * page_size], page, page_size);
+  hashes[id] = key;
+  references[id] = 1;
+  index.insert(std::make_pair(key, id));
+  page_count++;
+  return id;
+}
+
+// other pages with the same hash keep their entries
+void PageArchive::release(uint32_t page) {
+  if (--references[page]) {
+    return;
+  }
+  std::pair<PageIndex::iterator, PageIndex::iterator> found =
+      index.equal_range(hashes[page]);
+  for (PageIndex::iterator it = found.first; it != found.second; ++it) {
+    if (it->second == page) {
+      index.erase(it);
+      break;
+    }
+  }
+  free_pages.push_back(page);
+  page_count--;
+}
+
+/* States */
+uint32_t PageArchive::add(const ConsoleSnapshot& snapshot) {
+  uint32_t state;
+  if (!free_states.empty()) {
+    state = free_states.back();
+    free_states.pop_back();
+  } else {
+    state = uint32_t(live.size());
+    live.push_back(0);
+    lists.resize(lists.size() + pages_per_state);
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&snapshot);
+  const size_t size = sizeof(ConsoleSnapshot);
+  uint32_t* list = &lists[size_t(state) * pages_per_state];
+  std::vector<uint8_t> last(page_size, 0);
+  for (size_t i = 0; i < pages_per_state; i++) {
+    size_t at = i * page_size;
+    if (at + page_size <= size) {
+      list[i] = intern(bytes + at);
+    } else {
+      memcpy(&last[0], bytes + at, size - at);
+      list[i] = intern(&last[0]);
+    }
+  }
+  live[state] = 1;
+  state_count++;
+  return state;
+}
+
+int PageArchive::restore(uint32_t state, ConsoleSnapshot& snapshot) const {
+  if (!contains(state)) {
+    return 1;
+  }
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&snapshot);
+  const size_t size = sizeof(ConsoleSnapshot);
+  const uint32_t* list = &lists[size_t(state) * pages_per_state];
+  const uint8_t* base = &pages[0];
+  size_t at = 0;
+  for (size_t i = 0; i + 1 < pages_per_state; i++, at += page_size) {
+    memcpy(bytes + at, base + size_t(list[i]) * page_size, page_size);
+  }
+  memcpy(bytes + at, base + size_t(list[pages_per_state - 1]) * page_size,
+         size - at);
+  return 0;
+}
+
+void PageArchive::remove(uint32_t state) {
+  if (!contains(state)) {
+    return;
+  }
+  const uint32_t* list = &lists[size_t(state) * pages_per_state];
+  for (size_t i = 0; i < pages_per_state; i++) {
+    release(list[i]);
+  }
+  live[state] = 0;
+  free_states.push_back(state);
+  state_count--;
+}
+
+bool PageArchive::contains(uint32_t state) const {
+  return state < live.size() && live[state];
+}
+
+/* Sizes */
+size_t PageArchive::get_page_size() const {
+  return page_size;
+}
+
+size_t PageArchive::get_pages_per_state() const {
+  return pages_per_state;
+}
+
+size_t PageArchive::get_states() const {
+  return state_count;
+}
+
+size_t PageArchive::get_pages() const {
+  return page_count;
+}
+
+size_t PageArchive::get_stored_bytes() const {
+  return page_count * page_size +
+         state_count * pages_per_state * sizeof(uint32_t);
+}
+
+double PageArchive::get_dedup_ratio() const {
+  size_t stored = get_stored_bytes();
+  return stored ? double(state_count) * sizeof(ConsoleSnapshot) / stored
+                : 0.0;
+}
+
+} // namespace nesemu
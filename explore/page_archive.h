@@ -0,0 +1,81 @@
+#ifndef NESEMU_EXPLORE_PAGE_ARCHIVE_H_
+#define NESEMU_EXPLORE_PAGE_ARCHIVE_H_
+
+#include "console/console.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace nesemu {
+
+/* Snapshots stored as lists of shared pages
+  A snapshot is cut into fixed-size pages, the last one padded with zeros,
+  and each page is looked up by its StateHash: a page some stored state
+  already has is shared and counted, only a new one is copied in. States
+  of one game differ in a few pages of RAM and nametables, while CHR, PRG
+  RAM and most of the rest repeat, so a state costs its list of page ids
+  and the few pages only it has. Restoring is a memcpy per page.
+
+  Pages that hash the same but differ are told apart by comparing them,
+  each is indexed under the hash and shared on its own. Pages and states
+  no longer used are reused before the arrays grow. Not locked, one
+  thread at a time.
+*/
+class PageArchive {
+  public:
+    typedef uint64_t (*PageHash)(const uint8_t* page, size_t size);
+
+    // page_size is a multiple of StateHash::LINE_SIZE, 0 picks PAGE_SIZE.
+    // hash 0 picks StateHash::hash_memory, tests pass a weaker one to make
+    // pages collide.
+    explicit PageArchive(size_t page_size = 0, PageHash hash = 0);
+
+    static const size_t PAGE_SIZE = 256;
+    static const uint32_t NONE = 0xFFFFFFFF; // no state
+
+    uint32_t add(const ConsoleSnapshot& snapshot); // returns its id
+    // Returns 1 on an id not in the archive.
+    int restore(uint32_t state, ConsoleSnapshot& snapshot) const;
+    void remove(uint32_t state);
+    bool contains(uint32_t state) const;
+
+    size_t get_page_size() const;
+    size_t get_pages_per_state() const;
+    size_t get_states() const;
+    size_t get_pages() const;  // distinct, in use
+    size_t get_stored_bytes() const; // pages and page lists
+    // what the states would take as whole snapshots, over stored bytes
+    double get_dedup_ratio() const;
+
+  private:
+    PageArchive(const PageArchive&);
+    PageArchive& operator=(const PageArchive&);
+
+    size_t page_size;
+    size_t pages_per_state;
+    PageHash hash;
+
+    /* Pages */
+    std::vector<uint8_t> pages;
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> references; // 0 for a free page
+    std::vector<uint32_t> free_pages;
+    typedef std::unordered_multimap<uint64_t, uint32_t> PageIndex;
+    PageIndex index; // hash to the pages with it
+    size_t page_count;
+
+    /* States, pages_per_state page ids each */
+    std::vector<uint32_t> lists;
+    std::vector<uint8_t> live;
+    std::vector<uint32_t> free_states;
+    size_t state_count;
+
+    uint32_t intern(const uint8_t* page);
+    void release(uint32_t page);
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_EXPLORE_PAGE_ARCHIVE_H_
@@ -0,0 +1,78 @@
+#include "archive.h"
+#include "page_archive.h"
+
+#include "console/test_rom.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace nesemu;
+
+static const int STATES = 1000;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Every state of STATES frames stored as shared pages of several sizes and
+// as runs packed against the first state: bytes kept for each against
+// whole snapshots, and how fast states go in and come back out.
+int main() {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  console.load_rom(&image[0], image.size());
+  std::vector<ConsoleSnapshot> states(STATES);
+  for (int i = 0; i < STATES; i++) {
+    console.get_controller(0).set_buttons(i & 16 ? BUTTON_A : 0);
+    console.run_frame();
+    console.save_snapshot(states[i]);
+  }
+  ConsoleSnapshot* restored = new ConsoleSnapshot;
+  const double whole = double(STATES) * sizeof(ConsoleSnapshot);
+
+  printf("%d states of %zu bytes\n", STATES, sizeof(ConsoleSnapshot));
+  printf("                  dedup   add us   restore GB/s\n");
+  const size_t sizes[] = {128, 256, 512, 1024, 4096};
+  for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+    PageArchive archive(sizes[s]);
+    std::vector<uint32_t> ids(STATES);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int i = 0; i < STATES; i++) {
+      ids[i] = archive.add(states[i]);
+    }
+    double add = seconds_since(start) * 1e6 / STATES;
+    const int rounds = 5;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+      for (int i = 0; i < STATES; i++) {
+        archive.restore(ids[i], *restored);
+      }
+    }
+    double restore = whole * rounds / seconds_since(start) / 1e9;
+    printf("  %4zu byte pages %6.1fx %8.2f %14.2f\n", sizes[s],
+           archive.get_dedup_ratio(), add, restore);
+  }
+
+  std::vector<std::vector<uint8_t> > packed(STATES);
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < STATES; i++) {
+    Archive::pack(states[i], states[0], packed[i]);
+    bytes += packed[i].size();
+  }
+  double add = seconds_since(start) * 1e6 / STATES;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < STATES; i++) {
+    Archive::unpack(packed[i].data(), packed[i].size(), states[0],
+                    *restored);
+  }
+  double restore = whole / seconds_since(start) / 1e9;
+  printf("  packed runs     %6.1fx %8.2f %14.2f\n", whole / bytes, add,
+         restore);
+  delete restored;
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "page_archive.h"
+
+#include "console/state_hash.h"
+#include "console/test_rom.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace nesemu {
+
+// the state after each of frames frames
+static void play(std::vector<ConsoleSnapshot>& states, int frames) {
+  std::vector<uint8_t> image = make_test_rom();
+  Console console;
+  ASSERT_EQ(console.load_rom(&image[0], image.size()), 0);
+  states.resize(frames);
+  for (int frame = 0; frame < frames; frame++) {
+    console.get_controller(0).set_buttons(frame & 4 ? BUTTON_A : 0);
+    ASSERT_EQ(console.run_frame(), 0);
+    console.save_snapshot(states[frame]);
+  }
+}
+
+TEST (PageArchiveTest, RestoresWhatWasAdded) {
+  std::vector<ConsoleSnapshot> states;
+  play(states, 30);
+  const size_t sizes[] = {0, 100, 1024};
+  for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+    PageArchive archive(sizes[s]);
+    EXPECT_EQ(archive.get_page_size() % StateHash::LINE_SIZE, 0u);
+    EXPECT_GE(archive.get_page_size() * archive.get_pages_per_state(),
+              sizeof(ConsoleSnapshot));
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < states.size(); i++) {
+      ids.push_back(archive.add(states[i]));
+    }
+    EXPECT_EQ(archive.get_states(), states.size());
+    // frames of one game share most of their pages
+    EXPECT_GT(archive.get_dedup_ratio(), 4.0) << "page size " << sizes[s];
+    std::unique_ptr<ConsoleSnapshot> restored(new ConsoleSnapshot);
+    for (size_t i = 0; i < states.size(); i++) {
+      ASSERT_EQ(archive.restore(ids[i], *restored), 0);
+      EXPECT_EQ(memcmp(restored.get(), &states[i], sizeof(ConsoleSnapshot)),
+                0) << "state " << i;
+    }
+    EXPECT_EQ(archive.restore(PageArchive::NONE, *restored), 1);
+  }
+}
+
+TEST (PageArchiveTest, CountsReferences) {
+  std::vector<ConsoleSnapshot> states;
+  play(states, 2);
+  PageArchive archive;
+  uint32_t first = archive.add(states[0]);
+  size_t pages = archive.get_pages();
+  EXPECT_GT(pages, 0u);
+  EXPECT_LE(pages, archive.get_pages_per_state());
+  uint32_t again = archive.add(states[0]);
+  EXPECT_NE(again, first);
+  EXPECT_EQ(archive.get_pages(), pages);
+  uint32_t second = archive.add(states[1]);
+  size_t both = archive.get_pages();
+  EXPECT_GT(both, pages);
+
+  // a page goes once no state uses it
+  archive.remove(first);
+  EXPECT_FALSE(archive.contains(first));
+  EXPECT_EQ(archive.get_pages(), both);
+  archive.remove(again);
+  EXPECT_LT(archive.get_pages(), both);
+  archive.remove(again);
+  EXPECT_EQ(archive.get_states(), 1u);
+
+  std::unique_ptr<ConsoleSnapshot> restored(new ConsoleSnapshot);
+  ASSERT_EQ(archive.restore(second, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[1], sizeof(ConsoleSnapshot)), 0);
+  archive.remove(second);
+  EXPECT_EQ(archive.get_pages(), 0u);
+  EXPECT_EQ(archive.get_stored_bytes(), 0u);
+
+  // freed ids and pages are used again
+  uint32_t reused = archive.add(states[1]);
+  EXPECT_TRUE(reused == first || reused == again || reused == second);
+  ASSERT_EQ(archive.restore(reused, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[1], sizeof(ConsoleSnapshot)), 0);
+}
+
+// every page under one hash
+static uint64_t same_hash(const uint8_t* /* page */, size_t /* size */) {
+  return 1;
+}
+
+// colliding pages are told apart, shared and freed like any others
+TEST (PageArchiveTest, SharesCollidingPages) {
+  std::vector<ConsoleSnapshot> states;
+  play(states, 2);
+  PageArchive archive(0, same_hash);
+  PageArchive plain;
+  uint32_t first = archive.add(states[0]);
+  plain.add(states[0]);
+  EXPECT_GT(archive.get_pages(), 1u);
+  EXPECT_EQ(archive.get_pages(), plain.get_pages());
+  uint32_t second = archive.add(states[1]);
+  plain.add(states[1]);
+  EXPECT_EQ(archive.get_pages(), plain.get_pages());
+
+  std::unique_ptr<ConsoleSnapshot> restored(new ConsoleSnapshot);
+  ASSERT_EQ(archive.restore(first, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[0], sizeof(ConsoleSnapshot)), 0);
+
+  // the pages only the first state had go, the rest are still found
+  archive.remove(first);
+  plain.remove(0);
+  EXPECT_EQ(archive.get_pages(), plain.get_pages());
+  ASSERT_EQ(archive.restore(second, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[1], sizeof(ConsoleSnapshot)), 0);
+  size_t pages = archive.get_pages();
+  archive.add(states[1]);
+  EXPECT_EQ(archive.get_pages(), pages);
+
+  uint32_t again = archive.add(states[0]);
+  plain.add(states[0]);
+  EXPECT_EQ(archive.get_pages(), plain.get_pages());
+  ASSERT_EQ(archive.restore(again, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[0], sizeof(ConsoleSnapshot)), 0);
+  ASSERT_EQ(archive.restore(second, *restored), 0);
+  EXPECT_EQ(memcmp(restored.get(), &states[1], sizeof(ConsoleSnapshot)), 0);
+}
+
+} // namespace nesemu
@@ -0,0 +1,390 @@
+#include "palette.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NESEMU_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace nesemu {
+
+const uint32_t nes_rgba[64] = {
+  0xFF666666, 0xFF882A00, 0xFFA71214, 0xFFA4003B, 0xFF7E005C, 0xFF40006E, 0xFF00066C, 0xFF001D56,
+  0xFF003533, 0xFF00480B, 0xFF005200, 0xFF084F00, 0xFF4D4000, 0xFF000000, 0xFF000000, 0xFF000000,
+  0xFFADADAD, 0xFFD95F15, 0xFFFF4042, 0xFFFE2775, 0xFFCC1AA0, 0xFF7B1EB7, 0xFF2031B5, 0xFF004E99,
+  0xFF006D6B, 0xFF008738, 0xFF00930C, 0xFF328F00, 0xFF8D7C00, 0xFF000000, 0xFF000000, 0xFF000000,
+  0xFFFFFEFF, 0xFFFFB064, 0xFFFF9092, 0xFFFF76C6, 0xFFFF6AF3, 0xFFCC6EFE, 0xFF7081FE, 0xFF229EEA,
+  0xFF00BEBC, 0xFF00D888, 0xFF30E45C, 0xFF82E045, 0xFFDECD48, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+  0xFFFFFEFF, 0xFFFFDFC0, 0xFFFFD2D3, 0xFFFFC8E8, 0xFFFFC2FB, 0xFFEAC4FE, 0xFFC5CCFE, 0xFFA5D8F7,
+  0xFF94E5E4, 0xFF96EFCF, 0xFFABF4BD, 0xFFCCF3B3, 0xFFF2EBB5, 0xFFB8B8B8, 0xFF000000, 0xFF000000
+};
+
+const uint8_t nes_luma[64] = {
+  102,  40,  35,  36,  42,  40,  36,  43,  46,  45,  48,  47,  46,   0,   0,   0,
+  173,  87,  86,  87,  86,  87,  87,  92,  96,  96,  90,  89,  89,   0,   0,   0,
+  254, 162, 157, 158, 164, 164, 165, 167, 168, 167, 167, 167, 167,  79,   0,   0,
+  254, 217, 215, 216, 218, 218, 218, 220, 220, 219, 219, 219, 220, 184,   0,   0
+};
+
+/* Scalar kernels */
+static void index_to_rgba_scalar(const uint8_t* indices, uint32_t* out,
+                                 size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = nes_rgba[indices[i] & 0x3F];
+  }
+}
+
+static void index_to_luma_scalar(const uint8_t* indices, uint8_t* out,
+                                 size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = nes_luma[indices[i] & 0x3F];
+  }
+}
+
+static void compose_scalar(const uint8_t* bg, const uint8_t* sprite,
+                           const uint8_t* palette_ram, uint8_t* out,
+                           size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    uint8_t b = bg[i];
+    uint8_t s = sprite[i];
+    uint8_t address = (b & 0x03) ? (b & 0x0F) : 0; // backdrop if transparent
+    if ((s & 0x03) && (!(b & 0x03) || !(s & 0x20))) { // sprite in front
+      address = s & 0x1F;
+    }
+    out[i] = palette_ram[address] & 0x3F;
+  }
+}
+
+static const PixelKernels scalar_kernels = {
+  index_to_rgba_scalar,
+  index_to_luma_scalar,
+  compose_scalar
+};
+
+#ifdef NESEMU_X86
+
+// nes_rgba split into planes, 4 rows of 16 so each row fits one pshufb table
+static const uint8_t rgb_planes[3][64] = {
+  { // R
+    0x66, 0x00, 0x14, 0x3B, 0x5C, 0x6E, 0x6C, 0x56, 0x33, 0x0B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xAD, 0x15, 0x42, 0x75, 0xA0, 0xB7, 0xB5, 0x99, 0x6B, 0x38, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xFF, 0x64, 0x92, 0xC6, 0xF3, 0xFE, 0xFE, 0xEA, 0xBC, 0x88, 0x5C, 0x45, 0x48, 0x4F, 0x00, 0x00,
+    0xFF, 0xC0, 0xD3, 0xE8, 0xFB, 0xFE, 0xFE, 0xF7, 0xE4, 0xCF, 0xBD, 0xB3, 0xB5, 0xB8, 0x00, 0x00
+  },
+  { // G
+    0x66, 0x2A, 0x12, 0x00, 0x00, 0x00, 0x06, 0x1D, 0x35, 0x48, 0x52, 0x4F, 0x40, 0x00, 0x00, 0x00,
+    0xAD, 0x5F, 0x40, 0x27, 0x1A, 0x1E, 0x31, 0x4E, 0x6D, 0x87, 0x93, 0x8F, 0x7C, 0x00, 0x00, 0x00,
+    0xFE, 0xB0, 0x90, 0x76, 0x6A, 0x6E, 0x81, 0x9E, 0xBE, 0xD8, 0xE4, 0xE0, 0xCD, 0x4F, 0x00, 0x00,
+    0xFE, 0xDF, 0xD2, 0xC8, 0xC2, 0xC4, 0xCC, 0xD8, 0xE5, 0xEF, 0xF4, 0xF3, 0xEB, 0xB8, 0x00, 0x00
+  },
+  { // B
+    0x66, 0x88, 0xA7, 0xA4, 0x7E, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x4D, 0x00, 0x00, 0x00,
+    0xAD, 0xD9, 0xFF, 0xFE, 0xCC, 0x7B, 0x20, 0x00, 0x00, 0x00, 0x00, 0x32, 0x8D, 0x00, 0x00, 0x00,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xCC, 0x70, 0x22, 0x00, 0x00, 0x30, 0x82, 0xDE, 0x4F, 0x00, 0x00,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEA, 0xC5, 0xA5, 0x94, 0x96, 0xAB, 0xCC, 0xF2, 0xB8, 0x00, 0x00
+  }
+};
+
+/* SSSE3 kernels, 16 pixels per iteration */
+
+// 64 entry byte table lookup: one pshufb per row of 16, picked by bits 4-5
+__attribute__((target("ssse3")))
+static inline __m128i lookup64_ssse3(__m128i index, const __m128i table[4]) {
+  __m128i row = _mm_and_si128(index, _mm_set1_epi8(0x30));
+  __m128i r0 = _mm_and_si128(_mm_cmpeq_epi8(row, _mm_setzero_si128()),
+                             _mm_shuffle_epi8(table[0], index));
+  __m128i r1 = _mm_and_si128(_mm_cmpeq_epi8(row, _mm_set1_epi8(0x10)),
+                             _mm_shuffle_epi8(table[1], index));
+  __m128i r2 = _mm_and_si128(_mm_cmpeq_epi8(row, _mm_set1_epi8(0x20)),
+                             _mm_shuffle_epi8(table[2], index));
+  __m128i r3 = _mm_and_si128(_mm_cmpeq_epi8(row, _mm_set1_epi8(0x30)),
+                             _mm_shuffle_epi8(table[3], index));
+  return _mm_or_si128(_mm_or_si128(r0, r1), _mm_or_si128(r2, r3));
+}
+
+__attribute__((target("ssse3")))
+static void load_table_ssse3(const uint8_t* source, __m128i table[4]) {
+  for (int i = 0; i < 4; i++) {
+    table[i] = _mm_loadu_si128((const __m128i*)(source + 16 * i));
+  }
+}
+
+__attribute__((target("ssse3")))
+static void index_to_rgba_ssse3(const uint8_t* indices, uint32_t* out,
+                                size_t count) {
+  __m128i r_table[4], g_table[4], b_table[4];
+  load_table_ssse3(rgb_planes[0], r_table);
+  load_table_ssse3(rgb_planes[1], g_table);
+  load_table_ssse3(rgb_planes[2], b_table);
+  const __m128i mask = _mm_set1_epi8(0x3F);
+  const __m128i alpha = _mm_set1_epi8(char(0xFF));
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i index = _mm_and_si128(
+        _mm_loadu_si128((const __m128i*)(indices + i)), mask);
+    __m128i r = lookup64_ssse3(index, r_table);
+    __m128i g = lookup64_ssse3(index, g_table);
+    __m128i b = lookup64_ssse3(index, b_table);
+    // interleave the planes back into R, G, B, A pixels
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, alpha);
+    __m128i ba_hi = _mm_unpackhi_epi8(b, alpha);
+    __m128i* dest = (__m128i*)(out + i);
+    _mm_storeu_si128(dest + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+  }
+  index_to_rgba_scalar(indices + i, out + i, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void index_to_luma_ssse3(const uint8_t* indices, uint8_t* out,
+                                size_t count) {
+  __m128i table[4];
+  load_table_ssse3(nes_luma, table);
+  const __m128i mask = _mm_set1_epi8(0x3F);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i index = _mm_and_si128(
+        _mm_loadu_si128((const __m128i*)(indices + i)), mask);
+    _mm_storeu_si128((__m128i*)(out + i), lookup64_ssse3(index, table));
+  }
+  index_to_luma_scalar(indices + i, out + i, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void compose_ssse3(const uint8_t* bg, const uint8_t* sprite,
+                          const uint8_t* palette_ram, uint8_t* out,
+                          size_t count) {
+  const __m128i mask = _mm_set1_epi8(0x3F);
+  const __m128i pal_lo = _mm_and_si128(
+      _mm_loadu_si128((const __m128i*)palette_ram), mask);
+  const __m128i pal_hi = _mm_and_si128(
+      _mm_loadu_si128((const __m128i*)(palette_ram + 16)), mask);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i pixel = _mm_set1_epi8(0x03);
+  const __m128i behind = _mm_set1_epi8(0x20);
+  const __m128i upper = _mm_set1_epi8(0x10);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i*)(bg + i));
+    __m128i s = _mm_loadu_si128((const __m128i*)(sprite + i));
+    __m128i b_clear = _mm_cmpeq_epi8(_mm_and_si128(b, pixel), zero);
+    __m128i s_clear = _mm_cmpeq_epi8(_mm_and_si128(s, pixel), zero);
+    __m128i s_behind = _mm_cmpeq_epi8(_mm_and_si128(s, behind), behind);
+    // background wins if the sprite is transparent or behind opaque bg
+    __m128i bg_wins = _mm_or_si128(s_clear, _mm_andnot_si128(b_clear, s_behind));
+    __m128i bg_address = _mm_andnot_si128(
+        b_clear, _mm_and_si128(b, _mm_set1_epi8(0x0F)));
+    __m128i s_address = _mm_and_si128(s, _mm_set1_epi8(0x1F));
+    __m128i address = _mm_or_si128(_mm_and_si128(bg_wins, bg_address),
+                                   _mm_andnot_si128(bg_wins, s_address));
+    // 32 entry palette lookup
+    __m128i use_hi = _mm_cmpeq_epi8(_mm_and_si128(address, upper), upper);
+    __m128i color = _mm_or_si128(
+        _mm_and_si128(use_hi, _mm_shuffle_epi8(pal_hi, address)),
+        _mm_andnot_si128(use_hi, _mm_shuffle_epi8(pal_lo, address)));
+    _mm_storeu_si128((__m128i*)(out + i), color);
+  }
+  compose_scalar(bg + i, sprite + i, palette_ram, out + i, count - i);
+}
+
+static const PixelKernels ssse3_kernels = {
+  index_to_rgba_ssse3,
+  index_to_luma_ssse3,
+  compose_ssse3
+};
+
+/* AVX2 kernels, 32 pixels per iteration */
+
+__attribute__((target("avx2")))
+static inline __m256i lookup64_avx2(__m256i index, const __m256i table[4]) {
+  __m256i row = _mm256_and_si256(index, _mm256_set1_epi8(0x30));
+  __m256i r0 = _mm256_and_si256(_mm256_cmpeq_epi8(row, _mm256_setzero_si256()),
+                                _mm256_shuffle_epi8(table[0], index));
+  __m256i r1 = _mm256_and_si256(_mm256_cmpeq_epi8(row, _mm256_set1_epi8(0x10)),
+                                _mm256_shuffle_epi8(table[1], index));
+  __m256i r2 = _mm256_and_si256(_mm256_cmpeq_epi8(row, _mm256_set1_epi8(0x20)),
+                                _mm256_shuffle_epi8(table[2], index));
+  __m256i r3 = _mm256_and_si256(_mm256_cmpeq_epi8(row, _mm256_set1_epi8(0x30)),
+                                _mm256_shuffle_epi8(table[3], index));
+  return _mm256_or_si256(_mm256_or_si256(r0, r1), _mm256_or_si256(r2, r3));
+}
+
+// pshufb works within 128-bit lanes, so every row is broadcast to both
+__attribute__((target("avx2")))
+static void load_table_avx2(const uint8_t* source, __m256i table[4]) {
+  for (int i = 0; i < 4; i++) {
+    table[i] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)(source + 16 * i)));
+  }
+}
+
+__attribute__((target("avx2")))
+static void index_to_rgba_avx2(const uint8_t* indices, uint32_t* out,
+                               size_t count) {
+  __m256i r_table[4], g_table[4], b_table[4];
+  load_table_avx2(rgb_planes[0], r_table);
+  load_table_avx2(rgb_planes[1], g_table);
+  load_table_avx2(rgb_planes[2], b_table);
+  const __m256i mask = _mm256_set1_epi8(0x3F);
+  const __m256i alpha = _mm256_set1_epi8(char(0xFF));
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i index = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i*)(indices + i)), mask);
+    __m256i r = lookup64_avx2(index, r_table);
+    __m256i g = lookup64_avx2(index, g_table);
+    __m256i b = lookup64_avx2(index, b_table);
+    __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+    __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+    __m256i ba_lo = _mm256_unpacklo_epi8(b, alpha);
+    __m256i ba_hi = _mm256_unpackhi_epi8(b, alpha);
+    // pixels 0-3 | 16-19, 4-7 | 20-23, 8-11 | 24-27, 12-15 | 28-31
+    __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+    __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+    __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+    __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+    __m256i* dest = (__m256i*)(out + i);
+    _mm256_storeu_si256(dest + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256(dest + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+    _mm256_storeu_si256(dest + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+    _mm256_storeu_si256(dest + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+  }
+  _mm256_zeroupper(); // the SSSE3 tail is not VEX encoded
+  index_to_rgba_ssse3(indices + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void index_to_luma_avx2(const uint8_t* indices, uint8_t* out,
+                               size_t count) {
+  __m256i table[4];
+  load_table_avx2(nes_luma, table);
+  const __m256i mask = _mm256_set1_epi8(0x3F);
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i index = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i*)(indices + i)), mask);
+    _mm256_storeu_si256((__m256i*)(out + i), lookup64_avx2(index, table));
+  }
+  _mm256_zeroupper();
+  index_to_luma_ssse3(indices + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void compose_avx2(const uint8_t* bg, const uint8_t* sprite,
+                         const uint8_t* palette_ram, uint8_t* out,
+                         size_t count) {
+  const __m256i mask = _mm256_set1_epi8(0x3F);
+  const __m256i pal_lo = _mm256_and_si256(_mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)palette_ram)), mask);
+  const __m256i pal_hi = _mm256_and_si256(_mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)(palette_ram + 16))), mask);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i pixel = _mm256_set1_epi8(0x03);
+  const __m256i behind = _mm256_set1_epi8(0x20);
+  const __m256i upper = _mm256_set1_epi8(0x10);
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i b = _mm256_loadu_si256((const __m256i*)(bg + i));
+    __m256i s = _mm256_loadu_si256((const __m256i*)(sprite + i));
+    __m256i b_clear = _mm256_cmpeq_epi8(_mm256_and_si256(b, pixel), zero);
+    __m256i s_clear = _mm256_cmpeq_epi8(_mm256_and_si256(s, pixel), zero);
+    __m256i s_behind = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind), behind);
+    __m256i bg_wins = _mm256_or_si256(s_clear,
+                                      _mm256_andnot_si256(b_clear, s_behind));
+    __m256i bg_address = _mm256_andnot_si256(
+        b_clear, _mm256_and_si256(b, _mm256_set1_epi8(0x0F)));
+    __m256i s_address = _mm256_and_si256(s, _mm256_set1_epi8(0x1F));
+    __m256i address = _mm256_blendv_epi8(s_address, bg_address, bg_wins);
+    __m256i use_hi = _mm256_cmpeq_epi8(_mm256_and_si256(address, upper), upper);
+    __m256i color = _mm256_blendv_epi8(_mm256_shuffle_epi8(pal_lo, address),
+                                       _mm256_shuffle_epi8(pal_hi, address),
+                                       use_hi);
+    _mm256_storeu_si256((__m256i*)(out + i), color);
+  }
+  _mm256_zeroupper();
+  compose_ssse3(bg + i, sprite + i, palette_ram, out + i, count - i);
+}
+
+static const PixelKernels avx2_kernels = {
+  index_to_rgba_avx2,
+  index_to_luma_avx2,
+  compose_avx2
+};
+
+// AVX2 also needs the OS to save the upper halves of the ymm registers
+static bool os_saves_ymm() {
+  uint32_t xcr0_lo, xcr0_hi;
+  __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  return (xcr0_lo & 0x06) == 0x06;
+}
+
+int detect_pixel_kernel() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return KERNEL_SCALAR;
+  }
+  bool ssse3 = ecx & bit_SSSE3;
+  bool osxsave = ecx & bit_OSXSAVE;
+  if (osxsave && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+      (ebx & bit_AVX2) && os_saves_ymm()) {
+    return KERNEL_AVX2;
+  }
+  return ssse3 ? KERNEL_SSSE3 : KERNEL_SCALAR;
+}
+
+#else // NESEMU_X86
+
+int detect_pixel_kernel() {
+  return KERNEL_SCALAR;
+}
+
+#endif // NESEMU_X86
+
+const PixelKernels* get_pixel_kernels(int kernel) {
+  if (kernel < 0 || kernel > detect_pixel_kernel()) {
+    return NULL;
+  }
+  switch (kernel) {
+#ifdef NESEMU_X86
+    case KERNEL_AVX2:
+      return &avx2_kernels;
+    case KERNEL_SSSE3:
+      return &ssse3_kernels;
+#endif
+    default:
+      return &scalar_kernels;
+  }
+}
+
+static int active_kernel = detect_pixel_kernel();
+static const PixelKernels* active_kernels = get_pixel_kernels(active_kernel);
+
+const PixelKernels* pixel_kernels() {
+  return active_kernels;
+}
+
+int get_pixel_kernel() {
+  return active_kernel;
+}
+
+int set_pixel_kernel(int kernel) {
+  const PixelKernels* kernels = get_pixel_kernels(kernel);
+  if (kernels == NULL) {
+    return 1;
+  }
+  active_kernel = kernel;
+  active_kernels = kernels;
+  return 0;
+}
+
+} // namespace nesemu
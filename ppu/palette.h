@@ -0,0 +1,70 @@
+#ifndef NESEMU_PPU_PALETTE_H_
+#define NESEMU_PPU_PALETTE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nesemu {
+
+/* Pixel kernels
+  Every kernel comes in a scalar, an SSSE3 and an AVX2 version. The widest
+  one the host supports is picked at runtime from CPUID, the others are kept
+  around so they can be forced for testing and benchmarking.
+*/
+enum PixelKernel {
+  KERNEL_SCALAR = 0,
+  KERNEL_SSSE3  = 1,
+  KERNEL_AVX2   = 2,
+  NUM_KERNELS   = 3
+};
+
+// 2C02 master palette, R in the lowest byte so a pixel is R, G, B, A in memory
+extern const uint32_t nes_rgba[64];
+
+// 8-bit luma of the master palette (BT.601 weights)
+extern const uint8_t nes_luma[64];
+
+struct PixelKernels {
+  // color indices -> RGBA pixels, only the low 6 bits of an index are used
+  void (*index_to_rgba)(const uint8_t* indices, uint32_t* out, size_t count);
+
+  // color indices -> grayscale, only the low 6 bits of an index are used
+  void (*index_to_luma)(const uint8_t* indices, uint8_t* out, size_t count);
+
+  // background/sprite priority composition
+  //   bg:     palette address 0x00-0x0F, transparent if the low 2 bits are 0
+  //   sprite: palette address 0x10-0x1F, 0x20 set for behind background,
+  //           transparent if the low 2 bits are 0
+  //   out:    color index read from palette_ram (32 bytes)
+  void (*compose)(const uint8_t* bg, const uint8_t* sprite,
+                  const uint8_t* palette_ram, uint8_t* out, size_t count);
+};
+
+// best kernel supported by this host
+int detect_pixel_kernel();
+
+// returns NULL when the kernel is not supported by this host
+const PixelKernels* get_pixel_kernels(int kernel);
+
+// kernels used by the convenience functions below
+const PixelKernels* pixel_kernels();
+int get_pixel_kernel();
+int set_pixel_kernel(int kernel); // returns 1 if not supported
+
+inline void index_to_rgba(const uint8_t* indices, uint32_t* out, size_t count) {
+  pixel_kernels()->index_to_rgba(indices, out, count);
+}
+
+inline void index_to_luma(const uint8_t* indices, uint8_t* out, size_t count) {
+  pixel_kernels()->index_to_luma(indices, out, count);
+}
+
+inline void compose_pixels(const uint8_t* bg, const uint8_t* sprite,
+                           const uint8_t* palette_ram, uint8_t* out,
+                           size_t count) {
+  pixel_kernels()->compose(bg, sprite, palette_ram, out, count);
+}
+
+} // namespace nesemu
+
+#endif // NESEMU_PPU_PALETTE_H_
@@ -0,0 +1,169 @@
+#include "palette.h"
+
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace nesemu {
+
+// every length up to two AVX2 blocks plus a tail, at every byte misalignment
+static const size_t MAX_LENGTH = 80;
+static const size_t MAX_OFFSET = 32;
+
+TEST (PixelKernelTest, DetectedKernelIsSupported) {
+  int kernel = detect_pixel_kernel();
+  EXPECT_GE(kernel, KERNEL_SCALAR);
+  EXPECT_LT(kernel, NUM_KERNELS);
+  EXPECT_TRUE(get_pixel_kernels(kernel) != NULL);
+  EXPECT_TRUE(get_pixel_kernels(KERNEL_SCALAR) != NULL);
+  EXPECT_TRUE(get_pixel_kernels(-1) == NULL);
+  EXPECT_TRUE(get_pixel_kernels(NUM_KERNELS) == NULL);
+}
+
+TEST (PixelKernelTest, SetKernel) {
+  int kernel = get_pixel_kernel();
+  EXPECT_EQ(set_pixel_kernel(KERNEL_SCALAR), 0);
+  EXPECT_EQ(get_pixel_kernel(), KERNEL_SCALAR);
+  EXPECT_EQ(pixel_kernels(), get_pixel_kernels(KERNEL_SCALAR));
+  EXPECT_EQ(set_pixel_kernel(NUM_KERNELS), 1);
+  EXPECT_EQ(get_pixel_kernel(), KERNEL_SCALAR);
+  EXPECT_EQ(set_pixel_kernel(kernel), 0);
+}
+
+TEST (PixelKernelTest, ScalarMatchesTables) {
+  const PixelKernels* scalar = get_pixel_kernels(KERNEL_SCALAR);
+  for (int i = 0; i < 256; i++) {
+    uint8_t index = uint8_t(i);
+    uint32_t rgba;
+    uint8_t luma;
+    scalar->index_to_rgba(&index, &rgba, 1);
+    scalar->index_to_luma(&index, &luma, 1);
+    EXPECT_EQ(rgba, nes_rgba[i & 0x3F]);
+    EXPECT_EQ(luma, nes_luma[i & 0x3F]);
+  }
+  // red is the lowest byte in memory
+  uint8_t bytes[4];
+  memcpy(bytes, &nes_rgba[0x16], 4);
+  EXPECT_EQ(bytes[0], 0xB5);
+  EXPECT_EQ(bytes[1], 0x31);
+  EXPECT_EQ(bytes[2], 0x20);
+  EXPECT_EQ(bytes[3], 0xFF);
+}
+
+TEST (PixelKernelTest, ScalarCompositionPriority) {
+  const PixelKernels* scalar = get_pixel_kernels(KERNEL_SCALAR);
+  uint8_t palette_ram[32];
+  for (int i = 0; i < 32; i++) {
+    palette_ram[i] = uint8_t(i + 0x20);
+  }
+  uint8_t bg[5]     = {0x00, 0x05, 0x00, 0x05, 0x06};
+  uint8_t sprite[5] = {0x00, 0x00, 0x3A, 0x3A, 0x1A};
+  uint8_t out[5];
+  scalar->compose(bg, sprite, palette_ram, out, 5);
+  EXPECT_EQ(out[0], 0x20); // both transparent, backdrop
+  EXPECT_EQ(out[1], 0x25); // background only
+  EXPECT_EQ(out[2], 0x3A); // sprite behind transparent background
+  EXPECT_EQ(out[3], 0x25); // sprite behind opaque background
+  EXPECT_EQ(out[4], 0x3A); // sprite in front
+}
+
+TEST (PixelKernelTest, IndexToRgbaBitExact) {
+  const PixelKernels* scalar = get_pixel_kernels(KERNEL_SCALAR);
+  std::vector<uint8_t> indices(256 + MAX_OFFSET);
+  for (size_t i = 0; i < indices.size(); i++) {
+    indices[i] = uint8_t(i * 7 + 3);
+  }
+  for (int kernel = KERNEL_SSSE3; kernel < NUM_KERNELS; kernel++) {
+    const PixelKernels* simd = get_pixel_kernels(kernel);
+    if (simd == NULL) {
+      continue;
+    }
+    // all 256 index values in one call
+    std::vector<uint8_t> all(256);
+    for (int i = 0; i < 256; i++) {
+      all[i] = uint8_t(i);
+    }
+    std::vector<uint32_t> expected(256), actual(256);
+    scalar->index_to_rgba(&all[0], &expected[0], 256);
+    simd->index_to_rgba(&all[0], &actual[0], 256);
+    EXPECT_EQ(expected, actual) << "kernel " << kernel;
+
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+      for (size_t length = 0; length <= MAX_LENGTH; length++) {
+        std::vector<uint32_t> want(length + 1, 0xDEADBEEF);
+        std::vector<uint32_t> got(length + 1, 0xDEADBEEF);
+        scalar->index_to_rgba(&indices[offset], &want[0], length);
+        simd->index_to_rgba(&indices[offset], &got[0], length);
+        ASSERT_EQ(want, got) << "kernel " << kernel << " offset " << offset
+                             << " length " << length;
+      }
+    }
+  }
+}
+
+TEST (PixelKernelTest, IndexToLumaBitExact) {
+  const PixelKernels* scalar = get_pixel_kernels(KERNEL_SCALAR);
+  std::vector<uint8_t> indices(256 + MAX_OFFSET);
+  for (size_t i = 0; i < indices.size(); i++) {
+    indices[i] = uint8_t(i * 13 + 1);
+  }
+  for (int kernel = KERNEL_SSSE3; kernel < NUM_KERNELS; kernel++) {
+    const PixelKernels* simd = get_pixel_kernels(kernel);
+    if (simd == NULL) {
+      continue;
+    }
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+      for (size_t length = 0; length <= 256; length++) {
+        std::vector<uint8_t> want(length + 1, 0xA5);
+        std::vector<uint8_t> got(length + 1, 0xA5);
+        scalar->index_to_luma(&indices[offset], &want[0], length);
+        simd->index_to_luma(&indices[offset], &got[0], length);
+        ASSERT_EQ(want, got) << "kernel " << kernel << " offset " << offset
+                             << " length " << length;
+      }
+    }
+  }
+}
+
+// every (background, sprite) byte pair against two palettes
+TEST (PixelKernelTest, ComposeBitExact) {
+  const PixelKernels* scalar = get_pixel_kernels(KERNEL_SCALAR);
+  std::vector<uint8_t> bg(0x10000), sprite(0x10000);
+  for (int i = 0; i < 0x10000; i++) {
+    bg[i] = uint8_t(i);
+    sprite[i] = uint8_t(i >> 8);
+  }
+  uint8_t palettes[2][32];
+  srand(26);
+  for (int i = 0; i < 32; i++) {
+    palettes[0][i] = uint8_t(i);
+    palettes[1][i] = uint8_t(rand());
+  }
+  for (int kernel = KERNEL_SSSE3; kernel < NUM_KERNELS; kernel++) {
+    const PixelKernels* simd = get_pixel_kernels(kernel);
+    if (simd == NULL) {
+      continue;
+    }
+    for (int p = 0; p < 2; p++) {
+      std::vector<uint8_t> want(0x10000), got(0x10000);
+      scalar->compose(&bg[0], &sprite[0], palettes[p], &want[0], 0x10000);
+      simd->compose(&bg[0], &sprite[0], palettes[p], &got[0], 0x10000);
+      ASSERT_EQ(want, got) << "kernel " << kernel << " palette " << p;
+    }
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+      for (size_t length = 0; length <= MAX_LENGTH; length++) {
+        std::vector<uint8_t> want(length + 1, 0xA5), got(length + 1, 0xA5);
+        size_t start = offset * 1021;
+        scalar->compose(&bg[start], &sprite[start + offset], palettes[1],
+                        &want[0], length);
+        simd->compose(&bg[start], &sprite[start + offset], palettes[1],
+                      &got[0], length);
+        ASSERT_EQ(want, got) << "kernel " << kernel << " offset " << offset
+                             << " length " << length;
+      }
+    }
+  }
+}
+
+} // namespace nesemu
@@ -0,0 +1,903 @@
+#include "ppu.h"
+
+#include "palette.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nesemu {
+
+PPU::PPU() {
+  // power up at the start of the pre-render line
+  clock = 0;
+  frame_count = 0;
+  scanline = 261;
+  dot = 0;
+  odd_frame = false;
+  pending_hit_dot = -1;
+
+  ctrl = 0;
+  mask = 0;
+  status = 0;
+  oam_addr = 0;
+  latch = 0;
+  read_buffer = 0;
+  v = 0;
+  t = 0;
+  x = 0;
+  w = 0;
+
+  chr.fill(0);
+  ciram.fill(0);
+  palette_ram.fill(0);
+  oam.fill(0);
+  mirroring = MIRROR_HORIZONTAL;
+
+  render_mode = RENDER_FULL;
+  frame_buffer.fill(0);
+  set_output(OUTPUT_INDEX);
+
+  scroll_line = scanline;
+  scroll_dot = dot;
+  hit_valid = false;
+  hit_line = -1;
+  hit_dot = 0;
+  hit_chr_count = 0;
+  hit_ciram_count = 0;
+  overflow_valid = false;
+}
+
+static uint16_t increment_y(uint16_t address) {
+  if ((address & 0x7000) != 0x7000) { // fine y
+    return address + 0x1000;
+  }
+  address &= 0x0FFF;
+  int coarse_y = (address & 0x03E0) >> 5;
+  if (coarse_y == 29) {
+    coarse_y = 0;
+    address ^= 0x0800; // switch vertical nametable
+  } else if (coarse_y == 31) {
+    coarse_y = 0;
+  } else {
+    coarse_y++;
+  }
+  return (address & 0x7C1F) | (coarse_y << 5);
+}
+
+/* Timing
+  The PPU is caught up lazily: run() jumps from one event to the next instead
+  of ticking every dot. Events on a line:
+    visible lines   0       render the whole scanline
+                    hit     sprite 0 hit flag (dot x + 1 of the first hit)
+                    256/257 increment vertical, copy horizontal scroll
+    241             1       vblank
+    261 pre-render  1       clear flags
+                    256/257 as visible lines
+                    280     copy vertical scroll
+                    339     skip the last dot on odd frames
+  Register writes only ever happen between run() calls, so a write made
+  mid-scanline shows up from the next scanline on.
+  Without rendering the visible line 256/257 events are skipped as well, v is
+  brought up to date by sync_scroll() only when something needs it.
+*/
+void PPU::run(uint64_t target) {
+  while (clock < target) {
+    int next = next_event_dot();
+    uint64_t when = clock + uint64_t(next - dot);
+    if (when > target) {
+      dot += int(target - clock);
+      clock = target;
+      return;
+    }
+    clock = when;
+    if (next == DOTS_PER_LINE) {
+      dot = 0;
+      scanline++;
+      if (scanline == LINES_PER_FRAME) {
+        scanline = 0;
+        odd_frame = !odd_frame;
+      }
+      pending_hit_dot = -1;
+    } else {
+      dot = next;
+    }
+    handle_event();
+  }
+}
+
+bool PPU::rendering() const {
+  return (mask & 0x18) != 0;
+}
+
+// next dot after the current one at which something happens on this line
+int PPU::next_event_dot() const {
+  int next = DOTS_PER_LINE;
+  if (scanline < SCREEN_HEIGHT || scanline == 261) {
+    if (pending_hit_dot > dot) {
+      next = pending_hit_dot;
+    }
+    if (scanline == 261) {
+      if (dot < 1) {
+        return 1;
+      }
+      if (rendering() && dot < 339) {
+        const int events[4] = {256, 257, 280, 339};
+        for (int i = 0; i < 4; i++) {
+          if (events[i] > dot) {
+            return std::min(next, events[i]);
+          }
+        }
+      }
+    } else if (rendering() && render_mode == RENDER_FULL && dot < 257) {
+      return std::min(next, dot < 256 ? 256 : 257);
+    }
+  } else if (scanline == 241 && dot < 1) {
+    next = 1;
+  }
+  return next;
+}
+
+void PPU::handle_event() {
+  if (scanline == 241) {
+    if (dot == 1) {
+      status |= 0x80;
+      finish_frame();
+    }
+    return;
+  }
+  if (scanline >= SCREEN_HEIGHT && scanline != 261) {
+    return;
+  }
+  if (dot == pending_hit_dot) {
+    status |= 0x40;
+    pending_hit_dot = -1;
+  }
+  switch (dot) {
+    case 0:
+      if (scanline < SCREEN_HEIGHT) {
+        if (render_mode == RENDER_FULL) {
+          render_line(scanline);
+        } else {
+          evaluate_line(scanline);
+        }
+      }
+      break;
+    case 1:
+      if (scanline == 261) {
+        status &= 0x1F; // vblank, sprite 0 hit and overflow
+        hit_valid = false;
+      }
+      break;
+    case 256:
+    case 257:
+    case 280:
+      if (render_mode == RENDER_NONE) {
+        sync_scroll(); // keeps the lazy span under a frame
+      } else if (rendering()) {
+        v = scroll_events(v, scanline, dot - 1, scanline, dot);
+      }
+      break;
+    case 339:
+      if (rendering() && scanline == 261 && odd_frame) {
+        dot = 340; // odd frames are one dot shorter
+      }
+      break;
+  }
+}
+
+/* Scroll
+  Rendering moves v at dot 256 (next row), 257 (horizontal copy from t) and,
+  on the pre-render line, 280 (vertical copy from t). scroll_events() applies
+  those between two positions, assuming rendering and t stay the same; every
+  register access that could change either syncs first.
+*/
+uint16_t PPU::scroll_events(uint16_t address, int line, int from,
+                            int to_line, int to_dot) const {
+  for (;;) {
+    bool last = line == to_line && from <= to_dot;
+    int to = last ? to_dot : DOTS_PER_LINE;
+    if (line < SCREEN_HEIGHT || line == 261) {
+      if (from < 256 && to >= 256) {
+        address = increment_y(address);
+      }
+      if (from < 257 && to >= 257) {
+        address = (address & 0x7BE0) | (t & 0x041F);
+      }
+      if (line == 261 && from < 280 && to >= 280) {
+        address = (address & 0x041F) | (t & 0x7BE0);
+      }
+    }
+    if (last) {
+      return address;
+    }
+    line = (line + 1) % LINES_PER_FRAME;
+    from = -1;
+  }
+}
+
+void PPU::sync_scroll() {
+  if (render_mode == RENDER_NONE && rendering()) {
+    v = scroll_events(v, scroll_line, scroll_dot, scanline, dot);
+  }
+  scroll_line = scanline;
+  scroll_dot = dot;
+}
+
+/* State */
+void PPU::save_state(PPUState& state) const {
+  state.clock = clock;
+  state.frame_count = frame_count;
+  state.scanline = scanline;
+  state.dot = dot;
+  state.odd_frame = odd_frame;
+  state.pending_hit_dot = pending_hit_dot;
+  state.ctrl = ctrl;
+  state.mask = mask;
+  state.status = status;
+  state.oam_addr = oam_addr;
+  state.latch = latch;
+  state.read_buffer = read_buffer;
+  state.v = v;
+  if (render_mode == RENDER_NONE && rendering()) {
+    state.v = scroll_events(v, scroll_line, scroll_dot, scanline, dot);
+  }
+  state.t = t;
+  state.x = x;
+  state.w = w;
+  state.chr = chr;
+  state.ciram = ciram;
+  state.palette_ram = palette_ram;
+  state.oam = oam;
+  state.mirroring = mirroring;
+}
+
+void PPU::load_state(const PPUState& state) {
+  clock = state.clock;
+  frame_count = state.frame_count;
+  scanline = state.scanline;
+  dot = state.dot;
+  odd_frame = state.odd_frame;
+  pending_hit_dot = state.pending_hit_dot;
+  ctrl = state.ctrl;
+  mask = state.mask;
+  status = state.status;
+  oam_addr = state.oam_addr;
+  latch = state.latch;
+  read_buffer = state.read_buffer;
+  v = state.v;
+  t = state.t;
+  x = state.x;
+  w = state.w;
+  chr = state.chr;
+  ciram = state.ciram;
+  palette_ram = state.palette_ram;
+  oam = state.oam;
+  mirroring = state.mirroring;
+  scroll_line = scanline;
+  scroll_dot = dot;
+  hit_valid = false;
+  overflow_valid = false;
+  if (max_pool) { // never pool with a frame from before the load
+    std::fill(pool[1].begin(), pool[1].end(), 0);
+  }
+}
+
+/* Scanline rendering */
+void PPU::render_line(int line) {
+  uint8_t colors[SCREEN_WIDTH];
+  if (!rendering()) {
+    memset(colors, palette_ram[0] & ((mask & 0x01) ? 0x30 : 0x3F),
+           SCREEN_WIDTH);
+    emit_line(line, colors);
+    return;
+  }
+
+  // background, one extra tile for the fine x scroll
+  uint8_t tiles[SCREEN_WIDTH + 8];
+  uint8_t* bg = tiles + x;
+  if (mask & 0x08) {
+    uint16_t address = v;
+    uint16_t table = (ctrl & 0x10) << 8;
+    for (int tile = 0; tile < 33; tile++) {
+      uint8_t index = get_vram(0x2000 | (address & 0x0FFF));
+      uint8_t attribute = get_vram(0x23C0 | (address & 0x0C00) |
+                                   ((address >> 4) & 0x38) |
+                                   ((address >> 2) & 0x07));
+      int shift = ((address >> 4) & 0x04) | (address & 0x02);
+      uint8_t palette = ((attribute >> shift) & 0x03) << 2;
+      uint16_t pattern = table | (index << 4) | ((address >> 12) & 0x07);
+      uint8_t lo = chr[pattern];
+      uint8_t hi = chr[pattern + 8];
+      for (int bit = 0; bit < 8; bit++) {
+        int pixel = ((lo >> (7 - bit)) & 1) | (((hi >> (7 - bit)) & 1) << 1);
+        tiles[tile * 8 + bit] = pixel ? (palette | pixel) : 0;
+      }
+      if ((address & 0x001F) == 31) { // coarse x wraps to the next nametable
+        address = (address & 0xFFE0) ^ 0x0400;
+      } else {
+        address++;
+      }
+    }
+    if (!(mask & 0x02)) { // left 8 pixels hidden
+      memset(bg, 0, 8);
+    }
+  } else {
+    memset(tiles, 0, sizeof tiles);
+  }
+
+  // sprites, the first 8 in OAM order that are on this line
+  uint8_t sprites[SCREEN_WIDTH];
+  uint8_t sprite_zero[SCREEN_WIDTH];
+  memset(sprites, 0, sizeof sprites);
+  memset(sprite_zero, 0, sizeof sprite_zero);
+  int height = (ctrl & 0x20) ? 16 : 8;
+  int count = 0;
+  for (int i = 0; i < 64; i++) {
+    int row = line - 1 - oam[i * 4];
+    if (row < 0 || row >= height) {
+      continue;
+    }
+    if (++count > 8) {
+      status |= 0x20; // sprite overflow
+      break;
+    }
+    if (!(mask & 0x10)) {
+      continue;
+    }
+    uint8_t attribute = oam[i * 4 + 2];
+    int left = oam[i * 4 + 3];
+    uint16_t pattern = sprite_pattern(i, row, height);
+    uint8_t lo = chr[pattern];
+    uint8_t hi = chr[pattern + 8];
+    uint8_t high = 0x10 | ((attribute & 0x03) << 2) | (attribute & 0x20);
+    for (int col = 0; col < 8 && left + col < SCREEN_WIDTH; col++) {
+      int bit = (attribute & 0x40) ? col : 7 - col; // horizontal flip
+      int pixel = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+      if (!pixel) {
+        continue;
+      }
+      if (i == 0) {
+        sprite_zero[left + col] = 1;
+      }
+      if (!(sprites[left + col] & 0x03)) { // lower index wins
+        sprites[left + col] = high | pixel;
+      }
+    }
+  }
+  if (!(mask & 0x04)) { // left 8 pixels hidden
+    memset(sprites, 0, 8);
+    memset(sprite_zero, 0, 8);
+  }
+
+  // sprite 0 hit, never at x = 255
+  if ((mask & 0x18) == 0x18 && !(status & 0x40)) {
+    for (int px = 0; px < SCREEN_WIDTH - 1; px++) {
+      if (sprite_zero[px] && (bg[px] & 0x03)) {
+        pending_hit_dot = px + 1;
+        break;
+      }
+    }
+  }
+
+  compose_pixels(bg, sprites, palette_ram.data(), colors, SCREEN_WIDTH);
+  if (mask & 0x01) { // grayscale
+    for (int px = 0; px < SCREEN_WIDTH; px++) {
+      colors[px] &= 0x30;
+    }
+  }
+  emit_line(line, colors);
+}
+
+/* Headless scanline
+  Same flags as render_line() without producing pixels. Overflow comes from a
+  per-line sprite count kept until OAM or the sprite size changes. Sprite 0
+  hit is predicted once for the rest of the frame, then posted as the hit
+  event on its line; the prediction is dropped when OAM entry 0, ctrl, mask,
+  scroll or a pattern/nametable byte it read is written.
+*/
+void PPU::evaluate_line(int line) {
+  if (!rendering()) {
+    return;
+  }
+  if (!overflow_valid) {
+    predict_overflow();
+  }
+  if (overflow_lines[line]) {
+    status |= 0x20;
+  }
+  if (!hit_valid) {
+    sync_scroll();
+    predict_hit(line);
+  }
+  if (hit_line == line) {
+    pending_hit_dot = hit_dot;
+  }
+}
+
+void PPU::predict_overflow() {
+  uint8_t count[SCREEN_HEIGHT];
+  memset(count, 0, sizeof count);
+  int height = (ctrl & 0x20) ? 16 : 8;
+  for (int i = 0; i < 64; i++) {
+    int end = std::min(oam[i * 4] + 1 + height, SCREEN_HEIGHT);
+    for (int line = oam[i * 4] + 1; line < end; line++) {
+      count[line]++;
+    }
+  }
+  for (int line = 0; line < SCREEN_HEIGHT; line++) {
+    overflow_lines[line] = count[line] > 8;
+  }
+  overflow_valid = true;
+}
+
+// first hit from the given line on, v must be current at its dot 0
+void PPU::predict_hit(int line) {
+  hit_valid = true;
+  hit_line = -1;
+  hit_chr_count = 0;
+  hit_ciram_count = 0;
+  if ((mask & 0x18) != 0x18 || (status & 0x40)) {
+    return;
+  }
+  int height = (ctrl & 0x20) ? 16 : 8;
+  int top = oam[0] + 1;
+  int end = std::min(top + height, SCREEN_HEIGHT);
+  uint16_t address = v;
+  int from = line;
+  for (int next = std::max(line, top); next < end; next++) {
+    address = scroll_events(address, from, 0, next, 0);
+    from = next;
+    int px = sprite_zero_hit(next, address);
+    if (px >= 0) {
+      hit_line = next;
+      hit_dot = px + 1;
+      return;
+    }
+  }
+}
+
+// first pixel of the line where sprite 0 hits, -1 none
+int PPU::sprite_zero_hit(int line, uint16_t address) {
+  int height = (ctrl & 0x20) ? 16 : 8;
+  uint8_t attribute = oam[2];
+  int left = oam[3];
+  uint16_t pattern = sprite_pattern(0, line - 1 - oam[0], height);
+  hit_chr[hit_chr_count++] = pattern;
+  uint8_t bits = chr[pattern] | chr[pattern + 8];
+  // left column clipping on either layer hides hits there
+  int first = ((mask & 0x06) == 0x06) ? 0 : 8;
+  for (int col = 0; col < 8; col++) {
+    int px = left + col;
+    if (px >= SCREEN_WIDTH - 1) {
+      break;
+    }
+    int bit = (attribute & 0x40) ? col : 7 - col;
+    if (px >= first && ((bits >> bit) & 1) && background_pixel(address, px)) {
+      return px;
+    }
+  }
+  return -1;
+}
+
+// pattern address of a row of a sprite, before any horizontal flip
+uint16_t PPU::sprite_pattern(int sprite, int row, int height) const {
+  uint8_t tile = oam[sprite * 4 + 1];
+  if (oam[sprite * 4 + 2] & 0x80) { // vertical flip
+    row = height - 1 - row;
+  }
+  if (height == 16) {
+    return ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) |
+           ((row & 0x08) << 1) | (row & 0x07);
+  }
+  return ((ctrl & 0x08) << 9) | (tile << 4) | row;
+}
+
+// 2-bit background pattern value at screen x on a scanline starting at
+// address, remembering what was read for vram_written()
+int PPU::background_pixel(uint16_t address, int px) {
+  int position = px + x;
+  int coarse_x = (address & 0x001F) + (position >> 3);
+  if (coarse_x > 31) { // wrapped into the next nametable
+    address ^= 0x0400;
+  }
+  address = (address & 0x7FE0) | (coarse_x & 0x1F);
+  uint16_t entry = nametable_index(0x2000 | (address & 0x0FFF));
+  uint8_t index = ciram[entry];
+  uint16_t pattern = ((ctrl & 0x10) << 8) | (index << 4) |
+                     ((address >> 12) & 0x07);
+  if (hit_ciram_count == 0 || hit_ciram[hit_ciram_count - 1] != entry ||
+      hit_chr[hit_chr_count - 1] != pattern) {
+    hit_ciram[hit_ciram_count++] = entry;
+    hit_chr[hit_chr_count++] = pattern;
+  }
+  int bit = 7 - (position & 0x07);
+  return ((chr[pattern] >> bit) & 1) | (((chr[pattern + 8] >> bit) & 1) << 1);
+}
+
+int PPU::set_render_mode(int mode) {
+  if (mode != RENDER_FULL && mode != RENDER_NONE) {
+    return 1;
+  }
+  sync_scroll();
+  render_mode = mode;
+  hit_valid = false;
+  return 0;
+}
+
+int PPU::get_render_mode() const {
+  return render_mode;
+}
+
+/* Frame output */
+int PPU::set_output(int mode, uint8_t* buffer, int width, int height,
+                    bool pool_frames) {
+  if (mode < OUTPUT_INDEX || mode > OUTPUT_INDEX_NEAREST) {
+    return 1;
+  }
+  if (width < 1 || width > SCREEN_WIDTH || height < 1 ||
+      height > SCREEN_HEIGHT) {
+    return 1;
+  }
+  if (mode == OUTPUT_INDEX &&
+      (width != SCREEN_WIDTH || height != SCREEN_HEIGHT || pool_frames)) {
+    return 1;
+  }
+  if (mode != OUTPUT_INDEX && buffer == NULL) {
+    return 1;
+  }
+  if (mode == OUTPUT_INDEX_NEAREST && pool_frames) { // max of indices is noise
+    return 1;
+  }
+
+  output_mode = mode;
+  output = buffer; // NULL means the internal frame buffer
+  output_width = width;
+  output_height = height;
+  max_pool = pool_frames;
+
+  if (mode == OUTPUT_GRAY_AREA) {
+    // every source pixel lands in exactly one output cell
+    std::vector<int> rows(height, 0);
+    for (int line = 0; line < SCREEN_HEIGHT; line++) {
+      row_of[line] = line * height / SCREEN_HEIGHT;
+      rows[row_of[line]]++;
+    }
+    for (int col = 0; col <= width; col++) { // pixel px is in column
+      column_start[col] =                     // px * width / SCREEN_WIDTH
+          (col * SCREEN_WIDTH + width - 1) / width;
+    }
+    area_sum.assign(width, 0);
+    area_count.resize(width * height);
+    for (int row = 0; row < height; row++) {
+      for (int col = 0; col < width; col++) {
+        int columns = column_start[col + 1] - column_start[col];
+        area_count[row * width + col] = uint16_t(rows[row] * columns);
+      }
+    }
+  } else if (mode != OUTPUT_INDEX) {
+    // sample the center of each output cell
+    for (int line = 0; line < SCREEN_HEIGHT; line++) {
+      row_of[line] = -1;
+    }
+    for (int row = 0; row < height; row++) {
+      row_of[(2 * row + 1) * SCREEN_HEIGHT / (2 * height)] = row;
+    }
+    for (int col = 0; col < width; col++) {
+      source_x[col] = (2 * col + 1) * SCREEN_WIDTH / (2 * width);
+    }
+  }
+
+  if (max_pool) {
+    pool[0].assign(width * height, 0);
+    pool[1].assign(width * height, 0);
+  } else {
+    pool[0].clear();
+    pool[1].clear();
+  }
+  return 0;
+}
+
+void PPU::emit_line(int line, const uint8_t* colors) {
+  if (output_mode == OUTPUT_INDEX) {
+    uint8_t* dest = output ? output : frame_buffer.data();
+    memcpy(dest + line * SCREEN_WIDTH, colors, SCREEN_WIDTH);
+    return;
+  }
+  int row = row_of[line];
+  if (row < 0) {
+    return;
+  }
+  uint8_t* dest = (max_pool ? &pool[0][0] : output) + row * output_width;
+  switch (output_mode) {
+    case OUTPUT_GRAY_NEAREST:
+      for (int col = 0; col < output_width; col++) {
+        dest[col] = nes_luma[colors[source_x[col]]];
+      }
+      break;
+    case OUTPUT_INDEX_NEAREST:
+      for (int col = 0; col < output_width; col++) {
+        dest[col] = colors[source_x[col]];
+      }
+      break;
+    case OUTPUT_GRAY_AREA: {
+      uint8_t luma[SCREEN_WIDTH];
+      index_to_luma(colors, luma, SCREEN_WIDTH);
+      uint32_t* sum = &area_sum[0];
+      for (int col = 0; col < output_width; col++) {
+        uint32_t total = 0;
+        for (int px = column_start[col]; px < column_start[col + 1]; px++) {
+          total += luma[px];
+        }
+        sum[col] += total;
+      }
+      if (line == SCREEN_HEIGHT - 1 || row_of[line + 1] != row) {
+        const uint16_t* count = &area_count[row * output_width];
+        for (int col = 0; col < output_width; col++) {
+          dest[col] = uint8_t((sum[col] + count[col] / 2) / count[col]);
+          sum[col] = 0;
+        }
+      }
+      break;
+    }
+  }
+}
+
+void PPU::finish_frame() {
+  frame_count++;
+  if (!max_pool) {
+    return;
+  }
+  int size = output_width * output_height;
+  const uint8_t* current = &pool[0][0];
+  const uint8_t* last = &pool[1][0];
+  for (int i = 0; i < size; i++) {
+    output[i] = std::max(current[i], last[i]);
+  }
+  pool[0].swap(pool[1]);
+}
+
+int PPU::set_output_buffer(uint8_t* buffer) {
+  if (output_mode != OUTPUT_INDEX && buffer == NULL) {
+    return 1;
+  }
+  output = buffer;
+  return 0;
+}
+
+int PPU::get_output_mode() const {
+  return output_mode;
+}
+
+const uint8_t* PPU::get_frame_buffer() const {
+  return frame_buffer.data();
+}
+
+/* Registers */
+uint8_t PPU::read_register(uint16_t address) {
+  uint8_t result = latch; // write only registers read back the open bus
+  switch (address & 0x07) {
+    case 2: // PPUSTATUS
+      result = (status & 0xE0) | (latch & 0x1F);
+      status &= 0x7F;
+      w = 0;
+      break;
+    case 4: // OAMDATA
+      result = oam[oam_addr];
+      break;
+    case 7: // PPUDATA
+      sync_scroll();
+      hit_valid = false;
+      if ((v & 0x3FFF) < 0x3F00) {
+        result = read_buffer;
+        read_buffer = get_vram(v);
+      } else { // palette reads are not buffered
+        result = get_vram(v);
+        read_buffer = get_vram(v - 0x1000);
+      }
+      v = (v + ((ctrl & 0x04) ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+  latch = result;
+  return result;
+}
+
+void PPU::write_register(uint16_t address, uint8_t value) {
+  latch = value;
+  sync_scroll();
+  switch (address & 0x07) {
+    case 0: // PPUCTRL
+      if ((ctrl ^ value) & 0x3B) { // nametable, pattern tables, sprite size
+        hit_valid = false;
+      }
+      if ((ctrl ^ value) & 0x20) {
+        overflow_valid = false;
+      }
+      ctrl = value;
+      t = (t & 0x73FF) | ((value & 0x03) << 10);
+      break;
+    case 1: // PPUMASK
+      if ((mask ^ value) & 0x1E) {
+        hit_valid = false;
+      }
+      mask = value;
+      break;
+    case 3: // OAMADDR
+      oam_addr = value;
+      break;
+    case 4: // OAMDATA
+      oam_written(oam_addr);
+      oam[oam_addr++] = value;
+      break;
+    case 5: // PPUSCROLL
+      hit_valid = false;
+      if (!w) {
+        t = (t & 0x7FE0) | (value >> 3);
+        x = value & 0x07;
+      } else {
+        t = (t & 0x0C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+      }
+      w ^= 1;
+      break;
+    case 6: // PPUADDR
+      hit_valid = false;
+      if (!w) {
+        t = (t & 0x00FF) | ((value & 0x3F) << 8);
+      } else {
+        t = (t & 0x7F00) | value;
+        v = t;
+      }
+      w ^= 1;
+      break;
+    case 7: // PPUDATA
+      hit_valid = false;
+      set_vram(v, value);
+      v = (v + ((ctrl & 0x04) ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+}
+
+uint8_t PPU::get_status() const {
+  return status;
+}
+
+bool PPU::get_nmi() const {
+  return (status & 0x80) && (ctrl & 0x80);
+}
+
+/* PPU memory
+  $0000-$1FFF pattern tables
+  $2000-$3EFF nametables (mirrored)
+  $3F00-$3FFF palette, $3F10/$14/$18/$1C mirror $3F00/$04/$08/$0C
+*/
+uint16_t PPU::nametable_index(uint16_t address) const {
+  int table = (address >> 10) & 0x03;
+  switch (mirroring) {
+    case MIRROR_HORIZONTAL:
+      table >>= 1;
+      break;
+    case MIRROR_VERTICAL:
+      table &= 1;
+      break;
+    case MIRROR_SINGLE_LOW:
+      table = 0;
+      break;
+    case MIRROR_SINGLE_HIGH:
+      table = 1;
+      break;
+  }
+  return (table << 10) | (address & 0x03FF);
+}
+
+uint8_t PPU::get_vram(uint16_t address) const {
+  address &= 0x3FFF;
+  if (address < 0x2000) {
+    return chr[address];
+  }
+  if (address < 0x3F00) {
+    return ciram[nametable_index(address)];
+  }
+  address &= 0x1F;
+  if ((address & 0x13) == 0x10) {
+    address &= 0x0F;
+  }
+  return palette_ram[address];
+}
+
+void PPU::set_vram(uint16_t address, uint8_t value) {
+  address &= 0x3FFF;
+  vram_written(address);
+  if (address < 0x2000) {
+    chr[address] = value;
+  } else if (address < 0x3F00) {
+    ciram[nametable_index(address)] = value;
+  } else {
+    address &= 0x1F;
+    if ((address & 0x13) == 0x10) {
+      address &= 0x0F;
+    }
+    palette_ram[address] = value;
+  }
+}
+
+uint8_t PPU::get_oam(uint8_t address) const {
+  return oam[address];
+}
+
+void PPU::set_oam(uint8_t address, uint8_t value) {
+  oam_written(address);
+  oam[address] = value;
+}
+
+// A game refreshes OAM every frame, mostly with the same sprite 0 and the
+// same rows, so predictions are only dropped for what changed
+void PPU::write_oam_dma(const uint8_t* page) {
+  uint8_t staged[256];
+  memcpy(staged + oam_addr, page, 256 - oam_addr);
+  memcpy(staged, page + 256 - oam_addr, oam_addr);
+  if (memcmp(staged, oam.data(), 4)) {
+    hit_valid = false;
+  }
+  for (int i = 0; overflow_valid && i < 256; i += 4) {
+    if (staged[i] != oam[i]) {
+      overflow_valid = false;
+    }
+  }
+  memcpy(oam.data(), staged, oam.size());
+  latch = page[255];
+}
+
+void PPU::set_mirroring(int mode) {
+  mirroring = mode;
+  hit_valid = false;
+}
+
+// drop the sprite 0 hit prediction if it read this pattern or nametable byte
+void PPU::vram_written(uint16_t address) {
+  if (!hit_valid || address >= 0x3F00) {
+    return;
+  }
+  if (address < 0x2000) {
+    address &= ~0x0008; // both bit planes
+    for (int i = 0; i < hit_chr_count; i++) {
+      if (hit_chr[i] == address) {
+        hit_valid = false;
+        return;
+      }
+    }
+    return;
+  }
+  uint16_t entry = nametable_index(address);
+  for (int i = 0; i < hit_ciram_count; i++) {
+    if (hit_ciram[i] == entry) {
+      hit_valid = false;
+      return;
+    }
+  }
+}
+
+void PPU::oam_written(uint8_t address) {
+  if (address < 4) { // sprite 0
+    hit_valid = false;
+  }
+  if ((address & 0x03) == 0) { // y position
+    overflow_valid = false;
+  }
+}
+
+uint64_t PPU::get_clock() const {
+  return clock;
+}
+
+int PPU::get_scanline() const {
+  return scanline;
+}
+
+int PPU::get_dot() const {
+  return dot;
+}
+
+uint64_t PPU::get_frame_count() const {
+  return frame_count;
+}
+
+} // namespace nesemu
@@ -0,0 +1,204 @@
+#ifndef NESEMU_PPU_PPU_H_
+#define NESEMU_PPU_PPU_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nesemu {
+
+/* Frame output modes
+  0 - Color indices, full 256x240 (default)
+  1 - Grayscale, nearest neighbour downsample
+  2 - Grayscale, area averaged downsample
+  3 - Color indices, nearest neighbour downsample
+*/
+#define OUTPUT_INDEX         0
+#define OUTPUT_GRAY_NEAREST  1
+#define OUTPUT_GRAY_AREA     2
+#define OUTPUT_INDEX_NEAREST 3
+
+/* Render modes
+  0 - Full, every scanline is rasterized and sent to the output
+  1 - None, only the state the CPU can observe is kept up to date (vblank,
+      sprite 0 hit, sprite overflow), no pixels are ever produced. Sprite 0
+      hit and overflow are predicted ahead of time and only recomputed when
+      OAM, scroll or the VRAM the prediction read changes.
+*/
+#define RENDER_FULL 0
+#define RENDER_NONE 1
+
+/* Nametable mirroring */
+#define MIRROR_HORIZONTAL  0
+#define MIRROR_VERTICAL    1
+#define MIRROR_SINGLE_LOW  2
+#define MIRROR_SINGLE_HIGH 3
+#define MIRROR_FOUR_SCREEN 4
+
+/* Everything the emulation depends on, without the output
+  Plain data: timing, registers and memory, with v brought up to date when
+  headless. It can be copied anywhere and loaded into any PPU.
+*/
+struct PPUState {
+  uint64_t clock;
+  uint64_t frame_count;
+  int scanline;
+  int dot;
+  bool odd_frame;
+  int pending_hit_dot;
+  uint8_t ctrl;
+  uint8_t mask;
+  uint8_t status;
+  uint8_t oam_addr;
+  uint8_t latch;
+  uint8_t read_buffer;
+  uint16_t v;
+  uint16_t t;
+  uint8_t x;
+  uint8_t w;
+  std::array<uint8_t, 0x2000> chr;
+  std::array<uint8_t, 0x1000> ciram;
+  std::array<uint8_t, 32> palette_ram;
+  std::array<uint8_t, 256> oam;
+  int mirroring;
+};
+
+class PPU {
+  public:
+    PPU();
+
+    static const int SCREEN_WIDTH = 256;
+    static const int SCREEN_HEIGHT = 240;
+    static const int DOTS_PER_LINE = 341;
+    static const int LINES_PER_FRAME = 262;
+
+    /* Timing */
+    // catch up to the given PPU clock (3 per CPU cycle)
+    void run(uint64_t target);
+    uint64_t get_clock() const;
+    int get_scanline() const; // 0-239 visible, 241-260 vblank, 261 pre-render
+    int get_dot() const;
+    uint64_t get_frame_count() const; // frames completed, bumped at vblank
+
+    /* CPU facing registers $2000-$2007 (mirrored up to $3FFF) */
+    uint8_t read_register(uint16_t address);
+    void write_register(uint16_t address, uint8_t value);
+    uint8_t get_status() const;
+    bool get_nmi() const; // NMI line, vblank flag and NMI enable
+
+    /* PPU memory */
+    uint8_t get_vram(uint16_t address) const;
+    void set_vram(uint16_t address, uint8_t value);
+    uint8_t get_oam(uint8_t address) const;
+    void set_oam(uint8_t address, uint8_t value);
+    // OAM DMA: same as 256 $2004 writes of page, in one copy
+    void write_oam_dma(const uint8_t* page);
+    void set_mirroring(int mode);
+
+    /* Frame output */
+    // Select where finished scanlines go. Downsampled modes write straight
+    // into buffer (width * height bytes) as each scanline is produced, so the
+    // full frame is never stored. max_pool keeps the per-pixel maximum of the
+    // last two frames (grayscale modes only). Returns 1 on bad arguments.
+    int set_output(int mode, uint8_t* buffer = NULL,
+                   int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT,
+                   bool max_pool = false);
+    // Moves the output to another buffer of the same size, keeping the mode
+    // and the max pool history. NULL only for OUTPUT_INDEX, 1 otherwise.
+    int set_output_buffer(uint8_t* buffer);
+    int get_output_mode() const;
+    const uint8_t* get_frame_buffer() const; // 256x240 color indices
+
+    // can be switched at any time, takes effect from the next scanline
+    int set_render_mode(int mode); // returns 1 on bad mode
+    int get_render_mode() const;
+
+    /* State */
+    // Loading keeps the output and render mode of this PPU and clears the
+    // max pool history; headless predictions are redone from the loaded
+    // state.
+    void save_state(PPUState& state) const;
+    void load_state(const PPUState& state);
+
+  private:
+    /* Timing */
+    uint64_t clock;
+    uint64_t frame_count;
+    int scanline;
+    int dot;
+    bool odd_frame;
+    int pending_hit_dot; // dot on this line at which sprite 0 hits, -1 none
+
+    /* Registers */
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint8_t oam_addr;
+    uint8_t latch;       // last value on the PPU data bus
+    uint8_t read_buffer; // $2007 read buffer
+    uint16_t v;          // current vram address
+    uint16_t t;          // temporary vram address
+    uint8_t x;           // fine x scroll
+    uint8_t w;           // write toggle
+
+    /* Memory */
+    // std::array so that copying a PPU (a savestate) copies them as blocks
+    std::array<uint8_t, 0x2000> chr;   // pattern tables
+    std::array<uint8_t, 0x1000> ciram; // nametables, 4KB for four screen
+    std::array<uint8_t, 32> palette_ram;
+    std::array<uint8_t, 256> oam;
+    int mirroring;
+
+    /* Output */
+    int render_mode;
+    int output_mode;
+    uint8_t* output;
+    int output_width;
+    int output_height;
+    bool max_pool;
+    int row_of[SCREEN_HEIGHT];  // output row fed by each scanline, -1 none
+    int column_start[SCREEN_WIDTH + 1]; // area mode: first pixel of columns
+    int source_x[SCREEN_WIDTH];  // nearest mode: source pixel of each column
+    std::vector<uint32_t> area_sum;   // area mode: running column sums
+    std::vector<uint16_t> area_count; // area mode: pixels per output cell
+    std::vector<uint8_t> pool[2];     // max pool: this frame and last frame
+    std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> frame_buffer;
+
+    /* Headless prediction */
+    int scroll_line; // v is up to date with rendering up to this position
+    int scroll_dot;
+    bool hit_valid;
+    int hit_line; // predicted sprite 0 hit, -1 none this frame
+    int hit_dot;
+    int hit_chr_count;
+    int hit_ciram_count;
+    uint16_t hit_chr[48];   // pattern rows the prediction read
+    uint16_t hit_ciram[32]; // nametable bytes the prediction read
+    bool overflow_valid;
+    bool overflow_lines[SCREEN_HEIGHT]; // more than 8 sprites on the line
+
+    /* Helpers */
+    bool rendering() const;
+    int next_event_dot() const;
+    void handle_event();
+    void render_line(int line);
+    void evaluate_line(int line);
+    void predict_hit(int line);
+    void predict_overflow();
+    int sprite_zero_hit(int line, uint16_t address);
+    int background_pixel(uint16_t address, int px);
+    void sync_scroll();
+    uint16_t scroll_events(uint16_t address, int line, int from,
+                           int to_line, int to_dot) const;
+    void vram_written(uint16_t address);
+    void oam_written(uint8_t address);
+    uint16_t sprite_pattern(int sprite, int row, int height) const;
+    void emit_line(int line, const uint8_t* colors);
+    void finish_frame();
+    uint16_t nametable_index(uint16_t address) const;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_PPU_PPU_H_
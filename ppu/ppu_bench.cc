@@ -0,0 +1,101 @@
+#include "ppu.h"
+#include "threaded_ppu.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace nesemu;
+
+static const int FRAMES = 600;
+static const uint64_t FRAME_DOTS = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+
+// busy scene: random patterns and nametables, all 64 sprites on screen
+template <class P>
+static void load_scene(P& ppu) {
+  srand(28);
+  for (int i = 0; i < 0x3000; i++) {
+    ppu.set_vram(i, uint8_t(rand()));
+  }
+  for (int i = 0; i < 32; i++) {
+    ppu.set_vram(0x3F00 + i, uint8_t(rand() & 0x3F));
+  }
+  for (int i = 0; i < 256; i++) {
+    ppu.set_oam(i, uint8_t((i & 3) == 0 ? rand() % 232 : rand()));
+  }
+  ppu.write_register(0x2000, 0x10);
+  ppu.write_register(0x2001, 0x1E);
+}
+
+// frames per second for the given configuration, traffic rewrites OAM and
+// the scroll every vblank like a game would
+static double run(int render_mode, int output_mode, int width, int height,
+                  bool traffic = false) {
+  PPU ppu;
+  std::vector<uint8_t> observation(width * height);
+  load_scene(ppu);
+  ppu.set_render_mode(render_mode);
+  if (output_mode != OUTPUT_INDEX) {
+    ppu.set_output(output_mode, &observation[0], width, height);
+  }
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int frame = 1; frame <= FRAMES; frame++) {
+    ppu.run(frame * FRAME_DOTS);
+    if (traffic) {
+      for (int i = 0; i < 256; i++) {
+        ppu.write_register(0x2004, ppu.get_oam(uint8_t(i)));
+      }
+      ppu.write_register(0x2005, uint8_t(frame));
+      ppu.write_register(0x2005, 0);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return FRAMES / elapsed.count();
+}
+
+// Threaded rendering: frames/sec seen by the CPU thread alone and when it
+// also fetches every finished frame.
+static void run_threaded(double* producer, double* fetched) {
+  for (int fetch = 0; fetch < 2; fetch++) {
+    ThreadedPPU ppu;
+    load_scene(ppu);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int frame = 1; frame <= FRAMES; frame++) {
+      ppu.run(frame * FRAME_DOTS);
+      ppu.write_register(0x2005, uint8_t(frame));
+      ppu.write_register(0x2005, 0);
+      if (fetch) {
+        ppu.get_frame_buffer();
+      }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    *(fetch ? fetched : producer) = FRAMES / elapsed.count();
+  }
+}
+
+int main() {
+  double full = run(RENDER_FULL, OUTPUT_INDEX, 256, 240);
+  double area = run(RENDER_FULL, OUTPUT_GRAY_AREA, 84, 84);
+  double nearest = run(RENDER_FULL, OUTPUT_GRAY_NEAREST, 84, 84);
+  double none = run(RENDER_NONE, OUTPUT_INDEX, 256, 240);
+  double none_traffic = run(RENDER_NONE, OUTPUT_INDEX, 256, 240, true);
+  double producer, fetched;
+  run_threaded(&producer, &fetched);
+
+  printf("PPU frames/sec (%d frames, busy scene)\n", FRAMES);
+  printf("  full, 256x240 indices  %10.0f\n", full);
+  printf("  full, 84x84 area       %10.0f\n", area);
+  printf("  full, 84x84 nearest    %10.0f\n", nearest);
+  printf("  none (RAM only)        %10.0f  %.1fx full\n", none, none / full);
+  printf("  none, OAM+scroll writes%10.0f  %.1fx full\n", none_traffic,
+         none_traffic / full);
+  printf("  threaded, CPU thread   %10.0f  %.1fx full\n", producer,
+         producer / full);
+  printf("  threaded, every frame  %10.0f\n", fetched);
+  return 0;
+}
@@ -0,0 +1,750 @@
+#include "ppu.h"
+
+#include "gtest/gtest.h"
+#include "palette.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace nesemu {
+
+// power up is at the start of the pre-render line
+static uint64_t clock_at(int line, int dot) {
+  return PPU::DOTS_PER_LINE + uint64_t(line) * PPU::DOTS_PER_LINE + dot;
+}
+
+// tile 1 is solid color 1, tile 2 solid color 2, tile 3 solid color 3
+static void load_solid_tiles(PPU& ppu) {
+  for (int row = 0; row < 8; row++) {
+    ppu.set_vram(0x0010 + row, 0xFF);
+    ppu.set_vram(0x0028 + row, 0xFF);
+    ppu.set_vram(0x0030 + row, 0xFF);
+    ppu.set_vram(0x0038 + row, 0xFF);
+  }
+}
+
+// random patterns, nametables, palette and sprites
+static void load_random_scene(PPU& ppu, unsigned seed) {
+  srand(seed);
+  for (int i = 0; i < 0x3000; i++) {
+    ppu.set_vram(i, uint8_t(rand()));
+  }
+  for (int i = 0; i < 32; i++) {
+    ppu.set_vram(0x3F00 + i, uint8_t(rand() & 0x3F));
+  }
+  for (int i = 0; i < 256; i++) {
+    ppu.set_oam(i, uint8_t(rand()));
+  }
+  ppu.write_register(0x2000, 0x10);
+  ppu.write_register(0x2001, 0x1E);
+  ppu.write_register(0x2005, 0x2B);
+  ppu.write_register(0x2005, 0x47);
+}
+
+TEST (PPUInitializeTest, FirstState) {
+  PPU ppu;
+  EXPECT_EQ(ppu.get_clock(), 0);
+  EXPECT_EQ(ppu.get_scanline(), 261);
+  EXPECT_EQ(ppu.get_dot(), 0);
+  EXPECT_EQ(ppu.get_frame_count(), 0);
+  EXPECT_EQ(ppu.get_status(), 0);
+  EXPECT_FALSE(ppu.get_nmi());
+  EXPECT_EQ(ppu.get_output_mode(), OUTPUT_INDEX);
+  for (int i = 0; i < 0x4000; i++) {
+    EXPECT_EQ(ppu.get_vram(i), 0);
+  }
+}
+
+TEST (PPUTimingTest, VblankAndNmi) {
+  PPU ppu;
+  ppu.run(clock_at(241, 0));
+  EXPECT_EQ(ppu.get_scanline(), 241);
+  EXPECT_EQ(ppu.get_dot(), 0);
+  EXPECT_EQ(ppu.get_status() & 0x80, 0);
+  EXPECT_EQ(ppu.get_frame_count(), 0);
+
+  ppu.run(clock_at(241, 1));
+  EXPECT_EQ(ppu.get_status() & 0x80, 0x80);
+  EXPECT_EQ(ppu.get_frame_count(), 1);
+  EXPECT_FALSE(ppu.get_nmi());
+  ppu.write_register(0x2000, 0x80);
+  EXPECT_TRUE(ppu.get_nmi());
+
+  // reading the status clears vblank
+  EXPECT_EQ(ppu.read_register(0x2002) & 0x80, 0x80);
+  EXPECT_EQ(ppu.read_register(0x2002) & 0x80, 0);
+  EXPECT_FALSE(ppu.get_nmi());
+}
+
+TEST (PPUTimingTest, PreRenderClearsFlags) {
+  PPU ppu;
+  ppu.run(clock_at(261, 0));
+  EXPECT_EQ(ppu.get_status() & 0x80, 0x80);
+  ppu.run(clock_at(261, 1));
+  EXPECT_EQ(ppu.get_status(), 0);
+  EXPECT_EQ(ppu.get_scanline(), 261);
+  EXPECT_EQ(ppu.get_dot(), 1);
+}
+
+TEST (PPUTimingTest, OddFramesSkipADotWhenRendering) {
+  const uint64_t frame = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+  {
+    PPU ppu;
+    ppu.run(1 + 3 * frame);
+    EXPECT_EQ(ppu.get_scanline(), 261);
+    EXPECT_EQ(ppu.get_dot(), 1);
+  }
+  {
+    PPU ppu;
+    ppu.write_register(0x2001, 0x08);
+    ppu.run(1 + frame);
+    EXPECT_EQ(ppu.get_dot(), 1); // even frame, full length
+    ppu.run(1 + 2 * frame);
+    EXPECT_EQ(ppu.get_scanline(), 261);
+    EXPECT_EQ(ppu.get_dot(), 2); // odd frame, one dot shorter
+  }
+}
+
+TEST (PPURegisterTest, AddressAndData) {
+  PPU ppu;
+  ppu.write_register(0x2006, 0x21);
+  ppu.write_register(0x2006, 0x08);
+  ppu.write_register(0x2007, 0xAB);
+  ppu.write_register(0x2007, 0xCD);
+  EXPECT_EQ(ppu.get_vram(0x2108), 0xAB);
+  EXPECT_EQ(ppu.get_vram(0x2109), 0xCD);
+
+  // increment by 32
+  ppu.write_register(0x2000, 0x04);
+  ppu.write_register(0x2006, 0x20);
+  ppu.write_register(0x2006, 0x00);
+  ppu.write_register(0x2007, 0x11);
+  ppu.write_register(0x2007, 0x22);
+  EXPECT_EQ(ppu.get_vram(0x2000), 0x11);
+  EXPECT_EQ(ppu.get_vram(0x2020), 0x22);
+
+  // reads are delayed by the read buffer
+  ppu.write_register(0x2000, 0x00);
+  ppu.write_register(0x2006, 0x21);
+  ppu.write_register(0x2006, 0x08);
+  ppu.read_register(0x2007);
+  EXPECT_EQ(ppu.read_register(0x2007), 0xAB);
+  EXPECT_EQ(ppu.read_register(0x2007), 0xCD);
+
+  // palette reads are not
+  ppu.set_vram(0x3F01, 0x2A);
+  ppu.write_register(0x2006, 0x3F);
+  ppu.write_register(0x2006, 0x01);
+  EXPECT_EQ(ppu.read_register(0x2007), 0x2A);
+}
+
+TEST (PPURegisterTest, StatusResetsWriteToggle) {
+  PPU ppu;
+  ppu.write_register(0x2006, 0x3F);
+  ppu.read_register(0x2002);
+  ppu.write_register(0x2006, 0x23);
+  ppu.write_register(0x2006, 0x45);
+  ppu.write_register(0x2007, 0x99);
+  EXPECT_EQ(ppu.get_vram(0x2345), 0x99);
+}
+
+TEST (PPURegisterTest, OamAddressAndData) {
+  PPU ppu;
+  ppu.write_register(0x2003, 0xFE);
+  ppu.write_register(0x2004, 0x12);
+  ppu.write_register(0x2004, 0x34);
+  ppu.write_register(0x2004, 0x56);
+  EXPECT_EQ(ppu.get_oam(0xFE), 0x12);
+  EXPECT_EQ(ppu.get_oam(0xFF), 0x34);
+  EXPECT_EQ(ppu.get_oam(0x00), 0x56);
+  ppu.write_register(0x2003, 0xFF);
+  EXPECT_EQ(ppu.read_register(0x2004), 0x34);
+}
+
+TEST (PPURegisterTest, OamDmaMatchesDataWrites) {
+  PPU bytewise, bulk;
+  uint8_t page[256];
+  for (int i = 0; i < 256; i++) {
+    page[i] = uint8_t(i * 7 + 3);
+  }
+  bytewise.write_register(0x2003, 0x10);
+  bulk.write_register(0x2003, 0x10);
+  for (int i = 0; i < 256; i++) {
+    bytewise.write_register(0x2004, page[i]);
+  }
+  bulk.write_oam_dma(page);
+  for (int i = 0; i < 256; i++) {
+    ASSERT_EQ(bulk.get_oam(uint8_t(i)), bytewise.get_oam(uint8_t(i)));
+  }
+  EXPECT_EQ(bulk.get_oam(0x10), page[0]);
+  EXPECT_EQ(bulk.read_register(0x2000), bytewise.read_register(0x2000));
+}
+
+TEST (PPUMemoryTest, PaletteMirrors) {
+  PPU ppu;
+  ppu.set_vram(0x3F10, 0x05);
+  EXPECT_EQ(ppu.get_vram(0x3F00), 0x05);
+  ppu.set_vram(0x3F0C, 0x06);
+  EXPECT_EQ(ppu.get_vram(0x3F1C), 0x06);
+  ppu.set_vram(0x3F11, 0x07);
+  EXPECT_EQ(ppu.get_vram(0x3F01), 0x00);
+  EXPECT_EQ(ppu.get_vram(0x3F31), 0x07);
+}
+
+TEST (PPUMemoryTest, NametableMirroring) {
+  PPU ppu;
+  ppu.set_mirroring(MIRROR_HORIZONTAL);
+  ppu.set_vram(0x2001, 0x01);
+  ppu.set_vram(0x2801, 0x02);
+  EXPECT_EQ(ppu.get_vram(0x2401), 0x01);
+  EXPECT_EQ(ppu.get_vram(0x2C01), 0x02);
+  EXPECT_EQ(ppu.get_vram(0x3001), 0x01); // $3000-$3EFF mirrors $2000
+
+  ppu.set_mirroring(MIRROR_VERTICAL);
+  EXPECT_EQ(ppu.get_vram(0x2801), 0x01);
+  EXPECT_EQ(ppu.get_vram(0x2401), 0x02);
+
+  ppu.set_mirroring(MIRROR_SINGLE_HIGH);
+  EXPECT_EQ(ppu.get_vram(0x2001), 0x02);
+  ppu.set_mirroring(MIRROR_SINGLE_LOW);
+  EXPECT_EQ(ppu.get_vram(0x2C01), 0x01);
+
+  ppu.set_mirroring(MIRROR_FOUR_SCREEN);
+  ppu.set_vram(0x2C01, 0x04);
+  EXPECT_EQ(ppu.get_vram(0x2C01), 0x04);
+  EXPECT_EQ(ppu.get_vram(0x2001), 0x01);
+}
+
+TEST (PPURenderTest, BackdropWhenDisabled) {
+  PPU ppu;
+  ppu.set_vram(0x3F00, 0x21);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  for (int i = 0; i < PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT; i++) {
+    ASSERT_EQ(frame[i], 0x21);
+  }
+}
+
+TEST (PPURenderTest, BackgroundTileAndScroll) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x2000, 0x01); // top left tile
+  ppu.set_vram(0x3F00, 0x0F);
+  ppu.set_vram(0x3F01, 0x16);
+  ppu.write_register(0x2001, 0x0A); // background, left column
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  for (int line = 0; line < 10; line++) {
+    for (int px = 0; px < 10; px++) {
+      uint8_t expected = (line < 8 && px < 8) ? 0x16 : 0x0F;
+      EXPECT_EQ(frame[line * 256 + px], expected) << line << "," << px;
+    }
+  }
+
+  // fine x = 3, fine y = 2
+  ppu.write_register(0x2005, 0x03);
+  ppu.write_register(0x2005, 0x02);
+  ppu.run(clock_at(241, 1) + PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME);
+  for (int line = 0; line < 10; line++) {
+    for (int px = 0; px < 10; px++) {
+      uint8_t expected = (line < 6 && px < 5) ? 0x16 : 0x0F;
+      EXPECT_EQ(frame[line * 256 + px], expected) << line << "," << px;
+    }
+  }
+
+  // hide the left column
+  ppu.write_register(0x2001, 0x08);
+  ppu.run(clock_at(241, 1) + 2 * PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME);
+  EXPECT_EQ(frame[0], 0x0F);
+}
+
+TEST (PPURenderTest, AttributePalettes) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x2000, 0x01);
+  ppu.set_vram(0x2002, 0x01); // second quadrant of attribute byte 0
+  ppu.set_vram(0x23C0, 0x0C);
+  ppu.set_vram(0x3F01, 0x11);
+  ppu.set_vram(0x3F0D, 0x33);
+  ppu.write_register(0x2001, 0x0A);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  EXPECT_EQ(frame[0], 0x11);
+  EXPECT_EQ(frame[16], 0x33);
+}
+
+TEST (PPURenderTest, SpritesAndPriority) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x2000 + 2 * 32 + 2, 0x01); // bg tile covering x 16-23, y 16-23
+  ppu.set_vram(0x3F00, 0x0F);
+  ppu.set_vram(0x3F01, 0x01);
+  ppu.set_vram(0x3F15, 0x25); // sprite palette 1, color 1
+  ppu.set_vram(0x3F1A, 0x2A); // sprite palette 2, color 2
+
+  // sprite 0 in front at (4, 10), sprite 1 behind bg at (20, 20)
+  ppu.set_oam(0, 9);
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(2, 0x01);
+  ppu.set_oam(3, 4);
+  ppu.set_oam(4, 19);
+  ppu.set_oam(5, 0x02);
+  ppu.set_oam(6, 0x22);
+  ppu.set_oam(7, 20);
+  for (int i = 8; i < 256; i += 4) {
+    ppu.set_oam(i, 0xF0); // off screen
+  }
+  ppu.write_register(0x2001, 0x1E);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  EXPECT_EQ(frame[9 * 256 + 4], 0x0F);
+  EXPECT_EQ(frame[10 * 256 + 4], 0x25);
+  EXPECT_EQ(frame[17 * 256 + 11], 0x25);
+  EXPECT_EQ(frame[18 * 256 + 4], 0x0F);
+  EXPECT_EQ(frame[20 * 256 + 20], 0x01); // behind opaque background
+  EXPECT_EQ(frame[20 * 256 + 24], 0x2A); // behind transparent background
+}
+
+TEST (PPURenderTest, SpriteFlip) {
+  PPU ppu;
+  // tile 4: only the top left pixel is set
+  ppu.set_vram(0x0040, 0x80);
+  ppu.set_vram(0x3F11, 0x30);
+  ppu.set_oam(0, 49);
+  ppu.set_oam(1, 0x04);
+  ppu.set_oam(2, 0xC0); // flip both ways
+  ppu.set_oam(3, 100);
+  for (int i = 4; i < 256; i += 4) {
+    ppu.set_oam(i, 0xF0);
+  }
+  ppu.write_register(0x2001, 0x14);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  EXPECT_EQ(frame[50 * 256 + 100], 0x00);
+  EXPECT_EQ(frame[57 * 256 + 107], 0x30);
+}
+
+TEST (PPURenderTest, SpriteOverflow) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  for (int i = 0; i < 64; i++) {
+    ppu.set_oam(i * 4, i < 9 ? 99 : 0xF0);
+    ppu.set_oam(i * 4 + 1, 0x01);
+    ppu.set_oam(i * 4 + 3, i * 8);
+  }
+  ppu.set_vram(0x3F11, 0x30);
+  ppu.write_register(0x2001, 0x18);
+  ppu.run(clock_at(99, 340));
+  EXPECT_EQ(ppu.get_status() & 0x20, 0);
+  ppu.run(clock_at(100, 0));
+  EXPECT_EQ(ppu.get_status() & 0x20, 0x20);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  EXPECT_EQ(frame[100 * 256 + 7 * 8], 0x30);
+  EXPECT_EQ(frame[100 * 256 + 8 * 8], 0x00); // ninth sprite dropped
+}
+
+TEST (PPURenderTest, SpriteZeroHitTiming) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  for (int i = 0; i < 32 * 30; i++) {
+    ppu.set_vram(0x2000 + i, 0x01);
+  }
+  ppu.set_oam(0, 29);
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(3, 40);
+  ppu.write_register(0x2001, 0x1E);
+  ppu.run(clock_at(30, 40));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+  ppu.run(clock_at(30, 41));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+  ppu.run(clock_at(261, 0));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+  ppu.run(clock_at(261, 1));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+}
+
+TEST (PPURenderTest, SpriteZeroHitClipping) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  for (int i = 0; i < 32 * 30; i++) {
+    ppu.set_vram(0x2000 + i, 0x01);
+  }
+  ppu.set_oam(0, 29);
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(3, 2); // pixels 2-9, 2-7 hidden by the left column clip
+  ppu.write_register(0x2001, 0x18);
+  ppu.run(clock_at(30, 8));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+  ppu.run(clock_at(30, 9));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+
+  // never at x = 255
+  PPU edge;
+  load_solid_tiles(edge);
+  for (int i = 0; i < 32 * 30; i++) {
+    edge.set_vram(0x2000 + i, 0x01);
+  }
+  edge.set_oam(0, 29);
+  edge.set_oam(1, 0x01);
+  edge.set_oam(3, 255);
+  edge.write_register(0x2001, 0x1E);
+  edge.run(clock_at(241, 1));
+  EXPECT_EQ(edge.get_status() & 0x40, 0);
+}
+
+TEST (PPURenderTest, MidFrameScrollSplit) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  for (int row = 0; row < 30; row++) {
+    ppu.set_vram(0x2000 + row * 32, 0x01); // left column of tiles
+  }
+  ppu.set_vram(0x3F01, 0x16);
+  ppu.write_register(0x2001, 0x0A);
+  ppu.run(clock_at(100, 300));
+  // horizontal scroll written after the copy at dot 257 applies to line 102
+  ppu.write_register(0x2005, 0x08);
+  ppu.write_register(0x2005, 0x00);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  EXPECT_EQ(frame[100 * 256], 0x16);
+  EXPECT_EQ(frame[101 * 256], 0x16);
+  EXPECT_EQ(frame[102 * 256], 0x00);
+  EXPECT_EQ(frame[239 * 256], 0x00);
+}
+
+TEST (PPUHeadlessTest, RenderModeSwitch) {
+  PPU ppu;
+  EXPECT_EQ(ppu.get_render_mode(), RENDER_FULL);
+  EXPECT_EQ(ppu.set_render_mode(2), 1);
+  EXPECT_EQ(ppu.set_render_mode(-1), 1);
+  EXPECT_EQ(ppu.set_render_mode(RENDER_NONE), 0);
+  EXPECT_EQ(ppu.get_render_mode(), RENDER_NONE);
+  EXPECT_EQ(ppu.set_render_mode(RENDER_FULL), 0);
+  EXPECT_EQ(ppu.get_render_mode(), RENDER_FULL);
+}
+
+TEST (PPUHeadlessTest, NeverProducesPixels) {
+  PPU ppu;
+  std::vector<uint8_t> observation(84 * 84, 0xEE);
+  load_random_scene(ppu, 7);
+  ppu.set_render_mode(RENDER_NONE);
+  ppu.run(clock_at(241, 1));
+  const uint8_t* frame = ppu.get_frame_buffer();
+  for (int i = 0; i < PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT; i++) {
+    ASSERT_EQ(frame[i], 0);
+  }
+  ppu.set_output(OUTPUT_GRAY_AREA, &observation[0], 84, 84);
+  ppu.run(clock_at(241, 1) + PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME);
+  EXPECT_EQ(observation, std::vector<uint8_t>(84 * 84, 0xEE));
+  EXPECT_EQ(ppu.get_frame_count(), 2);
+
+  // switching back renders again from the next frame on
+  ppu.set_render_mode(RENDER_FULL);
+  ppu.run(clock_at(241, 1) + 2 * PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME);
+  EXPECT_NE(observation, std::vector<uint8_t>(84 * 84, 0xEE));
+}
+
+// Random register traffic at random times, the headless PPU must report the
+// same status at every dot and return the same register reads.
+TEST (PPUHeadlessTest, FlagsMatchFullRendering) {
+  const int registers[7] = {0x2000, 0x2001, 0x2003, 0x2004, 0x2005, 0x2006,
+                            0x2007};
+  int hits = 0;
+  int overflows = 0;
+  for (unsigned seed = 1; seed <= 6; seed++) {
+    PPU full, headless;
+    load_random_scene(full, seed);
+    load_random_scene(headless, seed);
+    headless.set_render_mode(RENDER_NONE);
+    srand(seed * 101);
+    // sprite 0 somewhere on screen, 8x16 sprites for half of the seeds
+    uint8_t y = uint8_t(rand() % 230);
+    uint8_t ctrl = (seed & 1) ? 0x30 : 0x18;
+    full.set_oam(0, y);
+    headless.set_oam(0, y);
+    full.write_register(0x2000, ctrl);
+    headless.write_register(0x2000, ctrl);
+
+    uint64_t end = clock_at(241, 1) + 3 * PPU::DOTS_PER_LINE * 262;
+    uint64_t next_write = rand() % 20000;
+    for (uint64_t clock = 1; clock < end; clock++) {
+      full.run(clock);
+      headless.run(clock);
+      ASSERT_EQ(full.get_status(), headless.get_status())
+          << "seed " << seed << " line " << full.get_scanline() << " dot "
+          << full.get_dot();
+      hits += (full.get_status() & 0x40) && full.get_dot() == 340;
+      overflows += (full.get_status() & 0x20) && full.get_dot() == 340;
+      if (clock != next_write) {
+        continue;
+      }
+      next_write += rand() % 20000;
+      int address = registers[rand() % 7];
+      uint8_t value = uint8_t(rand());
+      if (address == 0x2001) {
+        value |= 0x18; // keep rendering on most of the time
+      }
+      if (rand() % 4 == 0) {
+        address = (rand() & 1) ? 0x2002 : 0x2007;
+        ASSERT_EQ(full.read_register(address), headless.read_register(address));
+      } else {
+        full.write_register(address, value);
+        headless.write_register(address, value);
+      }
+    }
+  }
+  EXPECT_GT(hits, 0);
+  EXPECT_GT(overflows, 0);
+}
+
+// Writes under sprite 0 after the prediction was made must move the hit,
+// writes elsewhere must not.
+TEST (PPUHeadlessTest, HitPredictionFollowsWrites) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_oam(0, 99);
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(3, 40); // lines 100-107, pixels 40-47 (tile column 5)
+  ppu.set_vram(0x2000 + 13 * 32 + 5, 0x01); // solid tile at lines 104-111
+  ppu.set_render_mode(RENDER_NONE);
+  ppu.write_register(0x2001, 0x1E);
+  ppu.run(clock_at(50, 0));
+  ppu.set_vram(0x2000 + 20 * 32 + 5, 0x01); // not under the sprite
+  ppu.set_vram(0x2000 + 12 * 32 + 5, 0x02); // lines 96-103, under it
+  ppu.run(clock_at(100, 40));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+  ppu.run(clock_at(100, 41));
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+
+  // clearing the pattern row the next frame's hit would come from, frame 0
+  // is odd and one dot short
+  const uint64_t frame1 = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME - 1;
+  ppu.run(clock_at(20, 0) + frame1);
+  ppu.set_vram(0x0028 + 4, 0x00); // tile 2 row 4 (line 100), plane 1
+  ppu.run(clock_at(101, 40) + frame1);
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+  ppu.run(clock_at(101, 41) + frame1);
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+
+  const uint64_t frame2 = frame1 + PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+  ppu.run(clock_at(20, 0) + frame2);
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+  ppu.set_oam(0, 150); // moved below the solid tiles
+  ppu.run(clock_at(241, 1) + frame2);
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+}
+
+TEST (PPUHeadlessTest, OamDmaUpdatesPredictions) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x2000 + 13 * 32 + 5, 0x01);
+  uint8_t page[256];
+  for (int i = 0; i < 256; i++) {
+    page[i] = 0xF0; // off screen
+  }
+  page[0] = 99;
+  page[1] = 0x01;
+  page[3] = 40;
+  ppu.write_oam_dma(page);
+  ppu.set_render_mode(RENDER_NONE);
+  ppu.write_register(0x2001, 0x1E);
+  ppu.run(clock_at(50, 0));
+  ppu.write_oam_dma(page); // same sprite 0
+  ppu.run(clock_at(104, 41)); // first line over the solid tile
+  EXPECT_EQ(ppu.get_status() & 0x40, 0x40);
+
+  const uint64_t frame1 = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME - 1;
+  ppu.run(clock_at(20, 0) + frame1);
+  page[0] = 150; // below the solid tile
+  ppu.write_oam_dma(page);
+  ppu.run(clock_at(241, 1) + frame1);
+  EXPECT_EQ(ppu.get_status() & 0x40, 0);
+}
+
+// Runs in uneven steps with VRAM and OAM changing between them, so v is
+// brought up to date lazily across many lines at once.
+TEST (PPUHeadlessTest, LazyScrollMatchesFullRendering) {
+  for (unsigned seed = 1; seed <= 6; seed++) {
+    PPU full, headless;
+    load_random_scene(full, seed);
+    load_random_scene(headless, seed);
+    headless.set_render_mode(RENDER_NONE);
+    srand(seed * 31);
+    uint64_t clock = 0;
+    uint64_t end = clock_at(241, 1) + 4 * PPU::DOTS_PER_LINE * 262;
+    while (clock < end) {
+      clock += rand() % (8 * PPU::DOTS_PER_LINE);
+      full.run(clock);
+      headless.run(clock);
+      ASSERT_EQ(full.get_status(), headless.get_status()) << "seed " << seed;
+      uint16_t address = uint16_t(rand() % 0x3000);
+      uint8_t value = uint8_t(rand());
+      uint8_t sprite = uint8_t(rand() % 8);
+      switch (rand() % 5) {
+        case 0:
+          full.set_vram(address, value);
+          headless.set_vram(address, value);
+          break;
+        case 1:
+          full.set_oam(sprite, value);
+          headless.set_oam(sprite, value);
+          break;
+        case 2:
+          full.write_register(0x2005, value);
+          headless.write_register(0x2005, value);
+          break;
+        case 3: // v as seen through the $2007 read buffer
+          ASSERT_EQ(full.read_register(0x2007), headless.read_register(0x2007));
+          ASSERT_EQ(full.read_register(0x2007), headless.read_register(0x2007));
+          break;
+      }
+    }
+  }
+}
+
+TEST (PPUOutputTest, BadArguments) {
+  PPU ppu;
+  uint8_t buffer[84 * 84];
+  EXPECT_EQ(ppu.set_output(-1, buffer, 84, 84), 1);
+  EXPECT_EQ(ppu.set_output(4, buffer, 84, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, NULL, 84, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, buffer, 0, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, buffer, 257, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, buffer, 84, 241), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_INDEX, buffer, 84, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_INDEX_NEAREST, buffer, 84, 84, true), 1);
+  EXPECT_EQ(ppu.get_output_mode(), OUTPUT_INDEX);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, buffer, 84, 84, true), 0);
+  EXPECT_EQ(ppu.get_output_mode(), OUTPUT_GRAY_AREA);
+}
+
+// direct output must equal downsampling the full frame afterwards, small
+// sizes averaging 256 and more pixels per cell
+TEST (PPUOutputTest, DirectDownsampleMatchesFullFrame) {
+  const int sizes[6][2] = {{84, 84}, {128, 120}, {160, 210}, {16, 15},
+                           {13, 11}, {1, 1}};
+  for (unsigned seed = 1; seed <= 3; seed++) {
+    PPU full;
+    load_random_scene(full, seed);
+    full.run(clock_at(241, 1));
+    const uint8_t* frame = full.get_frame_buffer();
+
+    for (int s = 0; s < 6; s++) {
+      int width = sizes[s][0];
+      int height = sizes[s][1];
+      for (int mode = OUTPUT_GRAY_NEAREST; mode <= OUTPUT_INDEX_NEAREST;
+           mode++) {
+        std::vector<uint8_t> expected(width * height);
+        for (int row = 0; row < height; row++) {
+          for (int col = 0; col < width; col++) {
+            uint8_t value;
+            if (mode == OUTPUT_GRAY_AREA) {
+              int y0 = (row * 240 + height - 1) / height;
+              int y1 = ((row + 1) * 240 + height - 1) / height;
+              int x0 = (col * 256 + width - 1) / width;
+              int x1 = ((col + 1) * 256 + width - 1) / width;
+              int sum = 0;
+              for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                  sum += nes_luma[frame[y * 256 + x]];
+                }
+              }
+              int count = (y1 - y0) * (x1 - x0);
+              value = uint8_t((sum + count / 2) / count);
+            } else {
+              int y = (2 * row + 1) * 240 / (2 * height);
+              int x = (2 * col + 1) * 256 / (2 * width);
+              value = frame[y * 256 + x];
+              if (mode == OUTPUT_GRAY_NEAREST) {
+                value = nes_luma[value];
+              }
+            }
+            expected[row * width + col] = value;
+          }
+        }
+
+        PPU direct;
+        std::vector<uint8_t> observation(width * height, 0xEE);
+        EXPECT_EQ(direct.set_output(mode, &observation[0], width, height), 0);
+        load_random_scene(direct, seed);
+        direct.run(clock_at(241, 1));
+        EXPECT_EQ(direct.get_status(), full.get_status());
+        ASSERT_EQ(observation, expected) << "mode " << mode << " size "
+                                         << width << "x" << height;
+      }
+    }
+  }
+}
+
+TEST (PPUOutputTest, MaxPoolOverTwoFrames) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x3F00, 0x0F); // black backdrop
+  ppu.set_vram(0x3F11, 0x30); // white sprite
+  ppu.set_oam(0, 99);
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(3, 100);
+  ppu.set_oam(4, 99);
+  ppu.set_oam(5, 0x01);
+  ppu.set_oam(7, 200);
+  for (int i = 8; i < 256; i += 4) {
+    ppu.set_oam(i, 0xF0);
+  }
+  ppu.write_register(0x2001, 0x14);
+  std::vector<uint8_t> observation(128 * 120);
+  ASSERT_EQ(ppu.set_output(OUTPUT_GRAY_NEAREST, &observation[0], 128, 120,
+                           true), 0);
+  const int frame = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+  const int left = 50 * 128 + 50;   // pixel (100, 100)
+  const int right = 50 * 128 + 100; // pixel (200, 100)
+
+  // flicker: one of the two sprites is hidden every other frame
+  for (int i = 0; i < 4; i++) {
+    ppu.set_oam((i & 1) ? 0 : 4, 0xF0);
+    ppu.set_oam((i & 1) ? 4 : 0, 99);
+    ppu.run(clock_at(241, 1) + i * frame);
+    if (i == 0) {
+      EXPECT_EQ(observation[left], nes_luma[0x30]);
+      EXPECT_EQ(observation[right], 0);
+    } else {
+      EXPECT_EQ(observation[left], nes_luma[0x30]);
+      EXPECT_EQ(observation[right], nes_luma[0x30]);
+    }
+    EXPECT_EQ(observation[0], 0);
+  }
+}
+
+// a moved output keeps the mode and the pooled frame
+TEST (PPUOutputTest, MoveOutputBuffer) {
+  PPU ppu;
+  load_solid_tiles(ppu);
+  ppu.set_vram(0x3F00, 0x0F);
+  ppu.set_vram(0x3F11, 0x30);
+  for (int i = 0; i < 256; i += 4) {
+    ppu.set_oam(i, 0xF0);
+  }
+  ppu.set_oam(1, 0x01);
+  ppu.set_oam(3, 200);
+  ppu.write_register(0x2001, 0x14);
+  std::vector<uint8_t> first(128 * 120), second(128 * 120, 0xEE);
+  EXPECT_EQ(ppu.set_output_buffer(NULL), 0); // OUTPUT_INDEX
+  ASSERT_EQ(ppu.set_output(OUTPUT_GRAY_NEAREST, &first[0], 128, 120, true),
+            0);
+  EXPECT_EQ(ppu.set_output_buffer(NULL), 1);
+  const int frame = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+  const int right = 50 * 128 + 100; // pixel (200, 100)
+  ppu.set_oam(0, 99);
+  ppu.run(clock_at(241, 1));
+  EXPECT_EQ(first[right], nes_luma[0x30]);
+
+  ASSERT_EQ(ppu.set_output_buffer(&second[0]), 0);
+  ppu.set_oam(0, 0xF0);
+  ppu.run(clock_at(241, 1) + frame);
+  EXPECT_EQ(ppu.get_output_mode(), OUTPUT_GRAY_NEAREST);
+  EXPECT_EQ(second[right], nes_luma[0x30]); // pooled with the last frame
+  EXPECT_EQ(second[0], 0);
+  EXPECT_EQ(first[0], 0);
+}
+
+} // namespace nesemu
@@ -0,0 +1,289 @@
+#include "threaded_ppu.h"
+
+#include <cstring>
+
+namespace nesemu {
+
+ThreadedPPU::ThreadedPPU() {
+  shadow.set_render_mode(RENDER_NONE);
+  synchronous = false;
+  status_logged = false;
+  log_head = 0;
+  log_tail = 0;
+  published = 0;
+  sleeping = false;
+  stopping = false;
+  set_output(OUTPUT_INDEX);
+  worker = std::thread(&ThreadedPPU::work, this);
+}
+
+ThreadedPPU::~ThreadedPPU() {
+  if (worker.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake_up.notify_one();
+    worker.join();
+  }
+}
+
+/* Timing */
+void ThreadedPPU::run(uint64_t target) {
+  if (synchronous) {
+    replica.run(target);
+    return;
+  }
+  uint64_t frames = shadow.get_frame_count();
+  shadow.run(target);
+  if (shadow.get_frame_count() != frames) {
+    log(LOG_RUN, 0, 0); // the worker can finish the frame
+    wake();
+  }
+}
+
+uint64_t ThreadedPPU::get_clock() const {
+  return synchronous ? replica.get_clock() : shadow.get_clock();
+}
+
+int ThreadedPPU::get_scanline() const {
+  return synchronous ? replica.get_scanline() : shadow.get_scanline();
+}
+
+int ThreadedPPU::get_dot() const {
+  return synchronous ? replica.get_dot() : shadow.get_dot();
+}
+
+uint64_t ThreadedPPU::get_frame_count() const {
+  return synchronous ? replica.get_frame_count() : shadow.get_frame_count();
+}
+
+/* Registers */
+uint8_t ThreadedPPU::read_register(uint16_t address) {
+  if (!synchronous && (address & 0x07) == 7) {
+    fall_back();
+  }
+  if (synchronous) {
+    return replica.read_register(address);
+  }
+  if ((address & 0x07) == 2 && !status_logged) {
+    // only the write toggle reset matters to the picture, repeated polls
+    // of $2002 with nothing in between are logged once
+    log(LOG_READ_STATUS, address, 0);
+    status_logged = true;
+  }
+  return shadow.read_register(address);
+}
+
+void ThreadedPPU::write_register(uint16_t address, uint8_t value) {
+  if (synchronous) {
+    replica.write_register(address, value);
+    return;
+  }
+  log(LOG_WRITE_REGISTER, address, value);
+  shadow.write_register(address, value);
+}
+
+uint8_t ThreadedPPU::get_status() const {
+  return synchronous ? replica.get_status() : shadow.get_status();
+}
+
+bool ThreadedPPU::get_nmi() const {
+  return synchronous ? replica.get_nmi() : shadow.get_nmi();
+}
+
+/* PPU memory */
+uint8_t ThreadedPPU::get_vram(uint16_t address) const {
+  return synchronous ? replica.get_vram(address) : shadow.get_vram(address);
+}
+
+void ThreadedPPU::set_vram(uint16_t address, uint8_t value) {
+  if (synchronous) {
+    replica.set_vram(address, value);
+    return;
+  }
+  log(LOG_VRAM, address, value);
+  shadow.set_vram(address, value);
+}
+
+uint8_t ThreadedPPU::get_oam(uint8_t address) const {
+  return synchronous ? replica.get_oam(address) : shadow.get_oam(address);
+}
+
+void ThreadedPPU::set_oam(uint8_t address, uint8_t value) {
+  if (synchronous) {
+    replica.set_oam(address, value);
+    return;
+  }
+  log(LOG_OAM, address, value);
+  shadow.set_oam(address, value);
+}
+
+// the shadow copies in one go, the worker replays the $2004 writes
+void ThreadedPPU::write_oam_dma(const uint8_t* page) {
+  if (synchronous) {
+    replica.write_oam_dma(page);
+    return;
+  }
+  for (int i = 0; i < 256; i++) {
+    log(LOG_WRITE_REGISTER, 0x2004, page[i]);
+  }
+  shadow.write_oam_dma(page);
+}
+
+void ThreadedPPU::set_mirroring(int mode) {
+  if (synchronous) {
+    replica.set_mirroring(mode);
+    return;
+  }
+  log(LOG_MIRRORING, 0, uint8_t(mode));
+  shadow.set_mirroring(mode);
+}
+
+bool ThreadedPPU::is_synchronous() const {
+  return synchronous;
+}
+
+/* Frame output */
+int ThreadedPPU::set_output(int mode, int width, int height, bool max_pool) {
+  if (!synchronous) {
+    drain();
+  }
+  std::vector<uint8_t> buffer(width > 0 && height > 0 ? width * height : 0);
+  uint8_t* dest = mode == OUTPUT_INDEX ? NULL : buffer.data();
+  if (replica.set_output(mode, dest, width, height, max_pool)) {
+    return 1;
+  }
+  output_mode = mode;
+  observation.swap(buffer);
+  frames[0].assign(width * height, 0);
+  frames[1].assign(width * height, 0);
+  return 0;
+}
+
+const uint8_t* ThreadedPPU::replica_output() const {
+  return output_mode == OUTPUT_INDEX ? replica.get_frame_buffer()
+                                     : &observation[0];
+}
+
+const uint8_t* ThreadedPPU::get_frame_buffer() {
+  if (synchronous) {
+    return replica_output();
+  }
+  uint64_t frame = shadow.get_frame_count();
+  if (published.load(std::memory_order_acquire) < frame) {
+    wake();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (published.load(std::memory_order_acquire) < frame) {
+      frame_done.wait(lock);
+    }
+  }
+  return &frames[frame & 1][0];
+}
+
+/* Log
+  Single producer, single consumer ring. The CPU thread only advances the
+  head and the worker only the tail, an entry is visible to the worker once
+  the head has moved past it. The worker is woken at frame ends, when the
+  ring fills up and when the CPU thread waits on it.
+*/
+void ThreadedPPU::log(int kind, uint16_t address, uint8_t value) {
+  if (kind != LOG_READ_STATUS) {
+    status_logged = false;
+  }
+  uint64_t head = log_head.load(std::memory_order_relaxed);
+  while (head - log_tail.load(std::memory_order_acquire) == LOG_SIZE) {
+    wake();
+    std::this_thread::yield();
+  }
+  LogEntry& entry = log_entries[head & (LOG_SIZE - 1)];
+  entry.clock = shadow.get_clock();
+  entry.address = address;
+  entry.value = value;
+  entry.kind = uint8_t(kind);
+  log_head.store(head + 1, std::memory_order_seq_cst);
+}
+
+void ThreadedPPU::wake() {
+  // pairs with the worker storing sleeping before checking the head again
+  if (sleeping.load(std::memory_order_seq_cst)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    wake_up.notify_one();
+  }
+}
+
+// wait until the worker has replayed everything logged so far
+void ThreadedPPU::drain() {
+  uint64_t head = log_head.load(std::memory_order_relaxed);
+  while (log_tail.load(std::memory_order_acquire) != head) {
+    wake();
+    std::this_thread::yield();
+  }
+}
+
+// after draining the replica is the shadow plus pixels, keep only it
+void ThreadedPPU::fall_back() {
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake_up.notify_one();
+  worker.join();
+  replica.run(shadow.get_clock());
+  synchronous = true;
+}
+
+void ThreadedPPU::work() {
+  uint64_t tail = log_tail.load(std::memory_order_relaxed);
+  for (;;) {
+    if (tail == log_head.load(std::memory_order_acquire)) {
+      std::unique_lock<std::mutex> lock(mutex);
+      sleeping.store(true, std::memory_order_seq_cst);
+      while (!stopping && tail == log_head.load(std::memory_order_seq_cst)) {
+        wake_up.wait(lock);
+      }
+      sleeping.store(false, std::memory_order_relaxed);
+      if (stopping && tail == log_head.load(std::memory_order_acquire)) {
+        return;
+      }
+      continue;
+    }
+    replay(log_entries[tail & (LOG_SIZE - 1)]);
+    log_tail.store(++tail, std::memory_order_release);
+  }
+}
+
+void ThreadedPPU::replay(const LogEntry& entry) {
+  replica.run(entry.clock);
+  switch (entry.kind) {
+    case LOG_WRITE_REGISTER:
+      replica.write_register(entry.address, entry.value);
+      break;
+    case LOG_READ_STATUS:
+      replica.read_register(entry.address);
+      break;
+    case LOG_VRAM:
+      replica.set_vram(entry.address, entry.value);
+      break;
+    case LOG_OAM:
+      replica.set_oam(uint8_t(entry.address), entry.value);
+      break;
+    case LOG_MIRRORING:
+      replica.set_mirroring(entry.value);
+      break;
+  }
+
+  uint64_t frame = replica.get_frame_count();
+  if (frame != published.load(std::memory_order_relaxed)) {
+    std::vector<uint8_t>& dest = frames[frame & 1];
+    memcpy(&dest[0], replica_output(), dest.size());
+    published.store(frame, std::memory_order_release);
+    { // a waiter either sees the new count or is already waiting
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    frame_done.notify_all();
+  }
+}
+
+} // namespace nesemu
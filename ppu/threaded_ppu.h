@@ -0,0 +1,118 @@
+#ifndef NESEMU_PPU_THREADED_PPU_H_
+#define NESEMU_PPU_THREADED_PPU_H_
+
+#include "ppu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nesemu {
+
+/* PPU that rasterizes on a worker thread
+  The CPU thread drives a headless copy of the PPU, which answers every read
+  (status, NMI, sprite 0 hit, OAM) exactly, and appends each write to a
+  lock-free single producer/single consumer log stamped with the PPU clock.
+  The worker replays the log into a fully rendering copy, so frame N is
+  rasterized while the CPU emulates frame N + 1. Replaying the same writes at
+  the same clocks makes the pixels identical to synchronous rendering.
+  Reading VRAM back through $2007 moves v and the read buffer on every read,
+  games that do it tend to do it in bulk, so the first such read drains the
+  log and the PPU falls back to rendering synchronously for good.
+*/
+class ThreadedPPU {
+  public:
+    ThreadedPPU();
+    ~ThreadedPPU();
+
+    /* Same as PPU */
+    void run(uint64_t target);
+    uint64_t get_clock() const;
+    int get_scanline() const;
+    int get_dot() const;
+    uint64_t get_frame_count() const;
+
+    uint8_t read_register(uint16_t address);
+    void write_register(uint16_t address, uint8_t value);
+    uint8_t get_status() const;
+    bool get_nmi() const;
+
+    uint8_t get_vram(uint16_t address) const;
+    void set_vram(uint16_t address, uint8_t value);
+    uint8_t get_oam(uint8_t address) const;
+    void set_oam(uint8_t address, uint8_t value);
+    void write_oam_dma(const uint8_t* page);
+    void set_mirroring(int mode);
+
+    /* Frame output */
+    // Same modes as PPU::set_output(), the buffer is owned by this object.
+    // Returns 1 on bad arguments.
+    int set_output(int mode, int width = PPU::SCREEN_WIDTH,
+                   int height = PPU::SCREEN_HEIGHT, bool max_pool = false);
+    // Last frame completed on the CPU side, waits for the worker to finish
+    // it. Stays valid until the next frame completes.
+    const uint8_t* get_frame_buffer();
+
+    bool is_synchronous() const; // fell back after a readback
+
+  private:
+    ThreadedPPU(const ThreadedPPU&);
+    ThreadedPPU& operator=(const ThreadedPPU&);
+
+    static const uint64_t LOG_SIZE = 1 << 14; // entries, power of two
+
+    enum {
+      LOG_RUN,
+      LOG_WRITE_REGISTER,
+      LOG_READ_STATUS,
+      LOG_VRAM,
+      LOG_OAM,
+      LOG_MIRRORING
+    };
+
+    struct LogEntry {
+      uint64_t clock;
+      uint16_t address;
+      uint8_t value;
+      uint8_t kind;
+    };
+
+    PPU shadow;  // CPU thread, headless
+    PPU replica; // worker thread, renders; the only PPU once synchronous
+    bool synchronous;
+    bool status_logged; // a $2002 read is the newest log entry
+
+    /* Log */
+    LogEntry log_entries[LOG_SIZE];
+    alignas(64) std::atomic<uint64_t> log_head; // written by the CPU thread
+    alignas(64) std::atomic<uint64_t> log_tail; // written by the worker
+
+    /* Frames */
+    int output_mode;
+    std::vector<uint8_t> observation; // replica output when downsampled
+    std::vector<uint8_t> frames[2];   // published, by frame number parity
+    std::atomic<uint64_t> published;  // frames published so far
+
+    /* Worker */
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    std::condition_variable frame_done;
+    std::atomic<bool> sleeping;
+    bool stopping;
+
+    void log(int kind, uint16_t address, uint8_t value);
+    void wake();
+    void drain();
+    void fall_back();
+    void work();
+    void replay(const LogEntry& entry);
+    const uint8_t* replica_output() const;
+};
+
+} // namespace nesemu
+
+#endif // NESEMU_PPU_THREADED_PPU_H_
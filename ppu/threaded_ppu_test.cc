@@ -0,0 +1,137 @@
+#include "threaded_ppu.h"
+
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace nesemu {
+
+static const uint64_t FRAME_DOTS = PPU::DOTS_PER_LINE * PPU::LINES_PER_FRAME;
+
+// random patterns, nametables, palette and sprites
+template <class P>
+static void load_random_scene(P& ppu, unsigned seed) {
+  srand(seed);
+  for (int i = 0; i < 0x3000; i++) {
+    ppu.set_vram(i, uint8_t(rand()));
+  }
+  for (int i = 0; i < 32; i++) {
+    ppu.set_vram(0x3F00 + i, uint8_t(rand() & 0x3F));
+  }
+  for (int i = 0; i < 256; i++) {
+    ppu.set_oam(i, uint8_t(rand()));
+  }
+  ppu.write_register(0x2000, 0x10);
+  ppu.write_register(0x2001, 0x1E);
+}
+
+// Drives both PPUs with the same random traffic at random clocks and checks
+// every frame the threaded one publishes against the synchronous output.
+static void compare_frames(int mode, int width, int height, bool max_pool,
+                           unsigned seed, bool read_back) {
+  const int registers[5] = {0x2000, 0x2001, 0x2004, 0x2005, 0x2006};
+  PPU sync;
+  ThreadedPPU threaded;
+  std::vector<uint8_t> observation(width * height);
+  if (mode != OUTPUT_INDEX) {
+    sync.set_output(mode, &observation[0], width, height, max_pool);
+  }
+  ASSERT_EQ(threaded.set_output(mode, width, height, max_pool), 0);
+  load_random_scene(sync, seed);
+  load_random_scene(threaded, seed);
+  srand(seed * 7);
+
+  uint64_t clock = 0;
+  int frames = 0;
+  while (frames < 12) {
+    clock += rand() % 3000;
+    sync.run(clock);
+    threaded.run(clock);
+    ASSERT_EQ(sync.get_status(), threaded.get_status());
+    ASSERT_EQ(sync.get_frame_count(), threaded.get_frame_count());
+    if (threaded.get_frame_count() > uint64_t(frames)) {
+      frames = int(threaded.get_frame_count());
+      const uint8_t* expected =
+          mode == OUTPUT_INDEX ? sync.get_frame_buffer() : &observation[0];
+      ASSERT_EQ(memcmp(expected, threaded.get_frame_buffer(), width * height),
+                0) << "frame " << frames;
+    }
+
+    uint16_t address = uint16_t(rand());
+    uint8_t value = uint8_t(rand());
+    switch (rand() % 9) {
+      case 0:
+        sync.set_vram(address & 0x3FFF, value);
+        threaded.set_vram(address & 0x3FFF, value);
+        break;
+      case 1:
+        sync.set_oam(uint8_t(address), value);
+        threaded.set_oam(uint8_t(address), value);
+        break;
+      case 2:
+        ASSERT_EQ(sync.read_register(0x2002), threaded.read_register(0x2002));
+        break;
+      case 3:
+        if (read_back && frames >= 6) {
+          ASSERT_EQ(sync.read_register(0x2007),
+                    threaded.read_register(0x2007));
+        }
+        break;
+      case 4: {
+        uint8_t page[256];
+        for (int i = 0; i < 256; i++) {
+          page[i] = uint8_t(rand());
+        }
+        sync.write_oam_dma(page);
+        threaded.write_oam_dma(page);
+        break;
+      }
+      default: {
+        int reg = registers[rand() % 5];
+        if (reg == 0x2001) {
+          value |= 0x18;
+        }
+        sync.write_register(reg, value);
+        threaded.write_register(reg, value);
+        break;
+      }
+    }
+  }
+  EXPECT_EQ(threaded.is_synchronous(), read_back);
+}
+
+TEST (ThreadedPPUTest, FramesMatchSynchronous) {
+  for (unsigned seed = 1; seed <= 3; seed++) {
+    compare_frames(OUTPUT_INDEX, 256, 240, false, seed, false);
+  }
+}
+
+TEST (ThreadedPPUTest, ObservationsMatchSynchronous) {
+  compare_frames(OUTPUT_GRAY_AREA, 84, 84, true, 4, false);
+  compare_frames(OUTPUT_INDEX_NEAREST, 128, 120, false, 5, false);
+}
+
+TEST (ThreadedPPUTest, FallsBackOnReadback) {
+  compare_frames(OUTPUT_INDEX, 256, 240, false, 6, true);
+  compare_frames(OUTPUT_GRAY_NEAREST, 84, 84, false, 7, true);
+}
+
+TEST (ThreadedPPUTest, BadOutput) {
+  ThreadedPPU ppu;
+  EXPECT_EQ(ppu.set_output(OUTPUT_INDEX, 84, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, 0, 84), 1);
+  EXPECT_EQ(ppu.set_output(OUTPUT_GRAY_AREA, 84, 84), 0);
+}
+
+// nothing logged yet, the first frame is blank and destruction is clean
+TEST (ThreadedPPUTest, IdleWorker) {
+  ThreadedPPU ppu;
+  ppu.run(FRAME_DOTS);
+  EXPECT_EQ(ppu.get_frame_count(), 1);
+  const uint8_t* frame = ppu.get_frame_buffer();
+  for (int i = 0; i < PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT; i++) {
+    ASSERT_EQ(frame[i], 0);
+  }
+}
+
+} // namespace nesemu